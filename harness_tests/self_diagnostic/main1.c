@@ -34,24 +34,24 @@ uint32_t construct_rx_msg(uint8_t op_code, uint8_t field_num, uint32_t tx_data){
     rx_msg[6] = (tx_data >> 8) & 0xFF;
     rx_msg[7] = tx_data & 0xFF;
 
-    enqueue(&can_rx_msg_queue, rx_msg);
-    rx_q_size = queue_size(&can_rx_msg_queue);
-    tx_q_size = queue_size(&can_tx_msg_queue);
+    can_ring_push(&can_rx_ring, rx_msg);
+    rx_q_size = can_ring_count(&can_rx_ring);
+    tx_q_size = can_ring_count(&can_tx_ring);
     ASSERT_EQ(rx_q_size, 1);
     ASSERT_EQ(tx_q_size, 0);
 
     process_next_rx_msg();
-    rx_q_size = queue_size(&can_rx_msg_queue);
-    tx_q_size = queue_size(&can_tx_msg_queue);
+    rx_q_size = can_ring_count(&can_rx_ring);
+    tx_q_size = can_ring_count(&can_tx_ring);
     ASSERT_EQ(rx_q_size, 0);
     ASSERT_EQ(tx_q_size, 1);
 
-    dequeue(&can_tx_msg_queue, tx_msg);
+    can_ring_pop(&can_tx_ring, tx_msg);
     print("CAN TX: ");
     print_bytes(tx_msg, 8);
 
-    rx_q_size = queue_size(&can_rx_msg_queue);
-    tx_q_size = queue_size(&can_tx_msg_queue);
+    rx_q_size = can_ring_count(&can_rx_ring);
+    tx_q_size = can_ring_count(&can_tx_ring);
     ASSERT_EQ(rx_q_size, 0);
     ASSERT_EQ(tx_q_size, 0);
     ASSERT_EQ(tx_msg[2], 0);
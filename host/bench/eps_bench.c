@@ -0,0 +1,688 @@
+/*
+Host benchmark and fuzzer for the EPS command path, heater control and IMU
+driver.
+
+For each benchmark this reports the host time per call and the simulated MCU
+time per call. The simulated time only includes what the models charge for
+(SPI transfers, blocking UART output, EEPROM writes and explicit delays), not
+CPU cycles, so it is a lower bound on how long the main loop is blocked.
+
+The HK dispatch benchmark compares handle_rx_hk() (table lookup) against a
+copy of the `else if` chain it replaced, in host TSC cycles per lookup where
+available.
+
+The main loop benchmark runs the main loop stages under a steady CAN command
+load and reports the per-stage statistics from loop_stats.c, and how long the
+IMU driver waited for HINT.
+
+The SPI transfer benchmark exchanges the same number of bytes with send_spi()
+(the CPU waits for each byte) and with the interrupt-driven engine in
+spi_xfer.c (the CPU only runs SPI_STC_vect), and reports the throughput and
+the fraction of the CPU that is busy, in simulated time.
+
+The ADC snapshot benchmark compares reading every channel with single-channel
+fetches against auto-1 sweeps (with and without oversampling), in SPI frames
+and simulated time per snapshot.
+
+The thermistor and setpoint conversions compare lib-common's floating point
+beta model against the lookup tables in therm_lut.c, in host time per call
+(the ratio is much larger on the AVR, which has no FPU).
+
+The fuzzer sends random CAN frames and checks that every received command
+gets exactly one response with the same opcode and field number.
+
+Usage: eps_bench [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sim/sim.h>
+
+#include "../../src/general.h"
+
+#define DEF_ITERATIONS 100000
+
+void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data);
+typedef void(*hk_handler_t)(uint8_t field_num, uint8_t* tx_status,
+    uint32_t* tx_data);
+
+typedef void(*bench_fn_t)(uint32_t i);
+
+static uint64_t host_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t host_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return host_time_ns();
+#endif
+}
+
+static void setup(void) {
+    sim_reset();
+    sim_imu_attach();
+
+    // Plausible readings - 7.58 V pack, ~0.3 A per solar panel (sun mode),
+    // ~0.5 A on each rail (under the protection thresholds)
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        sim_adc_values[i] = 0x800;
+    }
+    sim_adc_values[ADC_VMON_PACK] = 0xC20;
+    sim_adc_values[ADC_IMON_3V3] = 0x148;
+    sim_adc_values[ADC_IMON_5V] = 0x148;
+    sim_adc_values[ADC_IMON_PAY_LIM] = 0x033;
+    sim_adc_values[ADC_IMON_X_PLUS] = 0x0C4;
+    sim_adc_values[ADC_IMON_X_MINUS] = 0x0C4;
+    sim_adc_values[ADC_IMON_Y_PLUS] = 0x0C4;
+    sim_adc_values[ADC_IMON_Y_MINUS] = 0x0C4;
+
+    sim_imu_cal_gyro[0] = 12;
+    sim_imu_cal_gyro[1] = -7;
+    sim_imu_cal_gyro[2] = 3;
+
+    init_eps();
+}
+
+static void send_cmd(uint8_t opcode, uint8_t field_num, uint32_t data) {
+    uint8_t msg[8] = {
+        opcode, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF
+    };
+    sim_can_rx(EPS_CMD_MOB_NUM, msg, 8);
+}
+
+// One full RX -> process -> TX round trip
+static void round_trip(uint8_t opcode, uint8_t field_num, uint32_t data) {
+    uint8_t tx_msg[8];
+    send_cmd(opcode, field_num, data);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    sim_can_tx_pop(tx_msg);
+}
+
+static void bench_hk_adc(uint32_t i) {
+    round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_VOL + (i % (CAN_EPS_HK_HEAT2_SP -
+        CAN_EPS_HK_BAT_VOL + 1)), 0);
+}
+
+static void bench_hk_gyro(uint32_t i) {
+    round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_CAL_X + (i % 3), 0);
+}
+
+static void bench_ctrl_get(uint32_t i) {
+    (void) i;
+    round_trip(CAN_EPS_CTRL, CAN_EPS_CTRL_GET_HEAT_SHAD_SP, 0);
+}
+
+static void bench_ctrl_set_sp(uint32_t i) {
+    round_trip(CAN_EPS_CTRL, CAN_EPS_CTRL_SET_HEAT1_SHAD_SP, 0x400 + (i & 0xFF));
+}
+
+static void bench_heater_ctrl(uint32_t i) {
+    (void) i;
+    control_heater_mode();
+}
+
+// Keeps the conversion results from being optimized away
+static volatile int32_t bench_sink = 0;
+
+static void bench_therm_exact(uint32_t i) {
+    bench_sink = (int32_t) (adc_raw_to_therm_temp(0x100 + (i & 0x3FF)) * 100);
+}
+
+static void bench_therm_lut(uint32_t i) {
+    bench_sink = adc_raw_to_therm_centi_c(0x100 + (i & 0x3FF));
+}
+
+static void bench_setpoint_exact(uint32_t i) {
+    bench_sink = heater_setpoint_to_dac_raw_data((double) (i & 0x1FFF) / 100);
+}
+
+static void bench_setpoint_lut(uint32_t i) {
+    bench_sink = heater_setpoint_centi_c_to_dac_raw((int16_t) (i & 0x1FFF));
+}
+
+static void run_bench(const char* name, bench_fn_t fn, uint32_t iterations) {
+    setup();
+    uint64_t sim_start_us = sim_time_us;
+    uint64_t host_start_ns = host_time_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        fn(i);
+    }
+    uint64_t host_ns = host_time_ns() - host_start_ns;
+    uint64_t sim_us = sim_time_us - sim_start_us;
+
+    printf("%-28s %10u %12.1f %14.1f\n", name, iterations,
+        (double) host_ns / iterations, (double) sim_us / iterations);
+}
+
+// The HK field dispatch before it was table-driven
+static void chain_handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data) {
+    // ADC fields are answered from the snapshot, like handle_rx_hk() - only
+    // the dispatch differs
+
+    // Check field number
+
+    if (field_num == CAN_EPS_HK_UPTIME) {
+        *tx_data = uptime_s;
+    }
+
+    else if (field_num == CAN_EPS_HK_RESTART_COUNT) {
+        *tx_data = restart_count;
+    }
+
+    else if (field_num == CAN_EPS_HK_RESTART_REASON) {
+        *tx_data = restart_reason;
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_VOL) {
+        *tx_data = adc_snapshot->raw[ADC_VMON_PACK];
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_PACK];
+    }
+
+    else if (field_num == CAN_EPS_HK_X_POS_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_X_PLUS];
+    }
+
+    else if (field_num == CAN_EPS_HK_X_NEG_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_X_MINUS];
+    }
+
+    else if (field_num == CAN_EPS_HK_Y_POS_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_Y_PLUS];
+    }
+
+    else if (field_num == CAN_EPS_HK_Y_NEG_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_Y_MINUS];
+    }
+
+    else if (field_num == CAN_EPS_HK_3V3_VOL) {
+        *tx_data = adc_snapshot->raw[ADC_VMON_3V3];
+    }
+
+    else if (field_num == CAN_EPS_HK_3V3_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_3V3];
+    }
+
+    else if (field_num == CAN_EPS_HK_5V_VOL) {
+        *tx_data = adc_snapshot->raw[ADC_VMON_5V];
+    }
+
+    else if (field_num == CAN_EPS_HK_5V_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_5V];
+    }
+
+    else if (field_num == CAN_EPS_HK_PAY_CUR) {
+        *tx_data = adc_snapshot->raw[ADC_IMON_PAY_LIM];
+    }
+
+    else if (field_num == CAN_EPS_HK_3V3_TEMP) {
+        *tx_data = adc_snapshot->raw[ADC_THM_3V3_TOP];
+    }
+
+    else if (field_num == CAN_EPS_HK_5V_TEMP) {
+        *tx_data = adc_snapshot->raw[ADC_THM_5V_TOP];
+    }
+
+    else if (field_num == CAN_EPS_HK_PAY_CON_TEMP) {
+        *tx_data = adc_snapshot->raw[ADC_THM_PAY_CONN];
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_TEMP1) {
+        *tx_data = adc_snapshot->raw[ADC_THM_BATT1];
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_TEMP2) {
+        *tx_data = adc_snapshot->raw[ADC_THM_BATT2];
+    }
+
+    else if (field_num == CAN_EPS_HK_HEAT1_SP) {
+        *tx_data = dac.raw_voltage_a;
+    }
+
+    else if (field_num == CAN_EPS_HK_HEAT2_SP) {
+        *tx_data = dac.raw_voltage_b;
+    }    
+
+    else if (field_num == CAN_EPS_HK_GYR_UNCAL_X) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_UNCAL_GYRO, 0);
+    }
+
+    else if (field_num == CAN_EPS_HK_GYR_UNCAL_Y) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_UNCAL_GYRO, 1);
+    }
+
+    else if (field_num == CAN_EPS_HK_GYR_UNCAL_Z) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_UNCAL_GYRO, 2);
+    }
+
+    else if (field_num == CAN_EPS_HK_GYR_CAL_X) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_CAL_GYRO, 0);
+    }
+
+    else if (field_num == CAN_EPS_HK_GYR_CAL_Y) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_CAL_GYRO, 1);
+    }
+
+    else if (field_num == CAN_EPS_HK_GYR_CAL_Z) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_CAL_GYRO, 2);
+    }
+
+    else if (field_num == CAN_EPS_HK_IDLE_FRAC) {
+        *tx_data = idle_fraction;
+    }
+
+    else if (field_num == CAN_EPS_HK_SLEEP_COUNT) {
+        *tx_data = idle_sleep_count;
+    }
+
+    else if (field_num == CAN_EPS_HK_DAC_SKIPPED) {
+        *tx_data = heater_dac_writes_skipped;
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_CHARGE) {
+        *tx_data = (uint32_t) batt_charge_mc | BATT_CHARGE_HK_UNCAL;
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_SOC) {
+        *tx_data = batt_soc | BATT_SOC_HK_UNCAL;
+    }
+
+    else if (field_num == CAN_EPS_HK_BAT_INT_TIME) {
+        *tx_data = batt_int_s;
+    }
+
+    else if (field_num >= CAN_EPS_HK_3V3_ENERGY &&
+            field_num <= CAN_EPS_HK_PAY_CUR_MAX) {
+        uint8_t index = field_num - CAN_EPS_HK_3V3_ENERGY;
+        get_rail_stat(index / RAIL_STAT_COUNT, index % RAIL_STAT_COUNT, tx_data);
+    }
+
+    else if (field_num == CAN_EPS_HK_ACC_X) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_ACCEL, 0);
+    }
+
+    else if (field_num == CAN_EPS_HK_ACC_Y) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_ACCEL, 1);
+    }
+
+    else if (field_num == CAN_EPS_HK_ACC_Z) {
+        *tx_data = (uint32_t) get_imu_hk_value(IMU_ACCEL, 2);
+    }
+
+    else if (field_num >= CAN_EPS_HK_ADC_EXT(0) &&
+            field_num < CAN_EPS_HK_ADC_EXT(ADC_CHANNELS)) {
+        *tx_data = adc_snapshot->ext[field_num - CAN_EPS_HK_ADC_EXT(0)];
+    }
+
+    // If the message type is not recognized, return before enqueueing
+    else {
+        *tx_status = CAN_STATUS_INVALID_FIELD_NUM;
+    }
+}
+
+
+// Collects every HK field, one request per field or in one batch. Returns
+// the number of CAN frames on the bus (requests and responses).
+static uint32_t collect_hk(bool batch) {
+    uint32_t frames = 0;
+    uint8_t tx_msg[8];
+    if (batch) {
+        // A batch selects up to 32 fields
+        for (uint8_t base = 0; base < EPS_HK_FIELD_COUNT; base += 32) {
+            uint8_t count = EPS_HK_FIELD_COUNT - base;
+            send_cmd(CAN_EPS_HK_BATCH, base,
+                (count >= 32) ? 0xFFFFFFFFUL : (1UL << count) - 1);
+            frames++;
+            process_next_rx_msg();
+            do {
+                send_next_tx_msg();
+            } while (sim_can_tx_pop(tx_msg) != 0 && ++frames);
+        }
+    } else {
+        for (uint8_t field_num = 0; field_num < EPS_HK_FIELD_COUNT;
+                field_num++) {
+            round_trip(CAN_EPS_HK, field_num, 0);
+            frames += 2;
+        }
+    }
+    return frames;
+}
+
+static void bench_collect_hk(const char* name, bool batch, uint32_t iterations) {
+    setup();
+    // Only the protocol cost, not the debug output
+    print_can_msgs = false;
+    uint32_t frames = 0;
+    uint64_t host_start_ns = host_time_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        frames = collect_hk(batch);
+    }
+    uint64_t host_ns = host_time_ns() - host_start_ns;
+
+    printf("%-28s %10u %12.1f %14u\n", name, iterations,
+        (double) host_ns / iterations, frames);
+}
+
+// One iteration of the main loop in main.c, with its stage timing
+static uint32_t main_loop_iteration(uint32_t iteration_start) {
+    uint32_t stage_start = iteration_start;
+    run_hb();
+    stage_start = record_loop_stage(LOOP_STAGE_HB, stage_start);
+    run_protection();
+    stage_start = record_loop_stage(LOOP_STAGE_PROT, stage_start);
+    run_measurements();
+    run_battery();
+    run_rail_stats();
+    stage_start = record_loop_stage(LOOP_STAGE_MEAS, stage_start);
+    run_heaters();
+    stage_start = record_loop_stage(LOOP_STAGE_HEATERS, stage_start);
+    send_next_tx_msg();
+    stage_start = record_loop_stage(LOOP_STAGE_CAN_TX, stage_start);
+    process_next_rx_msg();
+    stage_start = record_loop_stage(LOOP_STAGE_CAN_RX, stage_start);
+    run_imu();
+    stage_start = record_loop_stage(LOOP_STAGE_IMU, stage_start);
+    run_config();
+    stage_start = record_loop_stage(LOOP_STAGE_CONFIG, stage_start);
+    run_idle();
+    stage_start = record_loop_stage(LOOP_STAGE_IDLE, stage_start);
+    record_loop_stage(LOOP_STAGE_ITERATION, iteration_start);
+    return stage_start;
+}
+
+// Runs the main loop for `seconds` of simulated time with a command every
+// 10 ms (cycling through the HK and heater CTRL fields), and prints the
+// stage statistics
+static void bench_main_loop(uint32_t seconds) {
+    setup();
+    reset_loop_stats();
+    sim_spi_cfg_writes = 0;
+    spi_cfg_skipped = 0;
+    // The commands are injected by this loop, not by an interrupt that would
+    // wake the MCU up
+    idle_sleep_enabled = false;
+
+    uint32_t i = 0;
+    uint64_t next_cmd_us = sim_time_us;
+    uint64_t end_us = sim_time_us + (uint64_t) seconds * 1000000;
+    uint32_t loop_time = read_loop_time();
+    uint8_t tx_msg[8];
+    while (sim_time_us < end_us) {
+        if (sim_time_us >= next_cmd_us) {
+            if (i % 2 == 0) {
+                send_cmd(CAN_EPS_HK, (i / 2) % EPS_HK_FIELD_COUNT, 0);
+            } else {
+                send_cmd(CAN_EPS_CTRL, CAN_EPS_CTRL_GET_HEAT_SHAD_SP +
+                    (i / 2) % 6, 0x400);
+            }
+            i++;
+            next_cmd_us += 10000;
+        }
+        loop_time = main_loop_iteration(loop_time);
+        while (sim_can_tx_pop(tx_msg) != 0) {
+        }
+        // CPU time is not simulated, so model 50 us per iteration
+        sim_advance_us(50);
+    }
+
+    const char* names[LOOP_STAGE_COUNT] = {
+        "run_hb", "run_measurements", "run_heaters", "send_next_tx_msg",
+        "process_next_rx_msg", "run_imu", "run_config",
+        "run_idle", "whole iteration", "run_protection"
+    };
+    uint32_t spi_cfg_writes = sim_spi_cfg_writes;
+    uint32_t ticks_per_s = 0;
+    get_loop_stat(0, LOOP_STAT_TICKS_PER_S, &ticks_per_s);
+    double ms_per_tick = 1000.0 / ticks_per_s;
+
+    printf("\n%-28s %10s %12s %14s\n", "main loop stage", "runs",
+        "mean ms", "max ms");
+    for (uint8_t stage = 0; stage < LOOP_STAGE_COUNT; stage++) {
+        loop_stage_stats_t* stats = &loop_stats[stage];
+        printf("%-28s %10u %12.3f %14.3f\n", names[stage], stats->count,
+            (double) stats->sum / stats->count * ms_per_tick,
+            stats->max * ms_per_tick);
+    }
+    printf("%-28s %10u (%u skipped)\n", "SPI mode/clock writes",
+        spi_cfg_writes, spi_cfg_skipped);
+
+    printf("\n%-28s %10s\n", "IMU wait for HINT, up to ms", "waits");
+    for (uint8_t bin = 0; bin < IMU_WAIT_HIST_BINS; bin++) {
+        char label[16] = "longer";
+        if (bin < IMU_WAIT_HIST_BINS - 1) {
+            snprintf(label, sizeof(label), "%.3f",
+                (bin == 0 ? 0 : (1UL << bin) - 1) * ms_per_tick);
+        }
+        printf("%-28s %10u\n", label, imu_wait_hist[bin]);
+    }
+    printf("%-28s %10u\n", "timed out", imu_wait_timeouts);
+}
+
+// Exchanges `count` transfers of SPI_BENCH_LEN bytes at `freq`, with blocking
+// send_spi() calls or interrupt-driven transfers, and prints the throughput
+// and CPU load
+#define SPI_BENCH_LEN 64
+
+static void bench_spi_xfer(const char* name, spi_clk_freq_t freq,
+        bool interrupt, uint32_t count) {
+    setup();
+    static uint8_t rx[SPI_BENCH_LEN];
+    // No device selected
+    spi_dev_t dev = { .cs = NULL, .cpol = 0, .cpha = 0, .clk_freq = freq };
+    spi_xfer_t xfer = {
+        .dev = &dev, .tx = NULL, .fill = 0xFF, .rx = rx, .rx_max = SPI_BENCH_LEN,
+        .len = SPI_BENCH_LEN, .done = NULL
+    };
+    claim_spi_bus(&dev);
+
+    uint64_t start_us = sim_time_us;
+    uint64_t start_isr_cycles = sim_spi_isr_cycles;
+    for (uint32_t i = 0; i < count; i++) {
+        if (interrupt) {
+            queue_spi_xfer(&xfer);
+            wait_spi_xfer();
+        } else {
+            for (uint16_t j = 0; j < SPI_BENCH_LEN; j++) {
+                rx[j] = send_spi(0xFF);
+            }
+        }
+    }
+    uint64_t sim_us = sim_time_us - start_us;
+    claim_spi_bus(&spi_lib_common_dev);
+
+    // The CPU is busy for the whole of a blocking transfer
+    double busy = 100.0;
+    if (interrupt) {
+        busy = 100.0 * (double) (sim_spi_isr_cycles - start_isr_cycles) /
+            ((double) sim_us * (F_CPU / 1000000));
+    }
+    uint32_t bytes = count * SPI_BENCH_LEN;
+    printf("%-28s %10u %12.0f %14.1f\n", name, bytes,
+        bytes * 1000000.0 / sim_us, busy);
+}
+
+// Samples all ADC channels `count` times, with auto-1 sweeps (averaging
+// `ratio` of them) or a single-channel fetch per channel, and prints the
+// snapshot rate and duration
+static void bench_adc_sweep(const char* name, bool burst, uint8_t ratio,
+        uint32_t count) {
+    setup();
+    set_meas_oversample_ratio(0xFF, ratio);
+    claim_spi_bus(&spi_lib_common_dev);
+
+    uint64_t start_us = sim_time_us;
+    uint32_t start_frames = sim_adc_frames;
+    for (uint32_t i = 0; i < count; i++) {
+        if (burst) {
+            sample_adc_snapshot();
+        } else {
+            for (uint8_t j = 0; j < ADC_CHANNELS; j++) {
+                fetch_and_read_adc_channel(&adc, j);
+            }
+        }
+    }
+    uint64_t sim_us = sim_time_us - start_us;
+
+    printf("%-28s %10u %12.1f %14.0f\n", name,
+        (sim_adc_frames - start_frames) / count, count * 1000000.0 / sim_us,
+        (double) sim_us / count);
+}
+
+// Looks up every field number (plus invalid ones) on each iteration
+static void bench_hk_dispatch(const char* name, hk_handler_t handler,
+        uint32_t iterations) {
+    setup();
+    uint32_t calls = 0;
+    uint64_t start = host_cycles();
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint8_t field_num = 0; field_num < EPS_HK_FIELD_COUNT + 2;
+                field_num++) {
+            uint8_t status = CAN_STATUS_OK;
+            uint32_t data = 0;
+            handler(field_num, &status, &data);
+            calls++;
+        }
+    }
+    uint64_t cycles = host_cycles() - start;
+
+    printf("%-28s %10u %12.1f\n", name, calls, (double) cycles / calls);
+}
+
+// Returns the number of fields where the table and the chain disagree
+static uint32_t check_hk_dispatch(void) {
+    setup();
+    uint32_t mismatches = 0;
+    for (uint16_t field_num = 0; field_num <= 0xFF; field_num++) {
+        uint8_t status = CAN_STATUS_OK;
+        uint32_t data = 0;
+        handle_rx_hk(field_num, &status, &data);
+
+        uint8_t chain_status = CAN_STATUS_OK;
+        uint32_t chain_data = 0;
+        chain_handle_rx_hk(field_num, &chain_status, &chain_data);
+
+        if (status != chain_status || data != chain_data) {
+            mismatches++;
+        }
+    }
+
+    printf("%-28s %10u %s (%u mismatches)\n", "check HK table vs chain", 256,
+        mismatches == 0 ? "OK" : "FAILED", mismatches);
+    return mismatches;
+}
+
+// Returns the number of protocol violations found
+static uint32_t fuzz(uint32_t iterations) {
+    setup();
+    srand(1);
+
+    uint32_t violations = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint8_t rx_msg[8];
+        for (uint8_t j = 0; j < 8; j++) {
+            rx_msg[j] = rand() & 0xFF;
+        }
+        // Bias towards valid opcodes and field numbers
+        if (rx_msg[0] & 0x80) {
+            const uint8_t opcodes[] = { CAN_EPS_HK, CAN_EPS_CTRL,
+                CAN_EPS_HK_BATCH, CAN_EPS_LOG_DUMP, CAN_EPS_IMU_DUMP };
+            rx_msg[0] = opcodes[rx_msg[0] % 5];
+            rx_msg[1] %= EPS_HK_FIELD_COUNT + 2;
+        }
+        // Would dereference an arbitrary host address
+        if (rx_msg[0] == CAN_EPS_CTRL && rx_msg[1] == CAN_EPS_CTRL_READ_RAM_BYTE) {
+            continue;
+        }
+
+        sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+        process_next_rx_msg();
+
+        // Every frame must match the command, and only batched reads and
+        // dumps get more than one (with their own byte 1)
+        bool streamed = (rx_msg[0] == CAN_EPS_HK_BATCH ||
+            rx_msg[0] == CAN_EPS_LOG_DUMP || rx_msg[0] == CAN_EPS_IMU_DUMP);
+        uint8_t tx_msg[8];
+        uint8_t frames = 0;
+        while (1) {
+            send_next_tx_msg();
+            uint8_t len = sim_can_tx_pop(tx_msg);
+            if (len == 0) {
+                break;
+            }
+            frames++;
+            if (len != 8 || tx_msg[0] != rx_msg[0] ||
+                    (frames == 1 && tx_msg[1] != rx_msg[1] && !streamed)) {
+                violations++;
+            }
+        }
+        if (frames == 0 || (frames > 1 && !streamed)) {
+            violations++;
+        }
+    }
+
+    printf("%-28s %10u %s (%u violations)\n", "fuzz process_next_rx_msg",
+        iterations, violations == 0 ? "OK" : "FAILED", violations);
+    return violations;
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = DEF_ITERATIONS;
+    if (argc > 1) {
+        iterations = (uint32_t) strtoul(argv[1], NULL, 0);
+    }
+
+    printf("%-28s %10s %12s %14s\n", "benchmark", "calls", "host ns/call",
+        "sim us/call");
+
+    run_bench("HK ADC field round trip", bench_hk_adc, iterations);
+    run_bench("HK gyro field round trip", bench_hk_gyro, iterations / 100);
+    run_bench("CTRL get setpoint", bench_ctrl_get, iterations);
+    run_bench("CTRL set setpoint", bench_ctrl_set_sp, iterations / 10);
+    run_bench("control_heater_mode", bench_heater_ctrl, iterations);
+    run_bench("thermistor temp, log()", bench_therm_exact, iterations);
+    run_bench("thermistor temp, LUT", bench_therm_lut, iterations);
+    run_bench("setpoint to DAC, exp()", bench_setpoint_exact, iterations);
+    run_bench("setpoint to DAC, LUT", bench_setpoint_lut, iterations);
+
+    printf("\n%-28s %10s %12s %14s\n", "full HK collection", "calls",
+        "host ns/call", "CAN frames");
+    bench_collect_hk("one request per field", false, iterations / 10);
+    bench_collect_hk("batched read", true, iterations / 10);
+
+    printf("\n%-28s %10s %12s\n", "HK dispatch", "calls", "cycles/call");
+    bench_hk_dispatch("table (handle_rx_hk)", handle_rx_hk, iterations);
+    bench_hk_dispatch("else if chain", chain_handle_rx_hk, iterations);
+    printf("\n");
+
+    printf("%-28s %10s %12s %14s\n", "SPI transfer", "bytes", "bytes/s",
+        "CPU busy %");
+    bench_spi_xfer("send_spi, fosc/4", SPI_FOSC_4, false, iterations / 100);
+    bench_spi_xfer("interrupt, fosc/4", SPI_FOSC_4, true, iterations / 100);
+    bench_spi_xfer("send_spi, fosc/16", SPI_FOSC_16, false, iterations / 100);
+    bench_spi_xfer("interrupt, fosc/16", SPI_FOSC_16, true, iterations / 100);
+    bench_spi_xfer("send_spi, fosc/64", SPI_FOSC_64, false, iterations / 100);
+    bench_spi_xfer("interrupt, fosc/64", SPI_FOSC_64, true, iterations / 100);
+
+    printf("\n%-28s %10s %12s %14s\n", "ADC snapshot (16 channels)",
+        "frames", "snapshots/s", "sim us/snap");
+    bench_adc_sweep("per-channel fetch", false, 1, iterations / 100);
+    bench_adc_sweep("auto-1 burst", true, 1, iterations / 100);
+    bench_adc_sweep("auto-1 burst, 4x oversample", true, 4, iterations / 1000);
+    bench_adc_sweep("auto-1 burst, 64x oversample", true, 64, iterations / 1000);
+
+    bench_main_loop(120);
+    printf("\n");
+
+    uint32_t mismatches = check_hk_dispatch();
+    return (fuzz(iterations) == 0 && mismatches == 0) ? 0 : 1;
+}
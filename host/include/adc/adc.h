@@ -0,0 +1,33 @@
+/*
+Host stand-in for lib-common's ADC library (ADS7952, 16 channels).
+
+Conversions return scripted values (see sim_adc_* in sim.h) and charge the
+simulated clock for the SPI frames the real driver would send.
+*/
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdint.h>
+
+#include <conversions/conversions.h>
+#include <spi/spi.h>
+#include <utilities/utilities.h>
+
+#define ADC_CHANNELS 16
+
+typedef struct {
+    // Bit i set means channel i is included in an auto-1 sweep
+    uint16_t auto_channels;
+    pin_info_t* cs;
+    uint16_t channel_data[ADC_CHANNELS];
+} adc_t;
+
+void init_adc(adc_t* adc);
+uint16_t send_adc_frame(adc_t* adc, uint16_t frame);
+void fetch_all_adc_channels(adc_t* adc);
+void fetch_adc_channel(adc_t* adc, uint8_t channel);
+uint16_t read_adc_channel(adc_t* adc, uint8_t channel);
+uint16_t fetch_and_read_adc_channel(adc_t* adc, uint8_t channel);
+
+#endif
@@ -0,0 +1,25 @@
+/*
+Host stand-in for <avr/eeprom.h>, backed by sim_eeprom[] (see sim.h).
+*/
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#define E2END 0x7FF
+
+uint8_t eeprom_read_byte(const uint8_t* addr);
+uint32_t eeprom_read_dword(const uint32_t* addr);
+void eeprom_write_byte(uint8_t* addr, uint8_t value);
+void eeprom_write_dword(uint32_t* addr, uint32_t value);
+void eeprom_update_byte(uint8_t* addr, uint8_t value);
+void eeprom_update_dword(uint32_t* addr, uint32_t value);
+
+#define eeprom_is_ready() (!(EECR & _BV(EEPE)))
+// Advances simulated time until a byte being programmed is done
+void eeprom_busy_wait(void);
+
+#endif
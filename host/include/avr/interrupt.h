@@ -0,0 +1,18 @@
+/*
+Host stand-in for <avr/interrupt.h>.
+
+An ISR becomes an ordinary function named after its vector, which the
+simulator calls when the corresponding hardware event happens (see sim.h).
+*/
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define sei() do { SREG |= _BV(SREG_I); } while (0)
+#define cli() do { SREG &= (uint8_t) ~_BV(SREG_I); } while (0)
+
+#endif
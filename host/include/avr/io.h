@@ -0,0 +1,129 @@
+/*
+Host stand-in for <avr/io.h> (ATmega64M1).
+
+I/O registers are plain RAM variables defined in host/sim/regs.c. Firmware
+reads and writes them exactly as it would on the MCU; the simulator inspects
+them where the hardware behaviour matters (e.g. EIMSK for INT2, SPCR for the
+SPI clock).
+*/
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit)    ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)  (!((sfr) & _BV(bit)))
+
+// GPIO
+extern volatile uint8_t PINB, DDRB, PORTB;
+extern volatile uint8_t PINC, DDRC, PORTC;
+extern volatile uint8_t PIND, DDRD, PORTD;
+extern volatile uint8_t PINE, DDRE, PORTE;
+
+// Status register
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+// MCU control
+extern volatile uint8_t MCUSR, MCUCR, SMCR;
+#define SE  0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+
+// External interrupts
+extern volatile uint8_t EICRA, EIMSK, EIFR;
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define ISC20 4
+#define ISC21 5
+#define ISC30 6
+#define ISC31 7
+#define INT0 0
+#define INT1 1
+#define INT2 2
+#define INT3 3
+#define INTF2 2
+
+// SPI
+extern volatile uint8_t SPCR, SPSR, SPDR;
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE  6
+#define SPIE 7
+#define SPI2X 0
+#define SPIF  7
+
+// EEPROM
+extern volatile uint8_t EECR, EEDR;
+extern volatile uint16_t EEAR;
+#define EERE  0
+#define EEWE  1
+#define EEPE  1
+#define EEMWE 2
+#define EEMPE 2
+#define EERIE 3
+
+// Timer/counter 0 (8-bit)
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+#define CS00  0
+#define CS01  1
+#define CS02  2
+#define WGM00 0
+#define WGM01 1
+#define OCIE0A 1
+#define TOIE0 0
+#define OCF0A 1
+
+// Timer/counter 1 (16-bit)
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B;
+#define CS10  0
+#define CS11  1
+#define CS12  2
+#define WGM12 3
+#define OCF1A 1
+#define OCF1B 2
+#define OCIE1A 1
+#define OCIE1B 2
+
+// Port pins
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#endif
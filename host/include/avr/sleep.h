@@ -0,0 +1,29 @@
+/*
+Host stand-in for <avr/sleep.h>.
+
+sleep_cpu() advances simulated time until an interrupt wakes the MCU (see
+sim_sleep_cpu() in sim.h).
+*/
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE         (0x00 << 1)
+#define SLEEP_MODE_ADC          (0x01 << 1)
+#define SLEEP_MODE_PWR_DOWN     (0x02 << 1)
+#define SLEEP_MODE_PWR_SAVE     (0x03 << 1)
+#define SLEEP_MODE_STANDBY      (0x06 << 1)
+
+#define set_sleep_mode(mode) do { \
+    SMCR = (SMCR & (uint8_t) ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | (mode); \
+} while (0)
+
+#define sleep_enable()  do { SMCR |= _BV(SE); } while (0)
+#define sleep_disable() do { SMCR &= (uint8_t) ~_BV(SE); } while (0)
+#define sleep_cpu()     sim_sleep_cpu()
+
+void sim_sleep_cpu(void);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+Host stand-in for lib-common's CAN library.
+
+There is no bus: received frames are injected with sim_can_rx() and frames
+the firmware transmits (resume_mob() on a TX MOB) are captured by the
+simulator (see sim_can_* in sim.h).
+*/
+
+#ifndef CAN_H
+#define CAN_H
+
+#include <stdint.h>
+
+#include <utilities/utilities.h>
+
+#define CAN_RX_MASK_ID 0x7F8
+
+typedef enum {
+    TX_MOB,
+    RX_MOB,
+    AUTO_MOB
+} mob_type_t;
+
+typedef union {
+    uint16_t std;
+    uint32_t ext;
+} mob_id_tag_t;
+
+typedef union {
+    uint16_t std;
+    uint32_t ext;
+} mob_id_mask_t;
+
+typedef struct {
+    uint8_t ide_mask : 1;
+    uint8_t rtr_mask : 1;
+    uint8_t rtr : 1;
+    uint8_t ide : 1;
+    uint8_t rb0 : 1;
+    uint8_t rb1 : 1;
+} mob_ctrl_t;
+
+typedef void(*can_rx_callback_t)(const uint8_t*, uint8_t);
+typedef void(*can_tx_callback_t)(uint8_t*, uint8_t*);
+
+typedef struct {
+    uint8_t mob_num;
+    mob_type_t mob_type;
+    mob_id_tag_t id_tag;
+    mob_id_mask_t id_mask;
+    mob_ctrl_t ctrl;
+    uint8_t dlc;
+    can_rx_callback_t rx_cb;
+    can_tx_callback_t tx_data_cb;
+} mob_t;
+
+#define default_rx_ctrl { .ide_mask = 0, .rtr_mask = 0, .rtr = 0, .ide = 0 }
+#define default_tx_ctrl { .ide_mask = 0, .rtr_mask = 0, .rtr = 0, .ide = 0 }
+
+void init_can(void);
+void init_rx_mob(mob_t* mob);
+void init_tx_mob(mob_t* mob);
+void pause_mob(mob_t* mob);
+void resume_mob(mob_t* mob);
+
+#endif
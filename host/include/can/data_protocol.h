@@ -0,0 +1,68 @@
+/*
+Host stand-in for lib-common's CAN data protocol (EPS subset).
+*/
+
+#ifndef CAN_DATA_PROTOCOL_H
+#define CAN_DATA_PROTOCOL_H
+
+// Opcodes
+#define CAN_EPS_HK      0x00
+#define CAN_PAY_HK      0x01
+#define CAN_PAY_OPT     0x02
+#define CAN_PAY_CTRL    0x03
+#define CAN_EPS_CTRL    0x04
+
+// Status
+#define CAN_STATUS_OK                   0x00
+#define CAN_STATUS_INVALID_OPCODE       0x01
+#define CAN_STATUS_INVALID_FIELD_NUM    0x02
+#define CAN_STATUS_INVALID_DATA         0x03
+
+// EPS housekeeping field numbers
+#define CAN_EPS_HK_UPTIME           0x00
+#define CAN_EPS_HK_RESTART_COUNT    0x01
+#define CAN_EPS_HK_RESTART_REASON   0x02
+#define CAN_EPS_HK_BAT_VOL          0x03
+#define CAN_EPS_HK_BAT_CUR          0x04
+#define CAN_EPS_HK_X_POS_CUR        0x05
+#define CAN_EPS_HK_X_NEG_CUR        0x06
+#define CAN_EPS_HK_Y_POS_CUR        0x07
+#define CAN_EPS_HK_Y_NEG_CUR        0x08
+#define CAN_EPS_HK_3V3_VOL          0x09
+#define CAN_EPS_HK_3V3_CUR          0x0A
+#define CAN_EPS_HK_5V_VOL           0x0B
+#define CAN_EPS_HK_5V_CUR           0x0C
+#define CAN_EPS_HK_PAY_CUR          0x0D
+#define CAN_EPS_HK_3V3_TEMP         0x0E
+#define CAN_EPS_HK_5V_TEMP          0x0F
+#define CAN_EPS_HK_PAY_CON_TEMP     0x10
+#define CAN_EPS_HK_BAT_TEMP1        0x11
+#define CAN_EPS_HK_BAT_TEMP2        0x12
+#define CAN_EPS_HK_HEAT1_SP         0x13
+#define CAN_EPS_HK_HEAT2_SP         0x14
+#define CAN_EPS_HK_GYR_UNCAL_X      0x15
+#define CAN_EPS_HK_GYR_UNCAL_Y      0x16
+#define CAN_EPS_HK_GYR_UNCAL_Z      0x17
+#define CAN_EPS_HK_GYR_CAL_X        0x18
+#define CAN_EPS_HK_GYR_CAL_Y        0x19
+#define CAN_EPS_HK_GYR_CAL_Z        0x1A
+#define CAN_EPS_HK_FIELD_COUNT      0x1B
+
+// EPS control field numbers
+#define CAN_EPS_CTRL_PING                   0x00
+#define CAN_EPS_CTRL_READ_EEPROM            0x01
+#define CAN_EPS_CTRL_ERASE_EEPROM           0x02
+#define CAN_EPS_CTRL_READ_RAM_BYTE          0x03
+#define CAN_EPS_CTRL_RESET                  0x04
+#define CAN_EPS_CTRL_GET_HEAT_SHAD_SP       0x05
+#define CAN_EPS_CTRL_SET_HEAT1_SHAD_SP      0x06
+#define CAN_EPS_CTRL_SET_HEAT2_SHAD_SP      0x07
+#define CAN_EPS_CTRL_GET_HEAT_SUN_SP        0x08
+#define CAN_EPS_CTRL_SET_HEAT1_SUN_SP       0x09
+#define CAN_EPS_CTRL_SET_HEAT2_SUN_SP       0x0A
+#define CAN_EPS_CTRL_GET_HEAT_CUR_THR       0x0B
+#define CAN_EPS_CTRL_SET_HEAT_CUR_THR_LOWER 0x0C
+#define CAN_EPS_CTRL_SET_HEAT_CUR_THR_UPPER 0x0D
+#define CAN_EPS_CTRL_FIELD_COUNT            0x0E
+
+#endif
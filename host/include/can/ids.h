@@ -0,0 +1,18 @@
+/*
+Host stand-in for lib-common's CAN MOB numbers and IDs.
+*/
+
+#ifndef CAN_IDS_H
+#define CAN_IDS_H
+
+#define OBC_PAY_HB_MOB_NUM  0
+#define OBC_EPS_HB_MOB_NUM  1
+#define EPS_HB_MOB_NUM      2
+#define PAY_HB_MOB_NUM      3
+#define EPS_CMD_MOB_NUM     4
+#define OBC_CMD_MOB_NUM     5
+
+#define EPS_EPS_CMD_MOB_ID  0x0010
+#define EPS_OBC_CMD_MOB_ID  0x0011
+
+#endif
@@ -0,0 +1,55 @@
+/*
+Host stand-in for lib-common's conversions library (same formulas, compiled
+for the host).
+*/
+
+#ifndef CONVERSIONS_H
+#define CONVERSIONS_H
+
+#include <stdint.h>
+
+// ADC reference voltage (in V)
+#define ADC_VREF 5.0
+// Gain of the INA214 current sense amplifiers
+#define ADC_CUR_SENSE_AMP_GAIN 100.0
+// Efuse IMON current gain (A/A)
+#define ADC_EFUSE_IMON_CUR_GAIN 246e-6
+
+// DAC reference voltage (in V) and output gain
+#define DAC_VREF 2.5
+#define DAC_VREF_GAIN 2
+#define DAC_NUM_BITS 12
+
+// Thermistor parameters (10k NTC, beta model)
+#define THERM_R_REF 10.0    // kilohms at THERM_T_REF
+#define THERM_T_REF 25.0    // C
+#define THERM_BETA 3380.0
+#define THERM_BIAS_RES 10.0 // kilohms
+#define THERM_V_REF 2.5     // V
+
+// IMU Q points (#1 p.58-60)
+#define IMU_ACCEL_Q 8
+#define IMU_GYRO_Q 9
+
+double adc_raw_to_ch_vol(uint16_t raw_data);
+uint16_t adc_ch_vol_to_raw(double ch_vol);
+double adc_raw_to_circ_vol(uint16_t raw_data, double low_res, double high_res);
+double adc_raw_to_circ_cur(uint16_t raw_data, double sense_res, double ref_vol);
+uint16_t adc_circ_cur_to_raw(double circ_cur, double sense_res, double ref_vol);
+double adc_raw_to_efuse_cur(uint16_t raw_data, double sense_res);
+double adc_raw_to_therm_temp(uint16_t raw_data);
+
+double therm_vol_to_res(double vol);
+double therm_res_to_vol(double res);
+double therm_res_to_temp(double res);
+double therm_temp_to_res(double temp);
+
+double dac_raw_data_to_vol(uint16_t raw_data);
+uint16_t dac_vol_to_raw_data(double vol);
+double dac_raw_data_to_heater_setpoint(uint16_t raw_data);
+uint16_t heater_setpoint_to_dac_raw_data(double temp);
+
+double imu_raw_data_to_double(uint16_t raw_data, uint8_t q_point);
+double imu_raw_data_to_gyro(uint16_t raw_data);
+
+#endif
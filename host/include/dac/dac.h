@@ -0,0 +1,33 @@
+/*
+Host stand-in for lib-common's DAC library (2-channel 12-bit DAC).
+
+Every write is recorded (see sim_dac_* in sim.h).
+*/
+
+#ifndef DAC_H
+#define DAC_H
+
+#include <stdint.h>
+
+#include <conversions/conversions.h>
+#include <spi/spi.h>
+#include <utilities/utilities.h>
+
+typedef enum {
+    DAC_A,
+    DAC_B
+} dac_chan_t;
+
+typedef struct {
+    pin_info_t* cs;
+    pin_info_t* clr;
+    uint16_t raw_voltage_a;
+    uint16_t raw_voltage_b;
+} dac_t;
+
+void init_dac(dac_t* dac);
+void reset_dac(dac_t* dac);
+void set_dac_raw_voltage(dac_t* dac, dac_chan_t channel, uint16_t raw_data);
+void set_dac_voltage(dac_t* dac, dac_chan_t channel, double voltage);
+
+#endif
@@ -0,0 +1,21 @@
+/*
+Host stand-in for lib-common's heartbeat library. There are no other
+subsystems on the simulated bus, so running the heartbeat does nothing.
+*/
+
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <stdint.h>
+
+#include <can/can.h>
+#include <utilities/utilities.h>
+
+#define HB_OBC 0
+#define HB_EPS 1
+#define HB_PAY 2
+
+void init_hb(uint8_t self_id);
+void run_hb(void);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+Host stand-in for lib-common's port expander library (MCP23S17).
+
+Pin state is kept per port (see sim_pex_* in sim.h).
+*/
+
+#ifndef PEX_H
+#define PEX_H
+
+#include <stdint.h>
+
+#include <spi/spi.h>
+#include <utilities/utilities.h>
+
+typedef enum {
+    PEX_A = 0,
+    PEX_B = 1
+} pex_port_t;
+
+typedef enum {
+    OUTPUT = 0,
+    INPUT = 1
+} pex_dir_t;
+
+typedef struct {
+    uint8_t addr;
+    pin_info_t* cs;
+    pin_info_t* rst;
+} pex_t;
+
+void init_pex(pex_t* pex);
+void reset_pex(pex_t* pex);
+void set_pex_pin_dir(pex_t* pex, pex_port_t port, uint8_t pin, pex_dir_t dir);
+void set_pex_pin(pex_t* pex, pex_port_t port, uint8_t pin, uint8_t state);
+uint8_t get_pex_pin(pex_t* pex, pex_port_t port, uint8_t pin);
+
+#endif
@@ -0,0 +1,31 @@
+/*
+Host stand-in for lib-common's queue library (fixed-size queue of 8-byte
+CAN messages).
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <utilities/utilities.h>
+
+#define MAX_QUEUE_SIZE 10
+#define QUEUE_DATA_SIZE 8
+
+typedef struct {
+    uint8_t head;
+    uint8_t tail;
+    uint8_t content[MAX_QUEUE_SIZE][QUEUE_DATA_SIZE];
+} queue_t;
+
+void init_queue(queue_t* queue);
+uint8_t queue_empty(queue_t* queue);
+uint8_t queue_full(queue_t* queue);
+uint8_t queue_size(queue_t* queue);
+void enqueue(queue_t* queue, uint8_t* data);
+void dequeue(queue_t* queue, uint8_t* data);
+void peek_queue(queue_t* queue, uint8_t* data);
+
+#endif
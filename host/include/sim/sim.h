@@ -0,0 +1,183 @@
+/*
+Control and inspection interface for the host-native simulation of the EPS
+board (see host/makefile).
+
+The simulated lib-common drivers and device models keep all of their state
+here so that benchmarks and host tests can script inputs (ADC values, CAN
+frames, IMU sensor data) and observe outputs (DAC writes, transmitted CAN
+frames, EEPROM contents) without a board.
+
+Time is simulated: sim_time_us only advances when firmware code delays, when
+a modelled peripheral transfer takes time (SPI bytes, UART characters, EEPROM
+writes), or when a test calls sim_advance_us(). Host wall-clock time is
+unaffected, so firmware code runs as fast as the host allows.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <adc/adc.h>
+#include <avr/eeprom.h>
+
+/* Clock */
+
+typedef void(*sim_tick_fn_t)(void);
+
+// Number of functions that can be notified when simulated time advances
+#define SIM_NUM_TICK_HOOKS 4
+
+extern uint64_t sim_time_us;
+
+void sim_reset(void);
+void sim_advance_us(uint64_t us);
+void sim_add_tick_hook(sim_tick_fn_t hook);
+
+/* Interrupts */
+
+// EE_READY_vect is dispatched by sim_advance_us() while EECR.EERIE is set and
+// the EEPROM is ready (see EEPROM below), SPI_STC_vect when a byte has been
+// exchanged while SPCR.SPIE is set (see SPI below)
+
+// Dispatches INT2_vect if the interrupt is enabled (EIMSK) and global
+// interrupts are on, otherwise leaves INTF2 pending in EIFR
+void sim_raise_int2(void);
+// Called by sim_advance_us() when Timer 1 passes OCR1B - dispatches
+// TIMER1_COMPB_vect if it is enabled (TIMSK1.OCIE1B), straight away if global
+// interrupts are on or once they are turned on (OCF1B pending in TIFR1)
+void sim_timer1_compb(void);
+
+/* Sleep */
+
+// Number of times sleep_cpu() put the MCU to sleep, and simulated time spent
+// asleep
+extern uint32_t sim_sleep_count;
+extern uint64_t sim_sleep_us;
+// Number of times sleep_cpu() was called with interrupts disabled or nothing
+// woke the MCU before the watchdog would have reset it
+extern uint32_t sim_sleep_stuck;
+
+// Puts the MCU to sleep if SMCR.SE is set, advancing the clock in small steps
+// (running the tick hooks) until an interrupt is dispatched: INT2, a CAN RX
+// frame, EE_READY, SPI STC, Timer 1 compare B or the uptime timer
+void sim_sleep_cpu(void);
+
+/* GPIO */
+
+typedef void(*sim_pin_fn_t)(volatile uint8_t* port, uint8_t pin, uint8_t val);
+
+// Drives an input pin as an external device would (sets the PINx bit)
+void sim_drive_pin(volatile uint8_t* port, uint8_t pin, uint8_t val);
+// Notified whenever firmware writes an output pin
+void sim_set_pin_listener(sim_pin_fn_t listener);
+
+/* SPI */
+
+typedef struct {
+    volatile uint8_t* cs_port;
+    uint8_t cs_pin;
+    // Called with 1 when CS is asserted (low) and 0 when it is released
+    void (*select)(uint8_t selected);
+    // Returns the MISO byte clocked out while `mosi` is clocked in
+    uint8_t (*xfer)(uint8_t mosi);
+} sim_spi_dev_t;
+
+#define SIM_SPI_MAX_DEVS 4
+
+extern uint32_t sim_spi_bytes;
+// Number of SPI mode/clock configuration changes (SPCR/SPSR writes)
+extern uint32_t sim_spi_cfg_writes;
+
+// CPU cycles an SPI_STC_vect call is assumed to take (vector, register saves
+// and restores, and the body)
+#define SIM_SPI_ISR_CYCLES 64
+// CPU cycles spent in SPI_STC_vect
+extern uint64_t sim_spi_isr_cycles;
+
+void sim_spi_attach(sim_spi_dev_t* dev);
+// Advances the clock by the time `count` bytes take at the current SPI clock
+void sim_spi_charge(uint32_t count);
+
+/* UART */
+
+// Set to true to echo print() output to stdout
+extern bool sim_uart_echo;
+extern uint32_t sim_uart_bytes;
+
+/* ADC */
+
+typedef uint16_t(*sim_adc_source_t)(uint8_t channel);
+
+// Raw 12-bit value returned for each channel (unless sim_adc_source is set)
+extern uint16_t sim_adc_values[ADC_CHANNELS];
+extern sim_adc_source_t sim_adc_source;
+// Number of single-channel conversions performed
+extern uint32_t sim_adc_conversions;
+// Number of 16-bit SPI frames exchanged with the ADC
+extern uint32_t sim_adc_frames;
+
+/* DAC */
+
+// Channel writes (set_dac_raw_voltage() calls and 24-bit frames on the SPI
+// bus), and number of times the outputs changed (both channels may change in
+// one update)
+extern uint32_t sim_dac_writes;
+extern uint32_t sim_dac_updates;
+extern uint16_t sim_dac_outputs[2];
+
+/* PEX */
+
+extern uint8_t sim_pex_dirs[2];
+extern uint8_t sim_pex_outputs[2];
+extern uint32_t sim_pex_writes;
+
+/* CAN */
+
+#define SIM_CAN_TX_LOG_SIZE 64
+
+extern uint32_t sim_can_rx_count;
+extern uint32_t sim_can_tx_count;
+
+// Delivers a received frame to the RX MOB numbered `mob_num`, as the CAN
+// interrupt would
+void sim_can_rx(uint8_t mob_num, const uint8_t* data, uint8_t len);
+// Pops the oldest transmitted frame into `data` (8 bytes), returns its length
+// or 0 if nothing has been transmitted
+uint8_t sim_can_tx_pop(uint8_t* data);
+
+/* EEPROM */
+
+// Bytes can also be programmed through EEAR/EEDR/EECR, taking 3.3 ms each
+extern uint8_t sim_eeprom[E2END + 1];
+// Number of bytes physically written
+extern uint32_t sim_eeprom_writes;
+
+/* Watchdog, reset */
+
+// Longest simulated time between two watchdog kicks while it was enabled
+extern uint64_t sim_wdt_max_gap_us;
+extern uint32_t sim_resets;
+extern uint32_t sim_last_reset_reason;
+
+/* BNO080 IMU model */
+
+// Attaches the IMU model to the SPI bus and pins used by src/imu.c
+void sim_imu_attach(void);
+
+// Sensor values reported by the model (raw Q-point format)
+extern int16_t sim_imu_accel[3];
+extern int16_t sim_imu_cal_gyro[3];
+extern int16_t sim_imu_uncal_gyro[3];
+extern int16_t sim_imu_gyro_bias[3];
+
+// Number of packets the hub has sent, SPI transactions with the hub, and
+// input reports generated
+extern uint32_t sim_imu_packets;
+extern uint32_t sim_imu_transactions;
+extern uint32_t sim_imu_reports;
+// Timestamp rebase records sent
+extern uint32_t sim_imu_rebases;
+
+#endif
@@ -0,0 +1,40 @@
+/*
+Host stand-in for lib-common's SPI library.
+
+Bytes are routed to whichever simulated device (see sim_spi_attach()) has its
+chip select asserted, and the simulated clock advances by the time the byte
+would take at the configured SPI clock.
+*/
+
+#ifndef SPI_H
+#define SPI_H
+
+#include <stdint.h>
+
+#include <utilities/utilities.h>
+
+typedef enum {
+    SPI_FOSC_4,
+    SPI_FOSC_16,
+    SPI_FOSC_64,
+    SPI_FOSC_128,
+    SPI_FOSC_2,
+    SPI_FOSC_8,
+    SPI_FOSC_32
+} spi_clk_freq_t;
+
+#define SPI_DEF_CLK_FREQ SPI_FOSC_64
+
+void init_spi(void);
+uint8_t send_spi(uint8_t data);
+
+void init_cs(uint8_t pin, volatile uint8_t* ddr);
+void set_cs_low(uint8_t pin, volatile uint8_t* port);
+void set_cs_high(uint8_t pin, volatile uint8_t* port);
+
+void set_spi_cpol_cpha(uint8_t cpol, uint8_t cpha);
+void reset_spi_cpol_cpha(void);
+void set_spi_clk_freq(spi_clk_freq_t freq);
+void reset_spi_clk_freq(void);
+
+#endif
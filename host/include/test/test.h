@@ -0,0 +1,37 @@
+/*
+Host stand-in for lib-common's test library. Same test_t/run_tests() shape
+and ASSERT_* macros as the harness, but results go to stdout and run_tests()
+returns the number of failed assertions so a host test can exit non-zero.
+*/
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdint.h>
+
+typedef void(*test_fn_t)(void);
+
+typedef struct {
+    char* name;
+    test_fn_t fn;
+} test_t;
+
+// Absolute tolerance used by ASSERT_FP_EQ
+#define TEST_FP_EPSILON 0.001
+
+void test_assert(int cond, const char* expr, const char* file, int line);
+uint16_t run_tests(test_t** suite, uint8_t len);
+
+#define ASSERT_TRUE(a)          test_assert(!!(a), #a, __FILE__, __LINE__)
+#define ASSERT_FALSE(a)         test_assert(!(a), "!(" #a ")", __FILE__, __LINE__)
+#define ASSERT_EQ(a, b)         test_assert((a) == (b), #a " == " #b, __FILE__, __LINE__)
+#define ASSERT_NEQ(a, b)        test_assert((a) != (b), #a " != " #b, __FILE__, __LINE__)
+#define ASSERT_GREATER(a, b)    test_assert((a) > (b), #a " > " #b, __FILE__, __LINE__)
+#define ASSERT_LESS(a, b)       test_assert((a) < (b), #a " < " #b, __FILE__, __LINE__)
+#define ASSERT_FP_EQ(a, b) \
+    test_assert(((a) - (b)) < TEST_FP_EPSILON && ((b) - (a)) < TEST_FP_EPSILON, \
+        #a " == " #b, __FILE__, __LINE__)
+#define ASSERT_FP_GREATER(a, b) test_assert((a) > (b), #a " > " #b, __FILE__, __LINE__)
+#define ASSERT_FP_LESS(a, b)    test_assert((a) < (b), #a " < " #b, __FILE__, __LINE__)
+
+#endif
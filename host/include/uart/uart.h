@@ -0,0 +1,34 @@
+/*
+Host stand-in for lib-common's UART library.
+
+Output is counted (sim_uart_bytes) and charged to the simulated clock at the
+configured baud rate, and only echoed to stdout if sim_uart_echo is set.
+*/
+
+#ifndef UART_H
+#define UART_H
+
+#include <stdint.h>
+
+#include <utilities/utilities.h>
+
+typedef enum {
+    UART_BAUD_1200,
+    UART_BAUD_9600,
+    UART_BAUD_19200,
+    UART_BAUD_115200
+} uart_baud_rate_t;
+
+#define UART_DEF_BAUD_RATE UART_BAUD_9600
+
+typedef uint8_t(*uart_rx_cb_t)(const uint8_t*, uint8_t);
+
+void init_uart(void);
+void set_uart_baud_rate(uart_baud_rate_t baud_rate);
+void put_uart_char(uint8_t c);
+void send_uart(const uint8_t* msg, uint8_t len);
+int print(char* fmt, ...);
+void print_bytes(uint8_t* data, uint8_t len);
+void set_uart_rx_cb(uart_rx_cb_t cb);
+
+#endif
@@ -0,0 +1,40 @@
+/*
+Host stand-in for lib-common's uptime library.
+
+uptime_s follows the simulated clock; callbacks registered with
+add_uptime_callback() run once per simulated second. reset_self_mcu() cannot
+restart the host process, so it only records the request (sim_resets).
+*/
+
+#ifndef UPTIME_H
+#define UPTIME_H
+
+#include <stdint.h>
+
+#include <utilities/utilities.h>
+
+#define UPTIME_RESTART_REASON_EXTRF     0x01
+#define UPTIME_RESTART_REASON_BORF      0x02
+#define UPTIME_RESTART_REASON_WDRF      0x03
+#define UPTIME_RESTART_REASON_RESET_CMD 0x04
+#define UPTIME_RESTART_REASON_NO_COMMS  0x05
+
+#define UPTIME_NUM_CALLBACKS 4
+
+typedef void(*uptime_fn_t)(void);
+
+extern volatile uint32_t uptime_s;
+extern uint32_t restart_count;
+extern uint32_t restart_reason;
+
+extern uint32_t com_timeout_period_s;
+
+void init_uptime(void);
+uint8_t add_uptime_callback(uptime_fn_t callback);
+
+void init_com_timeout(void);
+void restart_com_timeout(void);
+
+void reset_self_mcu(uint32_t reason);
+
+#endif
@@ -0,0 +1,29 @@
+/*
+Host stand-in for <util/atomic.h>.
+
+Same semantics as avr-libc: the global interrupt flag is cleared for the
+duration of the block and SREG is restored on every exit path, including an
+early return from inside the block.
+*/
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+static inline void __host_restore_sreg(const uint8_t* sreg) {
+    SREG = *sreg;
+}
+
+static inline uint8_t __host_cli(void) {
+    cli();
+    return 1;
+}
+
+#define ATOMIC_RESTORESTATE \
+    uint8_t sreg_save __attribute__((__cleanup__(__host_restore_sreg))) = SREG
+
+#define ATOMIC_BLOCK(type) \
+    for (type, __todo = __host_cli(); __todo; __todo = 0)
+
+#endif
@@ -0,0 +1,32 @@
+/*
+Host stand-in for <util/crc16.h> (the C equivalents given in the avr-libc
+documentation of the inline assembly versions).
+*/
+
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+// CRC-CCITT, polynomial 0x8408 (reversed 0x1021)
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+    data ^= (uint8_t) (crc & 0xFF);
+    data ^= (uint8_t) (data << 4);
+    return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^
+        ((uint16_t) data << 3));
+}
+
+// CRC-16, polynomial 0xA001 (reversed 0x8005)
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a) {
+    crc ^= a;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (crc & 1) {
+            crc = (crc >> 1) ^ 0xA001;
+        } else {
+            crc = (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+#endif
@@ -0,0 +1,17 @@
+/*
+Host stand-in for <util/delay.h>.
+
+Delays do not sleep on the host, they advance the simulated clock instead
+(see sim_advance_us() in sim.h), so timeouts and periodic tasks behave as they
+would on the MCU while benchmarks still run at full host speed.
+*/
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#include <avr/io.h>
+
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+Host stand-in for lib-common's utilities library.
+*/
+
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+// Default value of an erased EEPROM double word
+#define EEPROM_DEF_DWORD 0xFFFFFFFF
+
+typedef struct {
+    volatile uint8_t* port;
+    volatile uint8_t* ddr;
+    uint8_t pin;
+} pin_info_t;
+
+void init_output_pin(uint8_t pin, volatile uint8_t* ddr, uint8_t init_val);
+void init_input_pin(uint8_t pin, volatile uint8_t* ddr);
+void set_pin_pullup(uint8_t pin, volatile uint8_t* port, uint8_t pullup);
+void set_pin_low(uint8_t pin, volatile uint8_t* port);
+void set_pin_high(uint8_t pin, volatile uint8_t* port);
+uint8_t get_pin_val(uint8_t pin, volatile uint8_t* port);
+
+uint32_t read_eeprom(uint16_t addr);
+void write_eeprom(uint16_t addr, uint32_t data);
+uint32_t read_eeprom_or_default(uint16_t addr, uint32_t default_data);
+
+#endif
@@ -0,0 +1,15 @@
+/*
+Host stand-in for lib-common's watchdog library.
+*/
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <avr/wdt.h>
+
+#include <utilities/utilities.h>
+
+#define WDT_OFF() wdt_disable()
+#define WDT_ENABLE_SYS_RESET(timeout) wdt_enable(timeout)
+
+#endif
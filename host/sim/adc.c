@@ -0,0 +1,93 @@
+/*
+Simulated lib-common ADC library.
+
+Each 16-bit frame is charged to the simulated clock. A single-channel fetch
+switches to manual mode and waits out the ADC's two-frame pipeline (3 frames);
+an auto-1 sweep costs one frame per enabled channel plus the program frames.
+*/
+
+#include <adc/adc.h>
+#include <sim/sim.h>
+
+#include "sim_internal.h"
+
+#define ADC_FETCH_CHANNEL_FRAMES 3
+#define ADC_AUTO1_PROGRAM_FRAMES 2
+
+uint16_t sim_adc_values[ADC_CHANNELS];
+sim_adc_source_t sim_adc_source = NULL;
+uint32_t sim_adc_conversions = 0;
+uint32_t sim_adc_frames = 0;
+
+
+void sim_reset_adc(void) {
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        sim_adc_values[i] = 0;
+    }
+    // A healthy 2S pack (7.58 V, about half charged) on channel 13
+    // (ADC_VMON_PACK in src/devices.h), above the undervoltage threshold
+    sim_adc_values[13] = 3104;
+    sim_adc_source = NULL;
+    sim_adc_conversions = 0;
+    sim_adc_frames = 0;
+}
+
+static uint16_t sample(uint8_t channel) {
+    sim_adc_conversions++;
+    if (sim_adc_source != NULL) {
+        return sim_adc_source(channel) & 0x0FFF;
+    }
+    return sim_adc_values[channel] & 0x0FFF;
+}
+
+static void charge_frames(uint32_t count) {
+    sim_adc_frames += count;
+    sim_spi_charge(count * 2);
+}
+
+void init_adc(adc_t* adc) {
+    init_cs(adc->cs->pin, adc->cs->ddr);
+    set_cs_high(adc->cs->pin, adc->cs->port);
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        adc->channel_data[i] = 0;
+    }
+    charge_frames(ADC_AUTO1_PROGRAM_FRAMES);
+}
+
+uint16_t send_adc_frame(adc_t* adc, uint16_t frame) {
+    (void) adc;
+    (void) frame;
+    charge_frames(1);
+    return 0;
+}
+
+void fetch_all_adc_channels(adc_t* adc) {
+    uint32_t frames = ADC_AUTO1_PROGRAM_FRAMES;
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        if (adc->auto_channels & _BV(i)) {
+            adc->channel_data[i] = sample(i);
+            frames++;
+        }
+    }
+    charge_frames(frames);
+}
+
+void fetch_adc_channel(adc_t* adc, uint8_t channel) {
+    if (channel >= ADC_CHANNELS) {
+        return;
+    }
+    adc->channel_data[channel] = sample(channel);
+    charge_frames(ADC_FETCH_CHANNEL_FRAMES);
+}
+
+uint16_t read_adc_channel(adc_t* adc, uint8_t channel) {
+    if (channel >= ADC_CHANNELS) {
+        return 0;
+    }
+    return adc->channel_data[channel];
+}
+
+uint16_t fetch_and_read_adc_channel(adc_t* adc, uint8_t channel) {
+    fetch_adc_channel(adc, channel);
+    return read_adc_channel(adc, channel);
+}
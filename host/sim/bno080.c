@@ -0,0 +1,461 @@
+/*
+Behavioural model of the BNO080 sensor hub on the SPI bus, enough for the
+SHTP traffic src/imu.c generates:
+
+- After reset (RSTn rising edge) the hub queues its advertisement (channel 0),
+  the executable reset message (channel 1) and the SH-2 initialize response
+  (channel 2).
+- Product ID requests are answered with a 16-byte and a 48-byte packet.
+- Set feature commands are answered with a get feature response and start or
+  stop input reports at the requested report interval. Features at the same
+  interval report at the same time, in one packet. With a non-zero batch
+  interval, reports are buffered and delivered together in one packet (early
+  if the buffer fills up).
+- Input report packets start with a timebase reference (0xFB) whose base
+  delta is the age of the oldest report in the packet, and every report's
+  delay field holds its offset from that base, both in 100 us units. A report
+  taken more than a delay field (14 bits, 1.6383 s) after the base is preceded
+  by a timestamp rebase (0xFA) moving the base to it, relative to the
+  timebase reference.
+- HINT (INTn) is asserted while a packet is queued or after the host asserts
+  PS0/WAKE, and deasserted during every transaction. Every edge is delivered
+  to INT2_vect.
+
+SPI is full duplex: if the hub has a packet queued when the host starts a
+write, the hub clocks its packet out at the same time and it is lost to a
+host that ignores MISO, as on the real part.
+*/
+
+#include <string.h>
+
+#include <avr/io.h>
+#include <sim/sim.h>
+
+#include "sim_internal.h"
+
+// Pins used by src/imu.c
+#define IMU_CS_PORT     PORTD
+#define IMU_CS_PIN      PD0
+#define IMU_INT_PORT    PORTB
+#define IMU_INT_PIN     PB5
+#define IMU_RST_PORT    PORTB
+#define IMU_RST_PIN     PB3
+#define IMU_WAKE_PORT   PORTB
+#define IMU_WAKE_PIN    PB6
+
+#define HDR_LEN 4
+#define MAX_PACKET_LEN 284
+#define MAX_QUEUED_PACKETS 8
+#define MAX_FEATURES 8
+#define MAX_BATCHED_REPORTS 16
+#define MAX_REPORT_LEN 16
+
+// Channels
+#define CH_COMMAND      0
+#define CH_EXECUTABLE   1
+#define CH_CONTROL      2
+#define CH_INPUT        3
+
+// Report IDs
+#define ID_GET_FEAT_RESP    0xFC
+#define ID_SET_FEAT_CMD     0xFD
+#define ID_TIMEBASE         0xFB
+#define ID_REBASE           0xFA
+#define ID_PROD_ID_REQ      0xF9
+#define ID_PROD_ID_RESP     0xF8
+#define ID_CMD_RESP         0xF1
+#define ID_ACCEL            0x01
+#define ID_CAL_GYRO         0x02
+#define ID_UNCAL_GYRO       0x07
+
+typedef struct {
+    uint16_t len;   // including header
+    uint8_t data[MAX_PACKET_LEN];
+} packet_t;
+
+typedef struct {
+    uint8_t id;
+    uint32_t report_interval_us;
+    uint32_t batch_interval_us;
+    uint64_t next_report_us;
+    uint8_t seq;
+} feature_t;
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t len;
+    uint8_t data[MAX_REPORT_LEN];
+} report_t;
+
+int16_t sim_imu_accel[3] = { 0 };
+int16_t sim_imu_cal_gyro[3] = { 0 };
+int16_t sim_imu_uncal_gyro[3] = { 0 };
+int16_t sim_imu_gyro_bias[3] = { 0 };
+
+uint32_t sim_imu_packets = 0;
+uint32_t sim_imu_transactions = 0;
+uint32_t sim_imu_reports = 0;
+uint32_t sim_imu_rebases = 0;
+
+static bool attached = false;
+
+static packet_t queue[MAX_QUEUED_PACKETS];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+
+// Packet being clocked out in the current transaction
+static packet_t out;
+static uint16_t out_pos = 0;
+// Bytes clocked in during the current transaction
+static packet_t in;
+
+static uint8_t hub_seq_nums[6] = { 0 };
+static bool wake_asserted = false;
+static uint8_t int_level = 1;
+
+static feature_t features[MAX_FEATURES];
+static uint8_t feature_count = 0;
+
+// Reports waiting to be delivered (batching)
+static report_t batch[MAX_BATCHED_REPORTS];
+static uint8_t batch_count = 0;
+static uint64_t batch_start_us = 0;
+
+static void update_int(void);
+
+
+void sim_reset_imu(void) {
+    attached = false;
+    queue_head = 0;
+    queue_count = 0;
+    out_pos = 0;
+    out.len = 0;
+    in.len = 0;
+    memset(hub_seq_nums, 0, sizeof(hub_seq_nums));
+    wake_asserted = false;
+    int_level = 1;
+    feature_count = 0;
+    batch_count = 0;
+    sim_imu_packets = 0;
+    sim_imu_transactions = 0;
+    sim_imu_reports = 0;
+    sim_imu_rebases = 0;
+}
+
+static void queue_packet(uint8_t channel, const uint8_t* cargo, uint16_t cargo_len) {
+    if (cargo_len > MAX_PACKET_LEN - HDR_LEN) {
+        cargo_len = MAX_PACKET_LEN - HDR_LEN;
+    }
+    // Drop the oldest packet if the host is not keeping up
+    if (queue_count == MAX_QUEUED_PACKETS) {
+        queue_head = (queue_head + 1) % MAX_QUEUED_PACKETS;
+        queue_count--;
+    }
+
+    packet_t* packet = &queue[(queue_head + queue_count) % MAX_QUEUED_PACKETS];
+    uint16_t len = HDR_LEN + cargo_len;
+    packet->len = len;
+    packet->data[0] = len & 0xFF;
+    packet->data[1] = (len >> 8) & 0xFF;
+    packet->data[2] = channel;
+    packet->data[3] = hub_seq_nums[channel]++;
+    memcpy(&packet->data[HDR_LEN], cargo, cargo_len);
+    queue_count++;
+
+    update_int();
+}
+
+static void update_int(void) {
+    uint8_t level = (queue_count > 0 || wake_asserted) ? 0 : 1;
+    if (level == int_level) {
+        return;
+    }
+    int_level = level;
+    sim_drive_pin(&IMU_INT_PORT, IMU_INT_PIN, level);
+    sim_raise_int2();
+}
+
+static void queue_startup_packets(void) {
+    // Advertisement - longer than the driver's receive buffer
+    uint8_t advert[64];
+    for (uint8_t i = 0; i < sizeof(advert); i++) {
+        advert[i] = i;
+    }
+    queue_packet(CH_COMMAND, advert, sizeof(advert));
+
+    // Executable reset complete
+    uint8_t reset_complete[] = { 0x01 };
+    queue_packet(CH_EXECUTABLE, reset_complete, sizeof(reset_complete));
+
+    // Unsolicited SH-2 initialize response (#1 p.48)
+    uint8_t init_resp[16] = { ID_CMD_RESP, 0x00, 0x84, 0x00, 0x00, 0x00 };
+    queue_packet(CH_CONTROL, init_resp, sizeof(init_resp));
+}
+
+static feature_t* find_feature(uint8_t id) {
+    for (uint8_t i = 0; i < feature_count; i++) {
+        if (features[i].id == id) {
+            return &features[i];
+        }
+    }
+    if (feature_count < MAX_FEATURES) {
+        feature_t* feature = &features[feature_count++];
+        memset(feature, 0, sizeof(*feature));
+        feature->id = id;
+        return feature;
+    }
+    return NULL;
+}
+
+static uint32_t get_le32(const uint8_t* data) {
+    return ((uint32_t) data[0]) | ((uint32_t) data[1] << 8) |
+        ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static void put_le16(uint8_t* data, int16_t value) {
+    data[0] = ((uint16_t) value) & 0xFF;
+    data[1] = (((uint16_t) value) >> 8) & 0xFF;
+}
+
+static void put_le32(uint8_t* data, uint32_t value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = (value >> 24) & 0xFF;
+}
+
+static void handle_set_feature(const uint8_t* cargo, uint16_t len) {
+    if (len < 17) {
+        return;
+    }
+    feature_t* feature = find_feature(cargo[1]);
+    if (feature == NULL) {
+        return;
+    }
+    feature->report_interval_us = get_le32(&cargo[5]);
+    feature->batch_interval_us = get_le32(&cargo[9]);
+    feature->next_report_us = sim_time_us + feature->report_interval_us;
+    // Features at the same rate are sampled together, so their reports
+    // share a packet
+    for (uint8_t i = 0; i < feature_count; i++) {
+        feature_t* other = &features[i];
+        if (other != feature && other->report_interval_us != 0 &&
+                other->report_interval_us == feature->report_interval_us) {
+            feature->next_report_us = other->next_report_us;
+            break;
+        }
+    }
+
+    uint8_t resp[17];
+    memcpy(resp, cargo, sizeof(resp));
+    resp[0] = ID_GET_FEAT_RESP;
+    queue_packet(CH_CONTROL, resp, sizeof(resp));
+}
+
+static void handle_prod_id_req(void) {
+    uint8_t resp[16] = { ID_PROD_ID_RESP, 0x01, 0x03, 0x02 };
+    queue_packet(CH_CONTROL, resp, sizeof(resp));
+
+    uint8_t subsystems[48] = { 0 };
+    subsystems[0] = ID_PROD_ID_RESP;
+    subsystems[16] = ID_PROD_ID_RESP;
+    subsystems[32] = ID_PROD_ID_RESP;
+    queue_packet(CH_CONTROL, subsystems, sizeof(subsystems));
+}
+
+static void handle_host_packet(void) {
+    if (in.len < HDR_LEN) {
+        return;
+    }
+    uint16_t len = ((uint16_t) in.data[1] << 8) | in.data[0];
+    len &= 0x7FFF;
+    // A read clocks in a zero header
+    if (len <= HDR_LEN || len > in.len) {
+        return;
+    }
+
+    uint8_t channel = in.data[2];
+    const uint8_t* cargo = &in.data[HDR_LEN];
+    uint16_t cargo_len = len - HDR_LEN;
+    if (channel != CH_CONTROL) {
+        return;
+    }
+    if (cargo[0] == ID_SET_FEAT_CMD) {
+        handle_set_feature(cargo, cargo_len);
+    } else if (cargo[0] == ID_PROD_ID_REQ) {
+        handle_prod_id_req();
+    }
+}
+
+static void select_hub(uint8_t selected) {
+    if (selected) {
+        sim_imu_transactions++;
+        in.len = 0;
+        out_pos = 0;
+        out.len = 0;
+        if (queue_count > 0) {
+            out = queue[queue_head];
+            queue_head = (queue_head + 1) % MAX_QUEUED_PACKETS;
+            queue_count--;
+            sim_imu_packets++;
+        }
+        // The transaction services the wake request, and HINT is deasserted
+        // once the read begins (#2 p.6)
+        wake_asserted = false;
+        if (int_level == 0) {
+            int_level = 1;
+            sim_drive_pin(&IMU_INT_PORT, IMU_INT_PIN, 1);
+            sim_raise_int2();
+        }
+    } else {
+        handle_host_packet();
+        // Reasserted if there is another packet to send
+        update_int();
+    }
+}
+
+static uint8_t xfer_hub(uint8_t mosi) {
+    if (in.len < MAX_PACKET_LEN) {
+        in.data[in.len++] = mosi;
+    }
+    if (out_pos < out.len) {
+        return out.data[out_pos++];
+    }
+    return 0x00;
+}
+
+static uint8_t make_report(feature_t* feature, uint8_t* data) {
+    uint8_t len = 10;
+    const int16_t* values = sim_imu_accel;
+    if (feature->id == ID_CAL_GYRO) {
+        values = sim_imu_cal_gyro;
+    } else if (feature->id == ID_UNCAL_GYRO) {
+        values = sim_imu_uncal_gyro;
+        len = 16;
+    }
+
+    data[0] = feature->id;
+    data[1] = feature->seq++;
+    data[2] = 0x03;     // accuracy high, delay filled in later
+    data[3] = 0x00;
+    for (uint8_t i = 0; i < 3; i++) {
+        put_le16(&data[4 + 2 * i], values[i]);
+    }
+    if (feature->id == ID_UNCAL_GYRO) {
+        for (uint8_t i = 0; i < 3; i++) {
+            put_le16(&data[10 + 2 * i], sim_imu_gyro_bias[i]);
+        }
+    }
+    return len;
+}
+
+static void flush_batch(void) {
+    if (batch_count == 0) {
+        return;
+    }
+
+    uint8_t cargo[MAX_PACKET_LEN - HDR_LEN];
+    uint16_t len = 0;
+    uint64_t ref_us = batch[0].time_us;
+    uint64_t base_us = ref_us;
+
+    // Base delta - how long ago the oldest report was taken (#1 p.79)
+    cargo[len++] = ID_TIMEBASE;
+    put_le32(&cargo[len], (uint32_t) ((sim_time_us - ref_us) / 100));
+    len += 4;
+
+    for (uint8_t i = 0; i < batch_count; i++) {
+        report_t* report = &batch[i];
+        bool rebase = (report->time_us - base_us) / 100 > 0x3FFF;
+        if (len + (rebase ? 5 : 0) + report->len > sizeof(cargo)) {
+            break;
+        }
+        // The delay doesn't reach this report - move the base to it,
+        // relative to the timebase reference
+        if (rebase) {
+            base_us = report->time_us;
+            cargo[len++] = ID_REBASE;
+            put_le32(&cargo[len], (uint32_t) ((base_us - ref_us) / 100));
+            len += 4;
+            sim_imu_rebases++;
+        }
+        uint16_t delay = (uint16_t) ((report->time_us - base_us) / 100);
+        report->data[2] = (report->data[2] & 0x03) | ((delay >> 6) & 0xFC);
+        report->data[3] = delay & 0xFF;
+        memcpy(&cargo[len], report->data, report->len);
+        len += report->len;
+    }
+    batch_count = 0;
+
+    queue_packet(CH_INPUT, cargo, len);
+}
+
+static void tick(void) {
+    if (!attached) {
+        return;
+    }
+
+    uint32_t batch_interval_us = 0;
+    for (uint8_t i = 0; i < feature_count; i++) {
+        feature_t* feature = &features[i];
+        if (feature->report_interval_us == 0) {
+            continue;
+        }
+        if (feature->batch_interval_us > batch_interval_us) {
+            batch_interval_us = feature->batch_interval_us;
+        }
+
+        while (feature->next_report_us <= sim_time_us) {
+            // A full FIFO is sent instead of losing reports
+            if (batch_count >= MAX_BATCHED_REPORTS) {
+                flush_batch();
+            }
+            if (batch_count == 0) {
+                batch_start_us = feature->next_report_us;
+            }
+            report_t* report = &batch[batch_count++];
+            report->time_us = feature->next_report_us;
+            report->len = make_report(feature, report->data);
+            sim_imu_reports++;
+            feature->next_report_us += feature->report_interval_us;
+        }
+    }
+
+    if (batch_count > 0 && (batch_count >= MAX_BATCHED_REPORTS ||
+            sim_time_us - batch_start_us >= batch_interval_us)) {
+        flush_batch();
+    }
+}
+
+static void pin_written(volatile uint8_t* port, uint8_t pin, uint8_t val) {
+    if (port == &IMU_RST_PORT && pin == IMU_RST_PIN && val) {
+        // Leaving reset
+        queue_head = 0;
+        queue_count = 0;
+        feature_count = 0;
+        batch_count = 0;
+        memset(hub_seq_nums, 0, sizeof(hub_seq_nums));
+        queue_startup_packets();
+    } else if (port == &IMU_WAKE_PORT && pin == IMU_WAKE_PIN) {
+        if (!val) {
+            wake_asserted = true;
+            update_int();
+        }
+    }
+}
+
+static sim_spi_dev_t hub = {
+    .cs_port = &IMU_CS_PORT,
+    .cs_pin = IMU_CS_PIN,
+    .select = select_hub,
+    .xfer = xfer_hub
+};
+
+void sim_imu_attach(void) {
+    attached = true;
+    sim_drive_pin(&IMU_INT_PORT, IMU_INT_PIN, 1);
+    int_level = 1;
+    sim_spi_attach(&hub);
+    sim_set_pin_listener(pin_written);
+    sim_add_tick_hook(tick);
+}
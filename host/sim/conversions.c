@@ -0,0 +1,85 @@
+/*
+Simulated lib-common conversions library.
+*/
+
+#include <math.h>
+
+#include <conversions/conversions.h>
+
+#define ADC_MAX_RAW 0x0FFF
+#define KELVIN_OFFSET 273.15
+
+double adc_raw_to_ch_vol(uint16_t raw_data) {
+    return ((double) raw_data) / ((double) ADC_MAX_RAW) * ADC_VREF;
+}
+
+uint16_t adc_ch_vol_to_raw(double ch_vol) {
+    return (uint16_t) (ch_vol / ADC_VREF * (double) ADC_MAX_RAW);
+}
+
+double adc_raw_to_circ_vol(uint16_t raw_data, double low_res, double high_res) {
+    return adc_raw_to_ch_vol(raw_data) * (low_res + high_res) / low_res;
+}
+
+double adc_raw_to_circ_cur(uint16_t raw_data, double sense_res, double ref_vol) {
+    return (adc_raw_to_ch_vol(raw_data) - ref_vol) /
+        (ADC_CUR_SENSE_AMP_GAIN * sense_res);
+}
+
+uint16_t adc_circ_cur_to_raw(double circ_cur, double sense_res, double ref_vol) {
+    return adc_ch_vol_to_raw(circ_cur * ADC_CUR_SENSE_AMP_GAIN * sense_res + ref_vol);
+}
+
+double adc_raw_to_efuse_cur(uint16_t raw_data, double sense_res) {
+    return adc_raw_to_ch_vol(raw_data) / sense_res / ADC_EFUSE_IMON_CUR_GAIN;
+}
+
+double adc_raw_to_therm_temp(uint16_t raw_data) {
+    return therm_res_to_temp(therm_vol_to_res(adc_raw_to_ch_vol(raw_data)));
+}
+
+// Thermistor is the top of a divider from THERM_V_REF, bias resistor below
+double therm_vol_to_res(double vol) {
+    return THERM_BIAS_RES * (THERM_V_REF - vol) / vol;
+}
+
+double therm_res_to_vol(double res) {
+    return THERM_V_REF * THERM_BIAS_RES / (res + THERM_BIAS_RES);
+}
+
+double therm_res_to_temp(double res) {
+    double inv_temp = 1.0 / (THERM_T_REF + KELVIN_OFFSET) +
+        log(res / THERM_R_REF) / THERM_BETA;
+    return 1.0 / inv_temp - KELVIN_OFFSET;
+}
+
+double therm_temp_to_res(double temp) {
+    return THERM_R_REF * exp(THERM_BETA *
+        (1.0 / (temp + KELVIN_OFFSET) - 1.0 / (THERM_T_REF + KELVIN_OFFSET)));
+}
+
+double dac_raw_data_to_vol(uint16_t raw_data) {
+    return ((double) raw_data) / ((double) (1 << DAC_NUM_BITS)) *
+        DAC_VREF * DAC_VREF_GAIN;
+}
+
+uint16_t dac_vol_to_raw_data(double vol) {
+    return (uint16_t) (vol / (DAC_VREF * DAC_VREF_GAIN) *
+        ((double) (1 << DAC_NUM_BITS)));
+}
+
+double dac_raw_data_to_heater_setpoint(uint16_t raw_data) {
+    return therm_res_to_temp(therm_vol_to_res(dac_raw_data_to_vol(raw_data)));
+}
+
+uint16_t heater_setpoint_to_dac_raw_data(double temp) {
+    return dac_vol_to_raw_data(therm_res_to_vol(therm_temp_to_res(temp)));
+}
+
+double imu_raw_data_to_double(uint16_t raw_data, uint8_t q_point) {
+    return ((double) ((int16_t) raw_data)) / ((double) (1UL << q_point));
+}
+
+double imu_raw_data_to_gyro(uint16_t raw_data) {
+    return imu_raw_data_to_double(raw_data, IMU_GYRO_Q);
+}
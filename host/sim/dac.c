@@ -0,0 +1,154 @@
+/*
+Simulated lib-common DAC library.
+
+The DAC is also attached to the SPI bus, where it decodes 24-bit DAC7562
+frames (command in bits 21-19, address in bits 18-16, data in bits 15-4) into
+its input registers and outputs.
+
+The LDAC pin is modelled as tied low (synchronous mode), the worst case for
+simultaneous updates: writing an input register updates that output straight
+away, unless its bit in the LDAC register is set.
+*/
+
+#include <dac/dac.h>
+#include <sim/sim.h>
+
+#include "sim_internal.h"
+
+uint32_t sim_dac_writes = 0;
+uint32_t sim_dac_updates = 0;
+uint16_t sim_dac_outputs[2] = { 0 };
+
+// Input registers (copied to the outputs on an update)
+static uint16_t inputs[2] = { 0 };
+// Bit n set - output n ignores the LDAC pin (cleared by a reset)
+static uint8_t ldac_reg = 0;
+// Bytes of the frame being clocked in
+static uint8_t frame[3];
+static uint8_t frame_len = 0;
+
+#define CMD_WRITE_INPUT             0x00
+#define CMD_UPDATE                  0x01
+#define CMD_WRITE_INPUT_UPDATE_ALL  0x02
+#define CMD_WRITE_INPUT_UPDATE      0x03
+#define CMD_SET_LDAC                0x06
+#define ADDR_ALL                    0x07
+
+static void select_dac(uint8_t selected);
+static uint8_t xfer_dac(uint8_t mosi);
+
+static sim_spi_dev_t spi_dev = {
+    .cs_port = NULL,
+    .cs_pin = 0,
+    .select = select_dac,
+    .xfer = xfer_dac
+};
+static bool attached = false;
+
+
+void sim_reset_dac(void) {
+    sim_dac_writes = 0;
+    sim_dac_updates = 0;
+    sim_dac_outputs[0] = 0;
+    sim_dac_outputs[1] = 0;
+    inputs[0] = 0;
+    inputs[1] = 0;
+    ldac_reg = 0;
+    frame_len = 0;
+    attached = false;
+}
+
+// Copies the input registers of the addressed channels (0, 1 or ADDR_ALL) to
+// the outputs
+static void update_outputs(uint8_t addr) {
+    for (uint8_t i = 0; i < 2; i++) {
+        if (addr == i || addr == ADDR_ALL) {
+            sim_dac_outputs[i] = inputs[i];
+        }
+    }
+    sim_dac_updates++;
+}
+
+static void handle_frame(void) {
+    uint8_t cmd = (frame[0] >> 3) & 0x07;
+    uint8_t addr = frame[0] & 0x07;
+    uint16_t data = (((uint16_t) frame[1] << 8) | frame[2]) >> 4;
+
+    if (cmd == CMD_SET_LDAC) {
+        ldac_reg = frame[2] & 0x03;
+        return;
+    }
+    if (cmd != CMD_UPDATE) {
+        for (uint8_t i = 0; i < 2; i++) {
+            if (addr == i || addr == ADDR_ALL) {
+                inputs[i] = data;
+            }
+        }
+        sim_dac_writes++;
+    }
+    if (cmd == CMD_UPDATE || cmd == CMD_WRITE_INPUT_UPDATE) {
+        update_outputs(addr);
+    } else if (cmd == CMD_WRITE_INPUT_UPDATE_ALL) {
+        update_outputs(ADDR_ALL);
+    } else if (cmd == CMD_WRITE_INPUT && addr < 2 && !(ldac_reg & _BV(addr))) {
+        // LDAC is low, so the output follows its input register
+        update_outputs(addr);
+    }
+}
+
+// A frame is latched when SYNC (CS) goes high
+static void select_dac(uint8_t selected) {
+    if (!selected && frame_len == sizeof(frame)) {
+        handle_frame();
+    }
+    frame_len = 0;
+}
+
+static uint8_t xfer_dac(uint8_t mosi) {
+    if (frame_len < sizeof(frame)) {
+        frame[frame_len++] = mosi;
+    }
+    return 0x00;
+}
+
+void init_dac(dac_t* dac) {
+    init_cs(dac->cs->pin, dac->cs->ddr);
+    set_cs_high(dac->cs->pin, dac->cs->port);
+    init_output_pin(dac->clr->pin, dac->clr->ddr, 1);
+    if (!attached) {
+        spi_dev.cs_port = dac->cs->port;
+        spi_dev.cs_pin = dac->cs->pin;
+        sim_spi_attach(&spi_dev);
+        attached = true;
+    }
+    reset_dac(dac);
+}
+
+void reset_dac(dac_t* dac) {
+    dac->raw_voltage_a = 0;
+    dac->raw_voltage_b = 0;
+    inputs[0] = 0;
+    inputs[1] = 0;
+    ldac_reg = 0;
+    sim_dac_outputs[0] = 0;
+    sim_dac_outputs[1] = 0;
+}
+
+void set_dac_raw_voltage(dac_t* dac, dac_chan_t channel, uint16_t raw_data) {
+    raw_data &= 0x0FFF;
+    if (channel == DAC_A) {
+        dac->raw_voltage_a = raw_data;
+    } else {
+        dac->raw_voltage_b = raw_data;
+    }
+    // Write input register n and update output n
+    inputs[channel] = raw_data;
+    sim_dac_writes++;
+    update_outputs(channel);
+    // One 24-bit frame per write
+    sim_spi_charge(sizeof(frame));
+}
+
+void set_dac_voltage(dac_t* dac, dac_chan_t channel, double voltage) {
+    set_dac_raw_voltage(dac, channel, dac_vol_to_raw_data(voltage));
+}
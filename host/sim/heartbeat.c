@@ -0,0 +1,12 @@
+/*
+Simulated lib-common heartbeat library (no other subsystems to talk to).
+*/
+
+#include <heartbeat/heartbeat.h>
+
+void init_hb(uint8_t self_id) {
+    (void) self_id;
+}
+
+void run_hb(void) {
+}
@@ -0,0 +1,65 @@
+/*
+Simulated lib-common port expander library.
+*/
+
+#include <pex/pex.h>
+#include <sim/sim.h>
+
+#include "sim_internal.h"
+
+// Opcode, register address, data
+#define PEX_FRAME_BYTES 3
+
+uint8_t sim_pex_dirs[2] = { 0xFF, 0xFF };
+uint8_t sim_pex_outputs[2] = { 0 };
+uint32_t sim_pex_writes = 0;
+
+
+void sim_reset_pex(void) {
+    sim_pex_dirs[PEX_A] = sim_pex_dirs[PEX_B] = 0xFF;
+    sim_pex_outputs[PEX_A] = sim_pex_outputs[PEX_B] = 0;
+    sim_pex_writes = 0;
+}
+
+void init_pex(pex_t* pex) {
+    init_cs(pex->cs->pin, pex->cs->ddr);
+    set_cs_high(pex->cs->pin, pex->cs->port);
+    init_output_pin(pex->rst->pin, pex->rst->ddr, 1);
+    reset_pex(pex);
+}
+
+void reset_pex(pex_t* pex) {
+    (void) pex;
+    // All pins are inputs after reset
+    sim_pex_dirs[PEX_A] = sim_pex_dirs[PEX_B] = 0xFF;
+    sim_pex_outputs[PEX_A] = sim_pex_outputs[PEX_B] = 0;
+}
+
+void set_pex_pin_dir(pex_t* pex, pex_port_t port, uint8_t pin, pex_dir_t dir) {
+    (void) pex;
+    if (dir == INPUT) {
+        sim_pex_dirs[port] |= _BV(pin);
+    } else {
+        sim_pex_dirs[port] &= (uint8_t) ~_BV(pin);
+    }
+    // Read-modify-write
+    sim_spi_charge(2 * PEX_FRAME_BYTES);
+}
+
+void set_pex_pin(pex_t* pex, pex_port_t port, uint8_t pin, uint8_t state) {
+    (void) pex;
+    if (state) {
+        sim_pex_outputs[port] |= _BV(pin);
+    } else {
+        sim_pex_outputs[port] &= (uint8_t) ~_BV(pin);
+    }
+    sim_pex_writes++;
+    // Read-modify-write
+    sim_spi_charge(2 * PEX_FRAME_BYTES);
+}
+
+uint8_t get_pex_pin(pex_t* pex, pex_port_t port, uint8_t pin) {
+    (void) pex;
+    sim_spi_charge(PEX_FRAME_BYTES);
+    return (sim_pex_outputs[port] >> pin) & 0x01;
+}
@@ -0,0 +1,47 @@
+/*
+Simulated lib-common queue library.
+*/
+
+#include <string.h>
+
+#include <queue/queue.h>
+
+void init_queue(queue_t* queue) {
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+uint8_t queue_empty(queue_t* queue) {
+    return queue->head == queue->tail;
+}
+
+uint8_t queue_full(queue_t* queue) {
+    return ((queue->tail + 1) % MAX_QUEUE_SIZE) == queue->head;
+}
+
+uint8_t queue_size(queue_t* queue) {
+    return (queue->tail + MAX_QUEUE_SIZE - queue->head) % MAX_QUEUE_SIZE;
+}
+
+void enqueue(queue_t* queue, uint8_t* data) {
+    if (queue_full(queue)) {
+        return;
+    }
+    memcpy(queue->content[queue->tail], data, QUEUE_DATA_SIZE);
+    queue->tail = (queue->tail + 1) % MAX_QUEUE_SIZE;
+}
+
+void dequeue(queue_t* queue, uint8_t* data) {
+    if (queue_empty(queue)) {
+        return;
+    }
+    memcpy(data, queue->content[queue->head], QUEUE_DATA_SIZE);
+    queue->head = (queue->head + 1) % MAX_QUEUE_SIZE;
+}
+
+void peek_queue(queue_t* queue, uint8_t* data) {
+    if (queue_empty(queue)) {
+        return;
+    }
+    memcpy(data, queue->content[queue->head], QUEUE_DATA_SIZE);
+}
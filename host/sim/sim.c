@@ -0,0 +1,279 @@
+/*
+Simulated clock, I/O registers and interrupt dispatch for the host build.
+*/
+
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include <sim/sim.h>
+#include <uptime/uptime.h>
+
+#include "sim_internal.h"
+
+// Registers
+volatile uint8_t PINB, DDRB, PORTB;
+volatile uint8_t PINC, DDRC, PORTC;
+volatile uint8_t PIND, DDRD, PORTD;
+volatile uint8_t PINE, DDRE, PORTE;
+volatile uint8_t SREG;
+volatile uint8_t MCUSR, MCUCR, SMCR;
+volatile uint8_t EICRA, EIMSK, EIFR;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t EECR, EEDR;
+volatile uint16_t EEAR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B;
+
+uint64_t sim_time_us = 0;
+
+uint32_t sim_sleep_count = 0;
+uint64_t sim_sleep_us = 0;
+uint32_t sim_sleep_stuck = 0;
+bool sim_woken = false;
+
+uint64_t sim_wdt_max_gap_us = 0;
+uint32_t sim_resets = 0;
+uint32_t sim_last_reset_reason = 0;
+
+static sim_tick_fn_t tick_hooks[SIM_NUM_TICK_HOOKS];
+static uint8_t tick_hook_count = 0;
+static bool in_tick_hooks = false;
+
+// Resolution of the wake-up time from sleep
+#define SIM_SLEEP_STEP_US 100
+// Watchdog timeout (WDTO_8S)
+#define SIM_SLEEP_MAX_US 8000000
+
+static bool wdt_enabled = false;
+static uint64_t wdt_last_kick_us = 0;
+
+// Defined by the firmware if it uses the interrupt
+void INT2_vect(void) __attribute__((weak));
+void TIMER1_COMPB_vect(void) __attribute__((weak));
+
+
+void sim_reset(void) {
+    PINB = DDRB = PORTB = 0;
+    PINC = DDRC = PORTC = 0;
+    PIND = DDRD = PORTD = 0;
+    PINE = DDRE = PORTE = 0;
+    SREG = MCUSR = MCUCR = SMCR = 0;
+    EICRA = EIMSK = EIFR = 0;
+    SPCR = SPSR = SPDR = 0;
+    EECR = EEDR = 0;
+    EEAR = 0;
+    TCCR0A = TCCR0B = TCNT0 = OCR0A = OCR0B = TIMSK0 = TIFR0 = 0;
+    TCCR1A = TCCR1B = TIMSK1 = TIFR1 = 0;
+    TCNT1 = OCR1A = OCR1B = 0;
+
+    sim_time_us = 0;
+    sim_sleep_count = 0;
+    sim_sleep_us = 0;
+    sim_sleep_stuck = 0;
+    sim_woken = false;
+    tick_hook_count = 0;
+    wdt_enabled = false;
+    sim_wdt_max_gap_us = 0;
+    sim_resets = 0;
+    sim_last_reset_reason = 0;
+
+    sim_reset_devices();
+}
+
+void sim_reset_devices(void) {
+    sim_reset_adc();
+    sim_reset_can();
+    sim_reset_dac();
+    sim_reset_eeprom();
+    sim_reset_imu();
+    sim_reset_pex();
+    sim_reset_pins();
+    sim_reset_spi();
+    sim_reset_uart();
+    sim_reset_uptime();
+}
+
+void sim_add_tick_hook(sim_tick_fn_t hook) {
+    if (tick_hook_count < SIM_NUM_TICK_HOOKS) {
+        tick_hooks[tick_hook_count++] = hook;
+    }
+}
+
+// Peripherals with interrupts modelled from their registers
+static void update_peripherals(void) {
+    sim_eeprom_update();
+    sim_spi_update();
+}
+
+// Time of the next Timer 1 compare match B, if its interrupt is enabled
+static uint64_t timer1_compb_us(void) {
+    if (!(TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) ||
+            !(TIMSK1 & _BV(OCIE1B))) {
+        return UINT64_MAX;
+    }
+    // First time in the second that TCNT1 reaches OCR1B
+    uint64_t second_us = sim_time_us - sim_time_us % 1000000;
+    uint64_t top = (uint64_t) OCR1A + 1;
+    uint64_t match_us = second_us + (OCR1B * 1000000ULL + top - 1) / top;
+    if (match_us <= sim_time_us) {
+        match_us += 1000000;
+    }
+    return match_us;
+}
+
+static uint64_t next_peripheral_event_us(void) {
+    uint64_t eeprom_us = sim_eeprom_ready_us();
+    uint64_t spi_us = sim_spi_ready_us();
+    uint64_t compb_us = timer1_compb_us();
+    uint64_t event_us = (eeprom_us < spi_us) ? eeprom_us : spi_us;
+    return (compb_us < event_us) ? compb_us : event_us;
+}
+
+void sim_advance_us(uint64_t us) {
+    // Stop when a peripheral is done or at a compare match, so its interrupt
+    // runs on time
+    update_peripherals();
+    uint64_t event_us = next_peripheral_event_us();
+    if (event_us > sim_time_us && event_us < sim_time_us + us) {
+        uint64_t first_us = event_us - sim_time_us;
+        sim_advance_us(first_us);
+        sim_advance_us(us - first_us);
+        return;
+    }
+
+    uint64_t prev_s = sim_time_us / 1000000;
+    uint16_t prev_tcnt1 = TCNT1;
+    sim_time_us += us;
+
+    for (uint64_t s = prev_s; s < sim_time_us / 1000000; s++) {
+        sim_uptime_tick();
+    }
+    // Timer 1 (see uptime.c)
+    if (TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) {
+        TCNT1 = (uint16_t) ((sim_time_us % 1000000) * ((uint64_t) OCR1A + 1) /
+            1000000);
+        // Compare match B if the counter passed OCR1B (steps are split at
+        // each match)
+        bool wrapped = sim_time_us / 1000000 != prev_s;
+        bool match = wrapped ?
+            (OCR1B > prev_tcnt1 || OCR1B <= TCNT1) :
+            (OCR1B > prev_tcnt1 && OCR1B <= TCNT1);
+        if (match || us >= 1000000) {
+            sim_timer1_compb();
+        }
+    }
+
+    update_peripherals();
+
+    // Device models may take time themselves, don't recurse into them
+    if (!in_tick_hooks) {
+        in_tick_hooks = true;
+        for (uint8_t i = 0; i < tick_hook_count; i++) {
+            tick_hooks[i]();
+        }
+        in_tick_hooks = false;
+    }
+
+    // Deliver an edge or compare match that arrived while interrupts were
+    // disabled
+    if ((EIFR & _BV(INTF2)) && (SREG & _BV(SREG_I))) {
+        sim_raise_int2();
+    }
+    if ((TIFR1 & _BV(OCF1B)) && (SREG & _BV(SREG_I))) {
+        sim_timer1_compb();
+    }
+}
+
+void sim_raise_int2(void) {
+    if ((EIMSK & _BV(INT2)) && (SREG & _BV(SREG_I)) && INT2_vect != NULL) {
+        EIFR &= (uint8_t) ~_BV(INTF2);
+        // Hardware clears the global interrupt flag while an ISR runs
+        sim_woken = true;
+        cli();
+        INT2_vect();
+        sei();
+    } else {
+        EIFR |= _BV(INTF2);
+    }
+}
+
+void sim_timer1_compb(void) {
+    if (!(TIMSK1 & _BV(OCIE1B)) || TIMER1_COMPB_vect == NULL) {
+        return;
+    }
+    if (SREG & _BV(SREG_I)) {
+        TIFR1 &= (uint8_t) ~_BV(OCF1B);
+        sim_woken = true;
+        cli();
+        TIMER1_COMPB_vect();
+        sei();
+    } else {
+        TIFR1 |= _BV(OCF1B);
+    }
+}
+
+void sim_sleep_cpu(void) {
+    if (!(SMCR & _BV(SE))) {
+        return;
+    }
+    // Nothing could wake the MCU
+    if (!(SREG & _BV(SREG_I))) {
+        sim_sleep_stuck++;
+        return;
+    }
+
+    sim_sleep_count++;
+    sim_woken = false;
+    uint64_t start_us = sim_time_us;
+    while (!sim_woken) {
+        if (sim_time_us - start_us >= SIM_SLEEP_MAX_US) {
+            sim_sleep_stuck++;
+            break;
+        }
+        // Don't step over the uptime timer or a peripheral interrupt
+        uint64_t step = 1000000 - sim_time_us % 1000000;
+        if (step > SIM_SLEEP_STEP_US) {
+            step = SIM_SLEEP_STEP_US;
+        }
+        uint64_t event_us = next_peripheral_event_us();
+        if (event_us > sim_time_us && event_us - sim_time_us < step) {
+            step = event_us - sim_time_us;
+        }
+        sim_advance_us(step);
+    }
+    sim_sleep_us += sim_time_us - start_us;
+}
+
+
+void _delay_ms(double ms) {
+    sim_advance_us((uint64_t) (ms * 1000.0));
+}
+
+void _delay_us(double us) {
+    sim_advance_us((uint64_t) us);
+}
+
+
+void wdt_reset(void) {
+    if (wdt_enabled) {
+        uint64_t gap = sim_time_us - wdt_last_kick_us;
+        if (gap > sim_wdt_max_gap_us) {
+            sim_wdt_max_gap_us = gap;
+        }
+    }
+    wdt_last_kick_us = sim_time_us;
+}
+
+void wdt_enable(uint8_t timeout) {
+    (void) timeout;
+    wdt_reset();
+    wdt_enabled = true;
+}
+
+void wdt_disable(void) {
+    wdt_enabled = false;
+}
@@ -0,0 +1,40 @@
+/*
+Hooks shared between the simulated drivers (not for firmware or tests).
+*/
+
+#ifndef SIM_INTERNAL_H
+#define SIM_INTERNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Set whenever an interrupt handler is dispatched (wakes sim_sleep_cpu())
+extern bool sim_woken;
+
+void sim_uptime_tick(void);
+// Models the EEPROM registers and dispatches EE_READY_vect (see utilities.c)
+void sim_eeprom_update(void);
+// Time the byte being programmed is done, UINT64_MAX if none is
+uint64_t sim_eeprom_ready_us(void);
+// Models the interrupt-driven SPI transfers and dispatches SPI_STC_vect (see
+// spi.c)
+void sim_spi_update(void);
+// Time the byte being exchanged is done, UINT64_MAX if none is
+uint64_t sim_spi_ready_us(void);
+
+void sim_reset_devices(void);
+void sim_reset_adc(void);
+void sim_reset_can(void);
+void sim_reset_dac(void);
+void sim_reset_eeprom(void);
+void sim_reset_imu(void);
+void sim_reset_pex(void);
+void sim_reset_pins(void);
+void sim_reset_spi(void);
+void sim_reset_uart(void);
+void sim_reset_uptime(void);
+
+// Notifies the pin listener about an output pin write
+void sim_pin_written(volatile uint8_t* port, uint8_t pin, uint8_t val);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+Simulated lib-common SPI library.
+
+The interrupt-driven path is modelled from the registers: while SPCR.SPIE is
+set, the byte in SPDR is exchanged with the selected device, and when it has
+been clocked out SPDR holds the received byte and SPI_STC_vect is dispatched.
+Each interrupt is charged SIM_SPI_ISR_CYCLES of CPU time before the next byte
+starts (the ISR writes SPDR at its end).
+*/
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <spi/spi.h>
+#include <sim/sim.h>
+
+#include "sim_internal.h"
+
+uint32_t sim_spi_bytes = 0;
+uint32_t sim_spi_cfg_writes = 0;
+uint64_t sim_spi_isr_cycles = 0;
+
+static sim_spi_dev_t* devs[SIM_SPI_MAX_DEVS];
+static uint8_t dev_count = 0;
+// Device with CS currently asserted
+static sim_spi_dev_t* selected = NULL;
+
+static spi_clk_freq_t clk_freq = SPI_DEF_CLK_FREQ;
+
+// SCK = F_CPU / divider, indexed by spi_clk_freq_t
+static const uint8_t clk_dividers[] = { 4, 16, 64, 128, 2, 8, 32 };
+
+// Interrupt-driven byte being exchanged, when it is done and the MISO byte
+static bool xfer_active = false;
+static uint64_t xfer_done_us = 0;
+static uint8_t xfer_miso = 0;
+
+// Defined by the firmware if it uses the interrupt
+void SPI_STC_vect(void) __attribute__((weak));
+
+
+void sim_reset_spi(void) {
+    sim_spi_bytes = 0;
+    sim_spi_cfg_writes = 0;
+    dev_count = 0;
+    selected = NULL;
+    clk_freq = SPI_DEF_CLK_FREQ;
+    sim_spi_isr_cycles = 0;
+    xfer_active = false;
+    xfer_done_us = 0;
+}
+
+// Starts exchanging SPDR if the interrupt is enabled, after `delay_cycles`
+static void start_xfer(uint32_t delay_cycles) {
+    if (xfer_active || !(SPCR & _BV(SPIE))) {
+        return;
+    }
+    xfer_miso = (selected != NULL) ? selected->xfer(SPDR) : 0x00;
+    sim_spi_bytes++;
+    uint64_t cycles = (uint64_t) delay_cycles + 8 * clk_dividers[clk_freq];
+    xfer_done_us = sim_time_us + cycles * 1000000 / F_CPU;
+    xfer_active = true;
+}
+
+uint64_t sim_spi_ready_us(void) {
+    return xfer_active ? xfer_done_us : UINT64_MAX;
+}
+
+void sim_spi_update(void) {
+    start_xfer(0);
+    if (!xfer_active || sim_time_us < xfer_done_us) {
+        return;
+    }
+
+    xfer_active = false;
+    SPDR = xfer_miso;
+    if ((SREG & _BV(SREG_I)) && SPI_STC_vect != NULL) {
+        sim_woken = true;
+        sim_spi_isr_cycles += SIM_SPI_ISR_CYCLES;
+        cli();
+        SPI_STC_vect();
+        sei();
+        start_xfer(SIM_SPI_ISR_CYCLES);
+    }
+}
+
+void sim_spi_attach(sim_spi_dev_t* dev) {
+    if (dev_count < SIM_SPI_MAX_DEVS) {
+        devs[dev_count++] = dev;
+    }
+}
+
+void sim_spi_charge(uint32_t count) {
+    sim_spi_bytes += count;
+    // 8 clocks per byte
+    uint64_t cycles = (uint64_t) count * 8 * clk_dividers[clk_freq];
+    sim_advance_us(cycles * 1000000 / F_CPU);
+}
+
+void init_spi(void) {
+    SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPR1);
+    sim_spi_cfg_writes++;
+    clk_freq = SPI_DEF_CLK_FREQ;
+}
+
+uint8_t send_spi(uint8_t data) {
+    uint8_t miso = 0x00;
+    if (selected != NULL) {
+        miso = selected->xfer(data);
+    }
+    SPDR = miso;
+    sim_spi_charge(1);
+    return miso;
+}
+
+void init_cs(uint8_t pin, volatile uint8_t* ddr) {
+    init_output_pin(pin, ddr, 1);
+}
+
+void set_cs_low(uint8_t pin, volatile uint8_t* port) {
+    set_pin_low(pin, port);
+    for (uint8_t i = 0; i < dev_count; i++) {
+        if (devs[i]->cs_port == port && devs[i]->cs_pin == pin) {
+            selected = devs[i];
+            selected->select(1);
+        }
+    }
+}
+
+void set_cs_high(uint8_t pin, volatile uint8_t* port) {
+    set_pin_high(pin, port);
+    if (selected != NULL &&
+            selected->cs_port == port && selected->cs_pin == pin) {
+        sim_spi_dev_t* dev = selected;
+        selected = NULL;
+        dev->select(0);
+    }
+}
+
+void set_spi_cpol_cpha(uint8_t cpol, uint8_t cpha) {
+    SPCR = (SPCR & (uint8_t) ~(_BV(CPOL) | _BV(CPHA))) |
+        (cpol ? _BV(CPOL) : 0) | (cpha ? _BV(CPHA) : 0);
+    sim_spi_cfg_writes++;
+}
+
+void reset_spi_cpol_cpha(void) {
+    set_spi_cpol_cpha(0, 0);
+}
+
+void set_spi_clk_freq(spi_clk_freq_t freq) {
+    clk_freq = freq;
+    sim_spi_cfg_writes++;
+}
+
+void reset_spi_clk_freq(void) {
+    set_spi_clk_freq(SPI_DEF_CLK_FREQ);
+}
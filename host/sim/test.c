@@ -0,0 +1,27 @@
+/*
+Simulated lib-common test library.
+*/
+
+#include <stdio.h>
+
+#include <test/test.h>
+
+static uint16_t failures = 0;
+
+void test_assert(int cond, const char* expr, const char* file, int line) {
+    if (!cond) {
+        printf("    FAIL %s:%d: %s\n", file, line, expr);
+        failures++;
+    }
+}
+
+uint16_t run_tests(test_t** suite, uint8_t len) {
+    uint16_t total_failures = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        failures = 0;
+        suite[i]->fn();
+        printf("%s %s\n", failures == 0 ? "PASS" : "FAIL", suite[i]->name);
+        total_failures += failures;
+    }
+    return total_failures;
+}
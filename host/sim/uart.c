@@ -0,0 +1,79 @@
+/*
+Simulated lib-common UART library.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <sim/sim.h>
+#include <uart/uart.h>
+
+#include "sim_internal.h"
+
+#define PRINT_BUF_SIZE 80
+
+bool sim_uart_echo = false;
+uint32_t sim_uart_bytes = 0;
+
+static uart_baud_rate_t baud_rate = UART_DEF_BAUD_RATE;
+static uart_rx_cb_t rx_cb = NULL;
+
+// Indexed by uart_baud_rate_t
+static const uint32_t baud_rates[] = { 1200, 9600, 19200, 115200 };
+
+
+void sim_reset_uart(void) {
+    sim_uart_bytes = 0;
+    baud_rate = UART_DEF_BAUD_RATE;
+    rx_cb = NULL;
+}
+
+void init_uart(void) {
+    baud_rate = UART_DEF_BAUD_RATE;
+}
+
+void set_uart_baud_rate(uart_baud_rate_t rate) {
+    baud_rate = rate;
+}
+
+void send_uart(const uint8_t* msg, uint8_t len) {
+    if (sim_uart_echo) {
+        fwrite(msg, 1, len, stdout);
+    }
+    sim_uart_bytes += len;
+    // Transmission is blocking, 10 bits per character (8N1)
+    sim_advance_us((uint64_t) len * 10 * 1000000 / baud_rates[baud_rate]);
+}
+
+void put_uart_char(uint8_t c) {
+    send_uart(&c, 1);
+}
+
+int print(char* fmt, ...) {
+    // Same truncation as the firmware's fixed-size buffer
+    char buf[PRINT_BUF_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int ret = vsnprintf(buf, PRINT_BUF_SIZE, fmt, args);
+    va_end(args);
+
+    if (ret < 0) {
+        return ret;
+    }
+    if (ret >= PRINT_BUF_SIZE) {
+        ret = PRINT_BUF_SIZE - 1;
+    }
+    send_uart((uint8_t*) buf, (uint8_t) ret);
+    return ret;
+}
+
+void print_bytes(uint8_t* data, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        print("%.2x ", data[i]);
+    }
+    print("\n");
+}
+
+void set_uart_rx_cb(uart_rx_cb_t cb) {
+    rx_cb = cb;
+}
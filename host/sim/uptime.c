@@ -0,0 +1,75 @@
+/*
+Simulated lib-common uptime library. Like the real one, it runs Timer 1 in
+CTC mode with the 1024 prescaler, so TCNT1 counts up to OCR1A once per
+second (see sim_advance_us()).
+*/
+
+#include <avr/io.h>
+#include <sim/sim.h>
+#include <uptime/uptime.h>
+
+#include "sim_internal.h"
+
+volatile uint32_t uptime_s = 0;
+uint32_t restart_count = 0;
+uint32_t restart_reason = 0;
+
+uint32_t com_timeout_period_s = 600;
+static uint32_t com_timeout_last_s = 0;
+
+static uptime_fn_t callbacks[UPTIME_NUM_CALLBACKS];
+static uint8_t callback_count = 0;
+static bool initialized = false;
+
+
+void sim_reset_uptime(void) {
+    uptime_s = 0;
+    restart_count = 0;
+    restart_reason = 0;
+    com_timeout_period_s = 600;
+    com_timeout_last_s = 0;
+    callback_count = 0;
+    initialized = false;
+}
+
+void sim_uptime_tick(void) {
+    if (!initialized) {
+        return;
+    }
+    // Timer 1 compare match interrupt
+    sim_woken = true;
+    uptime_s++;
+    for (uint8_t i = 0; i < callback_count; i++) {
+        callbacks[i]();
+    }
+}
+
+void init_uptime(void) {
+    initialized = true;
+    // 8 MHz / 1024 = 7812.5 ticks per second
+    OCR1A = 7812;
+    TCCR1B = _BV(WGM12) | _BV(CS12) | _BV(CS10);
+    restart_count++;
+    restart_reason = UPTIME_RESTART_REASON_EXTRF;
+}
+
+uint8_t add_uptime_callback(uptime_fn_t callback) {
+    if (callback_count >= UPTIME_NUM_CALLBACKS) {
+        return 0;
+    }
+    callbacks[callback_count++] = callback;
+    return 1;
+}
+
+void init_com_timeout(void) {
+    com_timeout_last_s = uptime_s;
+}
+
+void restart_com_timeout(void) {
+    com_timeout_last_s = uptime_s;
+}
+
+void reset_self_mcu(uint32_t reason) {
+    sim_resets++;
+    sim_last_reset_reason = reason;
+}
@@ -0,0 +1,230 @@
+/*
+Simulated lib-common utilities: GPIO helpers and EEPROM access.
+
+The EEPROM registers are modelled too: setting EEPE (after EEMPE) programs
+EEDR at EEAR, which takes SIM_EEPROM_WRITE_US, and EE_READY_vect is
+dispatched while EERIE is set and no byte is being programmed (see
+sim_eeprom_update()). The avr-libc functions wait for a byte in progress.
+*/
+
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <sim/sim.h>
+#include <utilities/utilities.h>
+
+#include "sim_internal.h"
+
+uint8_t sim_eeprom[E2END + 1];
+uint32_t sim_eeprom_writes = 0;
+
+static sim_pin_fn_t pin_listener = NULL;
+
+// Byte being programmed through the registers and when it is done
+static bool eeprom_programming = false;
+static uint64_t eeprom_ready_us = 0;
+
+// Defined by the firmware if it uses the interrupt
+void EE_READY_vect(void) __attribute__((weak));
+
+// Time to program one EEPROM byte (ATmega64M1 datasheet, 3.3 ms)
+#define SIM_EEPROM_WRITE_US 3300
+
+
+void sim_reset_pins(void) {
+    pin_listener = NULL;
+}
+
+void sim_reset_eeprom(void) {
+    // Erased EEPROM reads as 0xFF
+    memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+    sim_eeprom_writes = 0;
+    eeprom_programming = false;
+    eeprom_ready_us = 0;
+}
+
+// Starts programming a byte if the firmware has set EEPE
+static void start_eeprom_programming(void) {
+    if (eeprom_programming || !(EECR & _BV(EEPE))) {
+        return;
+    }
+    sim_eeprom[EEAR & E2END] = EEDR;
+    sim_eeprom_writes++;
+    EECR &= (uint8_t) ~_BV(EEMPE);
+    eeprom_programming = true;
+    eeprom_ready_us = sim_time_us + SIM_EEPROM_WRITE_US;
+}
+
+uint64_t sim_eeprom_ready_us(void) {
+    return eeprom_programming ? eeprom_ready_us : UINT64_MAX;
+}
+
+void sim_eeprom_update(void) {
+    start_eeprom_programming();
+    if (eeprom_programming && sim_time_us >= eeprom_ready_us) {
+        eeprom_programming = false;
+        EECR &= (uint8_t) ~_BV(EEPE);
+    }
+
+    if (!eeprom_programming && (EECR & _BV(EERIE)) && (SREG & _BV(SREG_I)) &&
+            EE_READY_vect != NULL) {
+        sim_woken = true;
+        cli();
+        EE_READY_vect();
+        sei();
+        start_eeprom_programming();
+    }
+}
+
+void eeprom_busy_wait(void) {
+    while (eeprom_programming) {
+        sim_advance_us(eeprom_ready_us - sim_time_us);
+    }
+}
+
+void sim_set_pin_listener(sim_pin_fn_t listener) {
+    pin_listener = listener;
+}
+
+void sim_pin_written(volatile uint8_t* port, uint8_t pin, uint8_t val) {
+    if (pin_listener != NULL) {
+        pin_listener(port, pin, val);
+    }
+}
+
+// PINx register for a PORTx register
+static volatile uint8_t* pin_reg(volatile uint8_t* port) {
+    if (port == &PORTB) {
+        return &PINB;
+    } else if (port == &PORTC) {
+        return &PINC;
+    } else if (port == &PORTD) {
+        return &PIND;
+    } else {
+        return &PINE;
+    }
+}
+
+// PORTx register for a DDRx register
+static volatile uint8_t* port_reg(volatile uint8_t* ddr) {
+    if (ddr == &DDRB) {
+        return &PORTB;
+    } else if (ddr == &DDRC) {
+        return &PORTC;
+    } else if (ddr == &DDRD) {
+        return &PORTD;
+    } else {
+        return &PORTE;
+    }
+}
+
+void sim_drive_pin(volatile uint8_t* port, uint8_t pin, uint8_t val) {
+    volatile uint8_t* reg = pin_reg(port);
+    if (val) {
+        *reg |= _BV(pin);
+    } else {
+        *reg &= (uint8_t) ~_BV(pin);
+    }
+}
+
+static void write_pin(volatile uint8_t* port, uint8_t pin, uint8_t val) {
+    if (val) {
+        *port |= _BV(pin);
+    } else {
+        *port &= (uint8_t) ~_BV(pin);
+    }
+    // An output pin reads back its driven level
+    sim_drive_pin(port, pin, val);
+    sim_pin_written(port, pin, val);
+}
+
+void init_output_pin(uint8_t pin, volatile uint8_t* ddr, uint8_t init_val) {
+    *ddr |= _BV(pin);
+    write_pin(port_reg(ddr), pin, init_val);
+}
+
+void init_input_pin(uint8_t pin, volatile uint8_t* ddr) {
+    *ddr &= (uint8_t) ~_BV(pin);
+}
+
+void set_pin_pullup(uint8_t pin, volatile uint8_t* port, uint8_t pullup) {
+    if (pullup) {
+        *port |= _BV(pin);
+        // Nothing else drives the pin yet, so the pullup wins
+        sim_drive_pin(port, pin, 1);
+    } else {
+        *port &= (uint8_t) ~_BV(pin);
+    }
+}
+
+void set_pin_low(uint8_t pin, volatile uint8_t* port) {
+    write_pin(port, pin, 0);
+}
+
+void set_pin_high(uint8_t pin, volatile uint8_t* port) {
+    write_pin(port, pin, 1);
+}
+
+uint8_t get_pin_val(uint8_t pin, volatile uint8_t* port) {
+    return (*pin_reg(port) >> pin) & 0x01;
+}
+
+
+uint8_t eeprom_read_byte(const uint8_t* addr) {
+    eeprom_busy_wait();
+    return sim_eeprom[((uintptr_t) addr) & E2END];
+}
+
+uint32_t eeprom_read_dword(const uint32_t* addr) {
+    eeprom_busy_wait();
+    uintptr_t base = (uintptr_t) addr;
+    uint32_t data = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        data |= ((uint32_t) sim_eeprom[(base + i) & E2END]) << (8 * i);
+    }
+    return data;
+}
+
+void eeprom_write_byte(uint8_t* addr, uint8_t value) {
+    eeprom_busy_wait();
+    sim_eeprom[((uintptr_t) addr) & E2END] = value;
+    sim_eeprom_writes++;
+    sim_advance_us(SIM_EEPROM_WRITE_US);
+}
+
+void eeprom_write_dword(uint32_t* addr, uint32_t value) {
+    uintptr_t base = (uintptr_t) addr;
+    for (uint8_t i = 0; i < 4; i++) {
+        eeprom_write_byte((uint8_t*) (base + i), (value >> (8 * i)) & 0xFF);
+    }
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t value) {
+    if (eeprom_read_byte(addr) != value) {
+        eeprom_write_byte(addr, value);
+    }
+}
+
+void eeprom_update_dword(uint32_t* addr, uint32_t value) {
+    uintptr_t base = (uintptr_t) addr;
+    for (uint8_t i = 0; i < 4; i++) {
+        eeprom_update_byte((uint8_t*) (base + i), (value >> (8 * i)) & 0xFF);
+    }
+}
+
+uint32_t read_eeprom(uint16_t addr) {
+    return eeprom_read_dword((const uint32_t*) (uintptr_t) addr);
+}
+
+void write_eeprom(uint16_t addr, uint32_t data) {
+    eeprom_write_dword((uint32_t*) (uintptr_t) addr, data);
+}
+
+uint32_t read_eeprom_or_default(uint16_t addr, uint32_t default_data) {
+    uint32_t data = read_eeprom(addr);
+    if (data == EEPROM_DEF_DWORD) {
+        return default_data;
+    }
+    return data;
+}
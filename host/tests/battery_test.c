@@ -0,0 +1,219 @@
+/*
+Host test of the coulomb counter: the pack current is sampled every
+BATT_SAMPLE_DIV protection ticks and integrated without losing fractions of a
+mC, the charge is pulled towards the voltage estimate at low current, and it is
+saved to the config journal and restored at startup.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data);
+
+// Pack voltage for an open circuit voltage of 3.79 V per cell (50%)
+#define HALF_PACK_RAW 3104
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+}
+
+// Starts counting again from the ADC values now set
+void restart_battery(void) {
+    sample_adc_snapshot();
+    init_battery();
+}
+
+// Runs the tasks that keep the charge up to date for `us`
+void run_for(uint64_t us) {
+    for (uint64_t t = 0; t < us; t += 10000) {
+        sim_advance_us(10000);
+        run_measurements();
+        run_battery();
+        run_config();
+    }
+}
+
+void sample_rate_test(void) {
+    setup();
+    uint32_t samples = 0;
+    for (uint32_t t = 0; t < 10000000; t += 1000) {
+        sim_advance_us(1000);
+        if (is_batt_sample_due()) {
+            samples++;
+            run_battery();
+        }
+    }
+    // BATT_SAMPLE_DIV x PROT_TICKS ticks of 128 us
+    ASSERT_TRUE(samples >= 99);
+    ASSERT_TRUE(samples <= 101);
+    ASSERT_TRUE(batt_int_s >= 9);
+    ASSERT_TRUE(batt_int_s <= 10);
+}
+
+void ocv_test(void) {
+    ASSERT_EQ(batt_ocv_to_soc(2500), 0);
+    ASSERT_EQ(batt_ocv_to_soc(3000), 0);
+    ASSERT_EQ(batt_ocv_to_soc(3225), 50);
+    ASSERT_EQ(batt_ocv_to_soc(3790), 500);
+    ASSERT_EQ(batt_ocv_to_soc(3805), 550);
+    ASSERT_EQ(batt_ocv_to_soc(4200), 1000);
+    ASSERT_EQ(batt_ocv_to_soc(4300), 1000);
+}
+
+void integrate_test(void) {
+    setup();
+    // About 1.5 A out of the pack, too much for the voltage correction
+    sim_adc_values[ADC_VMON_PACK] = HALF_PACK_RAW;
+    sim_adc_values[ADC_IMON_PACK] = 1000;
+    restart_battery();
+    int32_t start = batt_charge_mc;
+    uint64_t start_us = sim_time_us;
+
+    // Sampling the ADC takes time too, so it runs for a bit over 100 s
+    run_for(100000000);
+    // 1526.25 mA, up to one sample period (0.1 s) short
+    int32_t used = start - batt_charge_mc;
+    int32_t expected = (int32_t) ((sim_time_us - start_us) * 1000 * 6250 /
+        4095 / 1000000);
+    ASSERT_TRUE(used >= expected - 153);
+    ASSERT_TRUE(used <= expected);
+    ASSERT_TRUE(batt_int_s >= 99);
+    ASSERT_TRUE(batt_int_s <= 101);
+    ASSERT_EQ(batt_soc, batt_charge_mc / (BATT_CAPACITY_MC / 1000));
+}
+
+void stall_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = HALF_PACK_RAW;
+    sim_adc_values[ADC_IMON_PACK] = 1000;
+    restart_battery();
+    // Part of a second integrated already
+    run_for(1050000);
+    uint32_t start_s = batt_int_s;
+    int32_t start = batt_charge_mc;
+
+    // The main loop is blocked for 20 s, the next sample only counts the
+    // longest gap allowed (0xFFFF ticks, 8.39 s)
+    sim_advance_us(20000000);
+    sample_batt_current();
+    ASSERT_TRUE(batt_int_s >= start_s + 8);
+    ASSERT_TRUE(batt_int_s <= start_s + 9);
+    int32_t expected = (int32_t) ((int64_t) 2 * (1000 - BATT_CUR_ZERO_RAW) *
+        0xFFFF * BATT_CUR_FULL_SCALE_MA / (2L * 0x0FFF * (OCR1A + 1)));
+    int32_t used = start - batt_charge_mc;
+    ASSERT_TRUE(used >= expected);
+    ASSERT_TRUE(used <= expected + 1);
+}
+
+void remainder_test(void) {
+    setup();
+    // 1.5 mA - 0.15 mC per sample, which would all be lost to rounding
+    sim_adc_values[ADC_VMON_PACK] = HALF_PACK_RAW;
+    sim_adc_values[ADC_IMON_PACK] = 1;
+    restart_battery();
+    int32_t start = batt_charge_mc;
+    run_for(100000000);
+    // The charge starts at the voltage estimate, so the correction barely
+    // moves it
+    int32_t used = start - batt_charge_mc;
+    ASSERT_TRUE(used >= 145);
+    ASSERT_TRUE(used <= 153);
+}
+
+void correction_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = HALF_PACK_RAW;
+    sim_adc_values[ADC_IMON_PACK] = 0;
+    restart_battery();
+    int32_t estimate = batt_charge_mc;
+
+    // Counted down to 20%, moves 1/4096 of the way back each snapshot
+    batt_charge_mc = BATT_CAPACITY_MC / 5;
+    int32_t diff = estimate - batt_charge_mc;
+    run_for(100000000);
+    int32_t moved = batt_charge_mc - BATT_CAPACITY_MC / 5;
+    ASSERT_TRUE(moved >= diff / 50);
+    ASSERT_TRUE(moved <= diff / 30);
+
+    // Not while the current is high
+    sim_adc_values[ADC_IMON_PACK] = 2000;
+    restart_battery();
+    batt_charge_mc = BATT_CAPACITY_MC / 5;
+    run_for(10000000);
+    ASSERT_TRUE(batt_charge_mc < BATT_CAPACITY_MC / 5);
+}
+
+void persist_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = HALF_PACK_RAW;
+    sim_adc_values[ADC_IMON_PACK] = 0;
+    restart_battery();
+    uint16_t saved = 0;
+    ASSERT_FALSE(get_config(CONFIG_BATT_CHARGE, &saved));
+
+    // Close to the voltage estimate, so the correction hardly moves it after
+    // it is saved
+    batt_charge_mc += 12345;
+    run_for((uint64_t) BATT_SAVE_PERIOD_S * 1000000 + 10000);
+    while (config_dirty || is_config_busy()) {
+        sim_advance_us(10000);
+        run_config();
+    }
+    ASSERT_TRUE(get_config(CONFIG_BATT_CHARGE, &saved));
+    int32_t saved_diff = (int32_t) saved - batt_charge_mc / BATT_SAVE_UNIT_MC;
+    ASSERT_TRUE(saved_diff >= 0);
+    ASSERT_TRUE(saved_diff <= 1);
+
+    // After a reset, it starts from the saved charge instead of the voltage
+    restore_config();
+    restart_battery();
+    ASSERT_EQ(batt_charge_mc, (int32_t) saved * BATT_SAVE_UNIT_MC);
+    ASSERT_EQ(batt_int_s, 0);
+}
+
+void hk_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = HALF_PACK_RAW;
+    sim_adc_values[ADC_IMON_PACK] = 1000;
+    restart_battery();
+    run_for(5000000);
+
+    uint8_t status = CAN_STATUS_OK;
+    uint32_t data = 0;
+    handle_rx_hk(CAN_EPS_HK_BAT_CHARGE, &status, &data);
+    ASSERT_EQ(status, CAN_STATUS_OK);
+    ASSERT_EQ(data & 0x7FFFFFFF, (uint32_t) batt_charge_mc);
+    handle_rx_hk(CAN_EPS_HK_BAT_SOC, &status, &data);
+    ASSERT_EQ(status, CAN_STATUS_OK);
+    ASSERT_EQ(data & 0x7FFF, batt_soc);
+#ifdef BATT_SOC_CALIBRATED
+    ASSERT_FALSE(data & 0x8000);
+#else
+    // Marked until the cell curve and pack constants are measured
+    ASSERT_TRUE(data & 0x8000);
+    handle_rx_hk(CAN_EPS_HK_BAT_CHARGE, &status, &data);
+    ASSERT_TRUE(data & 0x80000000UL);
+#endif
+    handle_rx_hk(CAN_EPS_HK_BAT_INT_TIME, &status, &data);
+    ASSERT_EQ(status, CAN_STATUS_OK);
+    ASSERT_TRUE(data >= 4);
+    ASSERT_TRUE(data <= 5);
+}
+
+test_t t1 = { .name = "sample rate test", .fn = sample_rate_test };
+test_t t2 = { .name = "ocv test", .fn = ocv_test };
+test_t t3 = { .name = "integrate test", .fn = integrate_test };
+test_t t4 = { .name = "stall test", .fn = stall_test };
+test_t t5 = { .name = "remainder test", .fn = remainder_test };
+test_t t6 = { .name = "correction test", .fn = correction_test };
+test_t t7 = { .name = "persist test", .fn = persist_test };
+test_t t8 = { .name = "hk test", .fn = hk_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/*
+Host test of the CAN frame rings: ordering across index wrap-around, overflow
+counting and high-water marks, and the RX/TX paths through the CAN MOBs.
+*/
+
+#include <string.h>
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void fill_frame(uint8_t* frame, uint8_t val) {
+    for (uint8_t i = 0; i < CAN_RING_FRAME_LEN; i++) {
+        frame[i] = val + i;
+    }
+}
+
+void order_test(void) {
+    can_ring_t ring;
+    init_can_ring(&ring);
+
+    // Enough frames for the 8-bit indices to wrap around, with the ring
+    // holding up to 2 frames at a time
+    uint8_t frame[CAN_RING_FRAME_LEN];
+    uint8_t pushed = 0;
+    uint8_t popped = 0;
+    for (uint16_t i = 0; i < 600; i++) {
+        fill_frame(frame, pushed++);
+        ASSERT_TRUE(can_ring_push(&ring, frame));
+        if (i % 2 == 0) {
+            fill_frame(frame, pushed++);
+            ASSERT_TRUE(can_ring_push(&ring, frame));
+        }
+
+        // In place
+        uint8_t* slot = can_ring_peek(&ring);
+        ASSERT_TRUE(slot != NULL);
+        if (slot == NULL) {
+            return;
+        }
+        ASSERT_EQ(slot[0], popped);
+        ASSERT_EQ(slot[7], (uint8_t) (popped + 7));
+        can_ring_release(&ring);
+        popped++;
+
+        // Copied out
+        if (i % 2 == 1) {
+            ASSERT_TRUE(can_ring_pop(&ring, frame));
+            ASSERT_EQ(frame[0], popped);
+            popped++;
+        }
+    }
+    ASSERT_EQ(can_ring_count(&ring), 0);
+    ASSERT_TRUE(can_ring_peek(&ring) == NULL);
+    ASSERT_EQ(ring.overflows, 0);
+    ASSERT_EQ(ring.high_water, 2);
+}
+
+void overflow_test(void) {
+    can_ring_t ring;
+    init_can_ring(&ring);
+
+    uint8_t frame[CAN_RING_FRAME_LEN];
+    for (uint8_t i = 0; i < CAN_RING_SIZE + 3; i++) {
+        fill_frame(frame, i);
+        ASSERT_EQ(can_ring_push(&ring, frame), i < CAN_RING_SIZE);
+    }
+    ASSERT_EQ(can_ring_count(&ring), CAN_RING_SIZE);
+    ASSERT_EQ(ring.overflows, 3);
+    ASSERT_EQ(ring.high_water, CAN_RING_SIZE);
+
+    // The oldest frames are kept
+    ASSERT_TRUE(can_ring_pop(&ring, frame));
+    ASSERT_EQ(frame[0], 0);
+    ASSERT_TRUE(can_ring_reserve(&ring) != NULL);
+}
+
+void can_path_test(void) {
+    sim_reset();
+    init_eps();
+    print_can_msgs = false;
+
+    // More commands than the RX ring holds arrive before the main loop runs
+    uint8_t rx_msg[8] = { CAN_EPS_HK, CAN_EPS_HK_UPTIME };
+    for (uint8_t i = 0; i < CAN_RING_SIZE + 2; i++) {
+        sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    }
+    ASSERT_EQ(can_rx_ring.overflows, 2);
+    ASSERT_EQ(can_rx_ring.high_water, CAN_RING_SIZE);
+
+    // Process all of them before any response is sent
+    for (uint8_t i = 0; i < CAN_RING_SIZE; i++) {
+        process_next_rx_msg();
+    }
+    ASSERT_EQ(can_rx_ring.overflows, 2);
+    ASSERT_EQ(can_tx_ring.high_water, CAN_RING_SIZE);
+    ASSERT_EQ(can_tx_ring.overflows, 0);
+
+    uint8_t tx_msg[8];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < CAN_RING_SIZE + 2; i++) {
+        send_next_tx_msg();
+        if (sim_can_tx_pop(tx_msg) == 8) {
+            ASSERT_EQ(tx_msg[0], CAN_EPS_HK);
+            ASSERT_EQ(tx_msg[1], CAN_EPS_HK_UPTIME);
+            count++;
+        }
+    }
+    ASSERT_EQ(count, CAN_RING_SIZE);
+    ASSERT_EQ(can_ring_count(&can_tx_ring), 0);
+}
+
+test_t t1 = { .name = "order test", .fn = order_test };
+test_t t2 = { .name = "overflow test", .fn = overflow_test };
+test_t t3 = { .name = "can path test", .fn = can_path_test };
+
+test_t* suite[] = { &t1, &t2, &t3 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
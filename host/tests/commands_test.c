@@ -0,0 +1,327 @@
+/*
+Host test of the CAN command path against the simulated board: HK fields
+return the scripted ADC and IMU values, and control commands reach the DAC
+and EEPROM.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void setup(void) {
+    sim_reset();
+    sim_imu_attach();
+    init_eps();
+}
+
+// Sends a command and returns the response data, checking the status
+uint32_t round_trip(uint8_t opcode, uint8_t field_num, uint32_t data,
+        uint8_t expected_status) {
+    uint8_t rx_msg[8] = {
+        opcode, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF
+    };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[0], opcode);
+    ASSERT_EQ(tx_msg[1], field_num);
+    ASSERT_EQ(tx_msg[2], expected_status);
+
+    return ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+        ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+}
+
+void hk_adc_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = 0x68F;
+    sim_adc_values[ADC_IMON_PAY_LIM] = 0x123;
+    sim_adc_values[ADC_THM_BATT2] = 0xABC;
+    // Let the ADC snapshot go stale so the main loop picks up the new values
+    sim_advance_us(1000000);
+    run_measurements();
+
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_VOL, 0, CAN_STATUS_OK), 0x68F);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_PAY_CUR, 0, CAN_STATUS_OK), 0x123);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_TEMP2, 0, CAN_STATUS_OK), 0xABC);
+    // With the oversampling's fractional bits
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_ADC_EXT(ADC_VMON_PACK), 0,
+        CAN_STATUS_OK), 0x68F0);
+    round_trip(CAN_EPS_HK, EPS_HK_FIELD_COUNT, 0, CAN_STATUS_INVALID_FIELD_NUM);
+    round_trip(0xEE, 0, 0, CAN_STATUS_INVALID_OPCODE);
+}
+
+void hk_snapshot_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = 0x600;
+    sim_advance_us(1000000);
+    run_measurements();
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_VOL, 0, CAN_STATUS_OK), 0x600);
+
+    // Within the sampling period, requests are answered without conversions
+    uint32_t conversions = sim_adc_conversions;
+    sim_adc_values[ADC_VMON_PACK] = 0x700;
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_VOL, 0, CAN_STATUS_OK), 0x600);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_CUR, 0, CAN_STATUS_OK), 0);
+    ASSERT_EQ(sim_adc_conversions, conversions);
+
+    // A stale snapshot is still answered as it is, only the main loop task
+    // sweeps
+    sim_advance_us(1000000);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_VOL, 0, CAN_STATUS_OK), 0x600);
+    ASSERT_EQ(sim_adc_conversions, conversions);
+    run_measurements();
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_BAT_VOL, 0, CAN_STATUS_OK), 0x700);
+    ASSERT_EQ(adc_snapshot->uptime_s, uptime_s);
+}
+
+void hk_imu_test(void) {
+    setup();
+    sim_imu_cal_gyro[0] = 100;
+    sim_imu_cal_gyro[2] = -100;
+    sim_imu_uncal_gyro[1] = 321;
+    // Let the streamed reports arrive
+    for (uint8_t i = 0; i < 20; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    ASSERT_TRUE(imu_record.cal_gyro.count > 0);
+    ASSERT_TRUE(imu_record.uncal_gyro.count > 0);
+
+    // Answered from the latest samples without talking to the IMU (no time
+    // passes without the CAN message printing, so no new reports arrive)
+    print_can_msgs = false;
+    uint32_t transactions = sim_imu_transactions;
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_CAL_X, 0, CAN_STATUS_OK), 100);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_CAL_Z, 0, CAN_STATUS_OK),
+        (uint16_t) -100);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_UNCAL_Y, 0, CAN_STATUS_OK), 321);
+    ASSERT_EQ(sim_imu_transactions, transactions);
+}
+
+void imu_stream_test(void) {
+    setup();
+    sim_imu_cal_gyro[0] = 5;
+    for (uint8_t i = 0; i < 100; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    // 1 s at the default 100 ms interval
+    ASSERT_TRUE(imu_record.cal_gyro.count >= 9);
+    ASSERT_EQ(imu_record.cal_gyro.data[0], 5);
+
+    // Stopped features are requested on demand again once the last streamed
+    // report is too old
+    ASSERT_TRUE(stop_imu_stream(IMU_CAL_GYRO));
+    ASSERT_FALSE(is_imu_streaming(IMU_CAL_GYRO));
+    sim_imu_cal_gyro[0] = 6;
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_CAL_X, 0, CAN_STATUS_OK), 5);
+    sim_advance_us(IMU_RECORD_MAX_AGE_MS * 1000UL);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_CAL_X, 0, CAN_STATUS_OK), 6);
+    ASSERT_EQ(imu_record.cal_gyro.data[0], 6);
+    ASSERT_TRUE(is_imu_streaming(IMU_UNCAL_GYRO));
+}
+
+void imu_acq_test(void) {
+    setup();
+    sim_imu_accel[2] = 2511;
+    sim_imu_cal_gyro[1] = -3;
+    sim_imu_uncal_gyro[0] = 44;
+    sim_imu_gyro_bias[2] = 7;
+    uint32_t packets = imu_record.packets;
+    uint32_t accel = imu_record.accel.count;
+    uint32_t cal_gyro = imu_record.cal_gyro.count;
+    uint32_t uncal_gyro = imu_record.uncal_gyro.count;
+    for (uint8_t i = 0; i < 100; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    // Every report arrives in the same packet
+    packets = imu_record.packets - packets;
+    ASSERT_TRUE(packets >= 9);
+    ASSERT_EQ(imu_record.features, IMU_ACQ_FEATURES);
+    ASSERT_EQ(imu_record.accel.count - accel, packets);
+    ASSERT_EQ(imu_record.cal_gyro.count - cal_gyro, packets);
+    ASSERT_EQ(imu_record.uncal_gyro.count - uncal_gyro, packets);
+    ASSERT_EQ(imu_record.accel.int_time, imu_record.int_time);
+    ASSERT_EQ(imu_record.uncal_gyro.int_time, imu_record.int_time);
+    ASSERT_EQ(imu_record.uncal_gyro.data[5], 7);
+
+    // Without streaming, the first field acquires every feature at once and
+    // the rest are answered from the record
+    stop_imu_acq();
+    sim_advance_us(IMU_RECORD_MAX_AGE_MS * 1000UL);
+    sim_imu_accel[2] = 2512;
+    uint32_t transactions = sim_imu_transactions;
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_UNCAL_X, 0, CAN_STATUS_OK), 44);
+    // Enable and disable each feature, and the reports
+    ASSERT_TRUE(sim_imu_transactions - transactions <= 6 * 3 + 2);
+    transactions = sim_imu_transactions;
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_GYR_CAL_Y, 0, CAN_STATUS_OK),
+        (uint16_t) -3);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_ACC_Z, 0, CAN_STATUS_OK), 2512);
+    ASSERT_EQ(round_trip(CAN_EPS_HK, CAN_EPS_HK_ACC_X, 0, CAN_STATUS_OK), 0);
+    ASSERT_EQ(sim_imu_transactions, transactions);
+}
+
+void hk_batch_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = 0x68F;
+    sim_adc_values[ADC_IMON_PACK] = 0x100;
+    sim_adc_values[ADC_IMON_X_PLUS] = 0x0C4;
+    sim_advance_us(1000000);
+    run_measurements();
+    // More than 16 bits
+    uptime_s = 0x12345;
+
+    // Uptime (32-bit), battery voltage and current, X+ current, and one
+    // invalid field (past the first 32, so from a second base field number)
+    uint32_t mask = _BV(CAN_EPS_HK_UPTIME) | _BV(CAN_EPS_HK_BAT_VOL) |
+        _BV(CAN_EPS_HK_BAT_CUR) | _BV(CAN_EPS_HK_X_POS_CUR);
+    uint8_t rx_msg[8] = { CAN_EPS_HK_BATCH, 0x00, 0x00, 0x00,
+        (mask >> 24) & 0xFF, (mask >> 16) & 0xFF, (mask >> 8) & 0xFF, mask & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+
+    uint8_t frames[8][8];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < 6; i++) {
+        send_next_tx_msg();
+        if (sim_can_tx_pop(frames[count]) == 8) {
+            count++;
+        }
+    }
+    ASSERT_EQ(count, 3);
+
+    uint8_t rx_invalid[8] = { CAN_EPS_HK_BATCH, EPS_HK_FIELD_COUNT, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x01 };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_invalid, 8);
+    process_next_rx_msg();
+    for (uint8_t i = 0; i < 2; i++) {
+        send_next_tx_msg();
+        if (sim_can_tx_pop(frames[count]) == 8) {
+            count++;
+        }
+    }
+    ASSERT_EQ(count, 4);
+
+    ASSERT_EQ(frames[0][1], CAN_EPS_HK_UPTIME);
+    ASSERT_EQ(frames[0][2], CAN_STATUS_OK);
+    ASSERT_EQ(frames[0][3], CAN_EPS_HK_BATCH_NO_FIELD);
+    ASSERT_EQ(frames[0][5], 0x01);
+    ASSERT_EQ(frames[0][6], 0x23);
+    ASSERT_EQ(frames[0][7], 0x45);
+
+    ASSERT_EQ(frames[1][1], CAN_EPS_HK_BAT_VOL);
+    ASSERT_EQ(frames[1][3], CAN_EPS_HK_BAT_CUR);
+    ASSERT_EQ((frames[1][4] << 8) | frames[1][5], 0x68F);
+    ASSERT_EQ((frames[1][6] << 8) | frames[1][7], 0x100);
+
+    // Its pair is invalid, so it is sent alone
+    ASSERT_EQ(frames[2][1], CAN_EPS_HK_X_POS_CUR);
+    ASSERT_EQ(frames[2][3], CAN_EPS_HK_BATCH_NO_FIELD);
+    ASSERT_EQ(frames[2][7], 0xC4);
+
+    ASSERT_EQ(frames[3][0], CAN_EPS_HK_BATCH);
+    ASSERT_EQ(frames[3][1], EPS_HK_FIELD_COUNT);
+    ASSERT_EQ(frames[3][2], CAN_STATUS_INVALID_FIELD_NUM);
+
+    // Empty mask
+    round_trip(CAN_EPS_HK_BATCH, 0, 0, CAN_STATUS_INVALID_DATA);
+}
+
+void hk_batch_reset_on_read_test(void) {
+    setup();
+    // The 5V energy doesn't fit in the 3V3 energy's frame, so it goes in the
+    // next one - it must only be read (and reset) once
+    rail_reset_on_read = true;
+    rail_accs[RAIL_3V3].energy_mj = 5;
+    rail_accs[RAIL_5V].energy_mj = 0x12345;
+
+    uint32_t mask = _BV(0) | _BV(CAN_EPS_HK_5V_ENERGY - CAN_EPS_HK_3V3_ENERGY);
+    uint8_t rx_msg[8] = { CAN_EPS_HK_BATCH, CAN_EPS_HK_3V3_ENERGY, 0x00, 0x00,
+        (mask >> 24) & 0xFF, (mask >> 16) & 0xFF, (mask >> 8) & 0xFF, mask & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+
+    uint8_t frames[4][8];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        send_next_tx_msg();
+        if (sim_can_tx_pop(frames[count]) == 8) {
+            count++;
+        }
+    }
+    ASSERT_EQ(count, 2);
+
+    ASSERT_EQ(frames[0][1], CAN_EPS_HK_3V3_ENERGY);
+    ASSERT_EQ(frames[0][3], CAN_EPS_HK_BATCH_NO_FIELD);
+    ASSERT_EQ(frames[0][7], 5);
+
+    ASSERT_EQ(frames[1][1], CAN_EPS_HK_5V_ENERGY);
+    ASSERT_EQ(frames[1][2], CAN_STATUS_OK);
+    ASSERT_EQ(frames[1][5], 0x01);
+    ASSERT_EQ(frames[1][6], 0x23);
+    ASSERT_EQ(frames[1][7], 0x45);
+    ASSERT_EQ(rail_accs[RAIL_5V].energy_mj, 0);
+}
+
+void ctrl_setpoint_test(void) {
+    setup();
+    ASSERT_EQ(sim_dac_outputs[DAC_A], HEATER_1_DEF_SHADOW_SETPOINT);
+
+    round_trip(CAN_EPS_CTRL, CAN_EPS_CTRL_SET_HEAT1_SHAD_SP, 0x456, CAN_STATUS_OK);
+    ASSERT_EQ(heater_1_shadow_setpoint.raw, 0x456);
+    ASSERT_EQ(sim_dac_outputs[DAC_A], 0x456);
+    // Committed to the config journal in the background
+    sim_advance_us(200000);
+    heater_1_shadow_setpoint.raw = 0;
+    init_heaters();
+    ASSERT_EQ(heater_1_shadow_setpoint.raw, 0x456);
+
+    uint32_t sp = round_trip(CAN_EPS_CTRL, CAN_EPS_CTRL_GET_HEAT_SHAD_SP, 0,
+        CAN_STATUS_OK);
+    ASSERT_EQ(sp, ((uint32_t) 0x456 << 16) | HEATER_2_DEF_SHADOW_SETPOINT);
+}
+
+void heater_mode_test(void) {
+    setup();
+    // 4 x 0.3 A is above the 1 A upper threshold
+    for (uint8_t i = ADC_IMON_X_PLUS; i <= ADC_IMON_Y_MINUS; i++) {
+        sim_adc_values[i] = 0x0C4;
+    }
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SUN);
+    ASSERT_EQ(sim_dac_outputs[DAC_A], HEATER_1_DEF_SUN_SETPOINT);
+
+    // No solar current
+    for (uint8_t i = ADC_IMON_X_PLUS; i <= ADC_IMON_Y_MINUS; i++) {
+        sim_adc_values[i] = 0;
+    }
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SHADOW);
+    ASSERT_EQ(sim_dac_outputs[DAC_B], HEATER_2_DEF_SHADOW_SETPOINT);
+}
+
+test_t t1 = { .name = "hk adc test", .fn = hk_adc_test };
+test_t t2 = { .name = "hk snapshot test", .fn = hk_snapshot_test };
+test_t t3 = { .name = "hk imu test", .fn = hk_imu_test };
+test_t t4 = { .name = "ctrl setpoint test", .fn = ctrl_setpoint_test };
+test_t t5 = { .name = "heater mode test", .fn = heater_mode_test };
+test_t t6 = { .name = "imu stream test", .fn = imu_stream_test };
+test_t t7 = { .name = "imu acq test", .fn = imu_acq_test };
+test_t t8 = { .name = "hk batch test", .fn = hk_batch_test };
+test_t t9 = { .name = "hk batch reset on read test",
+    .fn = hk_batch_reset_on_read_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
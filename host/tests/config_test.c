@@ -0,0 +1,186 @@
+/*
+Host test of the EEPROM config journal: commands return without waiting for
+the EEPROM, records are committed by the EE_READY interrupt into successive
+slots, and init_heaters() restores the newest record with a valid CRC.
+*/
+
+#include <string.h>
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+// Longer than a whole record takes to program (32 x 3.3 ms)
+#define COMMIT_US 120000
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+}
+
+void send_ctrl(uint8_t field_num, uint32_t data) {
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8];
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[2], CAN_STATUS_OK);
+}
+
+// Reads the record in a journal slot, returns 1 if its CRC is valid
+uint8_t read_slot(uint8_t slot, config_record_t* record) {
+    uint16_t addr = CONFIG_JOURNAL_ADDR + slot * CONFIG_SLOT_SIZE;
+    memcpy(record, &sim_eeprom[addr], CONFIG_SLOT_SIZE);
+    return record->crc == calc_config_crc(record);
+}
+
+void non_blocking_test(void) {
+    setup();
+    uint64_t start_us = sim_time_us;
+    uint32_t writes = sim_eeprom_writes;
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT1_SUN_SP, 0x321);
+    // Only the DAC write takes time, at most one byte has been programmed
+    ASSERT_TRUE(sim_time_us - start_us < 1000);
+    ASSERT_TRUE(sim_eeprom_writes - writes <= 1);
+    ASSERT_TRUE(is_config_busy());
+    ASSERT_EQ(heater_1_sun_setpoint.raw, 0x321);
+
+    sim_advance_us(COMMIT_US);
+    ASSERT_FALSE(is_config_busy());
+    ASSERT_EQ(sim_eeprom_writes, writes + CONFIG_SLOT_SIZE);
+
+    config_record_t record;
+    ASSERT_TRUE(read_slot(0, &record));
+    ASSERT_EQ(record.seq, 1);
+    ASSERT_EQ(record.values[CONFIG_HEAT1_SUN_SP], 0x321);
+    ASSERT_EQ(record.values[CONFIG_HEAT1_SHAD_SP], CONFIG_NO_VALUE);
+
+    // Setting the same value again doesn't write anything
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT1_SUN_SP, 0x321);
+    sim_advance_us(COMMIT_US);
+    ASSERT_EQ(sim_eeprom_writes, writes + CONFIG_SLOT_SIZE);
+}
+
+void restore_test(void) {
+    setup();
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT1_SHAD_SP, 0x111);
+    sim_advance_us(COMMIT_US);
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT2_SHAD_SP, 0x222);
+    sim_advance_us(COMMIT_US);
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT_CUR_THR_LOWER, 0x100);
+    sim_advance_us(COMMIT_US);
+
+    // Restart with the same EEPROM
+    heater_1_shadow_setpoint.raw = 0;
+    heater_2_shadow_setpoint.raw = 0;
+    heater_sun_cur_thresh_lower.raw = 0;
+    init_heaters();
+    ASSERT_EQ(config_slot, 2);
+    ASSERT_EQ(config_record.seq, 3);
+    ASSERT_EQ(heater_1_shadow_setpoint.raw, 0x111);
+    ASSERT_EQ(heater_2_shadow_setpoint.raw, 0x222);
+    ASSERT_EQ(heater_sun_cur_thresh_lower.raw, 0x100);
+    // Never set
+    ASSERT_EQ(heater_1_sun_setpoint.raw, HEATER_1_DEF_SUN_SETPOINT);
+    ASSERT_EQ(heater_sun_cur_thresh_upper.raw, HEATER_SUN_CUR_THRESH_UPPER);
+    ASSERT_EQ(sim_dac_outputs[DAC_A], 0x111);
+}
+
+void coalesce_test(void) {
+    setup();
+    uint32_t writes = sim_eeprom_writes;
+    // The first command starts a commit, the rest are committed together
+    // once it is done
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT1_SHAD_SP, 0x101);
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT2_SHAD_SP, 0x102);
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT1_SUN_SP, 0x103);
+    send_ctrl(CAN_EPS_CTRL_SET_HEAT2_SUN_SP, 0x104);
+    ASSERT_TRUE(config_dirty);
+    sim_advance_us(COMMIT_US);
+    ASSERT_TRUE(is_config_commit_due());
+    ASSERT_TRUE(is_work_pending());
+    run_config();
+    sim_advance_us(COMMIT_US);
+    ASSERT_FALSE(config_dirty);
+    ASSERT_EQ(sim_eeprom_writes, writes + 2 * CONFIG_SLOT_SIZE);
+
+    config_record_t record;
+    ASSERT_TRUE(read_slot(1, &record));
+    ASSERT_EQ(record.seq, 2);
+    ASSERT_EQ(record.values[CONFIG_HEAT1_SHAD_SP], 0x101);
+    ASSERT_EQ(record.values[CONFIG_HEAT2_SUN_SP], 0x104);
+}
+
+void wear_test(void) {
+    setup();
+    uint32_t writes = sim_eeprom_writes;
+    for (uint16_t i = 0; i < 100; i++) {
+        set_raw_heater_setpoint(&heater_1_shadow_setpoint, 0x200 + i);
+        sim_advance_us(COMMIT_US);
+    }
+    ASSERT_EQ(sim_eeprom_writes, writes + 100 * CONFIG_SLOT_SIZE);
+
+    // Every slot has been used, each about as often
+    config_record_t record;
+    for (uint8_t slot = 0; slot < CONFIG_SLOT_COUNT; slot++) {
+        ASSERT_TRUE(read_slot(slot, &record));
+        ASSERT_TRUE(record.seq > 100 - CONFIG_SLOT_COUNT);
+    }
+    ASSERT_EQ(config_slot, 99 % CONFIG_SLOT_COUNT);
+
+    heater_1_shadow_setpoint.raw = 0;
+    init_heaters();
+    ASSERT_EQ(heater_1_shadow_setpoint.raw, 0x200 + 99);
+}
+
+void torn_record_test(void) {
+    setup();
+    set_raw_heater_setpoint(&heater_2_sun_setpoint, 0x1AB);
+    sim_advance_us(COMMIT_US);
+
+    // Reset while the second record is being written
+    set_raw_heater_setpoint(&heater_2_sun_setpoint, 0x1CD);
+    sim_advance_us(COMMIT_US / 2);
+    ASSERT_TRUE(is_config_busy());
+    EECR &= ~_BV(EERIE);
+
+    heater_2_sun_setpoint.raw = 0;
+    init_heaters();
+    ASSERT_EQ(heater_2_sun_setpoint.raw, 0x1AB);
+    ASSERT_EQ(config_slot, 0);
+
+    // A corrupted record is skipped too
+    sim_eeprom[CONFIG_JOURNAL_ADDR + 6] ^= 0x01;
+    init_heaters();
+    ASSERT_EQ(heater_2_sun_setpoint.raw, HEATER_2_DEF_SUN_SETPOINT);
+}
+
+void legacy_test(void) {
+    setup();
+    // Written at the old fixed address before the journal existed
+    write_eeprom(HEATER_CUR_THRESH_UPPER_ADDR, 0x2AA);
+    init_heaters();
+    ASSERT_EQ(heater_sun_cur_thresh_upper.raw, 0x2AA);
+
+    // The journal takes priority once the value is set
+    set_raw_heater_cur_thresh(&heater_sun_cur_thresh_upper, 0x2BB);
+    sim_advance_us(COMMIT_US);
+    init_heaters();
+    ASSERT_EQ(heater_sun_cur_thresh_upper.raw, 0x2BB);
+}
+
+test_t t1 = { .name = "non-blocking test", .fn = non_blocking_test };
+test_t t2 = { .name = "restore test", .fn = restore_test };
+test_t t3 = { .name = "coalesce test", .fn = coalesce_test };
+test_t t4 = { .name = "wear test", .fn = wear_test };
+test_t t5 = { .name = "torn record test", .fn = torn_record_test };
+test_t t6 = { .name = "legacy test", .fn = legacy_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+/*
+Host test of the binary event log: entries are written whole or dropped and
+counted, and a CAN dump returns exactly the logged bytes.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+    log_can_msgs = false;
+    // Start with an empty log
+    init_event_log();
+}
+
+void entry_test(void) {
+    setup();
+    uptime_s = 0x12345;
+    uint8_t frame[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    ASSERT_TRUE(log_event(EVT_CAN_RX, frame));
+    ASSERT_EQ(event_log_count(), EVT_HEADER_LEN + EVT_CAN_RX_LEN);
+
+    uint8_t data[16] = { 0 };
+    ASSERT_EQ(read_event_log(data, sizeof(data)), EVT_HEADER_LEN + EVT_CAN_RX_LEN);
+    ASSERT_EQ(data[0], EVT_CAN_RX);
+    ASSERT_EQ(data[1], 0x23);
+    ASSERT_EQ(data[2], 0x45);
+    ASSERT_EQ(data[3], 1);
+    ASSERT_EQ(data[10], 8);
+    ASSERT_EQ(event_log_count(), 0);
+}
+
+void drop_test(void) {
+    setup();
+    uint8_t frame[8] = { 0 };
+    uint8_t added = 0;
+    while (log_event(EVT_CAN_TX, frame)) {
+        added++;
+    }
+    // 255 usable bytes, 11 bytes per entry
+    ASSERT_EQ(added, 23);
+    ASSERT_EQ(event_log.dropped, 1);
+    ASSERT_FALSE(log_event(EVT_CAN_TX, frame));
+    ASSERT_EQ(event_log.dropped, 2);
+
+    // After space is freed, the drops are recorded before the next entry
+    uint8_t data[EVT_HEADER_LEN + EVT_CAN_TX_LEN];
+    for (uint8_t i = 0; i < 2; i++) {
+        read_event_log(data, sizeof(data));
+    }
+    ASSERT_TRUE(log_event(EVT_CAN_TX, frame));
+    ASSERT_EQ(event_log.dropped_pending, 0);
+
+    for (uint8_t i = 0; i < 21; i++) {
+        read_event_log(data, sizeof(data));
+    }
+    ASSERT_EQ(read_event_log(data, EVT_HEADER_LEN + EVT_DROPPED_LEN),
+        EVT_HEADER_LEN + EVT_DROPPED_LEN);
+    ASSERT_EQ(data[0], EVT_DROPPED);
+    ASSERT_EQ(data[4], 2);
+    ASSERT_EQ(read_event_log(data, sizeof(data)), sizeof(data));
+    ASSERT_EQ(data[0], EVT_CAN_TX);
+    ASSERT_EQ(event_log_count(), 0);
+}
+
+void can_dump_test(void) {
+    setup();
+    log_can_msgs = true;
+    // Heater control and a command with its response - 3 entries
+    control_heater_mode();
+    uint8_t rx_msg[8] = { CAN_EPS_HK, CAN_EPS_HK_BAT_VOL };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8];
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+
+    // The dump request is logged before the dump starts, so it is the last
+    // entry in it
+    uint8_t dump_msg[8] = { CAN_EPS_LOG_DUMP };
+    sim_can_rx(EPS_CMD_MOB_NUM, dump_msg, 8);
+    process_next_rx_msg();
+
+    uint8_t expected[EVENT_LOG_SIZE];
+    uint8_t expected_len = event_log_count();
+    ASSERT_EQ(expected_len, 4 * EVT_HEADER_LEN + EVT_HEATER_CTRL_LEN +
+        2 * EVT_CAN_RX_LEN + EVT_CAN_TX_LEN);
+    for (uint8_t i = 0; i < expected_len; i++) {
+        expected[i] = event_log.data[(uint8_t) (event_log.head + i)];
+    }
+
+    uint8_t dumped[EVENT_LOG_SIZE];
+    uint8_t dumped_len = 0;
+    uint8_t frames = 0;
+    for (uint8_t i = 0; i < 20; i++) {
+        send_next_tx_msg();
+        if (sim_can_tx_pop(tx_msg) == 0) {
+            continue;
+        }
+        frames++;
+        ASSERT_EQ(tx_msg[0], CAN_EPS_LOG_DUMP);
+        ASSERT_TRUE(tx_msg[1] <= CAN_EPS_LOG_DUMP_FRAME_BYTES);
+        for (uint8_t j = 0; j < tx_msg[1]; j++) {
+            dumped[dumped_len++] = tx_msg[2 + j];
+        }
+    }
+    ASSERT_EQ(dumped_len, expected_len);
+    ASSERT_EQ(frames, expected_len / CAN_EPS_LOG_DUMP_FRAME_BYTES + 1);
+    for (uint8_t i = 0; i < expected_len; i++) {
+        ASSERT_EQ(dumped[i], expected[i]);
+    }
+    ASSERT_EQ(dumped[0], EVT_HEATER_CTRL);
+    ASSERT_EQ(dumped[EVT_HEADER_LEN + EVT_HEATER_CTRL_LEN], EVT_CAN_RX);
+
+    ASSERT_EQ(event_log_count(), 0);
+    log_can_msgs = false;
+}
+
+void hk_poll_test(void) {
+    setup();
+    // CAN messages aren't logged by default, so polling doesn't crowd out
+    // the heater control entry
+    for (uint16_t i = 0; i < 100; i++) {
+        uint8_t rx_msg[8] = { CAN_EPS_HK, CAN_EPS_HK_BAT_VOL };
+        sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+        process_next_rx_msg();
+        send_next_tx_msg();
+        uint8_t tx_msg[8];
+        ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    }
+    ASSERT_EQ(event_log_count(), 0);
+    control_heater_mode();
+    ASSERT_EQ(event_log_count(), EVT_HEADER_LEN + EVT_HEATER_CTRL_LEN);
+    ASSERT_EQ(event_log.dropped, 0);
+}
+
+void no_uart_test(void) {
+    setup();
+    uint32_t uart_bytes = sim_uart_bytes;
+    control_heater_mode();
+    uint8_t rx_msg[8] = { CAN_EPS_HK, CAN_EPS_HK_BAT_VOL };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    ASSERT_EQ(sim_uart_bytes, uart_bytes);
+}
+
+test_t t1 = { .name = "entry test", .fn = entry_test };
+test_t t2 = { .name = "drop test", .fn = drop_test };
+test_t t3 = { .name = "can dump test", .fn = can_dump_test };
+test_t t4 = { .name = "no uart test", .fn = no_uart_test };
+test_t t5 = { .name = "hk poll test", .fn = hk_poll_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+/*
+Host test of the heater sun/shadow decision: the integer comparison on the ADC
+snapshot makes the same decision as converting every current to amps, and
+gets the extra resolution of oversampling. Also checks that the DAC is only
+written when a setpoint output changes.
+*/
+
+#include <stdlib.h>
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+#define SOLAR_CHANNELS 4
+
+void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data);
+
+const uint8_t solar_channels[SOLAR_CHANNELS] = {
+    ADC_IMON_X_PLUS, ADC_IMON_X_MINUS, ADC_IMON_Y_PLUS, ADC_IMON_Y_MINUS
+};
+
+double raw_to_cur(uint16_t raw) {
+    return adc_raw_to_circ_cur(raw, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
+}
+
+// Mode chosen by the original floating point implementation
+heater_mode_t float_mode(heater_mode_t prev_mode) {
+    double total = 0;
+    for (uint8_t i = 0; i < SOLAR_CHANNELS; i++) {
+        total += raw_to_cur(sim_adc_values[solar_channels[i]]);
+    }
+    if (total > raw_to_cur(heater_sun_cur_thresh_upper.raw)) {
+        return HEATER_MODE_SUN;
+    } else if (total < raw_to_cur(heater_sun_cur_thresh_lower.raw)) {
+        return HEATER_MODE_SHADOW;
+    }
+    return prev_mode;
+}
+
+void equivalence_test(void) {
+    sim_reset();
+    init_eps();
+    srand(7);
+
+    uint32_t mismatches = 0;
+    for (uint16_t i = 0; i < 5000; i++) {
+        // Keep the thresholds close to the sum so both branches are taken
+        if (i % 100 == 0) {
+            uint16_t lower = rand() % 0x800;
+            set_raw_heater_cur_thresh(&heater_sun_cur_thresh_lower, lower);
+            set_raw_heater_cur_thresh(&heater_sun_cur_thresh_upper,
+                lower + rand() % 0x40);
+        }
+        for (uint8_t j = 0; j < SOLAR_CHANNELS; j++) {
+            sim_adc_values[solar_channels[j]] =
+                heater_sun_cur_thresh_lower.raw / SOLAR_CHANNELS + rand() % 0x20;
+        }
+        sample_adc_snapshot();
+
+        heater_mode_t expected = float_mode(heater_mode);
+        control_heater_mode();
+        if (heater_mode != expected) {
+            mismatches++;
+        }
+    }
+    ASSERT_EQ(mismatches, 0);
+}
+
+void boundary_test(void) {
+    sim_reset();
+    init_eps();
+
+    heater_mode = HEATER_MODE_SHADOW;
+
+    // Exactly at the upper threshold is not above it
+    for (uint8_t i = 0; i < SOLAR_CHANNELS; i++) {
+        sim_adc_values[solar_channels[i]] = 0;
+    }
+    sim_adc_values[ADC_IMON_X_PLUS] = HEATER_SUN_CUR_THRESH_UPPER;
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SHADOW);
+
+    sim_adc_values[ADC_IMON_Y_MINUS] = 1;
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SUN);
+
+    // Between the thresholds keeps the mode
+    sim_adc_values[ADC_IMON_X_PLUS] = HEATER_SUN_CUR_THRESH_LOWER;
+    sim_adc_values[ADC_IMON_Y_MINUS] = 0;
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SUN);
+
+    sim_adc_values[ADC_IMON_X_PLUS] = HEATER_SUN_CUR_THRESH_LOWER - 1;
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SHADOW);
+}
+
+void set_solar_current(uint16_t raw) {
+    for (uint8_t i = 0; i < SOLAR_CHANNELS; i++) {
+        sim_adc_values[solar_channels[i]] = raw;
+    }
+    sample_adc_snapshot();
+}
+
+#define DITHER_BASE 0x300
+
+// Solar currents alternate between DITHER_BASE and DITHER_BASE + 1 on every
+// conversion (a mean of DITHER_BASE + 0.5)
+uint16_t dither_count[ADC_CHANNELS] = { 0 };
+uint16_t dither_source(uint8_t channel) {
+    for (uint8_t i = 0; i < SOLAR_CHANNELS; i++) {
+        if (channel == solar_channels[i]) {
+            return DITHER_BASE + (dither_count[channel]++ & 1);
+        }
+    }
+    return sim_adc_values[channel];
+}
+
+void oversample_test(void) {
+    sim_reset();
+    init_eps();
+    heater_mode = HEATER_MODE_SHADOW;
+
+    // The sun threshold is half a count per channel above DITHER_BASE
+    uint16_t offset = (SOLAR_CHANNELS - 1) * HEATER_SOLAR_CUR_ZERO_RAW;
+    set_raw_heater_cur_thresh(&heater_sun_cur_thresh_lower,
+        SOLAR_CHANNELS * DITHER_BASE - offset);
+    set_raw_heater_cur_thresh(&heater_sun_cur_thresh_upper,
+        SOLAR_CHANNELS * DITHER_BASE + 1 - offset);
+
+    // A single conversion per channel can't see it
+    sim_adc_source = dither_source;
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SHADOW);
+
+    // The mean of 16 can
+    for (uint8_t i = 0; i < SOLAR_CHANNELS; i++) {
+        ASSERT_TRUE(set_meas_oversample_ratio(solar_channels[i], 16));
+    }
+    sample_adc_snapshot();
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SUN);
+    sim_adc_source = NULL;
+
+    // The half count is also available over CAN
+    uint32_t data = 0;
+    uint8_t status = CAN_STATUS_OK;
+    handle_rx_hk(CAN_EPS_HK_ADC_EXT(ADC_IMON_X_PLUS), &status, &data);
+    ASSERT_EQ(status, CAN_STATUS_OK);
+    ASSERT_EQ(data, (DITHER_BASE << MEAS_EXT_FRAC_BITS) +
+        (1 << (MEAS_EXT_FRAC_BITS - 1)));
+}
+
+void dac_coalesce_test(void) {
+    sim_reset();
+    init_eps();
+    ASSERT_EQ(sim_dac_outputs[DAC_A], HEATER_1_DEF_SHADOW_SETPOINT);
+    ASSERT_EQ(sim_dac_outputs[DAC_B], HEATER_2_DEF_SHADOW_SETPOINT);
+
+    // Staying in shadow mode doesn't write anything
+    uint32_t writes = sim_dac_writes;
+    uint32_t skipped = heater_dac_writes_skipped;
+    set_solar_current(0);
+    for (uint8_t i = 0; i < 10; i++) {
+        control_heater_mode();
+    }
+    ASSERT_EQ(sim_dac_writes, writes);
+    ASSERT_EQ(heater_dac_writes_skipped, skipped + 20);
+
+    // Both sun setpoints differ - both outputs change in one update (A waits
+    // for B, even with the sim's LDAC pin tied low)
+    uint32_t updates = sim_dac_updates;
+    set_solar_current(0x0C4);
+    control_heater_mode();
+    ASSERT_EQ(heater_mode, HEATER_MODE_SUN);
+    ASSERT_EQ(sim_dac_writes, writes + 2);
+    ASSERT_EQ(sim_dac_updates, updates + 1);
+    ASSERT_EQ(sim_dac_outputs[DAC_A], HEATER_1_DEF_SUN_SETPOINT);
+    ASSERT_EQ(sim_dac_outputs[DAC_B], HEATER_2_DEF_SUN_SETPOINT);
+    ASSERT_EQ(dac.raw_voltage_a, HEATER_1_DEF_SUN_SETPOINT);
+    ASSERT_EQ(dac.raw_voltage_b, HEATER_2_DEF_SUN_SETPOINT);
+
+    // Only the channel whose setpoint changed is written
+    writes = sim_dac_writes;
+    skipped = heater_dac_writes_skipped;
+    set_raw_heater_setpoint(&heater_2_sun_setpoint, 0x3A0);
+    ASSERT_EQ(sim_dac_writes, writes + 1);
+    ASSERT_EQ(heater_dac_writes_skipped, skipped + 1);
+    ASSERT_EQ(sim_dac_outputs[DAC_B], 0x3A0);
+
+    // Changing the other mode's setpoint doesn't touch the outputs
+    writes = sim_dac_writes;
+    set_raw_heater_setpoint(&heater_1_shadow_setpoint, 0x410);
+    ASSERT_EQ(sim_dac_writes, writes);
+    ASSERT_EQ(sim_dac_outputs[DAC_A], HEATER_1_DEF_SUN_SETPOINT);
+
+    // Available over CAN
+    uint32_t data = 0;
+    uint8_t status = CAN_STATUS_OK;
+    handle_rx_hk(CAN_EPS_HK_DAC_SKIPPED, &status, &data);
+    ASSERT_EQ(status, CAN_STATUS_OK);
+    ASSERT_EQ(data, heater_dac_writes_skipped);
+}
+
+test_t t1 = { .name = "equivalence test", .fn = equivalence_test };
+test_t t2 = { .name = "boundary test", .fn = boundary_test };
+test_t t3 = { .name = "dac coalesce test", .fn = dac_coalesce_test };
+test_t t4 = { .name = "oversample test", .fn = oversample_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
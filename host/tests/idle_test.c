@@ -0,0 +1,215 @@
+/*
+Host test of idle sleep: the main loop only sleeps when no task has work,
+every interrupt source wakes it up, and under a scripted CAN load every
+command is still answered while most of the time is spent asleep.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+// Scripted CAN load - one HK request every `cmd_period_us` until `cmd_end_us`
+static uint64_t cmd_period_us = 0;
+static uint64_t cmd_next_us = 0;
+static uint64_t cmd_end_us = 0;
+static uint32_t cmd_sent = 0;
+
+void setup(void) {
+    sim_reset();
+    sim_imu_attach();
+    init_eps();
+    // Only count the main loop's sleeps (not the IMU initialization waiting
+    // for SPI transfers)
+    sim_sleep_count = 0;
+    sim_sleep_us = 0;
+    cmd_period_us = 0;
+    cmd_sent = 0;
+}
+
+// Delivers the scripted CAN frames as the CAN interrupt would
+void cmd_tick(void) {
+    while (cmd_period_us > 0 && sim_time_us >= cmd_next_us &&
+            cmd_next_us < cmd_end_us) {
+        uint8_t rx_msg[8] = { CAN_EPS_HK, CAN_EPS_HK_BAT_VOL, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00 };
+        sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+        cmd_sent++;
+        cmd_next_us += cmd_period_us;
+    }
+}
+
+// Same tasks as the main loop in main.c, except run_idle()
+void run_tasks(void) {
+    run_hb();
+    run_protection();
+    run_measurements();
+    run_battery();
+    run_rail_stats();
+    run_heaters();
+    send_next_tx_msg();
+    process_next_rx_msg();
+    run_imu();
+    run_config();
+}
+
+// Runs the main loop until `us` of simulated time has passed, returns the
+// number of CAN frames transmitted
+uint32_t run_main_loop(uint64_t us) {
+    uint64_t end_us = sim_time_us + us;
+    uint32_t tx_count = 0;
+    uint8_t tx_msg[8];
+    while (sim_time_us < end_us) {
+        run_tasks();
+        run_idle();
+        while (sim_can_tx_pop(tx_msg) != 0) {
+            tx_count++;
+        }
+    }
+    return tx_count;
+}
+
+void pending_work_test(void) {
+    setup();
+    run_tasks();
+    ASSERT_FALSE(is_work_pending());
+
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, CAN_EPS_CTRL_PING, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00 };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    ASSERT_TRUE(is_work_pending());
+    run_idle();
+    ASSERT_EQ(sim_sleep_count, 0);
+
+    // The response is waiting to be sent
+    process_next_rx_msg();
+    ASSERT_TRUE(is_work_pending());
+    run_tasks();
+    ASSERT_FALSE(is_work_pending());
+
+    // A second has passed
+    sim_advance_us(1000000);
+    ASSERT_TRUE(is_meas_due());
+    ASSERT_TRUE(is_work_pending());
+    run_idle();
+    ASSERT_EQ(sim_sleep_count, 0);
+}
+
+void wake_test(void) {
+    setup();
+    // Nothing is streamed, so only the timers wake the MCU up
+    stop_imu_acq();
+    run_protection();
+    run_measurements();
+    run_battery();
+    run_rail_stats();
+    run_heaters();
+    // Stopping the streams waited for SPI transfers in sleep
+    sim_sleep_count = 0;
+
+    // The protection tick (Timer 1 compare B), which also times the battery
+    // and rail current samples
+    uint64_t start_us = sim_time_us;
+    run_idle();
+    ASSERT_EQ(sim_sleep_count, 1);
+    ASSERT_TRUE(is_prot_check_due());
+    ASSERT_TRUE(sim_time_us - start_us <= 10000);
+    run_protection();
+    run_battery();
+    run_rail_stats();
+    ASSERT_FALSE(is_work_pending());
+
+    // Without it, the uptime timer
+    TIMSK1 &= (uint8_t) ~_BV(OCIE1B);
+    uint32_t uptime = uptime_s;
+    sim_sleep_count = 0;
+    idle_sleep_count = 0;
+    run_idle();
+    ASSERT_EQ(sim_sleep_count, 1);
+    ASSERT_EQ(idle_sleep_count, 1);
+    ASSERT_EQ(uptime_s, uptime + 1);
+    ASSERT_EQ(sim_time_us % 1000000, 0);
+
+    // Woken up by a CAN frame 30 ms into the next sleep
+    run_measurements();
+    cmd_period_us = 1000000;
+    cmd_next_us = sim_time_us + 30000;
+    cmd_end_us = cmd_next_us + 1;
+    sim_add_tick_hook(cmd_tick);
+    start_us = sim_time_us;
+    run_idle();
+    ASSERT_EQ(sim_sleep_count, 2);
+    ASSERT_EQ(cmd_sent, 1);
+    ASSERT_EQ(sim_time_us - start_us, 30000);
+
+    // The IMU reports wake it up through INT2, then the SPI interrupt wakes
+    // it up while the packet is read in the background
+    process_next_rx_msg();
+    send_next_tx_msg();
+    start_imu_stream(IMU_CAL_GYRO);
+    run_imu();
+    uint32_t reports = imu_record.cal_gyro.count;
+    run_idle();
+    ASSERT_EQ(idle_sleep_count, 3);
+    ASSERT_TRUE(imu_int_flag);
+    run_imu();
+    ASSERT_EQ(imu_rx_state, IMU_RX_BUSY);
+    while (imu_rx_state == IMU_RX_BUSY && idle_sleep_count < 100) {
+        run_idle();
+    }
+    ASSERT_TRUE(is_work_pending());
+    run_imu();
+    ASSERT_EQ(imu_record.cal_gyro.count, reports + 1);
+    ASSERT_EQ(sim_sleep_stuck, 0);
+}
+
+void can_load_test(void) {
+    setup();
+    print_can_msgs = false;
+    // 50 commands per second for 10 s
+    cmd_period_us = 20000;
+    cmd_next_us = sim_time_us;
+    cmd_end_us = sim_time_us + 10000000;
+    sim_add_tick_hook(cmd_tick);
+
+    uint32_t tx_count = run_main_loop(11000000);
+    ASSERT_EQ(cmd_sent, 500);
+    ASSERT_EQ(tx_count, 500);
+    ASSERT_EQ(can_rx_ring.overflows, 0);
+
+    // At least one sleep per command, per IMU packet, per protection check
+    // and per second, but not more than one per wake-up (including one per
+    // SPI byte of the IMU packets read in the background)
+    ASSERT_TRUE(sim_sleep_count >= 500 + 100 + 1000 + 10);
+    ASSERT_TRUE(sim_sleep_count <= 500 + 2 * 110 + 1101 + 11 + sim_spi_bytes);
+    // The rest are ADC samples waiting for an IMU packet transfer to end
+    ASSERT_TRUE(idle_sleep_count <= sim_sleep_count);
+    ASSERT_TRUE(idle_sleep_count + 2 * 110 >= sim_sleep_count);
+    ASSERT_EQ(sim_sleep_stuck, 0);
+
+    // Most of the time is spent asleep
+    ASSERT_TRUE(sim_sleep_us > 9000000);
+    ASSERT_TRUE(idle_fraction > 800);
+    ASSERT_TRUE(idle_fraction <= 1000);
+}
+
+void disabled_test(void) {
+    setup();
+    idle_sleep_enabled = false;
+    run_tasks();
+    run_idle();
+    ASSERT_EQ(sim_sleep_count, 0);
+    ASSERT_EQ(idle_sleep_count, 0);
+    idle_sleep_enabled = true;
+}
+
+test_t t1 = { .name = "pending work test", .fn = pending_work_test };
+test_t t2 = { .name = "wake test", .fn = wake_test };
+test_t t3 = { .name = "can load test", .fn = can_load_test };
+test_t t4 = { .name = "disabled test", .fn = disabled_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
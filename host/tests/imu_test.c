@@ -0,0 +1,427 @@
+/*
+Host test of the event-driven IMU driver: HINT edges set a timestamped flag,
+stepping a command never waits for the hub, the waits are counted in the
+histogram OBC reads over CAN, and a hub that never answers fails the command
+after IMU_INT_TIMEOUT_MS. With a batch interval, the hub delivers the same
+reports in fewer packets. Every sample is stamped with when the hub took it,
+even past a timestamp rebase, and OBC can arm the ring, decimate it and drain
+it over CAN.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void setup(bool attach) {
+    sim_reset();
+    if (attach) {
+        sim_imu_attach();
+    }
+    init_eps();
+    print_can_msgs = false;
+}
+
+// Sends a CTRL command and returns the response status
+uint8_t send_ctrl(uint8_t field_num, uint32_t data, uint32_t* tx_data) {
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    if (tx_data != NULL) {
+        *tx_data = ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+            ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+    }
+    return tx_msg[2];
+}
+
+uint32_t hist_total(void) {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < IMU_WAIT_HIST_BINS; i++) {
+        total += imu_wait_hist[i];
+    }
+    return total;
+}
+
+void int_flag_test(void) {
+    setup(true);
+    run_imu();
+    ASSERT_FALSE(imu_int_flag);
+
+    // The next streamed report asserts HINT
+    uint32_t start = read_loop_time();
+    while (!imu_int_flag && sim_time_us < 1000000) {
+        sim_advance_us(128);
+    }
+    ASSERT_TRUE(imu_int_flag);
+    ASSERT_EQ(get_imu_int(), 0);
+    uint32_t now = read_loop_time();
+    ASSERT_TRUE(imu_int_time >= start);
+    ASSERT_TRUE(now - imu_int_time <= 1);
+
+    // Serviced by the main loop, not the interrupt
+    run_imu();
+    ASSERT_FALSE(imu_int_flag);
+    ASSERT_EQ(imu_rx_state, IMU_RX_BUSY);
+}
+
+void step_test(void) {
+    setup(true);
+    reset_imu_wait_hist();
+    ASSERT_TRUE(start_imu_set_feat_cmd(IMU_ACCEL, IMU_DEF_REPORT_INTERVAL, 0));
+    // Only one command at a time
+    ASSERT_FALSE(start_imu_set_feat_cmd(IMU_MAG, IMU_DEF_REPORT_INTERVAL, 0));
+
+    // Each step returns straight away while the hub isn't ready
+    uint64_t start_us = sim_time_us;
+    uint32_t steps = 0;
+    uint8_t result = IMU_PENDING;
+    while ((result = step_imu()) == IMU_PENDING && steps < 10000) {
+        ASSERT_EQ(sim_time_us, start_us);
+        steps++;
+        sim_advance_us(100);
+        start_us = sim_time_us;
+    }
+    ASSERT_EQ(result, IMU_DONE);
+    ASSERT_TRUE(steps > 1);
+    ASSERT_FALSE(is_imu_op_pending());
+    ASSERT_TRUE(finish_imu_op());
+
+    // Waited for the hub to wake up, then for the response
+    ASSERT_TRUE(hist_total() >= 2);
+    ASSERT_EQ(imu_wait_timeouts, 0);
+}
+
+void timeout_test(void) {
+    // No hub on the bus
+    setup(false);
+    reset_imu_wait_hist();
+    ASSERT_TRUE(start_imu_set_feat_cmd(IMU_ACCEL, IMU_DEF_REPORT_INTERVAL, 0));
+    ASSERT_EQ(PORTB & _BV(PB6), 0);
+    sim_advance_us(100000);
+    ASSERT_EQ(step_imu(), IMU_PENDING);
+    sim_advance_us(30000);
+    ASSERT_EQ(step_imu(), IMU_FAILED);
+    ASSERT_EQ(imu_wait_timeouts, 1);
+    ASSERT_EQ(hist_total(), 0);
+    // PS0/WAKE released
+    ASSERT_EQ(PORTB & _BV(PB6), _BV(PB6));
+
+    // The blocking version sleeps instead of polling
+    uint32_t sleeps = sim_sleep_count;
+    uint64_t start_us = sim_time_us;
+    ASSERT_FALSE(enable_imu_feat(IMU_ACCEL));
+    ASSERT_TRUE(sim_sleep_count > sleeps);
+    ASSERT_TRUE(sim_time_us - start_us >= IMU_INT_TIMEOUT_MS * 1000UL);
+    ASSERT_TRUE(sim_time_us - start_us <= (IMU_INT_TIMEOUT_MS + 20) * 1000UL);
+    ASSERT_EQ(imu_wait_timeouts, 2);
+    ASSERT_EQ(sim_sleep_stuck, 0);
+}
+
+void ctrl_test(void) {
+    setup(true);
+    uint16_t x = 0;
+    ASSERT_TRUE(get_imu_accel(&x, NULL, NULL));
+
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < IMU_WAIT_HIST_BINS; i++) {
+        uint32_t count = 0;
+        ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_WAIT_HIST, i, &count),
+            CAN_STATUS_OK);
+        ASSERT_EQ(count, imu_wait_hist[i]);
+        total += count;
+    }
+    ASSERT_TRUE(total > 0);
+    uint32_t timeouts = 0xFF;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_WAIT_HIST, IMU_WAIT_HIST_BINS,
+        &timeouts), CAN_STATUS_OK);
+    ASSERT_EQ(timeouts, 0);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_WAIT_HIST, IMU_WAIT_HIST_BINS + 1,
+        NULL), CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_WAIT_HIST, 0x100, NULL),
+        CAN_STATUS_INVALID_DATA);
+
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_RESET_IMU_WAIT_HIST, 0, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(hist_total(), 0);
+}
+
+uint32_t record_counts(void) {
+    return imu_record.accel.count + imu_record.cal_gyro.count +
+        imu_record.uncal_gyro.count;
+}
+
+// Runs the main loop's IMU servicing for `ms`, returns the reports received
+uint32_t run_imu_for(uint32_t ms) {
+    uint32_t counts = record_counts();
+    for (uint32_t i = 0; i < ms / 10; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    return record_counts() - counts;
+}
+
+void interval_ctrl_test(void) {
+    setup(true);
+    uint32_t value = 0;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_INTERVAL, (IMU_CAL_GYRO << 8) | 0,
+        &value), CAN_STATUS_OK);
+    ASSERT_EQ(value, IMU_DEF_STREAM_INTERVAL);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_INTERVAL, (IMU_CAL_GYRO << 8) | 1,
+        &value), CAN_STATUS_OK);
+    ASSERT_EQ(value, IMU_DEF_BATCH_INTERVAL);
+
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_BATCH_INTERVAL,
+        ((uint32_t) IMU_CAL_GYRO << 24) | 300000, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL,
+        ((uint32_t) IMU_CAL_GYRO << 24) | 50000, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(imu_cal_gyro_intervals.report, 50000);
+    ASSERT_EQ(imu_cal_gyro_intervals.batch, 300000);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_INTERVAL, (IMU_CAL_GYRO << 8) | 1,
+        &value), CAN_STATUS_OK);
+    ASSERT_EQ(value, 300000);
+    // Other features are unchanged
+    ASSERT_EQ(imu_accel_intervals.report, IMU_DEF_STREAM_INTERVAL);
+
+    // Unsupported features, items and a report interval of 0
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_INTERVAL, (IMU_MAG << 8) | 0, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_INTERVAL, (IMU_ACCEL << 8) | 2, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL,
+        ((uint32_t) IMU_MAG << 24) | 50000, NULL), CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL,
+        ((uint32_t) IMU_ACCEL << 24) | 0, NULL), CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(imu_accel_intervals.report, IMU_DEF_STREAM_INTERVAL);
+
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+}
+
+void batch_test(void) {
+    setup(true);
+    run_imu_for(500);
+    uint32_t packets = sim_imu_packets;
+    uint32_t int_count = imu_record.packets;
+    uint32_t reports = run_imu_for(2000);
+    uint32_t unbatched_packets = sim_imu_packets - packets;
+    uint32_t unbatched_ints = imu_record.packets - int_count;
+    // 3 features at 100ms
+    ASSERT_TRUE(reports >= 3 * 19);
+
+    // Batch 5 reports of each feature
+    ASSERT_TRUE(set_imu_intervals(IMU_ACCEL, IMU_DEF_STREAM_INTERVAL, 500000));
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, IMU_DEF_STREAM_INTERVAL, 500000));
+    ASSERT_TRUE(set_imu_intervals(IMU_UNCAL_GYRO, IMU_DEF_STREAM_INTERVAL, 500000));
+    run_imu_for(500);
+    packets = sim_imu_packets;
+    int_count = imu_record.packets;
+    uint32_t batched_reports = run_imu_for(2000);
+    uint32_t batched_packets = sim_imu_packets - packets;
+    uint32_t batched_ints = imu_record.packets - int_count;
+
+    // Every report still arrives, in far fewer wake-ups and transactions
+    ASSERT_TRUE(batched_reports + 3 * 5 >= reports);
+    ASSERT_TRUE(batched_packets * 4 <= unbatched_packets);
+    ASSERT_TRUE(batched_ints * 4 <= unbatched_ints);
+    ASSERT_EQ(imu_parser.skipped, 0);
+
+    ASSERT_TRUE(set_imu_intervals(IMU_ACCEL, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+    ASSERT_TRUE(set_imu_intervals(IMU_UNCAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+}
+
+uint32_t abs_diff(uint32_t a, uint32_t b) {
+    return (a > b) ? a - b : b - a;
+}
+
+// Checks the samples in the ring are `interval_us` apart for each feature
+// (within the 128us tick and 100us timebase resolution), and taken no later
+// than now and at most `max_age_us` ago
+void check_sample_times(uint32_t interval_us, uint32_t max_age_us) {
+    uint32_t now_us = read_loop_time() * IMU_TICK_US;
+    uint32_t last_us[8] = { 0 };
+    uint8_t counts[8] = { 0 };
+    imu_ring_entry_t entry;
+    while (pop_imu_sample(&entry)) {
+        ASSERT_TRUE(entry.id < 8);
+        ASSERT_TRUE(now_us - entry.time_us < max_age_us);
+        if (counts[entry.id] > 0) {
+            ASSERT_TRUE(abs_diff(entry.time_us - last_us[entry.id],
+                interval_us) <= 400);
+        }
+        last_us[entry.id] = entry.time_us;
+        counts[entry.id]++;
+    }
+    ASSERT_TRUE(counts[IMU_ACCEL] >= 3);
+    ASSERT_TRUE(counts[IMU_CAL_GYRO] >= 3);
+    ASSERT_TRUE(counts[IMU_UNCAL_GYRO] >= 3);
+}
+
+void timestamp_test(void) {
+    setup(true);
+    set_imu_ring_decimation(1);
+    run_imu_for(500);
+    reset_imu_samples();
+    run_imu_for(500);
+    // Reported straight away, so taken at most one timebase delta before HINT
+    uint32_t int_us = imu_record.accel.int_time * 128;
+    ASSERT_TRUE(int_us - imu_record.accel.time_us <=
+        imu_record.base_delta * 100 + 128);
+    check_sample_times(IMU_DEF_STREAM_INTERVAL, 2000000);
+
+    // The reports of a batch are received together, but keep the times they
+    // were taken
+    ASSERT_TRUE(set_imu_intervals(IMU_ACCEL, IMU_DEF_STREAM_INTERVAL, 500000));
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, IMU_DEF_STREAM_INTERVAL, 500000));
+    ASSERT_TRUE(set_imu_intervals(IMU_UNCAL_GYRO, IMU_DEF_STREAM_INTERVAL, 500000));
+    run_imu_for(600);
+    reset_imu_samples();
+    run_imu_for(1000);
+    ASSERT_TRUE(imu_sample_count() >= 3 * 5);
+    check_sample_times(IMU_DEF_STREAM_INTERVAL, 2000000);
+    ASSERT_EQ(take_imu_samples_dropped(), 0);
+
+    ASSERT_TRUE(set_imu_intervals(IMU_ACCEL, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+    ASSERT_TRUE(set_imu_intervals(IMU_UNCAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+}
+
+// A batch longer than the 14-bit report delay (1.6383 s) has a timestamp
+// rebase in the middle, and the reports after it keep their times too
+void rebase_test(void) {
+    setup(true);
+    set_imu_ring_decimation(1);
+    // 16 reports (a full FIFO) take about 2.1 s
+    ASSERT_TRUE(set_imu_intervals(IMU_ACCEL, 400000, 3000000));
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, 400000, 3000000));
+    ASSERT_TRUE(set_imu_intervals(IMU_UNCAL_GYRO, 400000, 3000000));
+    run_imu_for(2500);
+    reset_imu_samples();
+    uint32_t rebases = sim_imu_rebases;
+    run_imu_for(4000);
+    ASSERT_TRUE(sim_imu_rebases >= rebases + 1);
+    ASSERT_TRUE(imu_sample_count() >= 3 * 5);
+    check_sample_times(400000, 4500000);
+    ASSERT_EQ(take_imu_samples_dropped(), 0);
+    ASSERT_EQ(imu_parser.skipped, 0);
+
+    ASSERT_TRUE(set_imu_intervals(IMU_ACCEL, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+    ASSERT_TRUE(set_imu_intervals(IMU_CAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+    ASSERT_TRUE(set_imu_intervals(IMU_UNCAL_GYRO, IMU_DEF_STREAM_INTERVAL,
+        IMU_DEF_BATCH_INTERVAL));
+}
+
+void dump_test(void) {
+    setup(true);
+    set_imu_ring_decimation(1);
+    reset_imu_samples();
+    // More samples than the ring holds
+    run_imu_for(2500);
+    ASSERT_EQ(imu_sample_count(), IMU_SAMPLE_RING_SIZE);
+    uint32_t dropped = imu_sample_ring.dropped;
+    ASSERT_TRUE(dropped > 0);
+    imu_ring_entry_t expected[IMU_SAMPLE_RING_SIZE];
+    for (uint8_t i = 0; i < IMU_SAMPLE_RING_SIZE; i++) {
+        expected[i] = imu_sample_ring.entries[
+            (imu_sample_ring.start + i) % IMU_SAMPLE_RING_SIZE];
+    }
+
+    uint8_t rx_msg[8] = { CAN_EPS_IMU_DUMP };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    ASSERT_TRUE(imu_dump_active);
+
+    uint8_t tx_msg[8];
+    uint8_t samples = 0;
+    bool ended = false;
+    for (uint16_t i = 0; i < 200 && !ended; i++) {
+        send_next_tx_msg();
+        if (sim_can_tx_pop(tx_msg) == 0) {
+            continue;
+        }
+        ASSERT_EQ(tx_msg[0], CAN_EPS_IMU_DUMP);
+        uint32_t data = ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+            ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+        if (tx_msg[1] == CAN_EPS_IMU_DUMP_END) {
+            ASSERT_EQ(data, dropped);
+            ended = true;
+        } else if (tx_msg[1] & CAN_EPS_IMU_DUMP_DATA) {
+            ASSERT_EQ(tx_msg[1], expected[samples].id | CAN_EPS_IMU_DUMP_DATA);
+            ASSERT_EQ((tx_msg[2] << 8) | tx_msg[3], expected[samples].data[0]);
+            ASSERT_EQ((tx_msg[6] << 8) | tx_msg[7], expected[samples].data[2]);
+            samples++;
+        } else {
+            ASSERT_EQ(tx_msg[1], expected[samples].id);
+            ASSERT_EQ(data, expected[samples].time_us);
+        }
+    }
+    ASSERT_TRUE(ended);
+    ASSERT_FALSE(imu_dump_active);
+    ASSERT_EQ(samples, IMU_SAMPLE_RING_SIZE);
+    ASSERT_EQ(imu_sample_count(), 0);
+    ASSERT_EQ(imu_sample_ring.dropped, 0);
+
+    // An empty ring only gets the end frame
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[1], CAN_EPS_IMU_DUMP_END);
+    send_next_tx_msg();
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 0);
+}
+
+// Nothing is added to the ring until OBC arms it, then every nth report of
+// each feature
+void decimation_test(void) {
+    setup(true);
+    uint32_t value = 0;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_RING_DECIMATION, 0, &value), 0);
+    ASSERT_EQ(value, 0);
+    run_imu_for(1000);
+    ASSERT_EQ(imu_sample_count(), 0);
+    ASSERT_EQ(take_imu_samples_dropped(), 0);
+
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_RING_DECIMATION, 0x100, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_RING_DECIMATION, 4, NULL), 0);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_IMU_RING_DECIMATION, 0, &value), 0);
+    ASSERT_EQ(value, 4);
+    run_imu_for(2000);
+    ASSERT_TRUE(imu_sample_count() >= 3 * 4);
+    ASSERT_TRUE(imu_sample_count() <= 3 * 6);
+    check_sample_times(4 * IMU_DEF_STREAM_INTERVAL, 2500000);
+
+    // Disarmed again
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_IMU_RING_DECIMATION, 0, NULL), 0);
+    run_imu_for(1000);
+    ASSERT_EQ(imu_sample_count(), 0);
+}
+
+test_t t1 = { .name = "int flag test", .fn = int_flag_test };
+test_t t2 = { .name = "step test", .fn = step_test };
+test_t t3 = { .name = "timeout test", .fn = timeout_test };
+test_t t4 = { .name = "ctrl test", .fn = ctrl_test };
+test_t t5 = { .name = "interval ctrl test", .fn = interval_ctrl_test };
+test_t t6 = { .name = "batch test", .fn = batch_test };
+test_t t7 = { .name = "timestamp test", .fn = timestamp_test };
+test_t t8 = { .name = "rebase test", .fn = rebase_test };
+test_t t9 = { .name = "dump test", .fn = dump_test };
+test_t t10 = { .name = "decimation test", .fn = decimation_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &t10 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
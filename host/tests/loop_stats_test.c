@@ -0,0 +1,104 @@
+/*
+Host test of the main loop stage statistics: durations measured with the
+uptime timer, the log2 histogram, and reading/resetting them over CAN.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+    // Start at a second boundary so whole numbers of 128 us ticks are exact
+    sim_advance_us(1000000 - sim_time_us % 1000000);
+}
+
+uint32_t get_stat(uint8_t stage, uint8_t item, uint8_t expected_status) {
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, CAN_EPS_CTRL_GET_LOOP_STATS, 0x00, 0x00,
+        0x00, 0x00, stage, item };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[2], expected_status);
+    return ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+        ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+}
+
+void timer_test(void) {
+    setup();
+    // Across a second boundary
+    sim_advance_us(900000);
+    uint32_t start = read_loop_time();
+    sim_advance_us(256000);
+    // 256 ms is 2000 ticks of 128 us
+    uint32_t ticks = read_loop_time() - start;
+    ASSERT_TRUE(ticks >= 1999 && ticks <= 2001);
+}
+
+void record_test(void) {
+    setup();
+    uint32_t start = read_loop_time();
+    // 0 ticks, 1 tick, 10 ticks
+    start = record_loop_stage(LOOP_STAGE_HEATERS, start);
+    sim_advance_us(128);
+    start = record_loop_stage(LOOP_STAGE_HEATERS, start);
+    sim_advance_us(1280);
+    start = record_loop_stage(LOOP_STAGE_HEATERS, start);
+
+    loop_stage_stats_t* stats = &loop_stats[LOOP_STAGE_HEATERS];
+    ASSERT_EQ(stats->count, 3);
+    ASSERT_EQ(stats->min, 0);
+    ASSERT_EQ(stats->max, 10);
+    ASSERT_EQ(stats->sum, 11);
+    ASSERT_EQ(stats->hist[0], 1);
+    ASSERT_EQ(stats->hist[1], 1);
+    // [8, 16)
+    ASSERT_EQ(stats->hist[4], 1);
+
+    // Longer than the histogram and 16-bit min/max cover
+    sim_advance_us(10000000);
+    record_loop_stage(LOOP_STAGE_HEATERS, start);
+    ASSERT_EQ(stats->max, 0xFFFF);
+    ASSERT_EQ(stats->hist[LOOP_HIST_BINS - 1], 1);
+    ASSERT_EQ(loop_stats[LOOP_STAGE_HB].count, 0);
+}
+
+void can_test(void) {
+    setup();
+    uint32_t start = read_loop_time();
+    sim_advance_us(128 * 4);
+    start = record_loop_stage(LOOP_STAGE_CAN_RX, start);
+    sim_advance_us(128 * 8);
+    record_loop_stage(LOOP_STAGE_CAN_RX, start);
+
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_COUNT, CAN_STATUS_OK), 2);
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_MIN, CAN_STATUS_OK), 4);
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_MAX, CAN_STATUS_OK), 8);
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_MEAN, CAN_STATUS_OK), 6);
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_HIST + 3, CAN_STATUS_OK), 1);
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_HIST + 4, CAN_STATUS_OK), 1);
+    ASSERT_EQ(get_stat(0, LOOP_STAT_TICKS_PER_S, CAN_STATUS_OK), 7813);
+    get_stat(LOOP_STAGE_COUNT, LOOP_STAT_COUNT, CAN_STATUS_INVALID_DATA);
+    get_stat(0, LOOP_STAT_HIST + LOOP_HIST_BINS, CAN_STATUS_INVALID_DATA);
+
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, CAN_EPS_CTRL_RESET_LOOP_STATS };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    ASSERT_EQ(loop_stats[LOOP_STAGE_CAN_RX].count, 0);
+    ASSERT_EQ(get_stat(LOOP_STAGE_CAN_RX, LOOP_STAT_MIN, CAN_STATUS_OK), 0);
+}
+
+test_t t1 = { .name = "timer test", .fn = timer_test };
+test_t t2 = { .name = "record test", .fn = record_test };
+test_t t3 = { .name = "can test", .fn = can_test };
+
+test_t* suite[] = { &t1, &t2, &t3 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/*
+Host test of ADC sampling: one auto-1 sweep covers all 16 channels, the
+snapshot is double-buffered and carries the timestamp of the middle of the
+sweep and its duration, and oversampling improves the SNR by about 6 dB per
+factor of 4. HK requests never wait for the sweeps, however many there are.
+*/
+
+#include <math.h>
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+    // Only the snapshot's own conversions (the protection checks that run
+    // between sweeps are tested in protection_test)
+    loop_poll_fn = NULL;
+}
+
+// Sends a CTRL command and returns the response status
+uint8_t send_ctrl(uint8_t field_num, uint32_t data, uint32_t* tx_data) {
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    if (tx_data != NULL) {
+        *tx_data = ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+            ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+    }
+    return tx_msg[2];
+}
+
+// Mid-scale input with white noise of a few LSB (uniform in +/-6 LSB, about
+// what adc_snr_test shows in steady state), from a fixed-seed generator so the
+// data is the same on every run
+#define NOISY_MEAN 0x800
+uint32_t noise_state = 1;
+
+uint16_t noisy_source(uint8_t channel) {
+    (void) channel;
+    noise_state = noise_state * 1103515245 + 12345;
+    int16_t noise = (int16_t) ((noise_state >> 16) % 13) - 6;
+    return (uint16_t) (NOISY_MEAN + noise);
+}
+
+void sweep_test(void) {
+    setup();
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        sim_adc_values[i] = (uint16_t) (0x100 + i);
+    }
+
+    uint32_t conversions = sim_adc_conversions;
+    uint32_t frames = sim_adc_frames;
+    sample_adc_snapshot();
+    // One frame per channel plus the two program frames
+    ASSERT_EQ(sim_adc_conversions, conversions + ADC_CHANNELS);
+    ASSERT_EQ(sim_adc_frames, frames + ADC_CHANNELS + 2);
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        ASSERT_EQ(adc_snapshot->raw[i], 0x100 + i);
+    }
+}
+
+void double_buffer_test(void) {
+    setup();
+    sim_adc_values[ADC_VMON_PACK] = 0x123;
+    sample_adc_snapshot();
+    adc_snapshot_t* prev = adc_snapshot;
+    uint32_t count = prev->count;
+
+    // The next sweep goes into the other buffer, leaving the previous one
+    sim_adc_values[ADC_VMON_PACK] = 0x456;
+    sample_adc_snapshot();
+    ASSERT_TRUE(adc_snapshot != prev);
+    ASSERT_EQ(adc_snapshot->raw[ADC_VMON_PACK], 0x456);
+    ASSERT_EQ(adc_snapshot->count, count + 1);
+    ASSERT_EQ(prev->raw[ADC_VMON_PACK], 0x123);
+
+    sample_adc_snapshot();
+    ASSERT_TRUE(adc_snapshot == prev);
+    ASSERT_EQ(adc_snapshot->count, count + 2);
+}
+
+void timestamp_test(void) {
+    setup();
+    uint32_t ticks_per_s = 0;
+    get_loop_stat(0, LOOP_STAT_TICKS_PER_S, &ticks_per_s);
+
+    // 18 frames of 2 bytes at 64 us each take 2304 us (18 ticks)
+    sim_advance_us(1000000 - sim_time_us % 1000000 + 500000);
+    uint32_t seconds = uptime_s;
+    sample_adc_snapshot();
+    ASSERT_TRUE(adc_snapshot->sweep_ticks >= 17 &&
+        adc_snapshot->sweep_ticks <= 19);
+    ASSERT_EQ(adc_snapshot->uptime_s, seconds);
+    // Half way through the sweep
+    uint32_t mid = ticks_per_s / 2 + 9;
+    ASSERT_TRUE(adc_snapshot->ticks >= mid - 1 && adc_snapshot->ticks <= mid + 1);
+
+    // A sweep that straddles the start of a second is stamped in the next one
+    sim_advance_us(1000000 - sim_time_us % 1000000 - 500);
+    seconds = uptime_s;
+    sample_adc_snapshot();
+    ASSERT_EQ(uptime_s, seconds + 1);
+    ASSERT_EQ(adc_snapshot->uptime_s, seconds + 1);
+    ASSERT_TRUE(adc_snapshot->ticks <= 6);
+    ASSERT_TRUE(adc_snapshot->sweep_ticks >= 17 &&
+        adc_snapshot->sweep_ticks <= 19);
+}
+
+// Returns the RMS error of `count` snapshots of the noisy channel
+double rms_error(uint32_t count) {
+    double sum_sq = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sample_adc_snapshot();
+        double value = (double) adc_snapshot->ext[ADC_VMON_PACK] /
+            (1 << MEAS_EXT_FRAC_BITS);
+        sum_sq += (value - NOISY_MEAN) * (value - NOISY_MEAN);
+    }
+    return sqrt(sum_sq / count);
+}
+
+void snr_test(void) {
+    setup();
+    noise_state = 1;
+    sim_adc_source = noisy_source;
+    double single = rms_error(200);
+    ASSERT_TRUE(single > 3.0);
+
+    // Averaging 4^n samples halves the noise amplitude n times (6 dB each)
+    uint8_t ratios[] = { 4, 16, 64 };
+    double min_gain_db[] = { 5.0, 10.5, 16.0 };
+    for (uint8_t i = 0; i < 3; i++) {
+        ASSERT_TRUE(set_meas_oversample_ratio(ADC_VMON_PACK, ratios[i]));
+        double gain_db = 20 * log10(single / rms_error(200));
+        ASSERT_TRUE(gain_db > min_gain_db[i]);
+        ASSERT_TRUE(gain_db < min_gain_db[i] + 3.0);
+    }
+}
+
+void decimate_test(void) {
+    setup();
+    ASSERT_TRUE(set_meas_oversample_ratio(ADC_IMON_PACK, 16));
+    ASSERT_TRUE(set_meas_oversample_ratio(ADC_VMON_PACK, 4));
+
+    // 16 sweeps for the channel with the highest ratio
+    uint32_t frames = sim_adc_frames;
+    sim_adc_values[ADC_VMON_PACK] = 0x123;
+    sim_adc_values[ADC_IMON_PACK] = 0xFFF;
+    sim_adc_values[ADC_VMON_3V3] = 0x456;
+    sample_adc_snapshot();
+    ASSERT_EQ(sim_adc_frames, frames + 16 * (ADC_CHANNELS + 2));
+    // Constant inputs are unchanged by the averaging
+    ASSERT_EQ(adc_snapshot->raw[ADC_VMON_PACK], 0x123);
+    ASSERT_EQ(adc_snapshot->raw[ADC_IMON_PACK], 0xFFF);
+    ASSERT_EQ(adc_snapshot->raw[ADC_VMON_3V3], 0x456);
+    ASSERT_EQ(adc_snapshot->ext[ADC_IMON_PACK], 0xFFF0);
+    ASSERT_EQ(adc_snapshot->ext[ADC_VMON_3V3], 0x4560);
+}
+
+void can_config_test(void) {
+    setup();
+    uint32_t ratio = 0;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_ADC_OVERSAMPLE, ADC_IMON_5V, &ratio),
+        CAN_STATUS_OK);
+    ASSERT_EQ(ratio, 1);
+
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_ADC_OVERSAMPLE,
+        (ADC_IMON_5V << 8) | 64, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_ADC_OVERSAMPLE, ADC_IMON_5V, &ratio),
+        CAN_STATUS_OK);
+    ASSERT_EQ(ratio, 64);
+    ASSERT_EQ(get_meas_oversample_ratio(ADC_VMON_5V), 1);
+
+    // Every channel at once
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_ADC_OVERSAMPLE, (0xFF << 8) | 4, NULL),
+        CAN_STATUS_OK);
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        ASSERT_EQ(get_meas_oversample_ratio(i), 4);
+    }
+
+    // Invalid ratios and channels
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_ADC_OVERSAMPLE, (1 << 8) | 8, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_ADC_OVERSAMPLE, (16 << 8) | 4, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_ADC_OVERSAMPLE, 16, NULL),
+        CAN_STATUS_INVALID_DATA);
+
+    // Restored from the config journal after a restart
+    ASSERT_TRUE(set_meas_oversample_ratio(ADC_THM_BATT2, 16));
+    while (config_dirty || is_config_busy()) {
+        sim_advance_us(10000);
+        run_config();
+    }
+    restore_config();
+    init_measurements();
+    ASSERT_EQ(get_meas_oversample_ratio(ADC_THM_BATT2), 16);
+    ASSERT_EQ(get_meas_oversample_ratio(ADC_IMON_5V), 4);
+}
+
+void hk_no_sweep_test(void) {
+    setup();
+    // 64 sweeps per snapshot
+    ASSERT_TRUE(set_meas_oversample_ratio(0xFF, 64));
+    sim_advance_us(1000000);
+    ASSERT_TRUE(is_meas_due());
+
+    // The stale snapshot is answered straight away
+    uint32_t conversions = sim_adc_conversions;
+    uint64_t start_us = sim_time_us;
+    uint8_t rx_msg[8] = { CAN_EPS_HK, CAN_EPS_HK_BAT_VOL };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[2], CAN_STATUS_OK);
+    ASSERT_EQ(sim_adc_conversions, conversions);
+    ASSERT_EQ(sim_time_us, start_us);
+
+    // The main loop task does the sweeps
+    run_measurements();
+    ASSERT_EQ(sim_adc_conversions, conversions + 64 * ADC_CHANNELS);
+    ASSERT_FALSE(is_meas_due());
+    ASSERT_TRUE(set_meas_oversample_ratio(0xFF, 1));
+}
+
+test_t t1 = { .name = "sweep test", .fn = sweep_test };
+test_t t2 = { .name = "double buffer test", .fn = double_buffer_test };
+test_t t3 = { .name = "timestamp test", .fn = timestamp_test };
+test_t t4 = { .name = "snr test", .fn = snr_test };
+test_t t5 = { .name = "decimate test", .fn = decimate_test };
+test_t t6 = { .name = "can config test", .fn = can_config_test };
+test_t t7 = { .name = "hk no sweep test", .fn = hk_no_sweep_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
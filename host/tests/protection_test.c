@@ -0,0 +1,328 @@
+/*
+Host test of the protection task: a sustained overcurrent or undervoltage
+trips within a few checks, and is logged and reported over CAN, while a short
+glitch is ignored. A trip is latched until OBC clears it, the thresholds are
+kept in the config journal, and the loads are switched off through the PEX.
+The checks keep running during main loop stages that take much longer than
+their period.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+#define LOAD_PINS (_BV(PEX_LOAD_3V3_EN) | _BV(PEX_LOAD_5V_EN) | _BV(PEX_LOAD_PAY_EN))
+
+// 4.1 V pack (2.05 V per cell)
+#define LOW_PACK_RAW ((uint16_t) (4100.0 / BATT_VOL_FULL_SCALE_MV * 0x0FFF + 0.5))
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+    print_can_msgs = false;
+    // Starts with an empty log
+    uint8_t data[64];
+    while (read_event_log(data, sizeof(data)) > 0) {}
+}
+
+// Sends a CTRL command and returns the response status
+uint8_t send_ctrl(uint8_t field_num, uint32_t data, uint32_t* tx_data) {
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    if (tx_data != NULL) {
+        *tx_data = ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+            ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+    }
+    return tx_msg[2];
+}
+
+// Runs the protection task for `us`, returns the time until the first trip
+// (or `us` if nothing tripped)
+uint64_t run_for(uint64_t us) {
+    uint64_t start_us = sim_time_us;
+    uint64_t trip_us = us;
+    uint16_t trips = prot_trip_count;
+    while (sim_time_us - start_us < us) {
+        sim_advance_us(1000);
+        run_protection();
+        if (prot_trip_count != trips && trip_us == us) {
+            trip_us = sim_time_us - start_us;
+        }
+    }
+    return trip_us;
+}
+
+// Checks the load enable pins, given the loads (PROT_LOAD_*) that should be
+// switched off
+void check_loads(uint8_t off) {
+    uint8_t on = 0;
+    if (!(off & PROT_LOAD_3V3)) {
+        on |= _BV(PEX_LOAD_3V3_EN);
+    }
+    if (!(off & PROT_LOAD_5V)) {
+        on |= _BV(PEX_LOAD_5V_EN);
+    }
+    if (!(off & PROT_LOAD_PAY)) {
+        on |= _BV(PEX_LOAD_PAY_EN);
+    }
+    ASSERT_EQ(sim_pex_dirs[PEX_LOAD_PORT] & LOAD_PINS, 0);
+    ASSERT_EQ(sim_pex_outputs[PEX_LOAD_PORT] & LOAD_PINS, on);
+}
+
+// Finds the protection trip entry in the log, returns true if there is one
+bool read_trip_event(uint8_t* args) {
+    uint8_t data[EVENT_LOG_SIZE - 1];
+    uint8_t len = read_event_log(data, sizeof(data));
+    for (uint8_t i = 0; i + EVT_HEADER_LEN <= len;
+            i += EVT_HEADER_LEN + event_arg_len(data[i])) {
+        if (data[i] == EVT_PROT_TRIP) {
+            for (uint8_t j = 0; j < EVT_PROT_TRIP_LEN; j++) {
+                args[j] = data[i + EVT_HEADER_LEN + j];
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void init_test(void) {
+    setup();
+    check_loads(0);
+    ASSERT_EQ(prot_thresholds[PROT_PACK_UV], PROT_DEF_PACK_UV);
+
+    // The sim's defaults are a healthy pack (7.58 V) and no load
+    ASSERT_EQ(run_for(1000000), 1000000);
+    ASSERT_EQ(prot_tripped, 0);
+    ASSERT_EQ(prot_loads_off, 0);
+    check_loads(0);
+}
+
+void pay_short_test(void) {
+    setup();
+    sim_adc_values[ADC_IMON_PAY_LIM] = 0x0FFF;
+    uint64_t trip_us = run_for(100000);
+
+    // Within PROT_TRIP_SAMPLES checks of 10 ms
+    ASSERT_TRUE(trip_us <= 40000);
+    ASSERT_EQ(prot_tripped, _BV(PROT_PAY_OC));
+    ASSERT_EQ(prot_loads_off, PROT_LOAD_PAY);
+    check_loads(PROT_LOAD_PAY);
+    ASSERT_EQ(prot_trip_count, 1);
+
+    uint8_t args[EVT_PROT_TRIP_LEN] = { 0x00 };
+    ASSERT_TRUE(read_trip_event(args));
+    ASSERT_EQ(args[0], PROT_PAY_OC);
+    ASSERT_EQ(args[1], PROT_LOAD_PAY);
+    ASSERT_EQ((args[2] << 8) | args[3], 0x0FFF);
+    ASSERT_EQ((args[4] << 8) | args[5], PROT_DEF_PAY_OC);
+
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[0], CAN_EPS_PROT_TRIP);
+    ASSERT_EQ(tx_msg[1], PROT_PAY_OC);
+    ASSERT_EQ(tx_msg[2], PROT_LOAD_PAY);
+    ASSERT_EQ(tx_msg[3], PROT_LOAD_PAY);
+    ASSERT_EQ((tx_msg[4] << 8) | tx_msg[5], 0x0FFF);
+    ASSERT_EQ((tx_msg[6] << 8) | tx_msg[7], PROT_DEF_PAY_OC);
+}
+
+void glitch_test(void) {
+    setup();
+    // One check short of tripping, then back to normal
+    sim_adc_values[ADC_IMON_3V3] = 0x0FFF;
+    uint8_t checks = 0;
+    while (checks < PROT_TRIP_SAMPLES - 1) {
+        sim_advance_us(1000);
+        if (is_prot_check_due()) {
+            run_protection();
+            checks++;
+        }
+    }
+    sim_adc_values[ADC_IMON_3V3] = 0;
+    run_for(10000);
+
+    sim_adc_values[ADC_IMON_3V3] = 0x0FFF;
+    ASSERT_EQ(run_for(15000), 15000);
+    sim_adc_values[ADC_IMON_3V3] = 0;
+    ASSERT_EQ(run_for(1000000), 1000000);
+    ASSERT_EQ(prot_tripped, 0);
+    check_loads(0);
+    uint8_t args[EVT_PROT_TRIP_LEN];
+    ASSERT_FALSE(read_trip_event(args));
+}
+
+void undervoltage_test(void) {
+    setup();
+    // Just above the default threshold (6.0 V)
+    sim_adc_values[ADC_VMON_PACK] = PROT_DEF_PACK_UV;
+    ASSERT_EQ(run_for(100000), 100000);
+    ASSERT_EQ(prot_tripped, 0);
+
+    // A 4.1 V pack trips with the default threshold
+    sim_adc_values[ADC_VMON_PACK] = LOW_PACK_RAW;
+    ASSERT_TRUE(run_for(100000) <= 40000);
+    ASSERT_EQ(prot_tripped, _BV(PROT_PACK_UV));
+    ASSERT_EQ(prot_loads_off, PROT_LOAD_5V | PROT_LOAD_PAY);
+    check_loads(PROT_LOAD_5V | PROT_LOAD_PAY);
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[0], CAN_EPS_PROT_TRIP);
+
+    // A threshold of 0 disables the check
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_PROT_THRESH,
+        ((uint32_t) PROT_PACK_UV << 16) | 0, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_CLEAR_PROT, 0, NULL), CAN_STATUS_OK);
+    check_loads(0);
+    sim_adc_values[ADC_VMON_PACK] = 0;
+    ASSERT_EQ(run_for(100000), 100000);
+    ASSERT_EQ(prot_tripped, 0);
+}
+
+// Time at which prot_trip_count reached `stage_trip_target`, seen by the ADC
+// from inside a long stage
+uint16_t stage_trip_target = 0;
+uint64_t stage_trip_us = 0;
+uint16_t trip_time_source(uint8_t channel) {
+    if (stage_trip_us == 0 && prot_trip_count >= stage_trip_target) {
+        stage_trip_us = sim_time_us;
+    }
+    return sim_adc_values[channel];
+}
+
+void long_stage_test(void) {
+    setup();
+    sim_adc_source = trip_time_source;
+
+    // A snapshot of 64 sweeps takes over 100 ms
+    ASSERT_TRUE(set_meas_oversample_ratio(0xFF, 64));
+    sim_adc_values[ADC_IMON_PAY_LIM] = 0x0FFF;
+    stage_trip_target = 1;
+    stage_trip_us = 0;
+    uint64_t start_us = sim_time_us;
+    sample_adc_snapshot();
+    ASSERT_TRUE(sim_time_us - start_us >= 100000);
+    ASSERT_TRUE(stage_trip_us != 0);
+    ASSERT_TRUE(stage_trip_us - start_us <= 40000);
+    check_loads(PROT_LOAD_PAY);
+
+    // Reported by the main loop task, not from inside the stage
+    uint8_t tx_msg[8] = { 0x00 };
+    send_next_tx_msg();
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 0);
+    run_protection();
+    send_next_tx_msg();
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[0], CAN_EPS_PROT_TRIP);
+    ASSERT_EQ(tx_msg[1], PROT_PAY_OC);
+    ASSERT_EQ(tx_msg[2], PROT_LOAD_PAY);
+
+    // A blocking IMU command waits IMU_INT_TIMEOUT_MS for the hub, which
+    // isn't attached
+    ASSERT_TRUE(set_meas_oversample_ratio(0xFF, 1));
+    sim_adc_values[ADC_IMON_5V] = 0x0FFF;
+    stage_trip_target = 2;
+    stage_trip_us = 0;
+    start_us = sim_time_us;
+    ASSERT_FALSE(enable_imu_feat(IMU_ACCEL));
+    ASSERT_TRUE(sim_time_us - start_us >= IMU_INT_TIMEOUT_MS * 1000UL);
+    ASSERT_TRUE(stage_trip_us != 0);
+    // Seen by the check after the trip
+    ASSERT_TRUE(stage_trip_us - start_us <= 50000);
+    check_loads(PROT_LOAD_PAY | PROT_LOAD_5V);
+    sim_adc_source = NULL;
+}
+
+void latch_test(void) {
+    setup();
+    sim_adc_values[ADC_IMON_5V] = 0x0FFF;
+    run_for(100000);
+    ASSERT_EQ(prot_tripped, _BV(PROT_5V_OC));
+    ASSERT_EQ(prot_loads_off, PROT_LOAD_5V);
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    ASSERT_EQ(tx_msg[0], CAN_EPS_PROT_TRIP);
+
+    // Still tripped after the current drops (it is off), and reported once
+    sim_adc_values[ADC_IMON_5V] = 0;
+    run_for(1000000);
+    ASSERT_EQ(prot_tripped, _BV(PROT_5V_OC));
+    ASSERT_EQ(prot_loads_off, PROT_LOAD_5V);
+    ASSERT_EQ(prot_trip_count, 1);
+    uint32_t status = 0;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_PROT_STATUS, 0, &status),
+        CAN_STATUS_OK);
+    ASSERT_EQ(status, (1UL << 16) | (_BV(PROT_5V_OC) << 8) |
+        PROT_LOAD_5V);
+
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_CLEAR_PROT, 0, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(prot_tripped, 0);
+    ASSERT_EQ(prot_loads_off, 0);
+    check_loads(0);
+
+    // Trips again if the fault is still there
+    sim_adc_values[ADC_IMON_5V] = 0x0FFF;
+    run_for(100000);
+    ASSERT_EQ(prot_loads_off, PROT_LOAD_5V);
+    ASSERT_EQ(prot_trip_count, 2);
+}
+
+void threshold_test(void) {
+    setup();
+    uint32_t threshold = 0;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_PROT_THRESH, PROT_3V3_OC, &threshold),
+        CAN_STATUS_OK);
+    ASSERT_EQ(threshold, PROT_DEF_RAIL_OC);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_PROT_THRESH, PROT_CHECK_COUNT, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_PROT_THRESH,
+        ((uint32_t) PROT_CHECK_COUNT << 16) | 100, NULL), CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_PROT_THRESH,
+        ((uint32_t) PROT_3V3_OC << 16) | 0x1000, NULL), CAN_STATUS_INVALID_DATA);
+
+    // Lower the 3V3 threshold below the load
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_PROT_THRESH,
+        ((uint32_t) PROT_3V3_OC << 16) | 300, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_PROT_THRESH, PROT_3V3_OC, &threshold),
+        CAN_STATUS_OK);
+    ASSERT_EQ(threshold, 300);
+    sim_adc_values[ADC_IMON_3V3] = 400;
+    ASSERT_TRUE(run_for(100000) <= 40000);
+    ASSERT_EQ(prot_tripped, _BV(PROT_3V3_OC));
+
+    // Saved in the config journal and restored at startup
+    while (config_dirty || is_config_busy()) {
+        sim_advance_us(10000);
+        run_config();
+    }
+    uint16_t saved = 0;
+    ASSERT_TRUE(get_config(CONFIG_PROT_THRESH + PROT_3V3_OC, &saved));
+    ASSERT_EQ(saved, 300);
+    restore_config();
+    init_protection();
+    ASSERT_EQ(prot_thresholds[PROT_3V3_OC], 300);
+    ASSERT_EQ(prot_thresholds[PROT_5V_OC], PROT_DEF_RAIL_OC);
+    check_loads(0);
+}
+
+test_t t1 = { .name = "init test", .fn = init_test };
+test_t t2 = { .name = "pay short test", .fn = pay_short_test };
+test_t t3 = { .name = "glitch test", .fn = glitch_test };
+test_t t4 = { .name = "undervoltage test", .fn = undervoltage_test };
+test_t t5 = { .name = "long stage test", .fn = long_stage_test };
+test_t t6 = { .name = "latch test", .fn = latch_test };
+test_t t7 = { .name = "threshold test", .fn = threshold_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+/*
+Host test of the rail statistics: the rail currents are sampled with the
+battery current and integrated into energy without losing fractions of a mJ,
+the minimum, maximum and mean follow the samples, and with reset on read each
+HK read covers the time since the previous one.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data);
+
+void setup(void) {
+    sim_reset();
+    init_eps();
+}
+
+// Sends a CTRL command and returns the response status
+uint8_t send_ctrl(uint8_t field_num, uint32_t data, uint32_t* tx_data) {
+    uint8_t rx_msg[8] = { CAN_EPS_CTRL, field_num, 0x00, 0x00,
+        (data >> 24) & 0xFF, (data >> 16) & 0xFF, (data >> 8) & 0xFF, data & 0xFF };
+    sim_can_rx(EPS_CMD_MOB_NUM, rx_msg, 8);
+    process_next_rx_msg();
+    send_next_tx_msg();
+    uint8_t tx_msg[8] = { 0x00 };
+    ASSERT_EQ(sim_can_tx_pop(tx_msg), 8);
+    if (tx_data != NULL) {
+        *tx_data = ((uint32_t) tx_msg[4] << 24) | ((uint32_t) tx_msg[5] << 16) |
+            ((uint32_t) tx_msg[6] << 8) | ((uint32_t) tx_msg[7]);
+    }
+    return tx_msg[2];
+}
+
+uint32_t read_hk(uint8_t field_num) {
+    uint8_t status = CAN_STATUS_OK;
+    uint32_t data = 0;
+    handle_rx_hk(field_num, &status, &data);
+    ASSERT_EQ(status, CAN_STATUS_OK);
+    return data;
+}
+
+// Runs the tasks that keep the statistics up to date for `us`
+void run_for(uint64_t us) {
+    for (uint64_t t = 0; t < us; t += 10000) {
+        sim_advance_us(10000);
+        run_measurements();
+        run_battery();
+        run_rail_stats();
+    }
+}
+
+// Starts from the ADC values now set
+void restart_rail_stats(void) {
+    sample_adc_snapshot();
+    sample_rails();
+    reset_rail_stats();
+}
+
+void energy_test(void) {
+    setup();
+    // 5.001 V, 999.69 mA
+    sim_adc_values[ADC_VMON_5V] = 2048;
+    sim_adc_values[ADC_IMON_5V] = 655;
+    restart_rail_stats();
+    uint64_t start_us = sim_time_us;
+
+    // Sampling the ADC takes time too, so it runs for a bit over 100 s
+    run_for(100000000);
+    uint64_t expected = (sim_time_us - start_us) * 5001 * 655 * 6250 / 4095 /
+        1000000000;
+    uint32_t energy = read_hk(CAN_EPS_HK_5V_ENERGY);
+    // Up to one sample period (0.1 s) short
+    ASSERT_TRUE(energy <= expected);
+    ASSERT_TRUE(energy + 500 >= expected);
+
+    // Nothing on the other rails
+    ASSERT_EQ(read_hk(CAN_EPS_HK_3V3_ENERGY), 0);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_ENERGY), 0);
+}
+
+void small_energy_test(void) {
+    setup();
+    // 3.299 V, 1.53 mA - 0.5 mJ per sample, which would be lost to rounding
+    sim_adc_values[ADC_VMON_3V3] = 1351;
+    sim_adc_values[ADC_IMON_3V3] = 1;
+    restart_rail_stats();
+    uint64_t start_us = sim_time_us;
+    run_for(100000000);
+    uint64_t expected = (sim_time_us - start_us) * 3299 * 6250 / 4095 /
+        1000000000;
+    uint32_t energy = read_hk(CAN_EPS_HK_3V3_ENERGY);
+    ASSERT_TRUE(energy <= expected);
+    ASSERT_TRUE(energy + 2 >= expected);
+}
+
+void cur_stats_test(void) {
+    setup();
+    // The payload efuse has its own current gain, and uses the pack voltage
+    sim_adc_values[ADC_VMON_PACK] = 3000;
+    sim_adc_values[ADC_IMON_PAY_LIM] = 100;
+    restart_rail_stats();
+    run_for(10000000);
+    sim_adc_values[ADC_IMON_PAY_LIM] = 300;
+    run_for(10000000);
+
+    // 9.713 mA per LSB
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_CUR_MIN), 971);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_CUR_MAX), 2914);
+    uint32_t mean = read_hk(CAN_EPS_HK_PAY_CUR_MEAN);
+    ASSERT_TRUE(mean >= 1900);
+    ASSERT_TRUE(mean <= 2000);
+    ASSERT_TRUE(read_hk(CAN_EPS_HK_PAY_ENERGY) > 0);
+
+    // Without reset on read, the statistics keep accumulating
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_CUR_MIN), 971);
+    ASSERT_TRUE(read_hk(CAN_EPS_HK_PAY_ENERGY) > 0);
+
+    // No samples since the reset
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_RESET_RAIL_STATS, 0, NULL), CAN_STATUS_OK);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_ENERGY), 0);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_CUR_MEAN), 0);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_CUR_MIN), 0);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_PAY_CUR_MAX), 0);
+}
+
+void reset_on_read_test(void) {
+    setup();
+    uint32_t enabled = 0xFF;
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_RAIL_RESET_ON_READ, 0, &enabled),
+        CAN_STATUS_OK);
+    ASSERT_EQ(enabled, 0);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ, 2, NULL),
+        CAN_STATUS_INVALID_DATA);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ, 1, NULL),
+        CAN_STATUS_OK);
+    ASSERT_EQ(send_ctrl(CAN_EPS_CTRL_GET_RAIL_RESET_ON_READ, 0, &enabled),
+        CAN_STATUS_OK);
+    ASSERT_EQ(enabled, 1);
+
+    sim_adc_values[ADC_VMON_5V] = 2048;
+    sim_adc_values[ADC_IMON_5V] = 400;
+    restart_rail_stats();
+    run_for(10000000);
+    uint32_t first = read_hk(CAN_EPS_HK_5V_ENERGY);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_5V_CUR_MAX), 611);
+
+    // Each read covers the time since the previous one
+    sim_adc_values[ADC_IMON_5V] = 200;
+    run_for(10000000);
+    uint32_t second = read_hk(CAN_EPS_HK_5V_ENERGY);
+    ASSERT_TRUE(second < first);
+    ASSERT_TRUE(second > first / 3);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_5V_CUR_MAX), 305);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_5V_ENERGY), 0);
+    ASSERT_EQ(read_hk(CAN_EPS_HK_5V_CUR_MAX), 0);
+}
+
+test_t t1 = { .name = "energy test", .fn = energy_test };
+test_t t2 = { .name = "small energy test", .fn = small_energy_test };
+test_t t3 = { .name = "cur stats test", .fn = cur_stats_test };
+test_t t4 = { .name = "reset on read test", .fn = reset_on_read_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/*
+Host test of the incremental SHTP parser: every report in a packet reaches its
+handler however long the packet is, reports without a handler are stepped
+over, and an unknown report ID skips the rest of the packet.
+*/
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+#define MAX_CALLS 40
+
+uint8_t calls = 0;
+uint8_t call_ids[MAX_CALLS];
+uint8_t call_lens[MAX_CALLS];
+uint8_t last_report[SHTP_REPORT_MAX_LEN];
+
+void report_received(const uint8_t* report, uint8_t len) {
+    if (calls < MAX_CALLS) {
+        call_ids[calls] = report[0];
+        call_lens[calls] = len;
+        calls++;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        last_report[i] = report[i];
+    }
+}
+
+const shtp_handler_t handlers[] PROGMEM = {
+    { 0xFB, report_received },
+    { 0x02, report_received },
+    { 0x07, report_received },
+};
+
+shtp_parser_t parser = {
+    .handlers = handlers,
+    .handler_count = sizeof(handlers) / sizeof(handlers[0])
+};
+
+void setup(void) {
+    calls = 0;
+    parser.reports = 0;
+    parser.skipped = 0;
+}
+
+void feed(const uint8_t* cargo, uint16_t len) {
+    start_shtp_packet(&parser, len);
+    for (uint16_t i = 0; i < len; i++) {
+        feed_shtp_byte(&parser, cargo[i]);
+    }
+}
+
+// Appends a report with the ID in the first byte and `len - 1` bytes of
+// `fill`, returns the new length
+uint16_t add_report(uint8_t* cargo, uint16_t pos, uint8_t id, uint8_t len,
+        uint8_t fill) {
+    cargo[pos] = id;
+    for (uint8_t i = 1; i < len; i++) {
+        cargo[pos + i] = fill;
+    }
+    return pos + len;
+}
+
+void len_test(void) {
+    ASSERT_EQ(get_shtp_report_len(0xFB), 5);
+    ASSERT_EQ(get_shtp_report_len(0x01), 10);
+    ASSERT_EQ(get_shtp_report_len(0x07), 16);
+    ASSERT_EQ(get_shtp_report_len(0x05), 14);
+    ASSERT_EQ(get_shtp_report_len(0xFC), 0);
+    ASSERT_EQ(get_shtp_report_len(0x17), 0);
+}
+
+void multi_report_test(void) {
+    setup();
+    uint8_t cargo[64];
+    uint16_t len = add_report(cargo, 0, 0xFB, 5, 0x11);
+    len = add_report(cargo, len, 0x01, 10, 0x22);
+    len = add_report(cargo, len, 0x02, 10, 0x33);
+    len = add_report(cargo, len, 0x07, 16, 0x44);
+    feed(cargo, len);
+
+    // The accelerometer has no handler
+    ASSERT_EQ(calls, 3);
+    ASSERT_EQ(call_ids[0], 0xFB);
+    ASSERT_EQ(call_lens[0], 5);
+    ASSERT_EQ(call_ids[1], 0x02);
+    ASSERT_EQ(call_lens[1], 10);
+    ASSERT_EQ(call_ids[2], 0x07);
+    ASSERT_EQ(call_lens[2], 16);
+    ASSERT_EQ(last_report[15], 0x44);
+    ASSERT_EQ(parser.reports, 3);
+    ASSERT_EQ(parser.skipped, 0);
+}
+
+void long_packet_test(void) {
+    setup();
+    // A batch of 30 reports, far more than any buffer in the driver
+    uint8_t cargo[5 + 30 * 10];
+    uint16_t len = add_report(cargo, 0, 0xFB, 5, 0x00);
+    for (uint8_t i = 0; i < 30; i++) {
+        len = add_report(cargo, len, 0x02, 10, i);
+    }
+    feed(cargo, len);
+    ASSERT_EQ(calls, 31);
+    ASSERT_EQ(call_ids[30], 0x02);
+    ASSERT_EQ(last_report[9], 29);
+    ASSERT_EQ(parser.skipped, 0);
+}
+
+void unknown_report_test(void) {
+    setup();
+    uint8_t cargo[64];
+    uint16_t len = add_report(cargo, 0, 0xFB, 5, 0x00);
+    len = add_report(cargo, len, 0x02, 10, 0x01);
+    len = add_report(cargo, len, 0x17, 6, 0x02);
+    len = add_report(cargo, len, 0x02, 10, 0x03);
+    feed(cargo, len);
+    // Can't tell where the report after the unknown one starts
+    ASSERT_EQ(calls, 2);
+    ASSERT_EQ(parser.skipped, 16);
+
+    // A report cut short by the end of the packet
+    setup();
+    len = add_report(cargo, 0, 0xFB, 5, 0x00);
+    len = add_report(cargo, len, 0x07, 16, 0x01);
+    feed(cargo, len - 1);
+    ASSERT_EQ(calls, 1);
+    ASSERT_EQ(parser.skipped, 15);
+
+    // The next packet starts over
+    setup();
+    feed(cargo, len);
+    ASSERT_EQ(calls, 2);
+}
+
+void padding_test(void) {
+    setup();
+    uint8_t cargo[16];
+    uint16_t len = add_report(cargo, 0, 0xFB, 5, 0x00);
+    start_shtp_packet(&parser, len);
+    for (uint16_t i = 0; i < len; i++) {
+        feed_shtp_byte(&parser, cargo[i]);
+    }
+    // Bytes clocked after the packet ends are ignored
+    for (uint8_t i = 0; i < 10; i++) {
+        feed_shtp_byte(&parser, 0x02);
+    }
+    ASSERT_EQ(calls, 1);
+    ASSERT_EQ(parser.skipped, 0);
+}
+
+void imu_stream_test(void) {
+    // The driver's input packets hold a report of every acquired feature
+    sim_reset();
+    sim_imu_attach();
+    init_eps();
+    uint32_t reports = imu_parser.reports;
+    for (uint8_t i = 0; i < 50; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    ASSERT_TRUE(imu_parser.reports - reports >= 4 * 4);
+    ASSERT_EQ(imu_parser.skipped, 0);
+    ASSERT_EQ(imu_record.features, IMU_ACQ_FEATURES);
+}
+
+test_t t1 = { .name = "len test", .fn = len_test };
+test_t t2 = { .name = "multi report test", .fn = multi_report_test };
+test_t t3 = { .name = "long packet test", .fn = long_packet_test };
+test_t t4 = { .name = "unknown report test", .fn = unknown_report_test };
+test_t t5 = { .name = "padding test", .fn = padding_test };
+test_t t6 = { .name = "imu stream test", .fn = imu_stream_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
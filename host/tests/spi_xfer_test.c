@@ -0,0 +1,202 @@
+/*
+Host test of the SPI bus manager: queued interrupt-driven transfers run back
+to back in order, chained transfers keep chip select asserted, and the mode
+and clock registers are only written when the device changes.
+*/
+
+#include <string.h>
+
+#include <sim/sim.h>
+#include <test/test.h>
+
+#include "../../src/general.h"
+
+// Two scripted devices on pins no board device uses
+pin_info_t dev_a_cs = { .port = &PORTD, .ddr = &DDRD, .pin = PD5 };
+pin_info_t dev_b_cs = { .port = &PORTD, .ddr = &DDRD, .pin = PD6 };
+spi_dev_t dev_a = { .cs = &dev_a_cs, .cpol = 1, .cpha = 1,
+    .clk_freq = SPI_FOSC_4 };
+spi_dev_t dev_b = { .cs = &dev_b_cs, .cpol = 0, .cpha = 0,
+    .clk_freq = SPI_FOSC_16 };
+
+// Order in which the devices were selected and bytes were clocked in, as
+// 'A'/'B' for selects, 'a'/'b' for releases and the MOSI bytes
+char events[64];
+uint8_t event_count = 0;
+uint8_t done_count = 0;
+
+void add_event(char event) {
+    if (event_count < sizeof(events) - 1) {
+        events[event_count++] = event;
+        events[event_count] = '\0';
+    }
+}
+
+void select_a(uint8_t selected) {
+    add_event(selected ? 'A' : 'a');
+}
+void select_b(uint8_t selected) {
+    add_event(selected ? 'B' : 'b');
+}
+uint8_t xfer_dev(uint8_t mosi) {
+    add_event((char) mosi);
+    return (uint8_t) (mosi + 1);
+}
+
+sim_spi_dev_t sim_dev_a = { .cs_port = &PORTD, .cs_pin = PD5,
+    .select = select_a, .xfer = xfer_dev };
+sim_spi_dev_t sim_dev_b = { .cs_port = &PORTD, .cs_pin = PD6,
+    .select = select_b, .xfer = xfer_dev };
+
+const uint8_t tx_a[] = { '1', '2' };
+const uint8_t tx_b[] = { '3' };
+const uint8_t tx_chain[] = { '4', '5' };
+uint8_t rx_a[2];
+uint8_t rx_b[1];
+uint8_t rx_chain[2];
+
+spi_xfer_t chained_xfer = { .dev = &dev_a, .tx = tx_chain, .rx = rx_chain,
+    .rx_max = 2, .len = 2, .done = NULL };
+
+void xfer_done(void) {
+    done_count++;
+}
+
+void chain_done(void) {
+    done_count++;
+    chain_spi_xfer(&chained_xfer);
+}
+
+void setup(void) {
+    sim_reset();
+    sim_imu_attach();
+    init_eps();
+    sim_spi_attach(&sim_dev_a);
+    sim_spi_attach(&sim_dev_b);
+    init_cs(dev_a_cs.pin, dev_a_cs.ddr);
+    init_cs(dev_b_cs.pin, dev_b_cs.ddr);
+    event_count = 0;
+    events[0] = '\0';
+    done_count = 0;
+    chained_xfer.done = NULL;
+}
+
+void queue_test(void) {
+    setup();
+    spi_xfer_t xfer_a = { .dev = &dev_a, .tx = tx_a, .rx = rx_a, .rx_max = 2,
+        .len = 2, .done = xfer_done };
+    spi_xfer_t xfer_b = { .dev = &dev_b, .tx = tx_b, .rx = rx_b, .rx_max = 1,
+        .len = 1, .done = xfer_done };
+    ASSERT_TRUE(queue_spi_xfer(&xfer_a));
+    ASSERT_TRUE(queue_spi_xfer(&xfer_b));
+    ASSERT_TRUE(queue_spi_xfer(&xfer_a));
+    ASSERT_TRUE(spi_xfer_busy);
+    wait_spi_xfer();
+
+    ASSERT_FALSE(spi_xfer_busy);
+    ASSERT_EQ(done_count, 3);
+    ASSERT_EQ(strcmp(events, "A12aB3bA12a"), 0);
+    ASSERT_EQ(rx_a[0], '2');
+    ASSERT_EQ(rx_a[1], '3');
+    ASSERT_EQ(rx_b[0], '4');
+    ASSERT_EQ(SPCR & _BV(SPIE), 0);
+}
+
+void queue_full_test(void) {
+    setup();
+    spi_xfer_t xfer_a = { .dev = &dev_a, .tx = tx_a, .len = 2 };
+    // The first one starts straight away
+    for (uint8_t i = 0; i < SPI_XFER_QUEUE_SIZE + 1; i++) {
+        ASSERT_TRUE(queue_spi_xfer(&xfer_a));
+    }
+    ASSERT_FALSE(queue_spi_xfer(&xfer_a));
+    wait_spi_xfer();
+    ASSERT_TRUE(queue_spi_xfer(&xfer_a));
+    wait_spi_xfer();
+}
+
+void chain_test(void) {
+    setup();
+    spi_xfer_t xfer_a = { .dev = &dev_a, .tx = tx_a, .len = 2,
+        .done = chain_done };
+    spi_xfer_t xfer_b = { .dev = &dev_b, .tx = tx_b, .len = 1 };
+    chained_xfer.done = xfer_done;
+    ASSERT_TRUE(queue_spi_xfer(&xfer_a));
+    ASSERT_TRUE(queue_spi_xfer(&xfer_b));
+    wait_spi_xfer();
+
+    // The queued transfer doesn't run between the two
+    ASSERT_EQ(done_count, 2);
+    ASSERT_EQ(strcmp(events, "A1245aB3b"), 0);
+    ASSERT_EQ(rx_chain[0], '5');
+    ASSERT_EQ(rx_chain[1], '6');
+}
+
+void cfg_cache_test(void) {
+    setup();
+    spi_xfer_t xfer_a = { .dev = &dev_a, .tx = tx_a, .len = 2 };
+    spi_xfer_t xfer_b = { .dev = &dev_b, .tx = tx_b, .len = 1 };
+
+    // Mode and clock both change from lib-common's
+    claim_spi_bus(&spi_lib_common_dev);
+    uint32_t writes = sim_spi_cfg_writes;
+    queue_spi_xfer(&xfer_a);
+    wait_spi_xfer();
+    ASSERT_EQ(sim_spi_cfg_writes, writes + 2);
+    ASSERT_EQ(SPCR & (_BV(CPOL) | _BV(CPHA)), _BV(CPOL) | _BV(CPHA));
+
+    // Nothing to write for the same device again
+    writes = sim_spi_cfg_writes;
+    uint32_t skipped = spi_cfg_skipped;
+    queue_spi_xfer(&xfer_a);
+    queue_spi_xfer(&xfer_a);
+    wait_spi_xfer();
+    ASSERT_EQ(sim_spi_cfg_writes, writes);
+    ASSERT_EQ(spi_cfg_skipped, skipped + 4);
+
+    // Device B only differs in mode from lib-common's default
+    queue_spi_xfer(&xfer_b);
+    wait_spi_xfer();
+    writes = sim_spi_cfg_writes;
+    claim_spi_bus(&spi_lib_common_dev);
+    ASSERT_EQ(sim_spi_cfg_writes, writes + 1);
+    ASSERT_EQ(SPCR & (_BV(CPOL) | _BV(CPHA)), 0);
+}
+
+void imu_stream_cfg_test(void) {
+    setup();
+    // Let a few streamed packets arrive
+    for (uint8_t i = 0; i < 20; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    uint32_t reports = imu_record.cal_gyro.count;
+    ASSERT_TRUE(reports > 0);
+
+    // In steady state the IMU packets don't write the SPI registers at all
+    uint32_t writes = sim_spi_cfg_writes;
+    for (uint8_t i = 0; i < 100; i++) {
+        sim_advance_us(10000);
+        run_imu();
+    }
+    ASSERT_TRUE(imu_record.cal_gyro.count >= reports + 9);
+    ASSERT_EQ(sim_spi_cfg_writes, writes);
+
+    // Reading the ADC switches back to lib-common's mode and clock once
+    sample_adc_snapshot();
+    ASSERT_EQ(sim_spi_cfg_writes, writes + 2);
+    sample_adc_snapshot();
+    ASSERT_EQ(sim_spi_cfg_writes, writes + 2);
+}
+
+test_t t1 = { .name = "queue test", .fn = queue_test };
+test_t t2 = { .name = "queue full test", .fn = queue_full_test };
+test_t t3 = { .name = "chain test", .fn = chain_test };
+test_t t4 = { .name = "cfg cache test", .fn = cfg_cache_test };
+test_t t5 = { .name = "imu stream cfg test", .fn = imu_stream_cfg_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
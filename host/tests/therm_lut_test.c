@@ -0,0 +1,96 @@
+/*
+Host test of the thermistor lookup tables against lib-common's floating point
+conversions (the exact beta model): the interpolated temperatures and
+setpoints stay within an error bound over the range the board operates in.
+*/
+
+#include <math.h>
+
+#include <test/test.h>
+
+#include "../../src/therm_lut.h"
+
+// Returns the largest error (in C) of `lut_fn` against `exact_fn` for the raw
+// values whose exact temperature is between `min_temp` and `max_temp`
+double max_temp_error(int16_t (*lut_fn)(uint16_t), double (*exact_fn)(uint16_t),
+        double min_temp, double max_temp) {
+    double max_err = 0;
+    for (uint16_t raw = 1; raw < 2047; raw++) {
+        double exact = exact_fn(raw);
+        if (exact < min_temp || exact > max_temp) {
+            continue;
+        }
+        double err = fabs(lut_fn(raw) / 100.0 - exact);
+        if (err > max_err) {
+            max_err = err;
+        }
+    }
+    return max_err;
+}
+
+void adc_test(void) {
+    ASSERT_TRUE(max_temp_error(adc_raw_to_therm_centi_c, adc_raw_to_therm_temp,
+        -40.0, 125.0) < 0.15);
+    ASSERT_TRUE(max_temp_error(adc_raw_to_therm_centi_c, adc_raw_to_therm_temp,
+        0.0, 100.0) < 0.05);
+}
+
+void dac_test(void) {
+    ASSERT_TRUE(max_temp_error(dac_raw_to_heater_setpoint_centi_c,
+        dac_raw_data_to_heater_setpoint, -40.0, 125.0) < 0.15);
+    ASSERT_TRUE(max_temp_error(dac_raw_to_heater_setpoint_centi_c,
+        dac_raw_data_to_heater_setpoint, 0.0, 100.0) < 0.05);
+    ASSERT_EQ(dac_raw_to_heater_setpoint_centi_c(0x400), 2500);
+}
+
+void setpoint_test(void) {
+    // Within one DAC step of the exact (truncated) value
+    for (int16_t centi_c = -4000; centi_c <= 12500; centi_c++) {
+        int32_t exact = heater_setpoint_to_dac_raw_data(centi_c / 100.0);
+        int32_t raw = heater_setpoint_centi_c_to_dac_raw(centi_c);
+        ASSERT_TRUE(raw >= exact - 1 && raw <= exact + 1);
+    }
+    ASSERT_EQ(heater_setpoint_centi_c_to_dac_raw(2500), 0x400);
+
+    // Round trip
+    for (uint16_t raw = 0x100; raw < 0x780; raw++) {
+        int16_t centi_c = dac_raw_to_heater_setpoint_centi_c(raw);
+        uint16_t back = heater_setpoint_centi_c_to_dac_raw(centi_c);
+        ASSERT_TRUE(back >= raw - 1 && back <= raw + 1);
+    }
+}
+
+void saturate_test(void) {
+    ASSERT_EQ(adc_raw_to_therm_centi_c(0), (int16_t) pgm_read_word(&therm_adc_lut[0]));
+    ASSERT_EQ(adc_raw_to_therm_centi_c(0xFFF), THERM_LUT_MAX_CENTI_C);
+    ASSERT_EQ(dac_raw_to_heater_setpoint_centi_c(0xFFF), THERM_LUT_MAX_CENTI_C);
+    int16_t sp_max = THERM_SP_LUT_MIN_CENTI_C +
+        ((THERM_SP_LUT_LEN - 1) << THERM_SP_LUT_SHIFT);
+    ASSERT_EQ(heater_setpoint_centi_c_to_dac_raw(THERM_LUT_MIN_CENTI_C),
+        heater_setpoint_centi_c_to_dac_raw(THERM_SP_LUT_MIN_CENTI_C));
+    ASSERT_EQ(heater_setpoint_centi_c_to_dac_raw(THERM_LUT_MAX_CENTI_C),
+        heater_setpoint_centi_c_to_dac_raw(sp_max));
+
+    // Increasing, so the interpolation and the inverse search are valid
+    for (uint8_t i = 1; i < THERM_LUT_LEN; i++) {
+        ASSERT_TRUE((int16_t) pgm_read_word(&therm_adc_lut[i]) >=
+            (int16_t) pgm_read_word(&therm_adc_lut[i - 1]));
+        ASSERT_TRUE((int16_t) pgm_read_word(&therm_dac_lut[i]) >
+            (int16_t) pgm_read_word(&therm_dac_lut[i - 1]));
+    }
+    for (uint8_t i = 1; i < THERM_SP_LUT_LEN; i++) {
+        ASSERT_TRUE(pgm_read_word(&therm_sp_lut[i]) >
+            pgm_read_word(&therm_sp_lut[i - 1]));
+    }
+}
+
+test_t t1 = { .name = "adc test", .fn = adc_test };
+test_t t2 = { .name = "dac test", .fn = dac_test };
+test_t t3 = { .name = "setpoint test", .fn = setpoint_test };
+test_t t4 = { .name = "saturate test", .fn = saturate_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4 };
+
+int main(void) {
+    return run_tests(suite, sizeof(suite) / sizeof(suite[0])) == 0 ? 0 : 1;
+}
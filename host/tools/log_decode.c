@@ -0,0 +1,134 @@
+/*
+Decodes the EPS binary event log (src/event_log.c) into text.
+
+Input (stdin) is whitespace-separated hex bytes, e.g. copied from a CAN log.
+By default every 8 bytes are one CAN_EPS_LOG_DUMP response frame and the log
+bytes are taken from them. With -r, the input is the raw log bytes.
+
+Usage: log_decode [-r] < dump.txt
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <conversions/conversions.h>
+
+#include "../../src/can_commands.h"
+
+#define MAX_LOG_LEN 65536
+
+static uint8_t log_data[MAX_LOG_LEN];
+static uint32_t log_len = 0;
+
+static uint16_t get_be16(const uint8_t* data) {
+    return ((uint16_t) data[0] << 8) | data[1];
+}
+
+static void print_frame(const char* name, const uint8_t* frame) {
+    printf("%s:", name);
+    for (uint8_t i = 0; i < 8; i++) {
+        printf(" %02X", frame[i]);
+    }
+    printf("\n");
+}
+
+static double raw_to_cur(uint16_t raw) {
+    return adc_raw_to_circ_cur(raw, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
+}
+
+static void print_heater_ctrl(const uint8_t* args) {
+    uint16_t total_raw = get_be16(&args[1]);
+    uint16_t sp1 = get_be16(&args[3]);
+    uint16_t sp2 = get_be16(&args[5]);
+    // Sum of the 4 solar currents, each with its own zero offset
+    double total = raw_to_cur(total_raw) - 3 * raw_to_cur(0);
+
+    printf("Heaters - %s mode, solar current %.3f A, setpoint 1 0x%03X "
+        "(%.1f C), setpoint 2 0x%03X (%.1f C)\n",
+        args[0] == HEATER_MODE_SUN ? "sun" : "shadow", total,
+        sp1, dac_raw_data_to_heater_setpoint(sp1),
+        sp2, dac_raw_data_to_heater_setpoint(sp2));
+}
+
+static void print_prot_trip(const uint8_t* args) {
+    const char* checks[PROT_CHECK_COUNT] = {
+        "pack undervoltage", "3V3 overcurrent", "5V overcurrent",
+        "payload overcurrent"
+    };
+    const char* check = args[0] < PROT_CHECK_COUNT ? checks[args[0]] : "unknown";
+
+    printf("Protection trip - %s, raw 0x%03X, threshold 0x%03X, loads off:%s%s%s\n",
+        check, get_be16(&args[2]), get_be16(&args[4]),
+        (args[1] & PROT_LOAD_3V3) ? " 3V3" : "",
+        (args[1] & PROT_LOAD_5V) ? " 5V" : "",
+        (args[1] & PROT_LOAD_PAY) ? " PAY" : "");
+}
+
+static void decode(void) {
+    uint32_t i = 0;
+    while (i + EVT_HEADER_LEN <= log_len) {
+        uint8_t id = log_data[i];
+        uint8_t len = event_arg_len(id);
+        if (len == 0) {
+            printf("Unknown event ID 0x%02X at byte %u, stopping\n", id, i);
+            return;
+        }
+        if (i + EVT_HEADER_LEN + len > log_len) {
+            printf("Truncated event at byte %u\n", i);
+            return;
+        }
+
+        const uint8_t* args = &log_data[i + EVT_HEADER_LEN];
+        printf("[%5u s] ", get_be16(&log_data[i + 1]));
+        switch (id) {
+            case EVT_DROPPED:
+                printf("%u events dropped (log full)\n", get_be16(args));
+                break;
+            case EVT_CAN_RX:
+                print_frame("CAN RX", args);
+                break;
+            case EVT_CAN_TX:
+                print_frame("CAN TX", args);
+                break;
+            case EVT_HEATER_CTRL:
+                print_heater_ctrl(args);
+                break;
+            case EVT_PROT_TRIP:
+                print_prot_trip(args);
+                break;
+        }
+
+        i += EVT_HEADER_LEN + len;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool raw = (argc > 1 && strcmp(argv[1], "-r") == 0);
+
+    uint8_t frame[8];
+    uint8_t frame_len = 0;
+    unsigned int byte = 0;
+    while (scanf("%x", &byte) == 1 && log_len < MAX_LOG_LEN) {
+        if (raw) {
+            log_data[log_len++] = byte;
+            continue;
+        }
+
+        frame[frame_len++] = byte;
+        if (frame_len < 8) {
+            continue;
+        }
+        frame_len = 0;
+        if (frame[0] != CAN_EPS_LOG_DUMP ||
+                frame[1] > CAN_EPS_LOG_DUMP_FRAME_BYTES) {
+            continue;
+        }
+        for (uint8_t i = 0; i < frame[1] && log_len < MAX_LOG_LEN; i++) {
+            log_data[log_len++] = frame[2 + i];
+        }
+    }
+
+    decode();
+    return 0;
+}
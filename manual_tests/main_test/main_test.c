@@ -81,7 +81,7 @@ void enqueue_rx_msg(uint8_t opcode, uint8_t field_number, uint32_t raw_data) {
     rx_msg[5] = (raw_data >> 16) & 0xFF;
     rx_msg[6] = (raw_data >> 8) & 0xFF;
     rx_msg[7] = raw_data & 0xFF;
-    enqueue(&can_rx_msg_queue, rx_msg);
+    can_ring_push(&can_rx_ring, rx_msg);
 }
 
 
@@ -105,6 +105,11 @@ void print_imu_gyro(uint16_t raw_data) {
     print(" 0x%.4X = %.3f rad/s\n", raw_data, imu_raw_data_to_gyro(raw_data));
 }
 
+// Signed, Q point 8 (#1 p.58)
+void print_imu_accel(uint16_t raw_data) {
+    print(" 0x%.4X = %.3f m/s^2\n", raw_data, (int16_t) raw_data / 256.0);
+}
+
 void process_eps_hk_tx_msg(uint8_t field_num, uint32_t tx_data) {
     switch (field_num) {
         case CAN_EPS_HK_3V3_VOL:
@@ -187,12 +192,78 @@ void process_eps_hk_tx_msg(uint8_t field_num, uint32_t tx_data) {
             print("Gyro (Cal) Z:");
             print_imu_gyro(tx_data);
             break;
+        case CAN_EPS_HK_IDLE_FRAC:
+            print("Idle: %lu/1000\n", tx_data);
+            break;
+        case CAN_EPS_HK_SLEEP_COUNT:
+            print("Sleep Count: %lu\n", tx_data);
+            break;
+        case CAN_EPS_HK_DAC_SKIPPED:
+            print("DAC Writes Skipped: %lu\n", tx_data);
+            break;
+        case CAN_EPS_HK_BAT_CHARGE:
+            print("Bat Charge: %ld mC\n", (int32_t) tx_data);
+            break;
+        case CAN_EPS_HK_BAT_SOC:
+            print("Bat SoC: %lu/1000\n", tx_data);
+            break;
+        case CAN_EPS_HK_BAT_INT_TIME:
+            print("Bat Integration Time: %lu s\n", tx_data);
+            break;
+        case CAN_EPS_HK_3V3_ENERGY:
+            print("3V3 Energy: %lu mJ\n", tx_data);
+            break;
+        case CAN_EPS_HK_3V3_CUR_MEAN:
+            print("3V3 Cur Mean: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_3V3_CUR_MIN:
+            print("3V3 Cur Min: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_3V3_CUR_MAX:
+            print("3V3 Cur Max: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_5V_ENERGY:
+            print("5V Energy: %lu mJ\n", tx_data);
+            break;
+        case CAN_EPS_HK_5V_CUR_MEAN:
+            print("5V Cur Mean: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_5V_CUR_MIN:
+            print("5V Cur Min: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_5V_CUR_MAX:
+            print("5V Cur Max: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_PAY_ENERGY:
+            print("PAY Energy: %lu mJ\n", tx_data);
+            break;
+        case CAN_EPS_HK_PAY_CUR_MEAN:
+            print("PAY Cur Mean: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_PAY_CUR_MIN:
+            print("PAY Cur Min: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_PAY_CUR_MAX:
+            print("PAY Cur Max: %lu mA\n", tx_data);
+            break;
+        case CAN_EPS_HK_ACC_X:
+            print("Accel X:");
+            print_imu_accel(tx_data);
+            break;
+        case CAN_EPS_HK_ACC_Y:
+            print("Accel Y:");
+            print_imu_accel(tx_data);
+            break;
+        case CAN_EPS_HK_ACC_Z:
+            print("Accel Z:");
+            print_imu_accel(tx_data);
+            break;
         default:
             return;
     }
 
     uint8_t next_field_num = field_num + 1;
-    if (next_field_num < CAN_EPS_HK_FIELD_COUNT) {
+    if (next_field_num < EPS_HK_FIELD_COUNT) {
         enqueue_rx_msg(CAN_EPS_HK, next_field_num, 0);
     }
 }
@@ -221,11 +292,8 @@ void process_eps_ctrl_tx_msg(uint8_t field_num) {
 // Displays the response that EPS sends back
 void sim_send_next_tx_msg(void) {
     uint8_t tx_msg[8] = { 0x00 };
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_empty(&can_tx_msg_queue)) {
-            return;
-        }
-        dequeue(&can_tx_msg_queue, tx_msg);
+    if (!can_ring_pop(&can_tx_ring, tx_msg)) {
+        return;
     }
 
     uint8_t opcode = tx_msg[0];
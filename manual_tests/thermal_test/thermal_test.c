@@ -49,17 +49,23 @@ const uint8_t all_cmds_len = sizeof(all_cmds) / sizeof(all_cmds[0]);
 
 
 void set_heater_1(double temp) {
-    set_raw_heater_setpoint(&heater_1_shadow_setpoint, heater_setpoint_to_dac_raw_data(temp));
+    set_raw_heater_setpoint(&heater_1_shadow_setpoint,
+        heater_setpoint_centi_c_to_dac_raw((int16_t) (temp * 100)));
     print("Set heater 1 setpoint (DAC A) = %.1f C\n", temp);
 }
 
 void set_heater_2(double temp) {
-    set_raw_heater_setpoint(&heater_2_shadow_setpoint, heater_setpoint_to_dac_raw_data(temp));
+    set_raw_heater_setpoint(&heater_2_shadow_setpoint,
+        heater_setpoint_centi_c_to_dac_raw((int16_t) (temp * 100)));
     print("Set heater 2 setpoint (DAC B) = %.1f C\n", temp);
 }
 
 
+// The IMU packets leave the bus in the IMU's SPI mode and clock, so each ADC
+// access claims it back for lib-common first
+
 void read_voltage(uint8_t channel) {
+    claim_spi_bus(&spi_lib_common_dev);
     fetch_adc_channel(&adc, channel);
     uint16_t raw_data = read_adc_channel(&adc, channel);
     double voltage = adc_raw_to_circ_vol(raw_data, ADC_VOL_SENSE_LOW_RES, ADC_VOL_SENSE_HIGH_RES);
@@ -67,6 +73,7 @@ void read_voltage(uint8_t channel) {
 }
 
 void read_current(uint8_t channel) {
+    claim_spi_bus(&spi_lib_common_dev);
     fetch_adc_channel(&adc, channel);
     uint16_t raw_data = read_adc_channel(&adc, channel);
     double current = adc_raw_to_circ_cur(raw_data, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
@@ -74,15 +81,15 @@ void read_current(uint8_t channel) {
 }
 
 void read_therm(uint8_t channel) {
+    claim_spi_bus(&spi_lib_common_dev);
     fetch_adc_channel(&adc, channel);
     uint16_t raw_data = read_adc_channel(&adc, channel);
-    double temp = adc_raw_to_therm_temp(raw_data);
-    print(", %.6f", temp);
+    int16_t temp = adc_raw_to_therm_centi_c(raw_data);
+    print(", %.2f", temp / 100.0);
 }
 
 void read_setpoint(uint16_t raw_voltage) {
-    print(", %.6f", therm_res_to_temp(therm_vol_to_res(
-        dac_raw_data_to_vol(raw_voltage))));
+    print(", %.2f", dac_raw_to_heater_setpoint_centi_c(raw_voltage) / 100.0);
 }
 
 void read_uncal_gyro(void) {
@@ -120,6 +127,7 @@ void read_data_fn(void) {
 
         // Use a different conversion formula for battery current (bipolar operation)
         uint8_t channel = ADC_IMON_PACK;
+        claim_spi_bus(&spi_lib_common_dev);
         fetch_adc_channel(&adc, channel);
         uint16_t raw_data = read_adc_channel(&adc, channel);
         double current = adc_raw_to_circ_cur(raw_data, ADC_BAT_CUR_SENSE_RES, ADC_BAT_CUR_SENSE_VREF);
@@ -0,0 +1,211 @@
+/*
+Battery coulomb counter and state of charge estimate.
+
+The pack current (ADC_IMON_PACK) is sampled every BATT_SAMPLE_DIV protection
+ticks (about 100 ms). The tick interrupt (see protection.c) sets a flag that
+wakes the main loop from idle sleep, and run_battery() converts the channel.
+The current is integrated with the trapezoidal rule over the measured time
+between samples (Timer 1 ticks), in 32-bit fixed point: the charge is kept in
+mC and the fractions left by the divisions are carried over to the next
+sample, so no charge is lost to rounding. Current out of the pack (discharge) is positive.
+
+Integration drifts with the current sense offset and can't see what the
+sensor doesn't measure, so the charge is slowly pulled towards an estimate
+from the pack voltage. Whenever a new ADC snapshot is available and the
+current is low enough for the IR drop estimate to be meaningful, the open
+circuit voltage (terminal voltage plus current x internal resistance) is
+converted to a state of charge with a typical Li-ion cell curve, and the
+charge moves 1/2^BATT_CORR_SHIFT of the way towards it (a time constant of
+about an hour at one snapshot per second).
+
+The charge is saved to the config journal every BATT_SAVE_PERIOD_S seconds
+and restored at startup, so it survives resets. If it has never been saved,
+it starts from the voltage estimate.
+
+The charge (mC), state of charge (1/1000) and the time the current has been
+integrated over (s) are HK fields (CAN_EPS_HK_BAT_CHARGE, CAN_EPS_HK_BAT_SOC,
+CAN_EPS_HK_BAT_INT_TIME), so OBC doesn't have to poll and integrate the pack
+current itself. The charge and state of charge depend on the cell curve and
+pack constants, which are not measured yet, so until the build defines
+BATT_SOC_CALIBRATED their top bit is set to mark them as uncalibrated (see
+battery.h).
+*/
+
+#include "battery.h"
+
+// Open circuit voltage (mV) of one cell at 0%, 10%, ..., 100% state of charge
+// (typical Li-ion curve, not calibrated - to be replaced with the measured
+// curve of the cells, see BATT_SOC_CALIBRATED)
+const uint16_t batt_ocv_curve[BATT_OCV_POINTS] PROGMEM = {
+    3000, 3450, 3680, 3740, 3770, 3790, 3820, 3870, 3920, 4000, 4200
+};
+
+// Set by the protection tick interrupt when the current should be sampled
+volatile bool batt_sample_flag = false;
+// Charge left in the pack (mC)
+int32_t batt_charge_mc = 0;
+// State of charge (1/1000)
+uint16_t batt_soc = 0;
+// Time the current has been integrated over since startup (s)
+uint32_t batt_int_s = 0;
+// Last sample of the pack current channel
+int16_t batt_last_cur_raw = 0;
+
+// Loop timer value of the last sample
+static uint32_t batt_last_time = 0;
+// Integrated charge that doesn't make a whole mC yet (1/0x0FFF mC), and the
+// part of that unit left from the last division by time (1/(2 * ticks per
+// second) of it)
+static int32_t batt_charge_rem = 0;
+static int32_t batt_tick_rem = 0;
+// Integrated time that doesn't make a whole second yet (ticks)
+static uint16_t batt_int_ticks = 0;
+// Count of the ADC snapshot the voltage correction last used
+static uint32_t batt_snapshot_count = 0;
+static uint32_t batt_last_save_s = 0;
+
+
+// Converts a pack current ADC value relative to BATT_CUR_ZERO_RAW to mA
+int32_t batt_cur_raw_to_ma(int32_t raw) {
+    return raw * BATT_CUR_FULL_SCALE_MA / 0x0FFF;
+}
+
+// Converts the open circuit voltage of a cell (mV) to a state of charge
+// (1/1000)
+uint16_t batt_ocv_to_soc(uint16_t cell_mv) {
+    if (cell_mv <= pgm_read_word(&batt_ocv_curve[0])) {
+        return 0;
+    }
+    for (uint8_t i = 1; i < BATT_OCV_POINTS; i++) {
+        uint16_t b = pgm_read_word(&batt_ocv_curve[i]);
+        if (cell_mv < b) {
+            uint16_t a = pgm_read_word(&batt_ocv_curve[i - 1]);
+            return (i - 1) * 100 + (uint16_t) ((uint32_t) (cell_mv - a) * 100 /
+                (b - a));
+        }
+    }
+    return 1000;
+}
+
+// Estimates the charge from the pack voltage and current in the ADC snapshot
+// and the last current sample
+static int32_t estimate_charge_from_voltage(int32_t cur_ma) {
+    int32_t pack_mv = (int32_t) adc_snapshot->raw[ADC_VMON_PACK] *
+        BATT_VOL_FULL_SCALE_MV / 0x0FFF;
+    int32_t ocv_mv = pack_mv + cur_ma * BATT_INTERNAL_RES_MOHM / 1000;
+    if (ocv_mv < 0) {
+        ocv_mv = 0;
+    }
+    uint16_t soc = batt_ocv_to_soc((uint16_t) (ocv_mv / BATT_CELLS_SERIES));
+    return BATT_CAPACITY_MC / 1000 * soc;
+}
+
+static void update_batt_soc(void) {
+    if (batt_charge_mc < 0) {
+        batt_charge_mc = 0;
+    } else if (batt_charge_mc > BATT_CAPACITY_MC) {
+        batt_charge_mc = BATT_CAPACITY_MC;
+    }
+    batt_soc = (uint16_t) (batt_charge_mc / (BATT_CAPACITY_MC / 1000));
+}
+
+// Call after init_measurements() and init_uptime()
+void init_battery(void) {
+    batt_sample_flag = false;
+    batt_charge_rem = 0;
+    batt_tick_rem = 0;
+    batt_int_s = 0;
+    batt_int_ticks = 0;
+    batt_snapshot_count = adc_snapshot->count;
+    batt_last_save_s = uptime_s;
+
+    claim_spi_bus(&spi_lib_common_dev);
+    batt_last_cur_raw = (int16_t) fetch_and_read_adc_channel(&adc, ADC_IMON_PACK);
+    batt_last_time = read_loop_time();
+
+    uint16_t saved = 0;
+    if (get_config(CONFIG_BATT_CHARGE, &saved)) {
+        batt_charge_mc = saved * BATT_SAVE_UNIT_MC;
+    } else {
+        batt_charge_mc = estimate_charge_from_voltage(
+            batt_cur_raw_to_ma(batt_last_cur_raw - BATT_CUR_ZERO_RAW));
+    }
+    update_batt_soc();
+}
+
+// Samples the pack current and integrates it since the last sample
+void sample_batt_current(void) {
+    claim_spi_bus(&spi_lib_common_dev);
+    int16_t raw = (int16_t) fetch_and_read_adc_channel(&adc, ADC_IMON_PACK);
+    uint32_t seconds = 0;
+    uint16_t ticks = 0;
+    uint16_t period = read_uptime_ticks(&seconds, &ticks);
+    uint32_t now = seconds * period + ticks;
+
+    uint32_t dt = now - batt_last_time;
+    // A gap this long means the samples were blocked, don't let one pair of
+    // samples stand for it
+    if (dt > 0xFFFF) {
+        dt = 0xFFFF;
+    }
+    batt_last_time = now;
+
+    // Trapezoid - twice the mean current, times the time
+    // Each step fits in 32 bits (|sum| < 2^13, full scale < 2^13,
+    // dt <= 0xFFFF ticks), and both divisions carry their remainder
+    int32_t sum = (int32_t) batt_last_cur_raw + raw - 2 * BATT_CUR_ZERO_RAW;
+    batt_last_cur_raw = raw;
+    // Twice the mean current (1/0x0FFF mA)
+    int32_t cur2 = sum * BATT_CUR_FULL_SCALE_MA;
+    // Charge over dt ticks (1/0x0FFF mC)
+    int32_t unit = 2L * period;
+    int32_t rem = (cur2 % unit) * (int32_t) dt + batt_tick_rem;
+    int32_t charge = (cur2 / unit) * (int32_t) dt + rem / unit +
+        batt_charge_rem;
+    batt_tick_rem = rem % unit;
+    batt_charge_rem = charge % 0x0FFF;
+    batt_charge_mc -= charge / 0x0FFF;
+    update_batt_soc();
+
+    // Whole seconds first - dt can be up to 0xFFFF ticks, which would wrap
+    // the remainder
+    batt_int_s += dt / period;
+    batt_int_ticks += dt % period;
+    if (batt_int_ticks >= period) {
+        batt_int_ticks -= period;
+        batt_int_s++;
+    }
+}
+
+// Returns true if the sample interrupt has fired since the last sample
+bool is_batt_sample_due(void) {
+    return batt_sample_flag;
+}
+
+/*
+Main loop task - samples the pack current when it is due, corrects the charge
+with each new ADC snapshot and saves it periodically.
+*/
+void run_battery(void) {
+    if (batt_sample_flag) {
+        batt_sample_flag = false;
+        sample_batt_current();
+    }
+
+    if (adc_snapshot->count != batt_snapshot_count) {
+        batt_snapshot_count = adc_snapshot->count;
+        int32_t cur_ma = batt_cur_raw_to_ma(batt_last_cur_raw - BATT_CUR_ZERO_RAW);
+        if (cur_ma <= BATT_CORR_MAX_CUR_MA && cur_ma >= -BATT_CORR_MAX_CUR_MA) {
+            int32_t estimate = estimate_charge_from_voltage(cur_ma);
+            batt_charge_mc += (estimate - batt_charge_mc) / (1L << BATT_CORR_SHIFT);
+            update_batt_soc();
+        }
+    }
+
+    if (uptime_s - batt_last_save_s >= BATT_SAVE_PERIOD_S) {
+        batt_last_save_s = uptime_s;
+        // Committed in the background, skipped if it hasn't changed
+        set_config(CONFIG_BATT_CHARGE,
+            (uint16_t) (batt_charge_mc / BATT_SAVE_UNIT_MC));
+    }
+}
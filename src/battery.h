@@ -0,0 +1,82 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <adc/adc.h>
+#include <avr/pgmspace.h>
+#include <conversions/conversions.h>
+#include <uptime/uptime.h>
+
+#include "config.h"
+#include "devices.h"
+#include "loop_stats.h"
+#include "measurements.h"
+
+// The pack constants below and batt_ocv_curve are placeholders until the
+// flight pack is characterized - until then, the charge and state of charge
+// are not calibrated, and their HK fields have the flag below set (define
+// this once they are measured)
+// #define BATT_SOC_CALIBRATED
+
+// Set in the CAN_EPS_HK_BAT_CHARGE and CAN_EPS_HK_BAT_SOC values while they
+// are not calibrated (the charge is at most 2^25 mC, the SoC 1000)
+#ifdef BATT_SOC_CALIBRATED
+#define BATT_CHARGE_HK_UNCAL    0
+#define BATT_SOC_HK_UNCAL       0
+#else
+#define BATT_CHARGE_HK_UNCAL    0x80000000UL
+#define BATT_SOC_HK_UNCAL       0x8000
+#endif
+
+// Battery pack - cells in series and nominal capacity
+#define BATT_CELLS_SERIES       2
+#define BATT_CAPACITY_MAH       5200
+#define BATT_CAPACITY_MC        ((int32_t) BATT_CAPACITY_MAH * 3600)
+// Internal resistance of the pack, to estimate the open circuit voltage
+// under load
+#define BATT_INTERNAL_RES_MOHM  100
+
+// Pack current sampling period (protection ticks, about 100 ms)
+#define BATT_SAMPLE_DIV         10
+
+// Current (mA) at full scale of the pack current sense ADC channel, and
+// pack voltage (mV) at full scale of the voltage monitor channel
+#define BATT_CUR_FULL_SCALE_MA  ((int32_t) (ADC_VREF * 1000.0 / \
+    (ADC_CUR_SENSE_AMP_GAIN * ADC_BAT_CUR_SENSE_RES) + 0.5))
+#define BATT_VOL_FULL_SCALE_MV  ((int32_t) (ADC_VREF * 1000.0 * \
+    (ADC_VOL_SENSE_LOW_RES + ADC_VOL_SENSE_HIGH_RES) / \
+    ADC_VOL_SENSE_LOW_RES + 0.5))
+// Raw pack current for 0 A
+#define BATT_CUR_ZERO_RAW       ((int16_t) (ADC_BAT_CUR_SENSE_VREF / ADC_VREF * \
+    0x0FFF + 0.5))
+
+// Voltage correction - once per snapshot while the pack current is below
+// BATT_CORR_MAX_CUR_MA, the charge moves 1/2^BATT_CORR_SHIFT of the way to
+// the charge estimated from the voltage
+#define BATT_CORR_MAX_CUR_MA    1000
+#define BATT_CORR_SHIFT         12
+
+// How often to save the charge to the config journal, and the resolution it
+// is saved with
+#define BATT_SAVE_PERIOD_S      600
+#define BATT_SAVE_UNIT_MC       1000L
+
+// Points of the open circuit voltage curve (every 10% state of charge)
+#define BATT_OCV_POINTS         11
+
+extern volatile bool batt_sample_flag;
+extern int32_t batt_charge_mc;
+extern uint16_t batt_soc;
+extern uint32_t batt_int_s;
+extern int16_t batt_last_cur_raw;
+
+void init_battery(void);
+int32_t batt_cur_raw_to_ma(int32_t raw);
+uint16_t batt_ocv_to_soc(uint16_t cell_mv);
+bool is_batt_sample_due(void);
+void sample_batt_current(void);
+void run_battery(void);
+
+#endif
@@ -7,31 +7,63 @@ Authors: Bruno Almeida
 
 #include "can_commands.h"
 
-
-// CAN messages received but not processed yet
-queue_t can_rx_msg_queue;
-// CAN messages that need to be transmitted (when possible)
-queue_t can_tx_msg_queue;
-
-// Set to true to print TX and RX CAN messages
-bool print_can_msgs = true;
+#include <string.h>
+
+#include <avr/pgmspace.h>
+
+
+// CAN messages received but not processed yet (filled by the CAN interrupt)
+can_ring_t can_rx_ring;
+// CAN messages that need to be transmitted (emptied by the CAN interrupt)
+can_ring_t can_tx_ring;
+
+// Set to true to print TX and RX CAN messages (blocks the main loop on the
+// UART, for debugging)
+bool print_can_msgs = false;
+// Set to true to record RX CAN messages and their responses in the event log
+// (for debugging - at 1 Hz HK polling they fill the log within seconds, and
+// then the heater and protection events it is for are dropped)
+bool log_can_msgs = false;
+
+// Batched HK read in progress - first field number and the fields that have
+// not been sent yet
+uint8_t hk_batch_base = 0;
+uint32_t hk_batch_mask = 0;
+// Next field of the batch, if it was already read but didn't fit in the
+// previous frame (each field is read once, so a statistic that resets on read
+// isn't lost)
+static bool hk_batch_ahead = false;
+static uint8_t hk_batch_ahead_status = CAN_STATUS_OK;
+static uint32_t hk_batch_ahead_data = 0;
+
+// Event log dump in progress - number of log bytes left to send
+bool log_dump_active = false;
+uint8_t log_dump_remaining = 0;
+
+// IMU sample dump in progress - number of samples left to send
+bool imu_dump_active = false;
+uint8_t imu_dump_remaining = 0;
+// Sample taken from the IMU sample ring whose frames are not all in the TX
+// ring yet, and whether its time frame is
+static bool imu_dump_pending = false;
+static bool imu_dump_time_sent = false;
+static imu_ring_entry_t imu_dump_entry;
 
 
 void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data);
+uint8_t next_hk_batch_field(uint8_t* field_num);
+void remove_hk_batch_field(uint8_t field_num);
 void handle_rx_ctrl(uint8_t field_num, uint32_t rx_data, uint8_t* tx_status,
         uint32_t* tx_data);
 
 
-// Checks the RX message queue and processes the first message (if it exists)
+// Checks the RX message ring and processes the first message (if it exists)
 void process_next_rx_msg(void) {
-    // Received message
-    uint8_t rx_msg[8] = {0x00};
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        // If there are no RX messages in the queue, exit the function
-        if (queue_empty(&can_rx_msg_queue)) {
-            return;
-        }
-        dequeue(&can_rx_msg_queue, rx_msg);
+    // Received message, parsed in place and released once it is handled
+    uint8_t* rx_msg = can_ring_peek(&can_rx_ring);
+    // If there are no RX messages in the ring, exit the function
+    if (rx_msg == NULL) {
+        return;
     }
 
     if (print_can_msgs) {
@@ -39,6 +71,9 @@ void process_next_rx_msg(void) {
         print("CAN RX: ");
         print_bytes(rx_msg, 8);
     }
+    if (log_can_msgs) {
+        log_event(EVT_CAN_RX, rx_msg);
+    }
 
     uint8_t opcode = rx_msg[0];
     uint8_t field_num = rx_msg[1];
@@ -58,158 +93,241 @@ void process_next_rx_msg(void) {
         case CAN_EPS_CTRL:
             handle_rx_ctrl(field_num, rx_data, &tx_status, &tx_data);
             break;
+        case CAN_EPS_LOG_DUMP:
+            // The responses are sent by continue_log_dump()
+            start_log_dump();
+            can_ring_release(&can_rx_ring);
+            restart_com_timeout();
+            return;
+        case CAN_EPS_IMU_DUMP:
+            // The responses are sent by continue_imu_dump()
+            start_imu_dump();
+            can_ring_release(&can_rx_ring);
+            restart_com_timeout();
+            return;
+        case CAN_EPS_HK_BATCH:
+            // The responses are sent by continue_hk_batch()
+            if (start_hk_batch(field_num, rx_data)) {
+                can_ring_release(&can_rx_ring);
+                restart_com_timeout();
+                return;
+            }
+            tx_status = CAN_STATUS_INVALID_DATA;
+            break;
         default:
             tx_status = CAN_STATUS_INVALID_OPCODE;
             break;
     }
 
-    // Message to transmit
+    can_ring_release(&can_rx_ring);
+
+    // Message to transmit, built in place in the TX ring (dropped and counted
+    // in `can_tx_ring.overflows` if it is full)
     // Send back the message type and field number
-    uint8_t tx_msg[8] = {0x00};
-    tx_msg[0] = opcode;
-    tx_msg[1] = field_num;
-    tx_msg[2] = tx_status;
-    tx_msg[3] = 0x00;
-    tx_msg[4] = (tx_data >> 24) & 0xFF;
-    tx_msg[5] = (tx_data >> 16) & 0xFF;
-    tx_msg[6] = (tx_data >> 8) & 0xFF;
-    tx_msg[7] = tx_data & 0xFF;
-    // Enqueue TX data to transmit
-    enqueue(&can_tx_msg_queue, tx_msg);
+    uint8_t* tx_msg = can_ring_reserve(&can_tx_ring);
+    if (tx_msg != NULL) {
+        tx_msg[0] = opcode;
+        tx_msg[1] = field_num;
+        tx_msg[2] = tx_status;
+        tx_msg[3] = 0x00;
+        tx_msg[4] = (tx_data >> 24) & 0xFF;
+        tx_msg[5] = (tx_data >> 16) & 0xFF;
+        tx_msg[6] = (tx_data >> 8) & 0xFF;
+        tx_msg[7] = tx_data & 0xFF;
+        if (log_can_msgs) {
+            log_event(EVT_CAN_TX, tx_msg);
+        }
+        can_ring_commit(&can_tx_ring);
+    }
 
     restart_com_timeout();
 }
 
-void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data) {
-    // Check field number
-
-    if (field_num == CAN_EPS_HK_UPTIME) {
-        *tx_data = uptime_s;
-    }
+// Where the data for an HK field comes from
+#define HK_SRC_NONE     0   // not a valid field number
+#define HK_SRC_ADC      1   // `arg` is the ADC channel in the snapshot
+#define HK_SRC_GETTER   2   // `getter(arg)` returns the data
+#define HK_SRC_ADC_EXT  3   // `arg` is the ADC channel in the snapshot, with
+                            // the oversampling's fractional bits
 
-    else if (field_num == CAN_EPS_HK_RESTART_COUNT) {
-        *tx_data = restart_count;
-    }
+typedef uint32_t(*hk_getter_t)(uint8_t arg);
 
-    else if (field_num == CAN_EPS_HK_RESTART_REASON) {
-        *tx_data = restart_reason;
-    }
-
-    else if (field_num == CAN_EPS_HK_BAT_VOL) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_VMON_PACK);
-    }
+typedef struct {
+    uint8_t source;
+    uint8_t arg;
+    hk_getter_t getter;
+} hk_field_t;
 
-    else if (field_num == CAN_EPS_HK_BAT_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_PACK);
-    }
-
-    else if (field_num == CAN_EPS_HK_X_POS_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_X_PLUS);
-    }
-
-    else if (field_num == CAN_EPS_HK_X_NEG_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_X_MINUS);
-    }
-
-    else if (field_num == CAN_EPS_HK_Y_POS_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_Y_PLUS);
-    }
+static uint32_t get_hk_uptime(uint8_t arg) {
+    return uptime_s;
+}
 
-    else if (field_num == CAN_EPS_HK_Y_NEG_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_Y_MINUS);
-    }
+static uint32_t get_hk_restart_count(uint8_t arg) {
+    return restart_count;
+}
 
-    else if (field_num == CAN_EPS_HK_3V3_VOL) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_VMON_3V3);
-    }
+static uint32_t get_hk_restart_reason(uint8_t arg) {
+    return restart_reason;
+}
 
-    else if (field_num == CAN_EPS_HK_3V3_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_3V3);
-    }
+// arg - DAC_A or DAC_B
+static uint32_t get_hk_heater_sp(uint8_t arg) {
+    return (arg == DAC_A) ? dac.raw_voltage_a : dac.raw_voltage_b;
+}
 
-    else if (field_num == CAN_EPS_HK_5V_VOL) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_VMON_5V);
-    }
+// arg - x/y/z index
+static uint32_t get_hk_uncal_gyro(uint8_t arg) {
+    return get_imu_hk_value(IMU_UNCAL_GYRO, arg);
+}
 
-    else if (field_num == CAN_EPS_HK_5V_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_5V);
-    }
+// arg - x/y/z index
+static uint32_t get_hk_cal_gyro(uint8_t arg) {
+    return get_imu_hk_value(IMU_CAL_GYRO, arg);
+}
 
-    else if (field_num == CAN_EPS_HK_PAY_CUR) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_IMON_PAY_LIM);
-    }
+// arg - x/y/z index
+static uint32_t get_hk_accel(uint8_t arg) {
+    return get_imu_hk_value(IMU_ACCEL, arg);
+}
 
-    else if (field_num == CAN_EPS_HK_3V3_TEMP) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_THM_3V3_TOP);
-    }
+static uint32_t get_hk_idle_frac(uint8_t arg) {
+    return idle_fraction;
+}
 
-    else if (field_num == CAN_EPS_HK_5V_TEMP) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_THM_5V_TOP);
-    }
+static uint32_t get_hk_sleep_count(uint8_t arg) {
+    return idle_sleep_count;
+}
 
-    else if (field_num == CAN_EPS_HK_PAY_CON_TEMP) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_THM_PAY_CONN);
-    }
+static uint32_t get_hk_dac_skipped(uint8_t arg) {
+    return heater_dac_writes_skipped;
+}
 
-    else if (field_num == CAN_EPS_HK_BAT_TEMP1) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_THM_BATT1);
-    }
+// Top bit set while uncalibrated
+static uint32_t get_hk_bat_charge(uint8_t arg) {
+    return (uint32_t) batt_charge_mc | BATT_CHARGE_HK_UNCAL;
+}
 
-    else if (field_num == CAN_EPS_HK_BAT_TEMP2) {
-        *tx_data = fetch_and_read_adc_channel(&adc, ADC_THM_BATT2);
-    }
+// Top bit (of 16) set while uncalibrated
+static uint32_t get_hk_bat_soc(uint8_t arg) {
+    return batt_soc | BATT_SOC_HK_UNCAL;
+}
 
-    else if (field_num == CAN_EPS_HK_HEAT1_SP) {
-        *tx_data = dac.raw_voltage_a;
-    }
+static uint32_t get_hk_bat_int_time(uint8_t arg) {
+    return batt_int_s;
+}
 
-    else if (field_num == CAN_EPS_HK_HEAT2_SP) {
-        *tx_data = dac.raw_voltage_b;
-    }    
+// arg - rail in bits 7-4, RAIL_STAT_* in bits 3-0
+static uint32_t get_hk_rail_stat(uint8_t arg) {
+    uint32_t value = 0;
+    get_rail_stat(arg >> 4, arg & 0x0F, &value);
+    return value;
+}
 
-    else if (field_num == CAN_EPS_HK_GYR_UNCAL_X) {
-        uint16_t uncal_x = 0;
-        get_imu_uncal_gyro(&uncal_x, NULL, NULL, NULL, NULL, NULL);
-        *tx_data = (uint32_t) uncal_x;
-    }
+#define HK_ADC(channel)         { .source = HK_SRC_ADC, .arg = (channel), .getter = NULL }
+#define HK_ADC_EXT(channel)     { .source = HK_SRC_ADC_EXT, .arg = (channel), .getter = NULL }
+#define HK_GETTER(fn, a)        { .source = HK_SRC_GETTER, .arg = (a), .getter = (fn) }
+#define HK_RAIL(rail, item)     HK_GETTER(get_hk_rail_stat, ((rail) << 4) | (item))
+
+// Indexed by HK field number, unlisted fields are invalid
+const hk_field_t hk_fields[EPS_HK_FIELD_COUNT] PROGMEM = {
+    [CAN_EPS_HK_UPTIME]         = HK_GETTER(get_hk_uptime, 0),
+    [CAN_EPS_HK_RESTART_COUNT]  = HK_GETTER(get_hk_restart_count, 0),
+    [CAN_EPS_HK_RESTART_REASON] = HK_GETTER(get_hk_restart_reason, 0),
+    [CAN_EPS_HK_BAT_VOL]        = HK_ADC(ADC_VMON_PACK),
+    [CAN_EPS_HK_BAT_CUR]        = HK_ADC(ADC_IMON_PACK),
+    [CAN_EPS_HK_X_POS_CUR]      = HK_ADC(ADC_IMON_X_PLUS),
+    [CAN_EPS_HK_X_NEG_CUR]      = HK_ADC(ADC_IMON_X_MINUS),
+    [CAN_EPS_HK_Y_POS_CUR]      = HK_ADC(ADC_IMON_Y_PLUS),
+    [CAN_EPS_HK_Y_NEG_CUR]      = HK_ADC(ADC_IMON_Y_MINUS),
+    [CAN_EPS_HK_3V3_VOL]        = HK_ADC(ADC_VMON_3V3),
+    [CAN_EPS_HK_3V3_CUR]        = HK_ADC(ADC_IMON_3V3),
+    [CAN_EPS_HK_5V_VOL]         = HK_ADC(ADC_VMON_5V),
+    [CAN_EPS_HK_5V_CUR]         = HK_ADC(ADC_IMON_5V),
+    [CAN_EPS_HK_PAY_CUR]        = HK_ADC(ADC_IMON_PAY_LIM),
+    [CAN_EPS_HK_3V3_TEMP]       = HK_ADC(ADC_THM_3V3_TOP),
+    [CAN_EPS_HK_5V_TEMP]        = HK_ADC(ADC_THM_5V_TOP),
+    [CAN_EPS_HK_PAY_CON_TEMP]   = HK_ADC(ADC_THM_PAY_CONN),
+    [CAN_EPS_HK_BAT_TEMP1]      = HK_ADC(ADC_THM_BATT1),
+    [CAN_EPS_HK_BAT_TEMP2]      = HK_ADC(ADC_THM_BATT2),
+    [CAN_EPS_HK_HEAT1_SP]       = HK_GETTER(get_hk_heater_sp, DAC_A),
+    [CAN_EPS_HK_HEAT2_SP]       = HK_GETTER(get_hk_heater_sp, DAC_B),
+    [CAN_EPS_HK_GYR_UNCAL_X]    = HK_GETTER(get_hk_uncal_gyro, 0),
+    [CAN_EPS_HK_GYR_UNCAL_Y]    = HK_GETTER(get_hk_uncal_gyro, 1),
+    [CAN_EPS_HK_GYR_UNCAL_Z]    = HK_GETTER(get_hk_uncal_gyro, 2),
+    [CAN_EPS_HK_GYR_CAL_X]      = HK_GETTER(get_hk_cal_gyro, 0),
+    [CAN_EPS_HK_GYR_CAL_Y]      = HK_GETTER(get_hk_cal_gyro, 1),
+    [CAN_EPS_HK_GYR_CAL_Z]      = HK_GETTER(get_hk_cal_gyro, 2),
+    [CAN_EPS_HK_IDLE_FRAC]      = HK_GETTER(get_hk_idle_frac, 0),
+    [CAN_EPS_HK_SLEEP_COUNT]    = HK_GETTER(get_hk_sleep_count, 0),
+    [CAN_EPS_HK_DAC_SKIPPED]    = HK_GETTER(get_hk_dac_skipped, 0),
+    [CAN_EPS_HK_BAT_CHARGE]     = HK_GETTER(get_hk_bat_charge, 0),
+    [CAN_EPS_HK_BAT_SOC]        = HK_GETTER(get_hk_bat_soc, 0),
+    [CAN_EPS_HK_BAT_INT_TIME]   = HK_GETTER(get_hk_bat_int_time, 0),
+    [CAN_EPS_HK_3V3_ENERGY]     = HK_RAIL(RAIL_3V3, RAIL_STAT_ENERGY),
+    [CAN_EPS_HK_3V3_CUR_MEAN]   = HK_RAIL(RAIL_3V3, RAIL_STAT_CUR_MEAN),
+    [CAN_EPS_HK_3V3_CUR_MIN]    = HK_RAIL(RAIL_3V3, RAIL_STAT_CUR_MIN),
+    [CAN_EPS_HK_3V3_CUR_MAX]    = HK_RAIL(RAIL_3V3, RAIL_STAT_CUR_MAX),
+    [CAN_EPS_HK_5V_ENERGY]      = HK_RAIL(RAIL_5V, RAIL_STAT_ENERGY),
+    [CAN_EPS_HK_5V_CUR_MEAN]    = HK_RAIL(RAIL_5V, RAIL_STAT_CUR_MEAN),
+    [CAN_EPS_HK_5V_CUR_MIN]     = HK_RAIL(RAIL_5V, RAIL_STAT_CUR_MIN),
+    [CAN_EPS_HK_5V_CUR_MAX]     = HK_RAIL(RAIL_5V, RAIL_STAT_CUR_MAX),
+    [CAN_EPS_HK_PAY_ENERGY]     = HK_RAIL(RAIL_PAY, RAIL_STAT_ENERGY),
+    [CAN_EPS_HK_PAY_CUR_MEAN]   = HK_RAIL(RAIL_PAY, RAIL_STAT_CUR_MEAN),
+    [CAN_EPS_HK_PAY_CUR_MIN]    = HK_RAIL(RAIL_PAY, RAIL_STAT_CUR_MIN),
+    [CAN_EPS_HK_PAY_CUR_MAX]    = HK_RAIL(RAIL_PAY, RAIL_STAT_CUR_MAX),
+    [CAN_EPS_HK_ACC_X]          = HK_GETTER(get_hk_accel, 0),
+    [CAN_EPS_HK_ACC_Y]          = HK_GETTER(get_hk_accel, 1),
+    [CAN_EPS_HK_ACC_Z]          = HK_GETTER(get_hk_accel, 2),
+    [CAN_EPS_HK_ADC_EXT(ADC_THM_BATT2)]       = HK_ADC_EXT(ADC_THM_BATT2),
+    [CAN_EPS_HK_ADC_EXT(ADC_THM_BATT1)]       = HK_ADC_EXT(ADC_THM_BATT1),
+    [CAN_EPS_HK_ADC_EXT(ADC_THM_PAY_CONN)]    = HK_ADC_EXT(ADC_THM_PAY_CONN),
+    [CAN_EPS_HK_ADC_EXT(ADC_VMON_5V)]         = HK_ADC_EXT(ADC_VMON_5V),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_X_PLUS)]     = HK_ADC_EXT(ADC_IMON_X_PLUS),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_X_MINUS)]    = HK_ADC_EXT(ADC_IMON_X_MINUS),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_Y_PLUS)]     = HK_ADC_EXT(ADC_IMON_Y_PLUS),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_Y_MINUS)]    = HK_ADC_EXT(ADC_IMON_Y_MINUS),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_5V)]         = HK_ADC_EXT(ADC_IMON_5V),
+    [CAN_EPS_HK_ADC_EXT(ADC_THM_5V_TOP)]      = HK_ADC_EXT(ADC_THM_5V_TOP),
+    [CAN_EPS_HK_ADC_EXT(ADC_VMON_3V3)]        = HK_ADC_EXT(ADC_VMON_3V3),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_3V3)]        = HK_ADC_EXT(ADC_IMON_3V3),
+    [CAN_EPS_HK_ADC_EXT(ADC_THM_3V3_TOP)]     = HK_ADC_EXT(ADC_THM_3V3_TOP),
+    [CAN_EPS_HK_ADC_EXT(ADC_VMON_PACK)]       = HK_ADC_EXT(ADC_VMON_PACK),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_PACK)]       = HK_ADC_EXT(ADC_IMON_PACK),
+    [CAN_EPS_HK_ADC_EXT(ADC_IMON_PAY_LIM)]    = HK_ADC_EXT(ADC_IMON_PAY_LIM),
+};
 
-    else if (field_num == CAN_EPS_HK_GYR_UNCAL_Y) {
-        uint16_t uncal_y = 0;
-        get_imu_uncal_gyro(NULL, &uncal_y, NULL, NULL, NULL, NULL);
-        *tx_data = (uint32_t) uncal_y;
+void handle_rx_hk(uint8_t field_num, uint8_t* tx_status, uint32_t* tx_data) {
+    // Check field number
+    if (field_num >= EPS_HK_FIELD_COUNT) {
+        *tx_status = CAN_STATUS_INVALID_FIELD_NUM;
+        return;
     }
 
-    else if (field_num == CAN_EPS_HK_GYR_UNCAL_Z) {
-        uint16_t uncal_z = 0;
-        get_imu_uncal_gyro(NULL, NULL, &uncal_z, NULL, NULL, NULL);
-        *tx_data = (uint32_t) uncal_z;
-    }
+    const hk_field_t* field = &hk_fields[field_num];
+    uint8_t source = pgm_read_byte(&field->source);
+    uint8_t arg = pgm_read_byte(&field->arg);
 
-    else if (field_num == CAN_EPS_HK_GYR_CAL_X) {
-        uint16_t cal_x = 0;
-        get_imu_cal_gyro(&cal_x, NULL, NULL);
-        *tx_data = (uint32_t) cal_x;
+    if (source == HK_SRC_ADC) {
+        // ADC fields are answered from the latest snapshot, which is refreshed
+        // by the main loop - a request never waits for a sweep
+        *tx_data = adc_snapshot->raw[arg];
     }
 
-    else if (field_num == CAN_EPS_HK_GYR_CAL_Y) {
-        uint16_t cal_y = 0;
-        get_imu_cal_gyro(NULL, &cal_y, NULL);
-        *tx_data = (uint32_t) cal_y;
+    else if (source == HK_SRC_ADC_EXT) {
+        *tx_data = adc_snapshot->ext[arg];
     }
 
-    else if (field_num == CAN_EPS_HK_GYR_CAL_Z) {
-        uint16_t cal_z = 0;
-        get_imu_cal_gyro(NULL, NULL, &cal_z);
-        *tx_data = (uint32_t) cal_z;
+    else if (source == HK_SRC_GETTER) {
+        hk_getter_t getter = (hk_getter_t) pgm_read_ptr(&field->getter);
+        *tx_data = getter(arg);
     }
 
-    // If the message type is not recognized, return before enqueueing
+    // If the field is not in the table, return before enqueueing
     else {
         *tx_status = CAN_STATUS_INVALID_FIELD_NUM;
     }
 }
 
-
 void handle_rx_ctrl(uint8_t field_num, uint32_t rx_data, uint8_t* tx_status,
         uint32_t* tx_data) {
     if (field_num == CAN_EPS_CTRL_PING) {
@@ -233,7 +351,9 @@ void handle_rx_ctrl(uint8_t field_num, uint32_t rx_data, uint8_t* tx_status,
         // Need to represent address as volatile uint8_t* to read RAM
         // Must first cast to uint16_t or else we get warning: cast to pointer
         // from integer of different size -Wint-to-pointer-cast]
-        volatile uint8_t* pointer = (volatile uint8_t*) ((uint16_t) rx_data);
+        // (uintptr_t is 16 bits on the AVR, it only matters for the host build)
+        volatile uint8_t* pointer =
+            (volatile uint8_t*) ((uintptr_t) ((uint16_t) rx_data));
         *tx_data = (uint32_t) (*pointer);
     }
 
@@ -284,6 +404,130 @@ void handle_rx_ctrl(uint8_t field_num, uint32_t rx_data, uint8_t* tx_status,
         set_raw_heater_cur_thresh(&heater_sun_cur_thresh_upper, (uint16_t) rx_data);
     }
 
+    else if (field_num == CAN_EPS_CTRL_GET_LOOP_STATS) {
+        uint8_t stage = (rx_data >> 8) & 0xFF;
+        uint8_t item = rx_data & 0xFF;
+        if (!get_loop_stat(stage, item, tx_data)) {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_RESET_LOOP_STATS) {
+        reset_loop_stats();
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_ADC_OVERSAMPLE) {
+        if (rx_data < ADC_CHANNELS) {
+            *tx_data = get_meas_oversample_ratio((uint8_t) rx_data);
+        } else {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_SET_ADC_OVERSAMPLE) {
+        uint8_t channel = (rx_data >> 8) & 0xFF;
+        uint8_t ratio = rx_data & 0xFF;
+        if (!set_meas_oversample_ratio(channel, ratio)) {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_RAIL_RESET_ON_READ) {
+        *tx_data = rail_reset_on_read ? 1 : 0;
+    }
+
+    else if (field_num == CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ) {
+        if (rx_data <= 1) {
+            rail_reset_on_read = (rx_data == 1);
+        } else {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_RESET_RAIL_STATS) {
+        reset_rail_stats();
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_PROT_THRESH) {
+        if (rx_data < PROT_CHECK_COUNT) {
+            *tx_data = prot_thresholds[rx_data];
+        } else {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_SET_PROT_THRESH) {
+        uint8_t check = (rx_data >> 16) & 0xFF;
+        uint16_t raw = rx_data & 0xFFFF;
+        if ((rx_data >> 24) != 0 || !set_prot_threshold(check, raw)) {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_PROT_STATUS) {
+        uint8_t trips = (prot_trip_count > 0xFF) ? 0xFF : prot_trip_count;
+        *tx_data = ((uint32_t) trips << 16) | ((uint32_t) prot_tripped << 8) |
+            prot_loads_off;
+    }
+
+    else if (field_num == CAN_EPS_CTRL_CLEAR_PROT) {
+        clear_protection();
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_IMU_WAIT_HIST) {
+        if (rx_data > 0xFF || !get_imu_wait_hist((uint8_t) rx_data, tx_data)) {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_RESET_IMU_WAIT_HIST) {
+        reset_imu_wait_hist();
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_IMU_INTERVAL) {
+        imu_intervals_t* intervals = NULL;
+        if (rx_data <= 0xFFFF) {
+            intervals = get_imu_intervals((rx_data >> 8) & 0xFF);
+        }
+        if (intervals != NULL && (rx_data & 0xFF) == 0) {
+            *tx_data = intervals->report;
+        } else if (intervals != NULL && (rx_data & 0xFF) == 1) {
+            *tx_data = intervals->batch;
+        } else {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL ||
+            field_num == CAN_EPS_CTRL_SET_IMU_BATCH_INTERVAL) {
+        uint8_t feat = (rx_data >> 24) & 0xFF;
+        uint32_t interval = rx_data & 0xFFFFFF;
+        imu_intervals_t* intervals = get_imu_intervals(feat);
+        uint8_t ok = 0;
+        if (intervals != NULL) {
+            if (field_num == CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL) {
+                ok = set_imu_intervals(feat, interval, intervals->batch);
+            } else {
+                ok = set_imu_intervals(feat, intervals->report, interval);
+            }
+        }
+        if (!ok) {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
+    else if (field_num == CAN_EPS_CTRL_GET_IMU_RING_DECIMATION) {
+        *tx_data = imu_ring_decimation;
+    }
+
+    else if (field_num == CAN_EPS_CTRL_SET_IMU_RING_DECIMATION) {
+        if (rx_data <= 0xFF) {
+            set_imu_ring_decimation(rx_data);
+        } else {
+            *tx_status = CAN_STATUS_INVALID_DATA;
+        }
+    }
+
     // If the field number is not recognized, return before enqueueing so we
     // don't send anything back
     else {
@@ -292,7 +536,210 @@ void handle_rx_ctrl(uint8_t field_num, uint32_t rx_data, uint8_t* tx_status,
 }
 
 /*
-If there is a TX message in the queue, send it
+Starts a batched HK read (see can_commands.h), replacing any batch in progress.
+Returns - 1 if the request is valid, 0 if it does not select any field
+*/
+uint8_t start_hk_batch(uint8_t base, uint32_t mask) {
+    // Field numbers past 0xFF can't be selected
+    if (base > 0xFF - 31) {
+        mask &= (1UL << (0xFF - base + 1)) - 1;
+    }
+    if (mask == 0) {
+        return 0;
+    }
+
+    hk_batch_base = base;
+    hk_batch_mask = mask;
+    hk_batch_ahead = false;
+    return 1;
+}
+
+// Gets the next field number in the batch (doesn't remove it)
+uint8_t next_hk_batch_field(uint8_t* field_num) {
+    if (hk_batch_mask == 0) {
+        return 0;
+    }
+    uint8_t i = 0;
+    while (!(hk_batch_mask & (1UL << i))) {
+        i++;
+    }
+    *field_num = hk_batch_base + i;
+    return 1;
+}
+
+void remove_hk_batch_field(uint8_t field_num) {
+    hk_batch_mask &= ~(1UL << (field_num - hk_batch_base));
+}
+
+// Reads the next field of the batch, or takes its value if it was read ahead
+static void read_hk_batch_field(uint8_t field_num, uint8_t* tx_status,
+        uint32_t* tx_data) {
+    if (hk_batch_ahead) {
+        hk_batch_ahead = false;
+        *tx_status = hk_batch_ahead_status;
+        *tx_data = hk_batch_ahead_data;
+    } else {
+        handle_rx_hk(field_num, tx_status, tx_data);
+    }
+}
+
+/*
+Adds frames for the batch in progress to the TX ring, leaving half of it for
+responses to other commands.
+*/
+void continue_hk_batch(void) {
+    while (hk_batch_mask != 0 &&
+            can_ring_count(&can_tx_ring) < CAN_RING_SIZE / 2) {
+        // Reserved before any field is read, so none is read and then dropped
+        uint8_t* tx_msg = can_ring_reserve(&can_tx_ring);
+        if (tx_msg == NULL) {
+            return;
+        }
+
+        uint8_t field_a = 0;
+        next_hk_batch_field(&field_a);
+        remove_hk_batch_field(field_a);
+
+        uint8_t status_a = CAN_STATUS_OK;
+        uint32_t data_a = 0;
+        read_hk_batch_field(field_a, &status_a, &data_a);
+
+        uint8_t field_b = CAN_EPS_HK_BATCH_NO_FIELD;
+        uint32_t data = data_a;
+        if (status_a == CAN_STATUS_OK && data_a <= 0xFFFF &&
+                next_hk_batch_field(&field_b)) {
+            uint8_t status_b = CAN_STATUS_OK;
+            uint32_t data_b = 0;
+            handle_rx_hk(field_b, &status_b, &data_b);
+
+            if (status_b == CAN_STATUS_OK && data_b <= 0xFFFF) {
+                remove_hk_batch_field(field_b);
+                data = (data_a << 16) | data_b;
+            } else {
+                // Field B goes in the next frame, with the value read now
+                hk_batch_ahead = true;
+                hk_batch_ahead_status = status_b;
+                hk_batch_ahead_data = data_b;
+                field_b = CAN_EPS_HK_BATCH_NO_FIELD;
+            }
+        }
+
+        tx_msg[0] = CAN_EPS_HK_BATCH;
+        tx_msg[1] = field_a;
+        tx_msg[2] = status_a;
+        tx_msg[3] = field_b;
+        tx_msg[4] = (data >> 24) & 0xFF;
+        tx_msg[5] = (data >> 16) & 0xFF;
+        tx_msg[6] = (data >> 8) & 0xFF;
+        tx_msg[7] = data & 0xFF;
+        can_ring_commit(&can_tx_ring);
+    }
+}
+
+// Starts sending the bytes that are in the event log now over CAN (see
+// can_commands.h), replacing any dump in progress
+void start_log_dump(void) {
+    log_dump_active = true;
+    log_dump_remaining = event_log_count();
+}
+
+// Adds frames for the log dump in progress to the TX ring, leaving half of it
+// for responses to other commands
+void continue_log_dump(void) {
+    while (log_dump_active &&
+            can_ring_count(&can_tx_ring) < CAN_RING_SIZE / 2) {
+        uint8_t* tx_msg = can_ring_reserve(&can_tx_ring);
+        if (tx_msg == NULL) {
+            return;
+        }
+
+        uint8_t len = CAN_EPS_LOG_DUMP_FRAME_BYTES;
+        if (log_dump_remaining < len) {
+            len = log_dump_remaining;
+        }
+        memset(tx_msg, 0x00, 8);
+        len = read_event_log(&tx_msg[2], len);
+        log_dump_remaining -= len;
+        tx_msg[0] = CAN_EPS_LOG_DUMP;
+        tx_msg[1] = len;
+        can_ring_commit(&can_tx_ring);
+
+        // A frame that is not full ends the dump
+        if (len < CAN_EPS_LOG_DUMP_FRAME_BYTES) {
+            log_dump_active = false;
+        }
+    }
+}
+
+// Starts sending the samples that are in the IMU sample ring now over CAN
+// (see can_commands.h), replacing any dump in progress
+void start_imu_dump(void) {
+    imu_dump_active = true;
+    imu_dump_remaining = imu_sample_count();
+}
+
+/*
+Adds frames for the IMU sample dump in progress to the TX ring, leaving half
+of it for responses to other commands. If a frame doesn't fit, the sample is
+kept and the dump resumes from that frame on the next call.
+*/
+void continue_imu_dump(void) {
+    // Room for both frames of a sample, so they normally go in together
+    while (imu_dump_active &&
+            can_ring_count(&can_tx_ring) + 2 <= CAN_RING_SIZE / 2) {
+        if (!imu_dump_pending) {
+            if (imu_dump_remaining == 0 || !pop_imu_sample(&imu_dump_entry)) {
+                uint8_t* tx_msg = can_ring_reserve(&can_tx_ring);
+                if (tx_msg == NULL) {
+                    return;
+                }
+                uint32_t dropped = take_imu_samples_dropped();
+                memset(tx_msg, 0x00, 8);
+                tx_msg[0] = CAN_EPS_IMU_DUMP;
+                tx_msg[1] = CAN_EPS_IMU_DUMP_END;
+                tx_msg[4] = (dropped >> 24) & 0xFF;
+                tx_msg[5] = (dropped >> 16) & 0xFF;
+                tx_msg[6] = (dropped >> 8) & 0xFF;
+                tx_msg[7] = dropped & 0xFF;
+                can_ring_commit(&can_tx_ring);
+                imu_dump_active = false;
+                return;
+            }
+            imu_dump_remaining--;
+            imu_dump_pending = true;
+            imu_dump_time_sent = false;
+        }
+
+        uint8_t* tx_msg = can_ring_reserve(&can_tx_ring);
+        if (tx_msg == NULL) {
+            return;
+        }
+        imu_ring_entry_t* entry = &imu_dump_entry;
+        if (!imu_dump_time_sent) {
+            memset(tx_msg, 0x00, 8);
+            tx_msg[0] = CAN_EPS_IMU_DUMP;
+            tx_msg[1] = entry->id;
+            tx_msg[4] = (entry->time_us >> 24) & 0xFF;
+            tx_msg[5] = (entry->time_us >> 16) & 0xFF;
+            tx_msg[6] = (entry->time_us >> 8) & 0xFF;
+            tx_msg[7] = entry->time_us & 0xFF;
+            can_ring_commit(&can_tx_ring);
+            imu_dump_time_sent = true;
+        } else {
+            tx_msg[0] = CAN_EPS_IMU_DUMP;
+            tx_msg[1] = entry->id | CAN_EPS_IMU_DUMP_DATA;
+            for (uint8_t i = 0; i < IMU_RING_VALUES; i++) {
+                tx_msg[2 + i * 2] = (entry->data[i] >> 8) & 0xFF;
+                tx_msg[3 + i * 2] = entry->data[i] & 0xFF;
+            }
+            can_ring_commit(&can_tx_ring);
+            imu_dump_pending = false;
+        }
+    }
+}
+
+/*
+If there is a TX message in the ring, send it
 
 When resume_mob(mob name) is called, it:
 1) resumes the MOB
@@ -300,15 +747,19 @@ When resume_mob(mob name) is called, it:
 3) sends the data
 4) pauses the mob
 */
-// Checks the TX message queue and sends the first message (if it exists)
+// Checks the TX message ring and sends the first message (if it exists)
 void send_next_tx_msg(void) {
-    if (queue_empty(&can_tx_msg_queue)) {
+    continue_hk_batch();
+    continue_log_dump();
+    continue_imu_dump();
+
+    // The frame stays in the ring until the CAN interrupt sends it
+    uint8_t* tx_msg = can_ring_peek(&can_tx_ring);
+    if (tx_msg == NULL) {
         return;
     }
 
     if (print_can_msgs) {
-        uint8_t tx_msg[8] = { 0x00 };
-        peek_queue(&can_tx_msg_queue, tx_msg);
         print("CAN TX: ");
         print_bytes(tx_msg, 8);
     }
@@ -5,19 +5,354 @@
 #include <stdint.h>
 
 #include <can/data_protocol.h>
-#include <queue/queue.h>
 #include <uart/uart.h>
 
+#include "battery.h"
 #include "can_interface.h"
+#include "can_ring.h"
 #include "devices.h"
+#include "event_log.h"
 #include "general.h"
 #include "heaters.h"
+#include "idle.h"
 #include "imu.h"
+#include "loop_stats.h"
+#include "measurements.h"
+#include "protection.h"
+#include "rail_stats.h"
 
-extern queue_t can_rx_msg_queue;
-extern queue_t can_tx_msg_queue;
+/*
+Batched HK read (not in lib-common's data_protocol.h yet)
+
+Request: byte 1 is the first field number, bytes 4-7 are a bitmask (bit n
+selects field number byte 1 + n).
+
+Responses are streamed as consecutive frames, in field number order:
+- byte 0 - CAN_EPS_HK_BATCH
+- byte 1 - field number A
+- byte 2 - status of field A
+- byte 3 - field number B, or CAN_EPS_HK_BATCH_NO_FIELD
+- bytes 4-7 - with field B, 16-bit data A then 16-bit data B, otherwise 32-bit
+  data A
+
+Two fields share a frame when both are valid and their data fits in 16 bits.
+*/
+#ifndef CAN_EPS_HK_BATCH
+#define CAN_EPS_HK_BATCH 0x05
+#endif
+#define CAN_EPS_HK_BATCH_NO_FIELD 0xFF
+
+/*
+Event log dump (not in lib-common's data_protocol.h yet)
+
+Request: no data.
+
+Responses are streamed as consecutive frames holding the bytes that were in
+the event log when the request was received (see event_log.c):
+- byte 0 - CAN_EPS_LOG_DUMP
+- byte 1 - number of log bytes in this frame (0 to 6)
+- bytes 2-7 - log bytes
+
+A frame with fewer than 6 log bytes ends the dump.
+*/
+#ifndef CAN_EPS_LOG_DUMP
+#define CAN_EPS_LOG_DUMP 0x06
+#endif
+#define CAN_EPS_LOG_DUMP_FRAME_BYTES 6
+
+/*
+Protection trip notification (not in lib-common's data_protocol.h yet)
+
+Sent without a request when a protection check trips (see protection.c):
+- byte 0 - CAN_EPS_PROT_TRIP
+- byte 1 - check (PROT_*)
+- byte 2 - loads switched off by this trip (PROT_LOAD_*, 0 if they were
+  already off)
+- byte 3 - all loads that are off
+- bytes 4-5 - raw ADC value
+- bytes 6-7 - threshold
+*/
+#ifndef CAN_EPS_PROT_TRIP
+#define CAN_EPS_PROT_TRIP 0x07
+#endif
+
+/*
+IMU sample dump (not in lib-common's data_protocol.h yet)
+
+Request: no data.
+
+Responses are streamed as consecutive frames, two for each timestamped sample
+that was in the IMU sample ring when the request was received (see imu.c),
+oldest first. The samples are removed from the ring as they are sent.
+- Time frame:
+  - byte 0 - CAN_EPS_IMU_DUMP
+  - byte 1 - report ID of the sample (IMU_ACCEL, IMU_CAL_GYRO or
+    IMU_UNCAL_GYRO)
+  - bytes 2-3 - 0
+  - bytes 4-7 - when the hub took the sample, in microseconds since startup
+    (counted in 128 us Timer 1 ticks, wraps around every 71.6 minutes)
+- Data frame:
+  - byte 0 - CAN_EPS_IMU_DUMP
+  - byte 1 - report ID of the sample | CAN_EPS_IMU_DUMP_DATA
+  - bytes 2-7 - x, y and z (16 bits each)
+
+A frame with byte 1 CAN_EPS_IMU_DUMP_END ends the dump, its bytes 4-7 are the
+number of samples that were replaced in the ring before they were dumped since
+the last dump.
+*/
+#ifndef CAN_EPS_IMU_DUMP
+#define CAN_EPS_IMU_DUMP 0x08
+#endif
+#define CAN_EPS_IMU_DUMP_DATA   0x80
+#define CAN_EPS_IMU_DUMP_END    0x00
+
+/*
+Main loop stage statistics (not in lib-common's data_protocol.h yet)
+
+CAN_EPS_CTRL_GET_LOOP_STATS - rx_data bits 15-8 are the stage (LOOP_STAGE_*)
+and bits 7-0 the item (LOOP_STAT_*), see loop_stats.h
+CAN_EPS_CTRL_RESET_LOOP_STATS - resets the statistics of every stage
+*/
+#ifndef CAN_EPS_CTRL_GET_LOOP_STATS
+#define CAN_EPS_CTRL_GET_LOOP_STATS     0x0E
+#endif
+#ifndef CAN_EPS_CTRL_RESET_LOOP_STATS
+#define CAN_EPS_CTRL_RESET_LOOP_STATS   0x0F
+#endif
+
+/*
+ADC oversampling (not in lib-common's data_protocol.h yet)
+
+CAN_EPS_CTRL_GET_ADC_OVERSAMPLE - rx_data is the ADC channel, tx_data is the
+number of sweeps averaged for it
+CAN_EPS_CTRL_SET_ADC_OVERSAMPLE - rx_data bits 15-8 are the ADC channel (0xFF
+for every channel) and bits 7-0 the number of sweeps to average (1, 4, 16 or
+64), see measurements.c
+*/
+#ifndef CAN_EPS_CTRL_GET_ADC_OVERSAMPLE
+#define CAN_EPS_CTRL_GET_ADC_OVERSAMPLE 0x10
+#endif
+#ifndef CAN_EPS_CTRL_SET_ADC_OVERSAMPLE
+#define CAN_EPS_CTRL_SET_ADC_OVERSAMPLE 0x11
+#endif
+
+/*
+Rail energy and current statistics (not in lib-common's data_protocol.h yet)
+
+CAN_EPS_CTRL_GET_RAIL_RESET_ON_READ - tx_data is 1 if reading a rail HK field
+restarts that statistic, otherwise 0
+CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ - rx_data is 1 to restart each statistic
+when it is read, 0 to accumulate until CAN_EPS_CTRL_RESET_RAIL_STATS
+CAN_EPS_CTRL_RESET_RAIL_STATS - restarts the statistics of every rail
+*/
+#ifndef CAN_EPS_CTRL_GET_RAIL_RESET_ON_READ
+#define CAN_EPS_CTRL_GET_RAIL_RESET_ON_READ 0x12
+#endif
+#ifndef CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ
+#define CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ 0x13
+#endif
+#ifndef CAN_EPS_CTRL_RESET_RAIL_STATS
+#define CAN_EPS_CTRL_RESET_RAIL_STATS       0x14
+#endif
+
+/*
+Overcurrent and undervoltage protection (not in lib-common's data_protocol.h
+yet)
+
+CAN_EPS_CTRL_GET_PROT_THRESH - rx_data is the check (PROT_*), tx_data is its
+raw ADC threshold
+CAN_EPS_CTRL_SET_PROT_THRESH - rx_data bits 23-16 are the check and bits 15-0
+the raw ADC threshold (up to 0x0FFF), saved in the config journal
+CAN_EPS_CTRL_GET_PROT_STATUS - tx_data bits 23-16 are the number of trips
+since startup (saturated at 0xFF), bits 15-8 the checks that have tripped and
+bits 7-0 the loads that are switched off (PROT_LOAD_*)
+CAN_EPS_CTRL_CLEAR_PROT - switches the loads back on and rearms the checks
+*/
+#ifndef CAN_EPS_CTRL_GET_PROT_THRESH
+#define CAN_EPS_CTRL_GET_PROT_THRESH        0x15
+#endif
+#ifndef CAN_EPS_CTRL_SET_PROT_THRESH
+#define CAN_EPS_CTRL_SET_PROT_THRESH        0x16
+#endif
+#ifndef CAN_EPS_CTRL_GET_PROT_STATUS
+#define CAN_EPS_CTRL_GET_PROT_STATUS        0x17
+#endif
+#ifndef CAN_EPS_CTRL_CLEAR_PROT
+#define CAN_EPS_CTRL_CLEAR_PROT             0x18
+#endif
+
+/*
+IMU wait for HINT histogram (not in lib-common's data_protocol.h yet)
+
+CAN_EPS_CTRL_GET_IMU_WAIT_HIST - rx_data is the bin (0 to
+IMU_WAIT_HIST_BINS - 1), tx_data is the number of waits for the hub that took
+that many significant bits of 128 us ticks (see imu.c), or rx_data
+IMU_WAIT_HIST_BINS for the number of waits that timed out
+CAN_EPS_CTRL_RESET_IMU_WAIT_HIST - clears the histogram and timeouts
+*/
+#ifndef CAN_EPS_CTRL_GET_IMU_WAIT_HIST
+#define CAN_EPS_CTRL_GET_IMU_WAIT_HIST      0x19
+#endif
+#ifndef CAN_EPS_CTRL_RESET_IMU_WAIT_HIST
+#define CAN_EPS_CTRL_RESET_IMU_WAIT_HIST    0x1A
+#endif
+
+/*
+IMU streaming intervals (not in lib-common's data_protocol.h yet)
+
+CAN_EPS_CTRL_GET_IMU_INTERVAL - rx_data bits 15-8 are the feature report ID
+(IMU_ACCEL, IMU_CAL_GYRO or IMU_UNCAL_GYRO), bits 7-0 are 0 for the report
+interval or 1 for the batch interval, tx_data is the interval in us
+CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL - rx_data bits 31-24 are the feature
+report ID, bits 23-0 are the report interval in us (not 0)
+CAN_EPS_CTRL_SET_IMU_BATCH_INTERVAL - rx_data bits 31-24 are the feature
+report ID, bits 23-0 are the batch interval in us (0 for no batching)
+
+A feature that is being streamed is sent its new intervals straight away.
+*/
+#ifndef CAN_EPS_CTRL_GET_IMU_INTERVAL
+#define CAN_EPS_CTRL_GET_IMU_INTERVAL           0x1B
+#endif
+#ifndef CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL
+#define CAN_EPS_CTRL_SET_IMU_REPORT_INTERVAL    0x1C
+#endif
+#ifndef CAN_EPS_CTRL_SET_IMU_BATCH_INTERVAL
+#define CAN_EPS_CTRL_SET_IMU_BATCH_INTERVAL     0x1D
+#endif
+
+/*
+IMU sample ring decimation (not in lib-common's data_protocol.h yet)
+
+CAN_EPS_CTRL_GET_IMU_RING_DECIMATION - tx_data is the decimation
+CAN_EPS_CTRL_SET_IMU_RING_DECIMATION - rx_data is the decimation (0 to 255)
+
+With a decimation of n, every nth report of each feature is added to the ring
+CAN_EPS_IMU_DUMP drains. It is 0 at startup, so nothing is added until OBC
+arms the ring. OBC has to dump it at least every
+IMU_SAMPLE_RING_SIZE * n * report interval / 3 (21 s for n = 10 at the
+default 100 ms) or the oldest samples are replaced.
+*/
+#ifndef CAN_EPS_CTRL_GET_IMU_RING_DECIMATION
+#define CAN_EPS_CTRL_GET_IMU_RING_DECIMATION    0x1E
+#endif
+#ifndef CAN_EPS_CTRL_SET_IMU_RING_DECIMATION
+#define CAN_EPS_CTRL_SET_IMU_RING_DECIMATION    0x1F
+#endif
+
+/*
+EPS HK fields after lib-common's CAN_EPS_HK_FIELD_COUNT (not in
+data_protocol.h yet)
+
+CAN_EPS_HK_IDLE_FRAC - fraction of the last IDLE_WINDOW_S seconds that the
+MCU spent asleep, in 1/1000 (see idle.c)
+CAN_EPS_HK_SLEEP_COUNT - number of times the MCU has gone to sleep
+CAN_EPS_HK_DAC_SKIPPED - number of heater DAC channel writes skipped because
+the setpoint was unchanged (see heaters.c)
+CAN_EPS_HK_BAT_CHARGE - charge left in the battery pack, in mC (see
+battery.c), bit 31 is set while the pack model is not calibrated
+(BATT_SOC_CALIBRATED)
+CAN_EPS_HK_BAT_SOC - battery state of charge, in 1/1000, bit 15 is set while
+the pack model is not calibrated
+CAN_EPS_HK_BAT_INT_TIME - time the pack current has been integrated over
+since startup, in seconds
+CAN_EPS_HK_<rail>_ENERGY, _CUR_MEAN, _CUR_MIN, _CUR_MAX - energy delivered by
+the 3V3, 5V or PAY rail (mJ), and the mean, minimum and maximum of its current
+(mA), since the statistic was last read or reset (see rail_stats.c)
+CAN_EPS_HK_ACC_X, _Y, _Z - accelerometer (signed, m/s^2 with Q point 8), from
+the same IMU record as the gyroscope fields (see imu.c)
+CAN_EPS_HK_ADC_EXT(channel) - one field per ADC channel (ADC_VMON_PACK etc.),
+the oversampled mean of the channel in the snapshot with MEAS_EXT_FRAC_BITS
+fractional bits, i.e. 16 x the raw value in the matching ADC field (see
+measurements.c)
+
+EPS_HK_FIELD_COUNT is the number of HK fields EPS answers.
+*/
+#ifndef CAN_EPS_HK_IDLE_FRAC
+#define CAN_EPS_HK_IDLE_FRAC    0x1B
+#endif
+#ifndef CAN_EPS_HK_SLEEP_COUNT
+#define CAN_EPS_HK_SLEEP_COUNT  0x1C
+#endif
+#ifndef CAN_EPS_HK_DAC_SKIPPED
+#define CAN_EPS_HK_DAC_SKIPPED  0x1D
+#endif
+#ifndef CAN_EPS_HK_BAT_CHARGE
+#define CAN_EPS_HK_BAT_CHARGE   0x1E
+#endif
+#ifndef CAN_EPS_HK_BAT_SOC
+#define CAN_EPS_HK_BAT_SOC      0x1F
+#endif
+#ifndef CAN_EPS_HK_BAT_INT_TIME
+#define CAN_EPS_HK_BAT_INT_TIME 0x20
+#endif
+#ifndef CAN_EPS_HK_3V3_ENERGY
+#define CAN_EPS_HK_3V3_ENERGY   0x21
+#endif
+#ifndef CAN_EPS_HK_3V3_CUR_MEAN
+#define CAN_EPS_HK_3V3_CUR_MEAN 0x22
+#endif
+#ifndef CAN_EPS_HK_3V3_CUR_MIN
+#define CAN_EPS_HK_3V3_CUR_MIN  0x23
+#endif
+#ifndef CAN_EPS_HK_3V3_CUR_MAX
+#define CAN_EPS_HK_3V3_CUR_MAX  0x24
+#endif
+#ifndef CAN_EPS_HK_5V_ENERGY
+#define CAN_EPS_HK_5V_ENERGY    0x25
+#endif
+#ifndef CAN_EPS_HK_5V_CUR_MEAN
+#define CAN_EPS_HK_5V_CUR_MEAN  0x26
+#endif
+#ifndef CAN_EPS_HK_5V_CUR_MIN
+#define CAN_EPS_HK_5V_CUR_MIN   0x27
+#endif
+#ifndef CAN_EPS_HK_5V_CUR_MAX
+#define CAN_EPS_HK_5V_CUR_MAX   0x28
+#endif
+#ifndef CAN_EPS_HK_PAY_ENERGY
+#define CAN_EPS_HK_PAY_ENERGY   0x29
+#endif
+#ifndef CAN_EPS_HK_PAY_CUR_MEAN
+#define CAN_EPS_HK_PAY_CUR_MEAN 0x2A
+#endif
+#ifndef CAN_EPS_HK_PAY_CUR_MIN
+#define CAN_EPS_HK_PAY_CUR_MIN  0x2B
+#endif
+#ifndef CAN_EPS_HK_PAY_CUR_MAX
+#define CAN_EPS_HK_PAY_CUR_MAX  0x2C
+#endif
+#ifndef CAN_EPS_HK_ACC_X
+#define CAN_EPS_HK_ACC_X        0x2D
+#endif
+#ifndef CAN_EPS_HK_ACC_Y
+#define CAN_EPS_HK_ACC_Y        0x2E
+#endif
+#ifndef CAN_EPS_HK_ACC_Z
+#define CAN_EPS_HK_ACC_Z        0x2F
+#endif
+#ifndef CAN_EPS_HK_ADC_EXT_FIRST
+#define CAN_EPS_HK_ADC_EXT_FIRST    0x30
+#endif
+#define CAN_EPS_HK_ADC_EXT(channel) (CAN_EPS_HK_ADC_EXT_FIRST + (channel))
+#define EPS_HK_FIELD_COUNT      0x40
+
+extern can_ring_t can_rx_ring;
+extern can_ring_t can_tx_ring;
+extern bool print_can_msgs;
+extern bool log_can_msgs;
+
+extern uint8_t hk_batch_base;
+extern uint32_t hk_batch_mask;
+extern bool log_dump_active;
+extern bool imu_dump_active;
 
 void process_next_rx_msg(void);
+uint8_t start_hk_batch(uint8_t base, uint32_t mask);
+void continue_hk_batch(void);
+void start_log_dump(void);
+void continue_log_dump(void);
+void start_imu_dump(void);
+void continue_imu_dump(void);
 void send_next_tx_msg(void);
 
 #endif
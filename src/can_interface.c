@@ -10,22 +10,19 @@ void cmd_rx_callback(const uint8_t* data, uint8_t len) {
         return;
     }
 
-    // If the RX message exists, add it to the queue of received messages to process
-    enqueue(&can_rx_msg_queue, (uint8_t *) data);
+    // If the RX message exists, add it to the ring of received messages to
+    // process (counted in `can_rx_ring.overflows` if it is full)
+    can_ring_push(&can_rx_ring, data);
 }
 
 // MOB 5
 // DATA TX - transmitting data
 void data_tx_callback(uint8_t* data, uint8_t* len) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_empty(&can_tx_msg_queue)) {
-            *len = 0;
-            return;
-        }
-
-        // If there is a message in the TX queue, transmit it
-        dequeue(&can_tx_msg_queue, data);
+    // If there is a message in the TX ring, transmit it
+    if (can_ring_pop(&can_tx_ring, data)) {
         *len = 8;
+    } else {
+        *len = 0;
     }
 }
 
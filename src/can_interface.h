@@ -5,7 +5,6 @@
 #include <can/can.h>
 #include <can/ids.h>
 #include <can/data_protocol.h>
-#include <queue/queue.h>
 #include <uart/uart.h>
 
 #include "can_commands.h"
@@ -0,0 +1,96 @@
+/*
+Single-producer, single-consumer ring buffers of 8-byte CAN frames.
+
+One side (e.g. the CAN RX interrupt) only adds frames and the other (e.g. the
+main loop) only removes them. Each side only writes its own index, and the
+indices are single bytes, which the AVR reads and writes atomically, so
+neither side needs to disable interrupts.
+
+Frames can be built and parsed in place - the producer fills the slot from
+can_ring_reserve() and then calls can_ring_commit(), and the consumer reads
+the slot from can_ring_peek() and then calls can_ring_release().
+*/
+
+#include "can_ring.h"
+
+#include <string.h>
+
+
+void init_can_ring(can_ring_t* ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->overflows = 0;
+    ring->high_water = 0;
+}
+
+// Number of frames in the ring (at the time it is read)
+uint8_t can_ring_count(can_ring_t* ring) {
+    return (uint8_t) (ring->tail - ring->head);
+}
+
+/*
+Producer - returns the next free slot to fill, or NULL if the ring is full
+(counted as an overflow). Call can_ring_commit() to add it.
+*/
+uint8_t* can_ring_reserve(can_ring_t* ring) {
+    uint8_t tail = ring->tail;
+    if ((uint8_t) (tail - ring->head) >= CAN_RING_SIZE) {
+        ring->overflows++;
+        return NULL;
+    }
+    return ring->frames[tail & (CAN_RING_SIZE - 1)];
+}
+
+// Producer - adds the slot returned by can_ring_reserve()
+void can_ring_commit(can_ring_t* ring) {
+    CAN_RING_BARRIER();
+    uint8_t tail = ring->tail + 1;
+    ring->tail = tail;
+
+    uint8_t count = (uint8_t) (tail - ring->head);
+    if (count > ring->high_water) {
+        ring->high_water = count;
+    }
+}
+
+// Producer - copies a frame in, returns 1 for success or 0 if the ring is full
+uint8_t can_ring_push(can_ring_t* ring, const uint8_t* frame) {
+    uint8_t* slot = can_ring_reserve(ring);
+    if (slot == NULL) {
+        return 0;
+    }
+    memcpy(slot, frame, CAN_RING_FRAME_LEN);
+    can_ring_commit(ring);
+    return 1;
+}
+
+/*
+Consumer - returns the oldest frame, or NULL if the ring is empty. The frame
+stays valid until can_ring_release() is called.
+*/
+uint8_t* can_ring_peek(can_ring_t* ring) {
+    uint8_t head = ring->head;
+    if (head == ring->tail) {
+        return NULL;
+    }
+    CAN_RING_BARRIER();
+    return ring->frames[head & (CAN_RING_SIZE - 1)];
+}
+
+// Consumer - removes the frame returned by can_ring_peek()
+void can_ring_release(can_ring_t* ring) {
+    CAN_RING_BARRIER();
+    ring->head = ring->head + 1;
+}
+
+// Consumer - copies the oldest frame out, returns 1 for success or 0 if the
+// ring is empty
+uint8_t can_ring_pop(can_ring_t* ring, uint8_t* frame) {
+    uint8_t* slot = can_ring_peek(ring);
+    if (slot == NULL) {
+        return 0;
+    }
+    memcpy(frame, slot, CAN_RING_FRAME_LEN);
+    can_ring_release(ring);
+    return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef CAN_RING_H
+#define CAN_RING_H
+
+#include <stdint.h>
+
+// Bytes in every frame
+#define CAN_RING_FRAME_LEN 8
+// Number of frames, must be a power of 2 (up to 128)
+#define CAN_RING_SIZE 16
+
+// Keeps the compiler from moving frame accesses past an index update
+#define CAN_RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+typedef struct {
+    uint8_t frames[CAN_RING_SIZE][CAN_RING_FRAME_LEN];
+    // Free-running indices, only written by the consumer (head) or the
+    // producer (tail)
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    // Frames the producer could not add because the ring was full
+    volatile uint16_t overflows;
+    // Most frames that have been in the ring at once
+    volatile uint8_t high_water;
+} can_ring_t;
+
+void init_can_ring(can_ring_t* ring);
+uint8_t can_ring_count(can_ring_t* ring);
+
+uint8_t* can_ring_reserve(can_ring_t* ring);
+void can_ring_commit(can_ring_t* ring);
+uint8_t can_ring_push(can_ring_t* ring, const uint8_t* frame);
+
+uint8_t* can_ring_peek(can_ring_t* ring);
+void can_ring_release(can_ring_t* ring);
+uint8_t can_ring_pop(can_ring_t* ring, uint8_t* frame);
+
+#endif
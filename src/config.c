@@ -0,0 +1,152 @@
+/*
+Journaled configuration store in EEPROM.
+
+All configuration values (heater setpoints and current thresholds) are kept
+together in a record of CONFIG_SLOT_SIZE bytes with a sequence number and a
+CRC. Every change appends a complete new record to the next slot of a ring
+of CONFIG_SLOT_COUNT slots, so the writes are spread over the whole journal
+(each byte is written once per CONFIG_SLOT_COUNT commits) and a record that
+was interrupted by a reset fails its CRC, leaving the previous one as the
+newest valid record.
+
+Writes don't block: set_config() only updates the RAM copy and starts a
+commit, and the EE_READY interrupt programs one byte each time the EEPROM
+becomes ready (about 3.3 ms per byte). Values changed while a commit is in
+progress are written by the next commit, which run_config() starts from the
+main loop once the current one is done.
+
+The journal uses lib-common's EEPROM layout only above CONFIG_JOURNAL_ADDR.
+Blocking EEPROM writes elsewhere (e.g. CAN_EPS_CTRL_ERASE_EEPROM) wait for
+the current byte but can interleave with a commit.
+*/
+
+#include "config.h"
+
+_Static_assert(sizeof(config_record_t) == CONFIG_SLOT_SIZE,
+    "a record must fill its slot exactly");
+
+// Latest values (the newest record, plus any changes not committed yet)
+config_record_t config_record;
+// Slot of the newest record written or restored
+uint8_t config_slot = CONFIG_SLOT_COUNT - 1;
+// Set when config_record has changes that have not been committed
+bool config_dirty = false;
+
+// Record being programmed by the EE_READY interrupt and the next byte
+static config_record_t config_write_buf;
+static uint16_t config_write_addr = 0;
+static volatile uint8_t config_write_index = CONFIG_SLOT_SIZE;
+
+
+uint16_t calc_config_crc(const config_record_t* record) {
+    const uint8_t* bytes = (const uint8_t*) record;
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < CONFIG_SLOT_SIZE - sizeof(record->crc); i++) {
+        crc = _crc_ccitt_update(crc, bytes[i]);
+    }
+    return crc;
+}
+
+/*
+Loads the newest valid record from the journal into config_record.
+Returns - 1 if a valid record was found, 0 if every value is unset
+*/
+uint8_t restore_config(void) {
+    uint8_t found = 0;
+    config_record_t record;
+
+    for (uint8_t slot = 0; slot < CONFIG_SLOT_COUNT; slot++) {
+        uint8_t* bytes = (uint8_t*) &record;
+        uint16_t addr = CONFIG_JOURNAL_ADDR + slot * CONFIG_SLOT_SIZE;
+        for (uint8_t i = 0; i < CONFIG_SLOT_SIZE; i++) {
+            bytes[i] = eeprom_read_byte((const uint8_t*) (uintptr_t) (addr + i));
+        }
+
+        if (record.crc != calc_config_crc(&record)) {
+            continue;
+        }
+        if (!found || record.seq > config_record.seq) {
+            config_record = record;
+            config_slot = slot;
+            found = 1;
+        }
+    }
+
+    if (!found) {
+        config_record.seq = 0;
+        for (uint8_t i = 0; i < CONFIG_SLOT_VALUES; i++) {
+            config_record.values[i] = CONFIG_NO_VALUE;
+        }
+        // The first record goes in slot 0
+        config_slot = CONFIG_SLOT_COUNT - 1;
+    }
+    config_dirty = false;
+    return found;
+}
+
+/*
+Gets a configuration value.
+Returns - 1 if the value is set, 0 if it has never been set
+*/
+uint8_t get_config(uint8_t id, uint16_t* value) {
+    if (id >= CONFIG_COUNT || config_record.values[id] == CONFIG_NO_VALUE) {
+        return 0;
+    }
+    *value = config_record.values[id];
+    return 1;
+}
+
+// Sets a configuration value and starts committing it in the background
+void set_config(uint8_t id, uint16_t value) {
+    if (id >= CONFIG_COUNT || config_record.values[id] == value) {
+        return;
+    }
+    config_record.values[id] = value;
+    config_dirty = true;
+    run_config();
+}
+
+// Returns true while the EE_READY interrupt is writing a record
+bool is_config_busy(void) {
+    return (EECR & _BV(EERIE)) != 0;
+}
+
+// Returns true if there are changes to commit and no commit in progress
+bool is_config_commit_due(void) {
+    return config_dirty && !is_config_busy();
+}
+
+// Main loop task - starts committing the latest values if they have changed
+void run_config(void) {
+    if (!is_config_commit_due()) {
+        return;
+    }
+
+    config_write_buf = config_record;
+    config_write_buf.seq++;
+    config_write_buf.crc = calc_config_crc(&config_write_buf);
+    config_record.seq = config_write_buf.seq;
+    config_dirty = false;
+
+    config_slot = (config_slot + 1) % CONFIG_SLOT_COUNT;
+    config_write_addr = CONFIG_JOURNAL_ADDR + config_slot * CONFIG_SLOT_SIZE;
+    config_write_index = 0;
+    // The interrupt fires as soon as the EEPROM is ready
+    EECR |= _BV(EERIE);
+}
+
+// Programs the next byte of the record, or ends the commit
+ISR(EE_READY_vect) {
+    if (config_write_index >= CONFIG_SLOT_SIZE) {
+        EECR &= (uint8_t) ~_BV(EERIE);
+        return;
+    }
+
+    EEAR = config_write_addr + config_write_index;
+    EEDR = ((uint8_t*) &config_write_buf)[config_write_index];
+    // EEPE must be set within 4 cycles of EEMPE (interrupts are disabled in
+    // the ISR)
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+    config_write_index++;
+}
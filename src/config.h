@@ -0,0 +1,61 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+
+// EEPROM region of the journal (after the fixed addresses used by lib-common
+// and the old heater configuration)
+#define CONFIG_JOURNAL_ADDR 0x100
+// Bytes per record, the journal is 1 KB
+#define CONFIG_SLOT_SIZE    32
+#define CONFIG_SLOT_COUNT   32
+// Values that fit in a record (the rest of the slot is the sequence number
+// and CRC)
+#define CONFIG_SLOT_VALUES  13
+
+// Configuration value IDs (index in the record)
+#define CONFIG_HEAT1_SHAD_SP        0
+#define CONFIG_HEAT2_SHAD_SP        1
+#define CONFIG_HEAT1_SUN_SP         2
+#define CONFIG_HEAT2_SUN_SP         3
+#define CONFIG_HEAT_CUR_THR_UPPER   4
+#define CONFIG_HEAT_CUR_THR_LOWER   5
+// ADC oversampling (2 bits per channel, see measurements.c)
+#define CONFIG_ADC_OVERSAMPLE_LO    6
+#define CONFIG_ADC_OVERSAMPLE_HI    7
+// Battery charge (see battery.c)
+#define CONFIG_BATT_CHARGE          8
+// Protection thresholds, CONFIG_PROT_THRESH + PROT_* (see protection.c)
+#define CONFIG_PROT_THRESH          9
+#define CONFIG_COUNT                13
+
+// Stored for values that have never been set (erased EEPROM)
+#define CONFIG_NO_VALUE 0xFFFF
+
+typedef struct {
+    // Incremented for every record written, the newest valid record wins
+    uint32_t seq;
+    uint16_t values[CONFIG_SLOT_VALUES];
+    // CRC-CCITT of the sequence number and values
+    uint16_t crc;
+} config_record_t;
+
+extern config_record_t config_record;
+extern uint8_t config_slot;
+extern bool config_dirty;
+
+uint16_t calc_config_crc(const config_record_t* record);
+uint8_t restore_config(void);
+uint8_t get_config(uint8_t id, uint16_t* value);
+void set_config(uint8_t id, uint16_t value);
+bool is_config_busy(void);
+bool is_config_commit_due(void);
+void run_config(void);
+
+#endif
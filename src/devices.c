@@ -7,7 +7,7 @@ pin_info_t adc_cs = {
     .pin = ADC_CS_PIN
 };
 adc_t adc = {
-    .auto_channels = 0x0fff, // poll channels 0-11 in auto-1 mode
+    .auto_channels = 0xffff, // sweep all 16 channels in auto-1 mode
     .cs = &adc_cs
 };
 
@@ -45,3 +45,43 @@ pex_t pex = {
     .cs = &pex_cs,
     .rst = &pex_rst
 };
+
+
+// Sends one 24-bit command frame to the DAC (`data` is bits 15-0)
+static void send_dac_frame(dac_t* dac, uint8_t cmd, uint8_t addr,
+        uint16_t data) {
+    set_cs_low(dac->cs->pin, dac->cs->port);
+    send_spi((cmd << 3) | addr);
+    send_spi((data >> 8) & 0xFF);
+    send_spi(data & 0xFF);
+    set_cs_high(dac->cs->pin, dac->cs->port);
+}
+
+/*
+Makes both DAC outputs ignore the LDAC pin, so they only change on an update
+command. If LDAC is tied low (synchronous mode), writing an input register
+would otherwise update that output on its own SYNC edge, and
+set_dac_raw_voltages() couldn't hold A back until B is written. This doesn't
+depend on how LDAC is wired. Call after init_dac() (a DAC reset clears the
+LDAC register), after claim_spi_bus(&spi_lib_common_dev).
+*/
+void init_dac_sync_update(dac_t* dac) {
+    send_dac_frame(dac, DAC_CMD_SET_LDAC, 0, DAC_LDAC_INACTIVE_ALL);
+}
+
+/*
+Sets both DAC channels so that the outputs change at the same time
+(lib-common's set_dac_raw_voltage() updates each output as soon as its channel
+is written). Channel A is only loaded into its input register, then writing B
+updates both outputs. Needs init_dac_sync_update(). Call
+claim_spi_bus(&spi_lib_common_dev) first.
+*/
+void set_dac_raw_voltages(dac_t* dac, uint16_t raw_data_a, uint16_t raw_data_b) {
+    raw_data_a &= 0x0FFF;
+    raw_data_b &= 0x0FFF;
+    send_dac_frame(dac, DAC_CMD_WRITE_INPUT, DAC_ADDR_A, raw_data_a << 4);
+    send_dac_frame(dac, DAC_CMD_WRITE_INPUT_UPDATE_ALL, DAC_ADDR_B,
+        raw_data_b << 4);
+    dac->raw_voltage_a = raw_data_a;
+    dac->raw_voltage_b = raw_data_b;
+}
@@ -5,6 +5,8 @@
 #include <dac/dac.h>
 #include <pex/pex.h>
 
+#include "spi_xfer.h"
+
 // ADC CS
 #define ADC_CS_PIN  PB2
 #define ADC_CS_PORT PORTB
@@ -37,6 +39,17 @@
 #define DAC_CLR_PORT PORTC
 #define DAC_CLR_DDR  DDRC
 
+// DAC7562 24-bit frame: command in bits 21-19, address in bits 18-16, data in
+// bits 15-0 (a value in bits 15-4)
+#define DAC_CMD_WRITE_INPUT             0x00    // write input register n
+#define DAC_CMD_WRITE_INPUT_UPDATE_ALL  0x02    // ...and update all outputs
+#define DAC_CMD_SET_LDAC                0x06    // LDAC register in bits 1-0
+#define DAC_ADDR_A                      0x00
+#define DAC_ADDR_B                      0x01
+// LDAC register bits set for both channels - the outputs ignore the LDAC pin
+// and only change on an update command
+#define DAC_LDAC_INACTIVE_ALL           0x03
+
 // PEX CS
 #define PEX_CS_PIN  PC1
 #define PEX_CS_PORT PORTC
@@ -50,6 +63,13 @@
 // PEX address
 #define PEX_ADDR 0b001
 
+// Load switch enables on PEX port A (high = on), switched off by the
+// protection task
+#define PEX_LOAD_PORT       PEX_A
+#define PEX_LOAD_3V3_EN     0
+#define PEX_LOAD_5V_EN      1
+#define PEX_LOAD_PAY_EN     2
+
 #define ADC_THM_BATT2       0
 #define ADC_THM_BATT1       1
 #define ADC_THM_PAY_CONN    2
@@ -67,8 +87,14 @@
 #define ADC_IMON_PACK       14
 #define ADC_IMON_PAY_LIM    15
 
+// The lib-common drivers for these use the SPI bus directly, call
+// claim_spi_bus(&spi_lib_common_dev) before using them
+
 extern adc_t adc;
 extern pex_t pex;
 extern dac_t dac;
 
+void init_dac_sync_update(dac_t* dac);
+void set_dac_raw_voltages(dac_t* dac, uint16_t raw_data_a, uint16_t raw_data_b);
+
 #endif
@@ -0,0 +1,119 @@
+/*
+Compact binary event log.
+
+Instead of formatting text with print() (which blocks the main loop for
+about 1 ms per character at 9600 baud, and needs the floating point printf
+for %f), events are appended to a RAM ring as an event ID, a timestamp and
+the raw argument bytes. The log is read out over CAN (CAN_EPS_LOG_DUMP) and
+formatted on the ground by host/tools/log_decode.c.
+
+Entries are only ever added by the main loop and removed by
+read_event_log(), each side only writing its own index, so an interrupt
+could take either side without disabling interrupts. An entry is either
+written completely or dropped (and counted) if there is not enough space.
+*/
+
+#include "event_log.h"
+
+#include <string.h>
+
+event_log_t event_log;
+
+
+void init_event_log(void) {
+    event_log.head = 0;
+    event_log.tail = 0;
+    event_log.dropped = 0;
+    event_log.dropped_pending = 0;
+}
+
+// Number of argument bytes for an event ID (0 if it is not known)
+uint8_t event_arg_len(uint8_t id) {
+    switch (id) {
+        case EVT_DROPPED:
+            return EVT_DROPPED_LEN;
+        case EVT_CAN_RX:
+            return EVT_CAN_RX_LEN;
+        case EVT_CAN_TX:
+            return EVT_CAN_TX_LEN;
+        case EVT_HEATER_CTRL:
+            return EVT_HEATER_CTRL_LEN;
+        case EVT_PROT_TRIP:
+            return EVT_PROT_TRIP_LEN;
+        default:
+            return 0;
+    }
+}
+
+// Number of bytes in the log
+uint8_t event_log_count(void) {
+    return (uint8_t) (event_log.tail - event_log.head);
+}
+
+static uint8_t event_log_space(void) {
+    return (EVENT_LOG_SIZE - 1) - event_log_count();
+}
+
+static void append_entry(uint8_t id, const uint8_t* args, uint8_t len) {
+    uint8_t tail = event_log.tail;
+    uint16_t time = (uint16_t) uptime_s;
+    event_log.data[tail++] = id;
+    event_log.data[tail++] = (time >> 8) & 0xFF;
+    event_log.data[tail++] = time & 0xFF;
+    for (uint8_t i = 0; i < len; i++) {
+        event_log.data[tail++] = args[i];
+    }
+
+    // Make the entry visible to the reader all at once
+    __asm__ __volatile__ ("" ::: "memory");
+    event_log.tail = tail;
+}
+
+/*
+Appends an event, with `event_arg_len(id)` bytes of arguments.
+Returns - 1 if the entry was added, 0 if it was dropped
+*/
+uint8_t log_event(uint8_t id, const uint8_t* args) {
+    uint8_t len = event_arg_len(id);
+    uint8_t needed = EVT_HEADER_LEN + len;
+    if (event_log.dropped_pending > 0) {
+        needed += EVT_HEADER_LEN + EVT_DROPPED_LEN;
+    }
+
+    if (event_log_space() < needed) {
+        event_log.dropped++;
+        event_log.dropped_pending++;
+        return 0;
+    }
+
+    if (event_log.dropped_pending > 0) {
+        uint8_t count[EVT_DROPPED_LEN] = {
+            (event_log.dropped_pending >> 8) & 0xFF,
+            event_log.dropped_pending & 0xFF
+        };
+        append_entry(EVT_DROPPED, count, EVT_DROPPED_LEN);
+        event_log.dropped_pending = 0;
+    }
+    append_entry(id, args, len);
+    return 1;
+}
+
+/*
+Removes up to `max_len` bytes from the log (entries can be split between
+reads, the decoder joins them).
+Returns - number of bytes read
+*/
+uint8_t read_event_log(uint8_t* data, uint8_t max_len) {
+    uint8_t head = event_log.head;
+    uint8_t count = (uint8_t) (event_log.tail - head);
+    if (count > max_len) {
+        count = max_len;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = event_log.data[head++];
+    }
+
+    __asm__ __volatile__ ("" ::: "memory");
+    event_log.head = head;
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <uptime/uptime.h>
+
+// Bytes in the ring - the 8-bit indices wrap around at this size, so it must
+// be 256 (and one less can be used)
+#define EVENT_LOG_SIZE 256
+
+// Every entry starts with the event ID and the low 16 bits of uptime_s (big
+// endian), followed by a fixed number of argument bytes for that ID
+#define EVT_HEADER_LEN 3
+
+// Event IDs and argument lengths (see host/tools/log_decode.c for formats)
+// Entries were dropped because the log was full - count (16 bits)
+#define EVT_DROPPED         0x01
+#define EVT_DROPPED_LEN     2
+// CAN message received - 8 bytes
+#define EVT_CAN_RX          0x02
+#define EVT_CAN_RX_LEN      8
+// CAN response queued for transmission - 8 bytes
+#define EVT_CAN_TX          0x03
+#define EVT_CAN_TX_LEN      8
+// Heater control step - mode (8 bits), sum of the raw solar currents, DAC A
+// and DAC B raw setpoints (16 bits each)
+#define EVT_HEATER_CTRL     0x04
+#define EVT_HEATER_CTRL_LEN 7
+// Protection check tripped - check (8 bits), loads switched off (8 bits), raw
+// ADC value and threshold (16 bits each)
+#define EVT_PROT_TRIP       0x05
+#define EVT_PROT_TRIP_LEN   6
+
+// Longest entry (header and arguments)
+#define EVT_MAX_LEN (EVT_HEADER_LEN + 8)
+
+typedef struct {
+    uint8_t data[EVENT_LOG_SIZE];
+    // Free-running indices, only written by the consumer (head) or the
+    // producer (tail)
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    // Entries dropped because the log was full, total and not yet recorded
+    // with an EVT_DROPPED entry
+    uint16_t dropped;
+    uint16_t dropped_pending;
+} event_log_t;
+
+extern event_log_t event_log;
+
+void init_event_log(void);
+uint8_t event_arg_len(uint8_t id);
+uint8_t event_log_count(void);
+uint8_t log_event(uint8_t id, const uint8_t* args);
+uint8_t read_event_log(uint8_t* data, uint8_t max_len);
+
+#endif
@@ -5,8 +5,12 @@
 void init_eps(void) {
     // UART
     init_uart();
+    // Before anything that logs events
+    init_event_log();
     // SPI
     init_spi();
+    // Interrupt-driven transfers (IMU)
+    init_spi_xfer();
 
     // ADC
     init_adc(&adc);
@@ -17,18 +21,37 @@ void init_eps(void) {
 
     init_heaters();
 
+    // ADC snapshot (needs the ADC)
+    init_measurements();
+
+    // The IMU driver times its waits for HINT with the uptime timer
+    init_uptime();
+
     // IMU
     init_imu();
+    // Keep the accelerometer and gyroscope reports in HK coming in the
+    // background, together in one packet
+    start_imu_acq();
 
-    // Queues
-    init_queue(&can_rx_msg_queue);
-    init_queue(&can_tx_msg_queue);
+    // CAN message rings
+    init_can_ring(&can_rx_ring);
+    init_can_ring(&can_tx_ring);
 
     // CAN and MOBs
     init_can();
     init_rx_mob(&cmd_rx_mob);
     init_tx_mob(&cmd_tx_mob);
 
-    init_uptime();
+    // Main loop timing (uses the uptime timer)
+    reset_loop_stats();
+    // Coulomb counter (uses the ADC snapshot, the config and the uptime timer)
+    init_battery();
+    // Rail energy (uses the ADC snapshot, sampled on the battery's tick)
+    init_rail_stats();
+    // Load switches and the protection tick, which also times the battery
+    // and rail samples
+    init_protection();
+    // Idle sleep (uses the main loop timer)
+    init_idle();
     init_com_timeout();
 }
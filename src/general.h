@@ -3,7 +3,6 @@
 
 #include <can/can.h>
 #include <heartbeat/heartbeat.h>
-#include <queue/queue.h>
 #include <spi/spi.h>
 #include <uptime/uptime.h>
 #include <watchdog/watchdog.h>
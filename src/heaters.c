@@ -9,6 +9,16 @@ Digikey Link: https://www.digikey.ca/product-detail/en/stmicroelectronics/TS391I
 Datasheet: https://www.st.com/content/ccc/resource/technical/document/datasheet/de/4c/b3/3d/64/7d/48/8e/CD00001660.pdf/files/CD00001660.pdf/jcr:content/translations/en.CD00001660.pdf
 
 Shadow is the default setpoint mode, sun is the secondary mode.
+
+The sun/shadow decision is made on the solar current channels of the ADC
+snapshot (see measurements.c), so it gets the resolution of their oversampling
+without converting them again. The current conversion is linear
+(current = k * (raw - zero)), so comparing the sum of the 4 solar currents
+against a current threshold is the same as comparing the sum of the values
+against raw threshold + 3 * zero, scaled by the snapshot's fractional bits.
+Those sums are precomputed whenever a threshold changes, so no floating point
+runs in the control step. Define HEATER_DEBUG to print the values converted to
+amps and degrees.
 */
 
 #include <stdbool.h>
@@ -18,67 +28,96 @@ Shadow is the default setpoint mode, sun is the secondary mode.
 #include <uptime/uptime.h>
 
 #include "devices.h"
+#include "event_log.h"
 #include "heaters.h"
+#include "measurements.h"
+
+// Uncomment to print the solar current and setpoints in physical units
+// #define HEATER_DEBUG
 
 heater_val_t heater_1_shadow_setpoint = {
     .raw = HEATER_1_DEF_SHADOW_SETPOINT,
+    .config_id = CONFIG_HEAT1_SHAD_SP,
     .eeprom_addr = HEATER_1_SHADOW_SETPOINT_ADDR
 };
 heater_val_t heater_2_shadow_setpoint = {
     .raw = HEATER_2_DEF_SHADOW_SETPOINT,
+    .config_id = CONFIG_HEAT2_SHAD_SP,
     .eeprom_addr = HEATER_2_SHADOW_SETPOINT_ADDR
 };
 heater_val_t heater_1_sun_setpoint = {
     .raw = HEATER_1_DEF_SUN_SETPOINT,
+    .config_id = CONFIG_HEAT1_SUN_SP,
     .eeprom_addr = HEATER_1_SUN_SETPOINT_ADDR
 };
 heater_val_t heater_2_sun_setpoint = {
     .raw = HEATER_2_DEF_SUN_SETPOINT,
+    .config_id = CONFIG_HEAT2_SUN_SP,
     .eeprom_addr = HEATER_2_SUN_SETPOINT_ADDR
 };
 
 heater_val_t heater_sun_cur_thresh_upper = {
     .raw = HEATER_SUN_CUR_THRESH_UPPER,
+    .config_id = CONFIG_HEAT_CUR_THR_UPPER,
     .eeprom_addr = HEATER_CUR_THRESH_UPPER_ADDR
 };
 heater_val_t heater_sun_cur_thresh_lower = {
     .raw = HEATER_SUN_CUR_THRESH_LOWER,
+    .config_id = CONFIG_HEAT_CUR_THR_LOWER,
     .eeprom_addr = HEATER_CUR_THRESH_LOWER_ADDR
 };
 
+// Thresholds for the sum of the solar current snapshot values (with
+// MEAS_EXT_FRAC_BITS fractional bits)
+uint32_t heater_sun_ext_sum_thresh_upper = 0;
+uint32_t heater_sun_ext_sum_thresh_lower = 0;
+
 heater_mode_t heater_mode = HEATER_MODE_SHADOW;
 
+// Last setpoints written to each DAC channel (HEATER_DAC_UNKNOWN before the
+// first write), and the number of channel writes skipped because the value
+// was unchanged
+uint16_t heater_dac_committed[2] = { HEATER_DAC_UNKNOWN, HEATER_DAC_UNKNOWN };
+uint32_t heater_dac_writes_skipped = 0;
+
 uint32_t heater_ctrl_period_s = HEATER_CTRL_PERIOD_S;
 uint32_t heater_ctrl_last_exec_time = 0;
 
 
 
+// Restores a value from the config journal, or from its old fixed EEPROM
+// address if it has never been journaled
+void restore_heater_val(heater_val_t* val, uint16_t default_raw) {
+    if (!get_config(val->config_id, &val->raw)) {
+        val->raw = (uint16_t) read_eeprom_or_default(val->eeprom_addr,
+            default_raw);
+    }
+}
+
 void init_heaters(void) {
+    // Newest valid record in the config journal
+    restore_config();
+
     // Read setpoints
-    heater_1_shadow_setpoint.raw = (uint16_t) read_eeprom_or_default(
-        heater_1_shadow_setpoint.eeprom_addr,
-        HEATER_1_DEF_SHADOW_SETPOINT);
-    heater_2_shadow_setpoint.raw = (uint16_t) read_eeprom_or_default(
-        heater_2_shadow_setpoint.eeprom_addr,
-        HEATER_2_DEF_SHADOW_SETPOINT);
-    heater_1_sun_setpoint.raw = (uint16_t) read_eeprom_or_default(
-        heater_1_sun_setpoint.eeprom_addr,
-        HEATER_1_DEF_SUN_SETPOINT);
-    heater_2_sun_setpoint.raw = (uint16_t) read_eeprom_or_default(
-        heater_2_sun_setpoint.eeprom_addr,
-        HEATER_2_DEF_SUN_SETPOINT);
+    restore_heater_val(&heater_1_shadow_setpoint, HEATER_1_DEF_SHADOW_SETPOINT);
+    restore_heater_val(&heater_2_shadow_setpoint, HEATER_2_DEF_SHADOW_SETPOINT);
+    restore_heater_val(&heater_1_sun_setpoint, HEATER_1_DEF_SUN_SETPOINT);
+    restore_heater_val(&heater_2_sun_setpoint, HEATER_2_DEF_SUN_SETPOINT);
 
     // Don't need to call set_raw_heater_setpoint() to save to EEPROM because
     // when it restarts, it will use the default values again
 
     // Read current thresholds
-    heater_sun_cur_thresh_upper.raw = (uint16_t) read_eeprom_or_default(
-        heater_sun_cur_thresh_upper.eeprom_addr,
-        HEATER_SUN_CUR_THRESH_UPPER);
-    heater_sun_cur_thresh_lower.raw = (uint16_t) read_eeprom_or_default(
-        heater_sun_cur_thresh_lower.eeprom_addr,
-        HEATER_SUN_CUR_THRESH_LOWER);
+    restore_heater_val(&heater_sun_cur_thresh_upper, HEATER_SUN_CUR_THRESH_UPPER);
+    restore_heater_val(&heater_sun_cur_thresh_lower, HEATER_SUN_CUR_THRESH_LOWER);
+    update_heater_sum_thresholds();
 
+    // The DAC was just reset, so its LDAC register is cleared - set it up for
+    // simultaneous updates, and write both channels
+    claim_spi_bus(&spi_lib_common_dev);
+    init_dac_sync_update(&dac);
+    heater_dac_committed[DAC_A] = HEATER_DAC_UNKNOWN;
+    heater_dac_committed[DAC_B] = HEATER_DAC_UNKNOWN;
     update_heater_setpoint_outputs();
 }
 
@@ -86,8 +125,8 @@ void init_heaters(void) {
 // raw_data - 12 bit DAC raw data for setpoint
 void set_raw_heater_setpoint(heater_val_t* setpoint, uint16_t raw_data) {
     setpoint->raw = raw_data;
-    //save to EEPROM
-    write_eeprom(setpoint->eeprom_addr, setpoint->raw);
+    // Save to EEPROM (committed in the background)
+    set_config(setpoint->config_id, setpoint->raw);
     update_heater_setpoint_outputs();
 }
 
@@ -95,68 +134,127 @@ void set_raw_heater_setpoint(heater_val_t* setpoint, uint16_t raw_data) {
 // raw_data - 12 bit DAC raw data for setpoint
 void set_raw_heater_cur_thresh(heater_val_t* cur_thresh, uint16_t raw_data) {
     cur_thresh->raw = raw_data;
-    //save to EEPROM
-    write_eeprom(cur_thresh->eeprom_addr, cur_thresh->raw);
+    // Save to EEPROM (committed in the background)
+    set_config(cur_thresh->config_id, cur_thresh->raw);
+    update_heater_sum_thresholds();
     update_heater_setpoint_outputs();
 }
 
-double read_solar_cur(uint8_t channel) {
-    fetch_adc_channel(&adc, channel);
-    uint16_t raw_data = read_adc_channel(&adc, channel);
-    double current = adc_raw_to_circ_cur(raw_data, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
-    return current;
+// Converts the current thresholds to thresholds for the sum of the solar
+// current snapshot values
+void update_heater_sum_thresholds(void) {
+    uint16_t offset = (HEATER_SOLAR_CUR_COUNT - 1) * HEATER_SOLAR_CUR_ZERO_RAW;
+    heater_sun_ext_sum_thresh_upper =
+        (uint32_t) (heater_sun_cur_thresh_upper.raw + offset) << MEAS_EXT_FRAC_BITS;
+    heater_sun_ext_sum_thresh_lower =
+        (uint32_t) (heater_sun_cur_thresh_lower.raw + offset) << MEAS_EXT_FRAC_BITS;
 }
 
+/*
+Writes the setpoints for the current mode to the DAC, skipping channels that
+already output that value. If both channels change, their outputs are
+updated together.
+*/
 void update_heater_setpoint_outputs(void) {
+    uint16_t raw_a = 0;
+    uint16_t raw_b = 0;
     if (heater_mode == HEATER_MODE_SUN) {
-        set_dac_raw_voltage(&dac, DAC_A, heater_1_sun_setpoint.raw);
-        set_dac_raw_voltage(&dac, DAC_B, heater_2_sun_setpoint.raw);
+        raw_a = heater_1_sun_setpoint.raw;
+        raw_b = heater_2_sun_setpoint.raw;
     }
     // Use shadow as the default just in case
     else {
-        set_dac_raw_voltage(&dac, DAC_A, heater_1_shadow_setpoint.raw);
-        set_dac_raw_voltage(&dac, DAC_B, heater_2_shadow_setpoint.raw);
+        raw_a = heater_1_shadow_setpoint.raw;
+        raw_b = heater_2_shadow_setpoint.raw;
+    }
+
+    bool write_a = (raw_a != heater_dac_committed[DAC_A]);
+    bool write_b = (raw_b != heater_dac_committed[DAC_B]);
+    if (!write_a) {
+        heater_dac_writes_skipped++;
     }
+    if (!write_b) {
+        heater_dac_writes_skipped++;
+    }
+    if (!write_a && !write_b) {
+        return;
+    }
+
+    claim_spi_bus(&spi_lib_common_dev);
+    if (write_a && write_b) {
+        set_dac_raw_voltages(&dac, raw_a, raw_b);
+    } else if (write_a) {
+        set_dac_raw_voltage(&dac, DAC_A, raw_a);
+    } else {
+        set_dac_raw_voltage(&dac, DAC_B, raw_b);
+    }
+    heater_dac_committed[DAC_A] = raw_a;
+    heater_dac_committed[DAC_B] = raw_b;
 }
 
 
 //when called, will check if setpoint needs to be changed and then do so if needed
 void control_heater_mode(void) {
-    double total_current = 0;
-    total_current += read_solar_cur(ADC_IMON_X_PLUS);
-    total_current += read_solar_cur(ADC_IMON_X_MINUS);
-    total_current += read_solar_cur(ADC_IMON_Y_PLUS);
-    total_current += read_solar_cur(ADC_IMON_Y_MINUS);
-
-    double upper_thresh = adc_raw_to_circ_cur(heater_sun_cur_thresh_upper.raw,
-        ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
-    double lower_thresh = adc_raw_to_circ_cur(heater_sun_cur_thresh_lower.raw,
-        ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
-    
+    // Only samples if the main loop hasn't refreshed the snapshot yet
+    run_measurements();
+
+    // At most 4 x 0xFFF0
+    adc_snapshot_t* snapshot = adc_snapshot;
+    uint32_t total_ext = 0;
+    total_ext += snapshot->ext[ADC_IMON_X_PLUS];
+    total_ext += snapshot->ext[ADC_IMON_X_MINUS];
+    total_ext += snapshot->ext[ADC_IMON_Y_PLUS];
+    total_ext += snapshot->ext[ADC_IMON_Y_MINUS];
+    // Rounded to a sum of raw values (at most 4 x 0xFFF) for the log
+    uint16_t total_raw = (uint16_t) ((total_ext +
+        (1 << (MEAS_EXT_FRAC_BITS - 1))) >> MEAS_EXT_FRAC_BITS);
+
+#ifdef HEATER_DEBUG
+    // Sum of the 4 converted currents
+    double total_current = adc_raw_to_circ_cur(total_raw, ADC_DEF_CUR_SENSE_RES,
+        ADC_DEF_CUR_SENSE_VREF) - (HEATER_SOLAR_CUR_COUNT - 1) *
+        adc_raw_to_circ_cur(0, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF);
     print("Solar current: %.6f A\n", total_current);
-    print("Upper threshold: %.6f A\n", upper_thresh);
-    print("Lower threshold: %.6f A\n", lower_thresh);
+    print("Upper threshold: %.6f A\n", adc_raw_to_circ_cur(
+        heater_sun_cur_thresh_upper.raw, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF));
+    print("Lower threshold: %.6f A\n", adc_raw_to_circ_cur(
+        heater_sun_cur_thresh_lower.raw, ADC_DEF_CUR_SENSE_RES, ADC_DEF_CUR_SENSE_VREF));
+#endif
 
-    if (total_current > upper_thresh) { //In the sun
+    if (total_ext > heater_sun_ext_sum_thresh_upper) { //In the sun
         heater_mode = HEATER_MODE_SUN;
-        print("Heaters - sun mode\n");
     }
-    else if (total_current < lower_thresh) {
+    else if (total_ext < heater_sun_ext_sum_thresh_lower) {
         heater_mode = HEATER_MODE_SHADOW;
-        print("Heaters - shadow mode\n");
     }
 
     update_heater_setpoint_outputs();
 
-    print("Heater setpoint 1: 0x%x (%.3f C)\n",
-        dac.raw_voltage_a, dac_raw_data_to_heater_setpoint(dac.raw_voltage_a));
-    print("Heater setpoint 2: 0x%x (%.3f C)\n",
-        dac.raw_voltage_b, dac_raw_data_to_heater_setpoint(dac.raw_voltage_b));
+    // Converted to amps and degrees by the log decoder
+    uint8_t args[EVT_HEATER_CTRL_LEN] = {
+        heater_mode,
+        (total_raw >> 8) & 0xFF, total_raw & 0xFF,
+        (dac.raw_voltage_a >> 8) & 0xFF, dac.raw_voltage_a & 0xFF,
+        (dac.raw_voltage_b >> 8) & 0xFF, dac.raw_voltage_b & 0xFF
+    };
+    log_event(EVT_HEATER_CTRL, args);
+
+#ifdef HEATER_DEBUG
+    print("Heater setpoint 1: 0x%x (%d cC)\n",
+        dac.raw_voltage_a, dac_raw_to_heater_setpoint_centi_c(dac.raw_voltage_a));
+    print("Heater setpoint 2: 0x%x (%d cC)\n",
+        dac.raw_voltage_b, dac_raw_to_heater_setpoint_centi_c(dac.raw_voltage_b));
+#endif
 }
 
-void run_heaters(void) {
+// Returns true if the heater control period has elapsed
+bool is_heater_ctrl_due(void) {
     // currently update every 1 minute
-    if ((uptime_s - heater_ctrl_last_exec_time) < heater_ctrl_period_s){
+    return (uptime_s - heater_ctrl_last_exec_time) >= heater_ctrl_period_s;
+}
+
+void run_heaters(void) {
+    if (!is_heater_ctrl_due()) {
         return;
     }
 
@@ -1,12 +1,18 @@
 #ifndef HEATERS_H
 #define HEATERS_H
 
+#include <stdbool.h>
+
 #include <dac/dac.h>
 #include <avr/eeprom.h>
+#include <conversions/conversions.h>
 
+#include "config.h"
 #include "devices.h"
+#include "therm_lut.h"
 
-//EEPROM address for storing raw data
+// EEPROM addresses the values were stored at before the config journal
+// (only read if the journal doesn't have a value, see init_heaters())
 #define HEATER_1_SHADOW_SETPOINT_ADDR   0x70
 #define HEATER_2_SHADOW_SETPOINT_ADDR   0x74
 #define HEATER_1_SUN_SETPOINT_ADDR      0x78
@@ -26,10 +32,22 @@
 
 #define HEATER_CTRL_PERIOD_S 60
 
+// Number of solar panel currents summed for the sun/shadow decision
+#define HEATER_SOLAR_CUR_COUNT 4
+// Raw ADC value of 0 A on a solar panel current channel (rounded to the
+// nearest count, folded at compile time)
+#define HEATER_SOLAR_CUR_ZERO_RAW \
+    ((uint16_t) (ADC_DEF_CUR_SENSE_VREF / ADC_VREF * 0xFFF + 0.5))
+
+// Not a 12-bit DAC value, so the next write always goes out
+#define HEATER_DAC_UNKNOWN 0xFFFF
+
 
 typedef struct {
     // Raw 12-bit DAC format
     uint16_t raw;
+    // CONFIG_* ID in the config journal
+    uint8_t config_id;
     uint16_t eeprom_addr;
 } heater_val_t;
 
@@ -48,16 +66,25 @@ extern heater_val_t heater_2_sun_setpoint;
 extern heater_val_t heater_sun_cur_thresh_upper;
 extern heater_val_t heater_sun_cur_thresh_lower;
 
+extern uint32_t heater_sun_ext_sum_thresh_upper;
+extern uint32_t heater_sun_ext_sum_thresh_lower;
+
 extern heater_mode_t heater_mode;
 
+extern uint16_t heater_dac_committed[2];
+extern uint32_t heater_dac_writes_skipped;
+
 
+void restore_heater_val(heater_val_t* val, uint16_t default_raw);
 void init_heaters(void);
 
 void set_raw_heater_setpoint(heater_val_t* setpoint, uint16_t raw_data);
 void set_raw_heater_cur_thresh(heater_val_t* cur_thresh, uint16_t raw_data);
 
+void update_heater_sum_thresholds(void);
 void update_heater_setpoint_outputs(void);
 void control_heater_mode(void);
+bool is_heater_ctrl_due(void);
 void run_heaters(void);
 
 #endif
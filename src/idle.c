@@ -0,0 +1,91 @@
+/*
+Idle scheduling for the main loop.
+
+When none of the main loop tasks has anything to do, run_idle() puts the MCU
+in idle sleep mode until the next interrupt. The CPU clock stops but the
+timers, the CAN controller and the external interrupts keep running, so it
+wakes up for:
+- a received or transmitted CAN frame (CAN interrupt)
+- an IMU packet (INT2 from HINT) and each byte of it (SPI STC)
+- the EEPROM becoming ready during a config commit (EE_READY)
+- the Timer 1 compare match that increments uptime_s every second, which is
+  what makes the measurement and heater tasks due
+
+The time spent asleep is measured with the main loop timer (see
+loop_stats.c). Every IDLE_WINDOW_S seconds, the fraction of the window that
+was spent asleep is saved in idle_fraction (in 1/1000) for HK.
+*/
+
+#include "idle.h"
+
+// Set to false to keep the main loop busy-waiting (e.g. to compare power
+// consumption)
+bool idle_sleep_enabled = true;
+// Number of times the MCU has gone to sleep
+uint32_t idle_sleep_count = 0;
+// Fraction of the last complete window spent asleep, in 1/1000
+uint16_t idle_fraction = 0;
+
+// Start of the current window and the time spent asleep in it (loop timer
+// ticks)
+static uint32_t idle_window_start = 0;
+static uint32_t idle_window_ticks = 0;
+
+
+void init_idle(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    idle_sleep_count = 0;
+    idle_fraction = 0;
+    idle_window_start = read_loop_time();
+    idle_window_ticks = 0;
+}
+
+// Returns true if any of the main loop tasks would do something if it ran now
+bool is_work_pending(void) {
+    return can_ring_count(&can_rx_ring) > 0 ||
+        can_ring_count(&can_tx_ring) > 0 ||
+        hk_batch_mask != 0 ||
+        log_dump_active ||
+        imu_dump_active ||
+        is_imu_work_pending() ||
+        is_meas_due() ||
+        is_prot_check_due() ||
+        is_batt_sample_due() ||
+        is_rail_sample_due() ||
+        is_heater_ctrl_due() ||
+        is_config_commit_due();
+}
+
+/*
+Main loop task - sleeps until the next interrupt if there is nothing to do,
+and updates the idle fraction.
+*/
+void run_idle(void) {
+    uint32_t start = read_loop_time();
+
+    if (idle_sleep_enabled) {
+        // Interrupts are disabled between the check and going to sleep, so an
+        // interrupt that makes work pending can't be missed
+        cli();
+        if (!is_work_pending()) {
+            sleep_enable();
+            // The instruction after sei() is always executed before a pending
+            // interrupt, so it wakes the MCU up right away
+            sei();
+            sleep_cpu();
+            sleep_disable();
+
+            idle_sleep_count++;
+            idle_window_ticks += read_loop_time() - start;
+        }
+        sei();
+    }
+
+    uint32_t now = read_loop_time();
+    uint32_t elapsed = now - idle_window_start;
+    if (elapsed >= (uint32_t) IDLE_WINDOW_S * (OCR1A + 1)) {
+        idle_fraction = (uint16_t) ((idle_window_ticks * 1000) / elapsed);
+        idle_window_start = now;
+        idle_window_ticks = 0;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include "battery.h"
+#include "can_commands.h"
+#include "config.h"
+#include "heaters.h"
+#include "imu.h"
+#include "loop_stats.h"
+#include "measurements.h"
+
+// Length of the window that the idle fraction is measured over
+#define IDLE_WINDOW_S 10
+
+extern bool idle_sleep_enabled;
+extern uint32_t idle_sleep_count;
+extern uint16_t idle_fraction;
+
+void init_idle(void);
+bool is_work_pending(void);
+void run_idle(void);
+
+#endif
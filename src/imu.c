@@ -81,6 +81,60 @@ Request data:
 - Send Set Feature Request with time interval = 0 (to disable sensor, stop receiving input reports)
 - IMU responds with Get Feature Response
 
+Streaming mode:
+- Instead of enabling a feature for every request, features can be left enabled
+with start_imu_stream(), or all of IMU_ACQ_FEATURES (accelerometer, calibrated
+and uncalibrated gyroscope) with start_imu_acq()
+- Each feature has its own report and batch interval (set_imu_intervals(),
+CAN_EPS_CTRL_SET_IMU_*_INTERVAL). With a batch interval, the hub buffers the
+reports in its FIFO and sends them in one packet, so the MCU is woken up and
+reads a packet once per batch instead of once per report
+- INT2_vect only sets `imu_int_flag` and timestamps it in `imu_int_time` when
+the hub asserts HINT
+- run_imu() in the main loop starts reading the pending packet, which the SPI
+interrupt receives in the background (see spi_xfer.c) while the main loop
+keeps running
+- The SPI interrupt parses the packet as each byte arrives (see shtp.c) and
+passes every report to its handler (`imu_input_handlers`) - the sensor
+reports are stored in `imu_record`, which holds the latest sample of every
+acquired feature, timestamped with the HINT edge of its packet, so packets of
+any length are read without a packet buffer and without losing reports
+- Once OBC arms it (CAN_EPS_CTRL_SET_IMU_RING_DECIMATION), every nth sensor
+report of each feature is also added to `imu_sample_ring`, which OBC drains
+in bulk with CAN_EPS_IMU_DUMP instead of polling HK in step with the reports
+(see IMU_SAMPLE_RING_SIZE for how often it has to)
+- HK requests for a streamed feature then only read memory
+- Without streaming, one HK request acquires a record of every feature at
+once (acquire_imu_record()), and the other axes and features are answered
+from it for IMU_RECORD_MAX_AGE_MS
+
+Event-driven transactions:
+- Nothing polls HINT - step_imu() (called by run_imu()) moves the driver
+along from `imu_int_flag` and returns IMU_PENDING while a command is waiting
+for the hub
+- A command (start_imu_op()) asserts PS0/WAKE, is sent by the SPI interrupt
+once the hub asserts HINT, then waits for the response packet
+- The blocking functions (e.g. send_imu_set_feat_cmd()) step it and sleep
+until the next interrupt between steps, instead of _delay_ms() polling
+- A wait that takes longer than IMU_INT_TIMEOUT_MS fails the command
+- The time from the start of each wait to the HINT edge that ends it is
+counted in `imu_wait_hist` (OBC reads it with CAN_EPS_CTRL_GET_IMU_WAIT_HIST)
+
+Sample timestamps:
+- The hub timestamps reports relative to the HINT edge that signals their
+packet - the timebase reference (0xFB) holds the base delta, how long before
+HINT the base time was, and each sensor report holds its delay after the base
+time (both in 100 us units, #1 p.57, 79)
+- So a report was taken at HINT - base delta + delay
+- The delay is only 14 bits (up to 1.6383 s), so in a longer batch the hub
+inserts a timestamp rebase (0xFA) before a report the delay can't reach - it
+moves the base time by a signed delta relative to the timebase reference
+(#1 p.79), and the reports after it are relative to the new base
+- HINT is timestamped in Timer 1 ticks (read_loop_time()), which are a whole
+128 us, so it is converted to microseconds since startup with one multiply
+(a shift) per packet - `time_us` wraps around every 71.6 minutes (differences
+are still correct)
+
 Hardware Configuration:
 - The PS1 port is permanently tied to VCC (1).
 - The PS0/WAKE port is tied to a GPIO pin.
@@ -150,6 +204,17 @@ pin_info_t imu_int = {
 };
 
 
+// The hub on the shared SPI bus
+// Needs SPI mode 3 (CPOL = 1, CPHA = 1)
+// BNO080 supports up to 3MHz, our clock division only allows 2MHz
+spi_dev_t imu_spi_dev = {
+    .cs = &imu_cs,
+    .cpol = 1,
+    .cpha = 1,
+    .clk_freq = SPI_FOSC_4
+};
+
+
 // Count the number of messages on each SHTP channel (in SHTP header) (#2 p. 4)
 uint8_t imu_seq_nums[6] = { 0 };
 
@@ -158,14 +223,148 @@ uint8_t imu_data[IMU_DATA_MAX_LEN] = { 0x00 };
 // Number of valid bytes in `imu_data`, NOT including the header
 uint16_t imu_data_len = 0;
 
+// Header and cargo of the command being sent (separate from `imu_data`, so a
+// packet read in the background doesn't overwrite it)
+static uint8_t imu_tx[IMU_HEADER_LEN + IMU_TX_MAX_LEN] = { 0x00 };
+
+// Set by INT2_vect when HINT is asserted, cleared when it is serviced
+volatile bool imu_int_flag = false;
+// When HINT was last asserted (read_loop_time())
+volatile uint32_t imu_int_time = 0;
+// Features being streamed (bit n set for report ID n)
+uint8_t imu_stream_mask = 0;
+// Timestamped samples for OBC, filled by the SPI interrupt
+imu_sample_ring_t imu_sample_ring = {
+    .start = 0, .count = 0, .dropped = 0
+};
+// Every nth report of each feature is added to the ring (0 for none)
+uint8_t imu_ring_decimation = IMU_DEF_RING_DECIMATION;
+// Report and batch intervals of each acquired feature while it is streamed
+imu_intervals_t imu_accel_intervals = {
+    .report = IMU_DEF_STREAM_INTERVAL, .batch = IMU_DEF_BATCH_INTERVAL
+};
+imu_intervals_t imu_cal_gyro_intervals = {
+    .report = IMU_DEF_STREAM_INTERVAL, .batch = IMU_DEF_BATCH_INTERVAL
+};
+imu_intervals_t imu_uncal_gyro_intervals = {
+    .report = IMU_DEF_STREAM_INTERVAL, .batch = IMU_DEF_BATCH_INTERVAL
+};
+
+// State of the packet read by the SPI interrupt (IMU_RX_*)
+volatile uint8_t imu_rx_state = IMU_RX_IDLE;
+// When HINT was asserted for the packet being read, in ticks and in
+// microseconds since startup (see imu_ticks_to_us())
+static uint32_t imu_rx_int_time = 0;
+static uint32_t imu_rx_int_us = 0;
+// Timebase reference of the packet being read (100 us units)
+static uint32_t imu_rx_base_delta = 0;
+
+// State of the command transaction (IMU_OP_*)
+volatile uint8_t imu_op_state = IMU_OP_IDLE;
+// The response to the command - its report ID, second byte (the feature for
+// a get feature response, or 0 for any) and minimum length
+static uint8_t imu_op_resp_id = 0;
+static uint8_t imu_op_resp_feat = 0;
+static uint8_t imu_op_resp_len = 0;
+
+// When the current wait for HINT started (read_loop_time())
+static volatile uint32_t imu_wait_start = 0;
+// Waits for HINT, by duration (bin 0 counts waits of 0 ticks, bin n counts
+// [2^(n-1), 2^n) ticks, the last bin everything longer), and the waits that
+// timed out
+uint16_t imu_wait_hist[IMU_WAIT_HIST_BINS] = { 0 };
+uint16_t imu_wait_timeouts = 0;
+
+static void imu_header_received(void);
+static void imu_input_byte(uint8_t byte);
+static void imu_data_received(void);
+static void imu_packet_sent(void);
+static void imu_timebase_received(const uint8_t* report, uint8_t len);
+static void imu_rebase_received(const uint8_t* report, uint8_t len);
+static void imu_sensor_report_received(const uint8_t* report, uint8_t len);
+
+// Handlers for the reports in input packets, called from SPI_STC_vect as
+// each report is received
+const shtp_handler_t imu_input_handlers[] PROGMEM = {
+    { IMU_BASE_TIMESTAMP_REF,   imu_timebase_received },
+    { IMU_TIMESTAMP_REBASE,     imu_rebase_received },
+    { IMU_ACCEL,                imu_sensor_report_received },
+    { IMU_CAL_GYRO,             imu_sensor_report_received },
+    { IMU_UNCAL_GYRO,           imu_sensor_report_received },
+};
+
+// Parser for input packets (see shtp.c)
+shtp_parser_t imu_parser = {
+    .handlers = imu_input_handlers,
+    .handler_count = sizeof(imu_input_handlers) / sizeof(imu_input_handlers[0])
+};
+// Features with a report in the input packet being received
+static volatile uint8_t imu_rx_features = 0;
+
+// SPI transfers for the header and data of a received packet
+static spi_xfer_t imu_header_xfer = {
+    .dev = &imu_spi_dev,
+    .tx = NULL,
+    .fill = 0x00,
+    .rx = imu_header,
+    .rx_max = IMU_HEADER_LEN,
+    .len = IMU_HEADER_LEN,
+    .done = imu_header_received
+};
+// Input packets are parsed as they arrive (`rx_byte`), other packets are
+// stored in `imu_data` (`rx`), see imu_header_received()
+static spi_xfer_t imu_data_xfer = {
+    .dev = &imu_spi_dev,
+    .tx = NULL,
+    // Sending 0xFF, not sure why but the reference library does this in receivePacket()
+    .fill = 0xFF,
+    .rx = imu_data,
+    .rx_max = IMU_DATA_MAX_LEN,
+    .rx_byte = NULL,
+    .len = 0,
+    .done = imu_data_received
+};
+// SPI transfer for a sent command (the hub's bytes are ignored)
+static spi_xfer_t imu_tx_xfer = {
+    .dev = &imu_spi_dev,
+    .tx = imu_tx,
+    .fill = 0x00,
+    .rx = NULL,
+    .rx_max = 0,
+    .len = 0,
+    .done = imu_packet_sent
+};
+
+// Latest reports of the acquired features
+imu_record_t imu_record = {
+    .accel = { .data = { 0 }, .uptime_s = 0, .int_time = 0, .count = 0 },
+    .cal_gyro = { .data = { 0 }, .uptime_s = 0, .int_time = 0, .count = 0 },
+    .uncal_gyro = { .data = { 0 }, .uptime_s = 0, .int_time = 0, .count = 0 },
+    .int_time = 0,
+    .base_delta = 0,
+    .features = 0,
+    .packets = 0
+};
+
+// Features enabled for a single acquisition (see acquire_imu_record()), not
+// streamed
+static uint8_t imu_oneshot_mask = 0;
+
 
 /*
 Initializes the IMU (#0 p. 43).
+Call after init_uptime() - the waits for HINT are timed with Timer 1.
 */
 void init_imu(void) {
     // The protocol selection and boot pins are sampled during startup, so we
     // need to set them before reset
     init_imu_pins();
+    imu_rx_state = IMU_RX_IDLE;
+    imu_op_state = IMU_OP_IDLE;
+    imu_int_flag = false;
+    reset_imu_wait_hist();
+    reset_imu_samples();
+    set_imu_ring_decimation(IMU_DEF_RING_DECIMATION);
 
     // Reset with the appropriate GPIO pin settings
     reset_imu();
@@ -203,7 +402,7 @@ void init_imu_pins(void) {
     set_pin_pullup(imu_int.pin, imu_int.port, 1);
     // RSTn = 1 (#0 p.10)
     init_output_pin(imu_rst.pin, imu_rst.ddr, 1);
-    
+
     // Enable interrupts
     // set behaviour of INT2 to trigger on any logical change (falling or rising edge) (p.84)
     EICRA &= ~_BV(ISC21);
@@ -228,55 +427,130 @@ void reset_imu(void) {
     set_pin_high(imu_rst.pin, imu_rst.port);
 }
 
-void wake_imu(void) {
-    // Set wake low then high (#0 p.19)
-    set_pin_low(imu_ps0_wake.pin, imu_ps0_wake.port);
-    wait_for_imu_int();
-    set_pin_high(imu_ps0_wake.pin, imu_ps0_wake.port);
-}
-
 uint8_t get_imu_int(void) {
     return get_pin_val(imu_int.pin, imu_int.port);
 }
 
+// Records that HINT is asserted (from INT2_vect, or when it is found
+// asserted without a new edge)
+static void set_imu_int_flag(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        imu_int_time = read_loop_time();
+        imu_int_flag = true;
+    }
+}
+
+static void start_imu_wait(void) {
+    imu_wait_start = read_loop_time();
+}
+
+static uint32_t imu_ms_to_ticks(uint16_t ms) {
+    return (uint32_t) ms * ((uint32_t) OCR1A + 1) / 1000;
+}
+
+// Converts a time from read_loop_time() to microseconds since startup (wraps
+// around every 71.6 minutes)
+static uint32_t imu_ticks_to_us(uint32_t ticks) {
+    return ticks * IMU_TICK_US;
+}
+
+// Adds the time from the start of the wait to `int_time` to the histogram
+static void record_imu_wait(uint32_t int_time) {
+    uint32_t ticks = int_time - imu_wait_start;
+    // HINT was already asserted when the wait started
+    if (ticks > INT32_MAX) {
+        ticks = 0;
+    }
+
+    // Number of significant bits
+    uint8_t bin = 0;
+    while (ticks > 0 && bin < IMU_WAIT_HIST_BINS - 1) {
+        ticks >>= 1;
+        bin++;
+    }
+    if (imu_wait_hist[bin] < 0xFFFF) {
+        imu_wait_hist[bin]++;
+    }
+}
+
 /*
-Waits until the interrupt pin goes low.
-Returns - 1 for success (got INT), 0 for failure (no INT)
+Returns true (and counts a timeout) if the current wait for HINT has taken
+longer than IMU_INT_TIMEOUT_MS.
 */
-uint8_t wait_for_imu_int(void) {
-    // Wait up to 120ms (can take up to 104ms after hardware reset, see reference library)
-    uint8_t timeout = 120;
-    while (get_imu_int() != 0 && timeout > 0) {
-        _delay_ms(1);
-        timeout--;
+static bool imu_wait_timed_out(void) {
+    if (read_loop_time() - imu_wait_start <= imu_ms_to_ticks(IMU_INT_TIMEOUT_MS)) {
+        return false;
+    }
+    if (imu_wait_timeouts < 0xFFFF) {
+        imu_wait_timeouts++;
     }
+    return true;
+}
 
-    if (timeout == 0) {
-#ifdef IMU_DEBUG
-        print("Failed INT\n");
-#endif
+void reset_imu_wait_hist(void) {
+    for (uint8_t i = 0; i < IMU_WAIT_HIST_BINS; i++) {
+        imu_wait_hist[i] = 0;
+    }
+    imu_wait_timeouts = 0;
+}
+
+/*
+Gets a bin of the wait for HINT histogram, or the number of timeouts.
+bin - 0 to IMU_WAIT_HIST_BINS - 1, or IMU_WAIT_HIST_BINS for the timeouts
+Returns - 1 for success, 0 if the bin is not valid
+*/
+uint8_t get_imu_wait_hist(uint8_t bin, uint32_t* value) {
+    if (bin < IMU_WAIT_HIST_BINS) {
+        *value = imu_wait_hist[bin];
+    } else if (bin == IMU_WAIT_HIST_BINS) {
+        *value = imu_wait_timeouts;
+    } else {
         return 0;
     }
+    return 1;
+}
 
-#ifdef IMU_DEBUG
-    print("Successful INT: timeout = %u\n", timeout);
-#endif
+// Returns true if step_imu() would do something if it ran now
+bool is_imu_work_pending(void) {
+    // An edge while a packet is being read waits for the transfer (whose
+    // interrupt wakes the MCU)
+    return (imu_int_flag && imu_rx_state != IMU_RX_BUSY) ||
+        imu_rx_state == IMU_RX_DONE || imu_rx_state == IMU_RX_FAILED;
+}
 
-    return 1;
+/*
+Sleeps until the next interrupt (HINT, the SPI transfer or a timer) if the
+driver has nothing to do, instead of polling HINT. For the functions that
+wait for the result of a transaction. A wait can take up to
+IMU_INT_TIMEOUT_MS, so the protection checks run on every wake-up (the tick
+that sets their flag wakes it up too, see run_loop_poll()).
+*/
+static void wait_imu_event(void) {
+    run_loop_poll();
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    // Interrupts are disabled between the check and going to sleep, so the
+    // interrupt can't be missed
+    cli();
+    if (is_imu_work_pending()) {
+        sei();
+        return;
+    }
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
 }
 
+// Selects the hub for blocking transfers (the mode and clock are left set
+// afterwards, see spi_xfer.c)
 void start_imu_spi(void) {
-    // Need to use SPI mode 3 (CPOL = 1, CPHA = 1)
-    set_spi_cpol_cpha(1, 1);
-    // BNO080 supports up to 3MHz, our clock division only allows 2MHz
-    set_spi_clk_freq(SPI_FOSC_4);
-    set_cs_low(imu_cs.pin, imu_cs.port);
+    claim_spi_bus(&imu_spi_dev);
+    select_spi_dev(&imu_spi_dev);
 }
 
 void end_imu_spi(void) {
-    set_cs_high(imu_cs.pin, imu_cs.port);
-    reset_spi_clk_freq();
-    reset_spi_cpol_cpha();
+    deselect_spi_dev(&imu_spi_dev);
 }
 
 void process_imu_header(uint8_t* channel, uint8_t* seq_num, uint16_t* length) {
@@ -286,41 +560,18 @@ void process_imu_header(uint8_t* channel, uint8_t* seq_num, uint16_t* length) {
     *seq_num = imu_header[3];
 }
 
-/*
-This function will populate `imu_header` and `imu_data`
-Returns - 1 for success, 0 for failure (either no interrupt or too long message for buffer)
-*/
-uint8_t receive_imu_packet(void) {
-    if (!wait_for_imu_int()) {
-        return 0;
-    }
-
-    start_imu_spi();
-
-    // Get header
-    // Add this header length (should be length of cargo + header)
-    // Note LSB first
-    for (uint16_t i = 0; i < IMU_HEADER_LEN; i++) {
-        imu_header[i] = send_spi(0x00);
-    }
-    
+// Called from SPI_STC_vect when the header has been received, continues with
+// reading the data
+static void imu_header_received(void) {
     uint8_t channel = 0;
     uint8_t seq_num = 0;
     uint16_t length = 0;
     process_imu_header(&channel, &seq_num, &length);
 
-#ifdef IMU_DEBUG
-    print("\nReceived IMU SPI:\n");
-    print("length = %u, channel = %u, seq_num = %u\n", length, channel, seq_num);
-#endif
-
     // "A length of 65535 is an error. The remaining header and cargo bytes are ignored. This type of error may occur if there is a failure in the SPI or I2C peripheral." (#2 p.4-5)
     if (length == 0xFFFF) {
-        end_imu_spi();
-#ifdef IMU_DEBUG
-        print("Error: length is 0xFFFF\n");
-#endif
-        return 0;
+        imu_rx_state = IMU_RX_FAILED;
+        return;
     }
 
     // MSB (bit 15) is used to indicate if the transfer is a continuation of the
@@ -329,232 +580,542 @@ uint8_t receive_imu_packet(void) {
 
     // Check for a null header (#2 p.5)
     if (length < IMU_HEADER_LEN) {
-        end_imu_spi();
-#ifdef IMU_DEBUG
-        print("Error: null header\n");
-#endif
-        return 0;
+        imu_rx_state = IMU_RX_FAILED;
+        return;
     }
-    
+
     // According to the reference library, we don't increment our sequence number when receiving packets
 
     // Subtract 4 bytes to get length of data (without header)
-    uint16_t data_len = length - IMU_HEADER_LEN;
-    
-    // Read and store data
+    imu_data_xfer.len = length - IMU_HEADER_LEN;
+    imu_rx_features = 0;
+    if (channel == IMU_NON_WAKE_INPUT || channel == IMU_WAKE_INPUT) {
+        // Every report is parsed as it arrives, nothing is stored
+        imu_data_xfer.rx = NULL;
+        imu_data_xfer.rx_byte = imu_input_byte;
+        imu_data_len = 0;
+        start_shtp_packet(&imu_parser, imu_data_xfer.len);
+    } else {
+        // Only data within the size of our buffer is stored (the responses
+        // we check fit, the rest is e.g. the advertisement)
+        imu_data_xfer.rx = imu_data;
+        imu_data_xfer.rx_byte = NULL;
+        imu_data_len = imu_data_xfer.len;
+        if (imu_data_len > IMU_DATA_MAX_LEN) {
+            imu_data_len = IMU_DATA_MAX_LEN;
+        }
+    }
+    chain_spi_xfer(&imu_data_xfer);
+}
+
+// Called from SPI_STC_vect with each byte of an input packet
+static void imu_input_byte(uint8_t byte) {
+    feed_shtp_byte(&imu_parser, byte);
+}
+
+/*
+Called from SPI_STC_vect with the timebase reference at the start of an input
+packet - how long before HINT was asserted the first report in the packet was
+taken, in 100 us units (#1 p.79)
+*/
+static void imu_timebase_received(const uint8_t* report, uint8_t len) {
+    imu_rx_base_delta = ((uint32_t) report[1]) | ((uint32_t) report[2] << 8) |
+        ((uint32_t) report[3] << 16) | ((uint32_t) report[4] << 24);
+    imu_record.base_delta = imu_rx_base_delta;
+}
+
+/*
+Called from SPI_STC_vect with a timestamp rebase - the base time of the
+following reports is moved by a signed delta (100 us units) from the timebase
+reference (#1 p.79). Modulo 2^32, so a base after HINT still gives the right
+times.
+*/
+static void imu_rebase_received(const uint8_t* report, uint8_t len) {
+    uint32_t rebase = ((uint32_t) report[1]) | ((uint32_t) report[2] << 8) |
+        ((uint32_t) report[3] << 16) | ((uint32_t) report[4] << 24);
+    imu_record.base_delta = imu_rx_base_delta - rebase;
+}
+
+// Adds a sample to `imu_sample_ring`, replacing the oldest one if it is full
+static void push_imu_sample(uint8_t id, uint32_t time_us, const uint16_t* data) {
+    imu_sample_ring_t* ring = &imu_sample_ring;
+    uint8_t pos = (ring->start + ring->count) % IMU_SAMPLE_RING_SIZE;
+    if (ring->count < IMU_SAMPLE_RING_SIZE) {
+        ring->count++;
+    } else {
+        ring->start = (ring->start + 1) % IMU_SAMPLE_RING_SIZE;
+        ring->dropped++;
+    }
+
+    imu_ring_entry_t* entry = &ring->entries[pos];
+    entry->id = id;
+    entry->time_us = time_us;
+    for (uint8_t i = 0; i < IMU_RING_VALUES; i++) {
+        entry->data[i] = data[i];
+    }
+}
+
+/*
+Called from SPI_STC_vect with each accelerometer or gyroscope report - stores
+it in `imu_record` if its feature is being streamed or acquired, timestamped
+with when the hub took it (see above), and in `imu_sample_ring` if it is the
+nth since the last one added.
+*/
+static void imu_sensor_report_received(const uint8_t* report, uint8_t len) {
+    uint8_t id = report[0];
+    if (!((imu_stream_mask | imu_oneshot_mask) & _BV(id))) {
+        return;
+    }
+
+    // Report ID, sequence number, status (bits 7-2 are bits 13-8 of the
+    // delay), delay, then 2 bytes per value (LSB first)
+    imu_sample_t* sample = get_imu_sample(id);
+    for (uint8_t i = 0; i < (len - 4) / 2; i++) {
+        sample->data[i] = (((uint16_t) report[5 + i * 2]) << 8) |
+            ((uint16_t) report[4 + i * 2]);
+    }
+    uint16_t delay = (((uint16_t) report[2] & 0xFC) << 6) | report[3];
+    sample->time_us = imu_rx_int_us -
+        (imu_record.base_delta - delay) * 100UL;
+    sample->uptime_s = uptime_s;
+    sample->int_time = imu_rx_int_time;
+    sample->count++;
+    imu_rx_features |= _BV(id);
+
+    if (imu_ring_decimation == 0) {
+        return;
+    }
+    if (sample->ring_skip == 0) {
+        push_imu_sample(id, sample->time_us, sample->data);
+        sample->ring_skip = imu_ring_decimation - 1;
+    } else {
+        sample->ring_skip--;
+    }
+}
+
+// Called from SPI_STC_vect when the whole packet has been received
+static void imu_data_received(void) {
+    if (imu_rx_features != 0) {
+        imu_record.int_time = imu_rx_int_time;
+        imu_record.features = imu_rx_features;
+        imu_record.packets++;
+    }
+    imu_rx_state = IMU_RX_DONE;
+}
+
+/*
+Starts reading the packet the hub has signalled (HINT must be asserted). The
+header and data are received by the SPI interrupt, `imu_rx_state` changes to
+IMU_RX_DONE or IMU_RX_FAILED when it is done.
+*/
+void start_imu_receive(void) {
+    imu_rx_state = IMU_RX_BUSY;
+    imu_rx_int_time = imu_int_time;
+    imu_rx_int_us = imu_ticks_to_us(imu_rx_int_time);
     imu_data_len = 0;
-    for (uint16_t i = 0; i < data_len; i++) {
-        // Sending 0xFF, not sure why but the reference library does this in receivePacket()
-        uint8_t byte = send_spi(0xFF);
-        // Only store received data within the size of our buffer
-        if (i < IMU_DATA_MAX_LEN) {
-            imu_data[i] = byte;
-            imu_data_len++;
+    // Get header
+    // Add this header length (should be length of cargo + header)
+    // Note LSB first
+    if (!queue_spi_xfer(&imu_header_xfer)) {
+        imu_rx_state = IMU_RX_FAILED;
+    }
+}
+
+/*
+Waits for a packet that is being read in the background and checks it for the
+response to the command in progress (also makes sure `imu_header` and
+`imu_data` can be reused). Input reports have already been stored by the SPI
+interrupt.
+*/
+void finish_imu_receive(void) {
+    while (imu_rx_state == IMU_RX_BUSY) {
+        wait_spi_xfer();
+    }
+    if (imu_rx_state == IMU_RX_IDLE) {
+        return;
+    }
+
+    if (imu_rx_state == IMU_RX_DONE) {
+        uint8_t channel = 0;
+        uint8_t seq_num = 0;
+        uint16_t length = 0;
+        process_imu_header(&channel, &seq_num, &length);
+        if (channel != IMU_NON_WAKE_INPUT && channel != IMU_WAKE_INPUT &&
+                imu_op_state == IMU_OP_RESP &&
+                imu_data_len >= imu_op_resp_len &&
+                imu_data[0] == imu_op_resp_id &&
+                (imu_op_resp_feat == 0 || imu_data[1] == imu_op_resp_feat)) {
+            // The response to the command
+            record_imu_wait(imu_rx_int_time);
+            imu_op_state = IMU_OP_DONE;
         }
     }
+    imu_rx_state = IMU_RX_IDLE;
+}
 
-    end_imu_spi();
+/*
+Waits for the hub to signal a packet and reads it, sleeping until HINT is
+asserted. This will populate `imu_header` and `imu_data`
+Returns - 1 for success, 0 for failure (either no interrupt or invalid header)
+*/
+uint8_t receive_imu_packet(void) {
+    // Don't lose a streamed packet that is being read
+    finish_imu_receive();
 
+    // Wait up to IMU_INT_TIMEOUT_MS
+    start_imu_wait();
+    if (get_imu_int() == 0) {
+        set_imu_int_flag();
+    }
+    while (!imu_int_flag) {
+        if (imu_wait_timed_out()) {
 #ifdef IMU_DEBUG
-    print("data_len = %u\n", data_len);
+            print("Failed INT\n");
+#endif
+            return 0;
+        }
+        wait_imu_event();
+    }
+    imu_int_flag = false;
+    record_imu_wait(imu_int_time);
+
+    start_imu_receive();
+    while (imu_rx_state == IMU_RX_BUSY) {
+        wait_spi_xfer();
+    }
+    uint8_t success = (imu_rx_state == IMU_RX_DONE);
+    imu_rx_state = IMU_RX_IDLE;
+
+#ifdef IMU_DEBUG
+    uint8_t channel = 0;
+    uint8_t seq_num = 0;
+    uint16_t length = 0;
+    process_imu_header(&channel, &seq_num, &length);
+    print("\nReceived IMU SPI:\n");
+    print("length = %u, channel = %u, seq_num = %u\n", length, channel, seq_num);
+    if (!success) {
+        print("Error: invalid header\n");
+        return 0;
+    }
+
     print("Header: ");
     print_bytes(imu_header, IMU_HEADER_LEN);
     print("Data: ");
     print_bytes(imu_data, imu_data_len);
 
-    // Print data as string
-    // for (uint16_t i = 0; i < imu_data_len; i++) {
-    //     put_uart_char(imu_data[i]);
-    // }
-    // put_uart_char('\n');
-
-    if (data_len > IMU_DATA_MAX_LEN) {
+    if ((length & ~_BV(15)) - IMU_HEADER_LEN > IMU_DATA_MAX_LEN) {
         print("Did not save entire packet\n");
     }
 #endif
 
-    return 1;
+    return success;
 }
 
-void populate_imu_header(uint8_t channel, uint8_t seq_num, uint16_t length) {
-    imu_header[0] = length & 0xFF;
-    imu_header[1] = (length >> 8) & 0xFF;
-    imu_header[2] = channel;
-    imu_header[3] = seq_num;
+void populate_imu_header(uint8_t* header, uint8_t channel, uint8_t seq_num,
+    uint16_t length) {
+    header[0] = length & 0xFF;
+    header[1] = (length >> 8) & 0xFF;
+    header[2] = channel;
+    header[3] = seq_num;
 }
 
 /*
-Populate `imu_data` before calling this; this function will take care of populating and sending the header.
-channel - 0 to 5
-Returns - 1 for success, 0 for failure
+Starts a command transaction - sends `len` bytes of cargo on `channel`, then
+waits for the response. Nothing waits here, step_imu() moves it along.
+resp_id - report ID the response starts with
+resp_feat - second byte of the response (the feature), 0 for any
+resp_len - minimum length of the response (not including the header)
+Returns - 1 if it started, 0 if another command is still in progress
 */
-uint8_t send_imu_packet(uint8_t channel) {
-    if (channel >= IMU_CHANNEL_COUNT) {
-        return 0;
-    }
-    
-    // Need to assert the wake signal first or else we never receive the interrupt
-    wake_imu();
-    if (!wait_for_imu_int()) {
+static uint8_t start_imu_op(uint8_t channel, const uint8_t* cargo, uint8_t len,
+    uint8_t resp_id, uint8_t resp_feat, uint8_t resp_len) {
+    if (channel >= IMU_CHANNEL_COUNT || len > IMU_TX_MAX_LEN ||
+            is_imu_op_pending()) {
         return 0;
     }
 
-    populate_imu_header(channel, imu_seq_nums[channel], IMU_HEADER_LEN + imu_data_len);
+    populate_imu_header(imu_tx, channel, imu_seq_nums[channel], IMU_HEADER_LEN + len);
+    for (uint8_t i = 0; i < len; i++) {
+        imu_tx[IMU_HEADER_LEN + i] = cargo[i];
+    }
+    imu_tx_xfer.len = IMU_HEADER_LEN + len;
+    imu_op_resp_id = resp_id;
+    imu_op_resp_feat = resp_feat;
+    imu_op_resp_len = resp_len;
 
 #ifdef IMU_DEBUG
     print("\nSending IMU SPI:\n");
-    print("Header: ");
-    print_bytes(imu_header, IMU_HEADER_LEN);
-    print("Data: ");
-    print_bytes(imu_data, imu_data_len);
+    print("Packet: ");
+    print_bytes(imu_tx, IMU_HEADER_LEN + len);
 #endif
 
-    // Set feature command (#1 p.55-56)
-    start_imu_spi();
-    for (uint16_t i = 0; i < IMU_HEADER_LEN; i++) {
-        send_spi(imu_header[i]);
+    // Need to assert the wake signal first or else we never receive the
+    // interrupt - the hub asserts HINT when it is ready (#0 p.19)
+    imu_op_state = IMU_OP_WAKE;
+    start_imu_wait();
+    set_pin_low(imu_ps0_wake.pin, imu_ps0_wake.port);
+    // Already asserted (no edge) if the hub has a packet waiting
+    if (get_imu_int() == 0) {
+        set_imu_int_flag();
     }
-    for (uint16_t i = 0; i < imu_data_len; i++) {
-        send_spi(imu_data[i]);
+    return 1;
+}
+
+// Sends the command once the hub has asserted HINT after PS0/WAKE
+static void send_imu_op(void) {
+    record_imu_wait(imu_int_time);
+    set_pin_high(imu_ps0_wake.pin, imu_ps0_wake.port);
+
+    imu_op_state = IMU_OP_SEND;
+    if (!queue_spi_xfer(&imu_tx_xfer)) {
+        imu_op_state = IMU_OP_FAILED;
     }
-    end_imu_spi();
+}
 
+// Called from SPI_STC_vect when the command has been sent
+static void imu_packet_sent(void) {
     // Increment the sequence number for that channel
-    imu_seq_nums[channel]++;
+    imu_seq_nums[imu_tx[2]]++;
+    start_imu_wait();
+    imu_op_state = (imu_op_resp_id == 0) ? IMU_OP_DONE : IMU_OP_RESP;
+}
 
-    return 1;
+bool is_imu_op_pending(void) {
+    return imu_op_state == IMU_OP_WAKE || imu_op_state == IMU_OP_SEND ||
+        imu_op_state == IMU_OP_RESP;
 }
 
 /*
-It seems that after sending the request, first we receive a 16-byte packet (assumed as the overall system ID), followed by a separate (but not continued) 48-byte packet (assumed as the subsystem IDs).
+Moves the driver along without waiting: processes a packet read in the
+background, sends the command when the hub is ready for it, starts reading the
+next packet the hub has signalled, and fails the command if the hub takes too
+long.
+Returns - IMU_PENDING while a command is in progress, then IMU_DONE or
+IMU_FAILED (IMU_DONE if there is no command)
 */
-uint8_t get_imu_prod_id(void) {
-    for (uint8_t i = 0; i < IMU_PACKET_CHECK_COUNT; i++) {
-        // Request product ID (#0 p.23)
-        imu_data[0] = IMU_PRODUCT_ID_REQ;
-        imu_data[1] = 0x00; // reserved
-        imu_data_len = 2;
-        send_imu_packet(IMU_CONTROL);
-
-        // Get response
-        if (!receive_imu_packet()) {
-            continue;
+uint8_t step_imu(void) {
+    if (imu_rx_state == IMU_RX_DONE || imu_rx_state == IMU_RX_FAILED) {
+        finish_imu_receive();
+        // Another packet may already be waiting without a new edge
+        if (get_imu_int() == 0) {
+            set_imu_int_flag();
         }
-        if (imu_data_len >= 16 && imu_data[0] == IMU_PRODUCT_ID_RESP) {
-            // Receive 48-byte packet for subsystems (don't care about contents)
-            receive_imu_packet();
-            return 1;
+    }
+
+    if (imu_rx_state == IMU_RX_IDLE && imu_int_flag) {
+        imu_int_flag = false;
+        if (imu_op_state == IMU_OP_WAKE) {
+            send_imu_op();
+        } else if (get_imu_int() == 0) {
+            // The flag may be left over from an edge that was already serviced
+            start_imu_receive();
         }
     }
 
-    return 0;
+    if ((imu_op_state == IMU_OP_WAKE || imu_op_state == IMU_OP_RESP) &&
+            imu_wait_timed_out()) {
+#ifdef IMU_DEBUG
+        print("Failed INT\n");
+#endif
+        set_pin_high(imu_ps0_wake.pin, imu_ps0_wake.port);
+        imu_op_state = IMU_OP_FAILED;
+    }
+
+    if (is_imu_op_pending()) {
+        return IMU_PENDING;
+    }
+    return (imu_op_state == IMU_OP_FAILED) ? IMU_FAILED : IMU_DONE;
 }
 
 /*
-Set feature command (#1 p.55-56)
-"Sensor operating rate is controlled through the report interval field. When set to zero the sensor is off." (#1 p.33)
-report_interval - in microseconds
+Waits for the command in progress to finish, sleeping between interrupts.
+Returns - 1 for success, 0 for failure
+*/
+uint8_t finish_imu_op(void) {
+    uint8_t result = IMU_PENDING;
+    while ((result = step_imu()) == IMU_PENDING) {
+        wait_imu_event();
+    }
+    imu_op_state = IMU_OP_IDLE;
+    return result == IMU_DONE;
+}
+
+/*
+It seems that after sending the request, first we receive a 16-byte packet (assumed as the overall system ID), followed by a separate (but not continued) 48-byte packet (assumed as the subsystem IDs).
 */
-uint8_t send_imu_set_feat_cmd(uint8_t feat_report_id, uint32_t report_interval) {
-    imu_data[0] = IMU_SET_FEAT_CMD;
-    imu_data[1] = feat_report_id;
-    imu_data[2] = 0x00;
-    imu_data[3] = 0x00;
-    imu_data[4] = 0x00;
-    imu_data[5] = report_interval & 0xFF;
-    imu_data[6] = (report_interval >> 8) & 0xFF;
-    imu_data[7] = (report_interval >> 16) & 0xFF;
-    imu_data[8] = (report_interval >> 24) & 0xFF;
-    imu_data[9] = 0x00;
-    imu_data[10] = 0x00;
-    imu_data[11] = 0x00;
-    imu_data[12] = 0x00;
-    imu_data[13] = 0x00;
-    imu_data[14] = 0x00;
-    imu_data[15] = 0x00;
-    imu_data[16] = 0x00;
-    imu_data_len = 17;
-
-    // Send set feature command
-    if (!send_imu_packet(IMU_CONTROL)) {
+uint8_t get_imu_prod_id(void) {
+    // Request product ID (#0 p.23)
+    uint8_t cargo[2] = {
+        IMU_PRODUCT_ID_REQ,
+        0x00 // reserved
+    };
+    if (!start_imu_op(IMU_CONTROL, cargo, sizeof(cargo), IMU_PRODUCT_ID_RESP, 0, 16)) {
+        return 0;
+    }
+    if (!finish_imu_op()) {
         return 0;
     }
 
-    // Wait for get feature response
-    for (uint8_t i = 0; i < IMU_PACKET_CHECK_COUNT; i++) {
-        if (!receive_imu_packet()) {
-            continue;
-        }
-        if (imu_data_len < 17) {
-            continue;
-        }
-        if (imu_data[0] != IMU_GET_FEAT_RESP) {
-            continue;
-        }
+    // Receive 48-byte packet for subsystems (don't care about contents)
+    receive_imu_packet();
+    return 1;
+}
 
-        return 1;
-    }
+/*
+Starts a set feature command (#1 p.55-56), step_imu() sends it and waits for
+the get feature response.
+"Sensor operating rate is controlled through the report interval field. When set to zero the sensor is off." (#1 p.33)
+With a non-zero batch interval, the hub keeps the reports in its FIFO and
+delivers them together (in one packet, one HINT) at most that long after the
+first one was taken, instead of interrupting the host for every report
+(#1 p.33, 56).
+report_interval - in microseconds
+batch_interval - in microseconds, 0 to deliver every report straight away
+Returns - 1 if it started, 0 if another command is still in progress
+*/
+uint8_t start_imu_set_feat_cmd(uint8_t feat_report_id, uint32_t report_interval,
+    uint32_t batch_interval) {
+    uint8_t cargo[17] = { 0x00 };
+    cargo[0] = IMU_SET_FEAT_CMD;
+    cargo[1] = feat_report_id;
+    cargo[5] = report_interval & 0xFF;
+    cargo[6] = (report_interval >> 8) & 0xFF;
+    cargo[7] = (report_interval >> 16) & 0xFF;
+    cargo[8] = (report_interval >> 24) & 0xFF;
+    cargo[9] = batch_interval & 0xFF;
+    cargo[10] = (batch_interval >> 8) & 0xFF;
+    cargo[11] = (batch_interval >> 16) & 0xFF;
+    cargo[12] = (batch_interval >> 24) & 0xFF;
+
+    return start_imu_op(IMU_CONTROL, cargo, sizeof(cargo), IMU_GET_FEAT_RESP,
+        feat_report_id, sizeof(cargo));
+}
 
-    return 0;
+/*
+Set feature command, waits for the get feature response.
+Returns - 1 for success, 0 for failure
+*/
+uint8_t send_imu_set_feat_cmd(uint8_t feat_report_id, uint32_t report_interval,
+    uint32_t batch_interval) {
+    if (!start_imu_set_feat_cmd(feat_report_id, report_interval, batch_interval)) {
+        return 0;
+    }
+    return finish_imu_op();
 }
 
 uint8_t enable_imu_feat(uint8_t feat_report_id) {
-    return send_imu_set_feat_cmd(feat_report_id, IMU_DEF_REPORT_INTERVAL);
+    return send_imu_set_feat_cmd(feat_report_id, IMU_DEF_REPORT_INTERVAL, 0);
 }
 
 uint8_t disable_imu_feat(uint8_t feat_report_id) {
-    return send_imu_set_feat_cmd(feat_report_id, 0);
+    return send_imu_set_feat_cmd(feat_report_id, 0, 0);
 }
 
 
 
 /*
-Enables a feature, gets one input report, and disables the feature.
-This only works for features that provide an input report of 5 bytes (timebase reference) + 10 bytes (sensor data, last 6 bytes are x/y/z)
+Copies a sample (updated by the SPI interrupt) without it changing half way.
 */
-uint8_t get_imu_data(uint8_t feat_report_id, uint16_t* x, uint16_t* y, uint16_t* z) {
-    // Send set feature command, receive get feature response
-    if (!enable_imu_feat(feat_report_id)) {
+static void read_imu_sample(const imu_sample_t* sample, imu_sample_t* copy) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *copy = *sample;
+    }
+}
+
+/*
+Enables the features in `features` (bit n set for report ID n) that are not
+being streamed, waits until each of them has sent an input report, and
+disables them again. The reports are stored in `imu_record` by
+imu_sensor_report_received() - with the same report interval, the hub sends
+them together in one packet, so one enable cycle serves every axis of every
+feature.
+Returns - 1 for success, 0 for failure
+*/
+uint8_t acquire_imu_record(uint8_t features) {
+    // Only the acquired features have storage
+    if (features & ~IMU_ACQ_FEATURES) {
         return 0;
     }
+    uint8_t oneshot = features & ~imu_stream_mask;
+    uint32_t counts[8] = { 0 };
+    uint8_t success = 1;
 
-    // Get input report packet
-    // The received packet begins with the timebase reference (0xFB) (#0 p.44, #1 p.79)
-    // Ignore base delta, sequence number, delay, etc.
-    for (uint8_t i = 0; i < IMU_PACKET_CHECK_COUNT; i++) {
-        if (!receive_imu_packet()) {
+    // Send set feature commands, receive get feature responses
+    for (uint8_t id = 0; id < 8; id++) {
+        if (!(oneshot & _BV(id))) {
             continue;
         }
-        if (imu_data_len < 15) {
-            continue;
-        }
-        if (imu_data[0] != IMU_BASE_TIMESTAMP_REF) {
-            continue;
-        }
-        if (imu_data[5] != feat_report_id) {
-            continue;
+        imu_sample_t sample;
+        read_imu_sample(get_imu_sample(id), &sample);
+        counts[id] = sample.count;
+        imu_oneshot_mask |= _BV(id);
+        if (!enable_imu_feat(id)) {
+            success = 0;
+            break;
         }
+    }
 
-        if (x != NULL) {
-            *x = (((uint16_t) imu_data[10]) << 8) | ((uint16_t) imu_data[9]);
+    // Get input report packets until every feature has reported
+    start_imu_wait();
+    while (success) {
+        step_imu();
+        uint8_t waiting = 0;
+        for (uint8_t id = 0; id < 8; id++) {
+            if (!(imu_oneshot_mask & _BV(id))) {
+                continue;
+            }
+            imu_sample_t sample;
+            read_imu_sample(get_imu_sample(id), &sample);
+            if (sample.count == counts[id]) {
+                waiting |= _BV(id);
+            }
         }
-        if (y != NULL) {
-            *y = (((uint16_t) imu_data[12]) << 8) | ((uint16_t) imu_data[11]);
+        if (waiting == 0) {
+            record_imu_wait(imu_record.int_time);
+            break;
         }
-        if (z != NULL) {
-            *z = (((uint16_t) imu_data[14]) << 8) | ((uint16_t) imu_data[13]);
+        if (imu_wait_timed_out()) {
+            success = 0;
+            break;
         }
+        wait_imu_event();
+    }
 
-        // After getting data from the input report, disable the sensor so we don't keep receiving input report packets every 60ms
-        // Send set feature command, receive get feature response
-        if (!disable_imu_feat(feat_report_id)) {
-            return 0;
+    // After getting data from the input reports, disable the sensors so we don't keep receiving input report packets every 60ms
+    // Send set feature commands, receive get feature responses
+    for (uint8_t id = 0; id < 8; id++) {
+        if (imu_oneshot_mask & _BV(id)) {
+            imu_oneshot_mask &= ~_BV(id);
+            if (!disable_imu_feat(id)) {
+                success = 0;
+            }
         }
+    }
+    return success;
+}
 
-        return 1;
+/*
+Enables a feature, gets one input report, and disables the feature.
+This only works for features that provide an input report of 5 bytes (timebase reference) + 10 bytes (sensor data, last 6 bytes are x/y/z)
+*/
+uint8_t get_imu_data(uint8_t feat_report_id, uint16_t* x, uint16_t* y, uint16_t* z) {
+    if (get_imu_sample(feat_report_id) == NULL ||
+            !acquire_imu_record(_BV(feat_report_id))) {
+        return 0;
     }
 
-    return 0;
+    imu_sample_t sample;
+    read_imu_sample(get_imu_sample(feat_report_id), &sample);
+    if (x != NULL) {
+        *x = sample.data[0];
+    }
+    if (y != NULL) {
+        *y = sample.data[1];
+    }
+    if (z != NULL) {
+        *z = sample.data[2];
+    }
+    return 1;
 }
 
 /*
@@ -583,68 +1144,245 @@ Uncalibrated gyroscope - non-drift-compensated rotational velocity
 
 x, y, z are signed fixed-point
 
-This does not use `get_imu_data()` because its input report format is different.
+The input report also has the bias x, y, z after the x, y, z.
 */
-uint8_t get_imu_uncal_gyro(uint16_t* x, uint16_t* y, uint16_t* z, uint16_t* bias_x, 
+uint8_t get_imu_uncal_gyro(uint16_t* x, uint16_t* y, uint16_t* z, uint16_t* bias_x,
     uint16_t* bias_y, uint16_t* bias_z) {
-    
-    // Send set feature command, receive get feature response
-    if (!enable_imu_feat(IMU_UNCAL_GYRO)) {
+    if (!acquire_imu_record(_BV(IMU_UNCAL_GYRO))) {
         return 0;
     }
 
-    // Get input report packet
-    // The received packet begins with the timebase reference (0xFB) (#0 p.44, #1 p.79)
-    // Ignore base delta, sequence number, delay, etc.
-    for (uint8_t i = 0; i < IMU_PACKET_CHECK_COUNT; i++) {
-        if (!receive_imu_packet()) {
-            continue;
-        }
-        if (imu_data_len < 21) {
-            continue;
-        }
-        if (imu_data[0] != IMU_BASE_TIMESTAMP_REF) {
-            continue;
-        }
-        if (imu_data[5] != IMU_UNCAL_GYRO) {
-            continue;
+    imu_sample_t sample;
+    read_imu_sample(&imu_record.uncal_gyro, &sample);
+    uint16_t* values[IMU_SAMPLE_VALUES] = { x, y, z, bias_x, bias_y, bias_z };
+    for (uint8_t i = 0; i < IMU_SAMPLE_VALUES; i++) {
+        if (values[i] != NULL) {
+            *values[i] = sample.data[i];
         }
+    }
+    return 1;
+}
 
-        if (x != NULL) {
-            *x = (((uint16_t) imu_data[10]) << 8) | ((uint16_t) imu_data[9]);
-        }
-        if (y != NULL) {
-            *y = (((uint16_t) imu_data[12]) << 8) | ((uint16_t) imu_data[11]);
-        }
-        if (z != NULL) {
-            *z = (((uint16_t) imu_data[14]) << 8) | ((uint16_t) imu_data[13]);
-        }
-        if (bias_x != NULL) {
-            *bias_x = (((uint16_t) imu_data[16]) << 8) | ((uint16_t) imu_data[15]);
-        }
-        if (bias_y != NULL) {
-            *bias_y = (((uint16_t) imu_data[18]) << 8) | ((uint16_t) imu_data[17]);
-        }
-        if (bias_z != NULL) {
-            *bias_z = (((uint16_t) imu_data[20]) << 8) | ((uint16_t) imu_data[19]);
+
+
+
+/*
+Returns the latest sample storage for an input report ID, or NULL if the
+report is not supported in streaming mode.
+*/
+imu_sample_t* get_imu_sample(uint8_t feat_report_id) {
+    if (feat_report_id == IMU_ACCEL) {
+        return &imu_record.accel;
+    } else if (feat_report_id == IMU_CAL_GYRO) {
+        return &imu_record.cal_gyro;
+    } else if (feat_report_id == IMU_UNCAL_GYRO) {
+        return &imu_record.uncal_gyro;
+    }
+    return NULL;
+}
+
+/*
+Returns the streaming report and batch intervals of an input report ID, or
+NULL if the report is not supported in streaming mode.
+*/
+imu_intervals_t* get_imu_intervals(uint8_t feat_report_id) {
+    if (feat_report_id == IMU_ACCEL) {
+        return &imu_accel_intervals;
+    } else if (feat_report_id == IMU_CAL_GYRO) {
+        return &imu_cal_gyro_intervals;
+    } else if (feat_report_id == IMU_UNCAL_GYRO) {
+        return &imu_uncal_gyro_intervals;
+    }
+    return NULL;
+}
+
+/*
+Sets the intervals a feature is streamed at, and sends them to the hub
+straight away if it is being streamed.
+report_interval - in microseconds (not 0, use stop_imu_stream())
+batch_interval - in microseconds, 0 for no batching
+Returns - 1 for success, 0 for failure
+*/
+uint8_t set_imu_intervals(uint8_t feat_report_id, uint32_t report_interval,
+    uint32_t batch_interval) {
+    imu_intervals_t* intervals = get_imu_intervals(feat_report_id);
+    if (intervals == NULL || report_interval == 0) {
+        return 0;
+    }
+    intervals->report = report_interval;
+    intervals->batch = batch_interval;
+
+    if (is_imu_streaming(feat_report_id)) {
+        return send_imu_set_feat_cmd(feat_report_id, report_interval,
+            batch_interval);
+    }
+    return 1;
+}
+
+/*
+Leaves a feature enabled at its streaming intervals (see set_imu_intervals())
+so its input reports are collected in the background.
+Returns - 1 for success, 0 for failure
+*/
+uint8_t start_imu_stream(uint8_t feat_report_id) {
+    imu_intervals_t* intervals = get_imu_intervals(feat_report_id);
+    imu_sample_t* sample = get_imu_sample(feat_report_id);
+    if (intervals == NULL || sample == NULL) {
+        return 0;
+    }
+    if (!send_imu_set_feat_cmd(feat_report_id, intervals->report,
+            intervals->batch)) {
+        return 0;
+    }
+
+    sample->count = 0;
+    imu_stream_mask |= _BV(feat_report_id);
+    return 1;
+}
+
+uint8_t stop_imu_stream(uint8_t feat_report_id) {
+    if (!is_imu_streaming(feat_report_id)) {
+        return 0;
+    }
+    imu_stream_mask &= ~_BV(feat_report_id);
+    return disable_imu_feat(feat_report_id);
+}
+
+uint8_t is_imu_streaming(uint8_t feat_report_id) {
+    return get_imu_sample(feat_report_id) != NULL &&
+        (imu_stream_mask & _BV(feat_report_id)) != 0;
+}
+
+/*
+Streams every feature in IMU_ACQ_FEATURES at its intervals. With the same
+report interval, the hub sends their reports together in one packet.
+Returns - 1 for success, 0 if any of them failed
+*/
+uint8_t start_imu_acq(void) {
+    uint8_t success = 1;
+    for (uint8_t id = 0; id < 8; id++) {
+        if ((IMU_ACQ_FEATURES & _BV(id)) && !start_imu_stream(id)) {
+            success = 0;
         }
+    }
+    return success;
+}
 
-        // After getting data from the input report, disable the sensor so we don't keep receiving input report packets every 60ms
-        // Send set feature command, receive get feature response
-        if (!disable_imu_feat(IMU_UNCAL_GYRO)) {
-            return 0;
+void stop_imu_acq(void) {
+    for (uint8_t id = 0; id < 8; id++) {
+        if (IMU_ACQ_FEATURES & _BV(id)) {
+            stop_imu_stream(id);
         }
+    }
+}
 
-        return 1;
+/*
+Main loop task - moves the driver along (see step_imu()), which collects the
+streamed reports.
+*/
+void run_imu(void) {
+    step_imu();
+}
+
+/*
+Gets one value of a feature's data for HK. If the feature is being streamed,
+this is a memory read of the latest sample. Otherwise, unless the feature has
+reported in the last IMU_RECORD_MAX_AGE_MS, every feature in IMU_ACQ_FEATURES
+that isn't streamed is acquired at once, so the other HK fields read after
+this one are memory reads too.
+index - 0 to 2 for x/y/z, 3 to 5 for the uncalibrated gyroscope bias x/y/z
+*/
+uint16_t get_imu_hk_value(uint8_t feat_report_id, uint8_t index) {
+    if (get_imu_sample(feat_report_id) == NULL || index >= IMU_SAMPLE_VALUES) {
+        return 0;
     }
 
-    return 0;
+    imu_sample_t sample;
+    read_imu_sample(get_imu_sample(feat_report_id), &sample);
+    if (is_imu_streaming(feat_report_id)) {
+        // Start reading a report the hub has signalled since the main loop
+        // last ran
+        run_imu();
+    } else if (sample.count == 0 || read_loop_time() - sample.int_time >
+            imu_ms_to_ticks(IMU_RECORD_MAX_AGE_MS)) {
+        if (!acquire_imu_record(IMU_ACQ_FEATURES)) {
+            return 0;
+        }
+    }
+    read_imu_sample(get_imu_sample(feat_report_id), &sample);
+    return sample.data[index];
 }
 
 
 // INT2 interrupt from INTn pin
 ISR(INT2_vect) {
+    // HINT is active low - the hub has a packet for us, or is ready for one
+    // after PS0/WAKE
+    if (get_imu_int() == 0) {
+        set_imu_int_flag();
+    }
+
 #ifdef IMU_VERBOSE
     print("\nINT2: pin = %u (%.2x)\n", get_imu_int(), PINB);
 #endif
 }
+
+
+// Removes all samples from `imu_sample_ring` and clears the dropped count
+void reset_imu_samples(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        imu_sample_ring.start = 0;
+        imu_sample_ring.count = 0;
+        imu_sample_ring.dropped = 0;
+    }
+}
+
+// Returns the number of samples in `imu_sample_ring`
+uint8_t imu_sample_count(void) {
+    return imu_sample_ring.count;
+}
+
+/*
+Removes the oldest sample from `imu_sample_ring`.
+entry - set to the sample
+Returns - 1 if there was a sample, 0 if the ring is empty
+*/
+uint8_t pop_imu_sample(imu_ring_entry_t* entry) {
+    uint8_t found = 0;
+    // The SPI interrupt can add a sample (and move `start`) at any time
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        imu_sample_ring_t* ring = &imu_sample_ring;
+        if (ring->count > 0) {
+            *entry = ring->entries[ring->start];
+            ring->start = (ring->start + 1) % IMU_SAMPLE_RING_SIZE;
+            ring->count--;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/*
+Sets how many reports of each feature there are for every one added to
+`imu_sample_ring`, starting with the next one.
+decimation - 1 for every report, 0 to stop adding them (the samples in the
+             ring are kept for a last dump)
+*/
+void set_imu_ring_decimation(uint8_t decimation) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        imu_ring_decimation = decimation;
+        imu_record.accel.ring_skip = 0;
+        imu_record.cal_gyro.ring_skip = 0;
+        imu_record.uncal_gyro.ring_skip = 0;
+    }
+}
+
+// Returns the number of samples replaced before they were read, and clears it
+uint32_t take_imu_samples_dropped(void) {
+    uint32_t dropped = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        dropped = imu_sample_ring.dropped;
+        imu_sample_ring.dropped = 0;
+    }
+    return dropped;
+}
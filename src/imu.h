@@ -1,16 +1,29 @@
 #ifndef IMU_H
 #define IMU_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <spi/spi.h>
 #include <uart/uart.h>
+#include <uptime/uptime.h>
 #include <utilities/utilities.h>
 
+#include "loop_stats.h"
+#include "shtp.h"
+#include "spi_xfer.h"
+
 // 4 bytes in all headers
 #define IMU_HEADER_LEN 4
 // Max number of bytes to save in data buffer (not including header)
-#define IMU_DATA_MAX_LEN 30
+// Enough for the longest response we check (a get feature response) - input
+// packets are parsed as they are received instead of being stored
+#define IMU_DATA_MAX_LEN 17
+// Max number of cargo bytes in a command (a set feature command)
+#define IMU_TX_MAX_LEN 17
 
 // Channels (#0 p.22)
 #define IMU_CHANNEL_COUNT   6 // total number of channels
@@ -27,6 +40,7 @@
 #define IMU_SET_FEAT_CMD        0xFD
 #define IMU_GET_FEAT_RESP       0xFC
 #define IMU_BASE_TIMESTAMP_REF  0xFB
+#define IMU_TIMESTAMP_REBASE    0xFA
 #define IMU_PRODUCT_ID_REQ      0xF9
 #define IMU_PRODUCT_ID_RESP     0xF8
 #define IMU_CMD_RESP            0xF1
@@ -41,36 +55,198 @@
 // Default report inteval (60ms, in microseconds)
 #define IMU_DEF_REPORT_INTERVAL 0x0000EA60
 
-// Number of packets to receive for checking a response from the IMU
-#define IMU_PACKET_CHECK_COUNT 10
+// Default report interval in streaming mode (100ms, in microseconds)
+#define IMU_DEF_STREAM_INTERVAL 0x000186A0
+// Default batch interval in streaming mode (in microseconds) - no batching,
+// so HK always has the latest report
+#define IMU_DEF_BATCH_INTERVAL 0
+
+// Features acquired together into `imu_record` (bit n set for report ID n)
+#define IMU_ACQ_FEATURES (_BV(IMU_ACCEL) | _BV(IMU_CAL_GYRO) | _BV(IMU_UNCAL_GYRO))
+// How long HK is answered from an acquired record for features that aren't
+// streamed
+#define IMU_RECORD_MAX_AGE_MS 1000
+
+// Longest wait for HINT (for the hub to be ready after PS0/WAKE, or for a
+// response or input report) before a transaction fails
+#define IMU_INT_TIMEOUT_MS 120
+
+// States of a packet read by the SPI interrupt
+#define IMU_RX_IDLE     0
+#define IMU_RX_BUSY     1
+#define IMU_RX_DONE     2
+#define IMU_RX_FAILED   3
+
+// States of a command transaction
+#define IMU_OP_IDLE     0
+#define IMU_OP_WAKE     1 // PS0/WAKE asserted, waiting for HINT
+#define IMU_OP_SEND     2 // being sent by the SPI interrupt
+#define IMU_OP_RESP     3 // waiting for the response
+#define IMU_OP_DONE     4
+#define IMU_OP_FAILED   5
+
+// Results of step_imu()
+#define IMU_PENDING     0
+#define IMU_DONE        1
+#define IMU_FAILED      2
+
+// Number of bins in the wait for HINT histogram (up to 2^10 ticks, 131 ms)
+#define IMU_WAIT_HIST_BINS 12
+
+// Number of values in a sample (x, y, z, then bias x, y, z for the
+// uncalibrated gyroscope)
+#define IMU_SAMPLE_VALUES 6
+
+/*
+Number of timestamped samples kept for OBC to drain (CAN_EPS_IMU_DUMP), 11
+bytes each. The 3 acquired features at the default stream interval make 30
+reports/s, so with a decimation of n OBC has to drain the ring at least every
+64 * n / 30 s (2.1 s for every report, 21 s for every 10th) to get them all.
+*/
+#define IMU_SAMPLE_RING_SIZE 64
+// Default ring decimation - 0 until OBC arms the ring, so nothing is pushed
+// (or counted as dropped) while no one is draining it
+#define IMU_DEF_RING_DECIMATION 0
+
+// Length of a Timer 1 tick (us) - the 8 MHz clock and the 1024 prescaler give
+// exactly 128 us
+#define IMU_TICK_US (1024UL * 1000000UL / F_CPU)
+// Values kept for each sample in the ring (x, y, z)
+#define IMU_RING_VALUES 3
+
+
+// Latest input report received for a feature
+typedef struct {
+    // Signed fixed-point, see the get_imu_*() functions for units
+    uint16_t data[IMU_SAMPLE_VALUES];
+    // Uptime when the report was received
+    uint32_t uptime_s;
+    // When HINT was asserted for the packet (read_loop_time())
+    uint32_t int_time;
+    // When the hub took the sample (see imu.c)
+    uint32_t time_us;
+    // Number of reports received since streaming started
+    uint32_t count;
+    // Reports left to skip before the next one is added to the ring
+    uint8_t ring_skip;
+} imu_sample_t;
+
+// A decoded accelerometer or gyroscope report, as kept for OBC
+typedef struct {
+    uint8_t id;
+    // When the hub took the sample (see imu.c)
+    uint32_t time_us;
+    // x, y, z (the uncalibrated gyroscope's bias is not kept)
+    uint16_t data[IMU_RING_VALUES];
+} imu_ring_entry_t;
+
+// Samples in the order they were received, oldest first. When it is full, a
+// new sample replaces the oldest one.
+typedef struct {
+    imu_ring_entry_t entries[IMU_SAMPLE_RING_SIZE];
+    // Index of the oldest sample and number of samples
+    uint8_t start;
+    uint8_t count;
+    // Samples replaced before they were read
+    uint32_t dropped;
+} imu_sample_ring_t;
+
+// Report and batch intervals of a feature while it is streamed (in
+// microseconds)
+typedef struct {
+    uint32_t report;
+    uint32_t batch;
+} imu_intervals_t;
+
+// Latest input reports of the acquired features, filled from every report in
+// each input packet
+typedef struct {
+    imu_sample_t accel;
+    imu_sample_t cal_gyro;
+    imu_sample_t uncal_gyro;
+    // When HINT was asserted for the latest input packet (read_loop_time())
+    uint32_t int_time;
+    // How long before HINT the base time of the latest report was (100 us
+    // units, #1 p.79) - the packet's timebase reference, moved by any
+    // timestamp rebase before that report
+    uint32_t base_delta;
+    // Features with a report in the latest input packet (bit n for report ID n)
+    uint8_t features;
+    // Number of input packets with a report of an acquired feature
+    uint32_t packets;
+} imu_record_t;
 
 
 extern uint8_t imu_seq_nums[];
 
+extern volatile bool imu_int_flag;
+extern volatile uint32_t imu_int_time;
+extern volatile uint8_t imu_rx_state;
+extern volatile uint8_t imu_op_state;
+extern uint16_t imu_wait_hist[];
+extern uint16_t imu_wait_timeouts;
+extern spi_dev_t imu_spi_dev;
+extern uint8_t imu_stream_mask;
+extern imu_intervals_t imu_accel_intervals;
+extern imu_intervals_t imu_cal_gyro_intervals;
+extern imu_intervals_t imu_uncal_gyro_intervals;
+extern imu_record_t imu_record;
+extern imu_sample_ring_t imu_sample_ring;
+extern uint8_t imu_ring_decimation;
+extern shtp_parser_t imu_parser;
+
 void init_imu(void);
 void init_imu_pins(void);
 void reset_imu(void);
-void wake_imu(void);
 
 uint8_t get_imu_int(void);
-uint8_t wait_for_imu_int(void);
+bool is_imu_work_pending(void);
+void reset_imu_wait_hist(void);
+uint8_t get_imu_wait_hist(uint8_t bin, uint32_t* value);
 void start_imu_spi(void);
 void end_imu_spi(void);
 
 void process_imu_header(uint8_t* channel, uint8_t* seq_num, uint16_t* length);
+void start_imu_receive(void);
+void finish_imu_receive(void);
 uint8_t receive_imu_packet(void);
-void populate_imu_header(uint8_t channel, uint8_t seq_num, uint16_t length);
-uint8_t send_imu_packet(uint8_t channel);
+void populate_imu_header(uint8_t* header, uint8_t channel, uint8_t seq_num,
+    uint16_t length);
+bool is_imu_op_pending(void);
+uint8_t step_imu(void);
+uint8_t finish_imu_op(void);
 
 uint8_t get_imu_prod_id(void);
-uint8_t send_imu_set_feat_cmd(uint8_t feat_report_id, uint32_t report_interval);
+uint8_t start_imu_set_feat_cmd(uint8_t feat_report_id, uint32_t report_interval,
+    uint32_t batch_interval);
+uint8_t send_imu_set_feat_cmd(uint8_t feat_report_id, uint32_t report_interval,
+    uint32_t batch_interval);
 uint8_t enable_imu_feat(uint8_t feat_report_id);
 uint8_t disable_imu_feat(uint8_t feat_report_id);
 
+uint8_t acquire_imu_record(uint8_t features);
 uint8_t get_imu_data(uint8_t feat_report_id, uint16_t* x, uint16_t* y, uint16_t* z);
 uint8_t get_imu_accel(uint16_t* x, uint16_t* y, uint16_t* z);
 uint8_t get_imu_uncal_gyro(uint16_t* x, uint16_t* y, uint16_t* z, uint16_t* bias_x, 
     uint16_t* bias_y, uint16_t* bias_z);
 uint8_t get_imu_cal_gyro(uint16_t* x, uint16_t* y, uint16_t* z);
 
+imu_sample_t* get_imu_sample(uint8_t feat_report_id);
+imu_intervals_t* get_imu_intervals(uint8_t feat_report_id);
+uint8_t set_imu_intervals(uint8_t feat_report_id, uint32_t report_interval,
+    uint32_t batch_interval);
+uint8_t start_imu_stream(uint8_t feat_report_id);
+uint8_t stop_imu_stream(uint8_t feat_report_id);
+uint8_t is_imu_streaming(uint8_t feat_report_id);
+uint8_t start_imu_acq(void);
+void stop_imu_acq(void);
+void run_imu(void);
+uint16_t get_imu_hk_value(uint8_t feat_report_id, uint8_t index);
+
+void reset_imu_samples(void);
+uint8_t imu_sample_count(void);
+uint8_t pop_imu_sample(imu_ring_entry_t* entry);
+uint32_t take_imu_samples_dropped(void);
+void set_imu_ring_decimation(uint8_t decimation);
+
 #endif
@@ -0,0 +1,145 @@
+/*
+Main loop latency instrumentation.
+
+Each stage of the main loop is timed with the timer that drives uptime_s
+(Timer 1, which lib-common's uptime library runs in CTC mode, counting to
+OCR1A once per second). Reading it never changes its configuration. With
+the 8 MHz clock and the 1024 prescaler, one tick is 128 us.
+
+For every stage, this keeps the number of runs, min/max/mean duration and a
+log2 histogram. They can be read and reset over CAN (CAN_EPS_CTRL_GET_LOOP_STATS
+and CAN_EPS_CTRL_RESET_LOOP_STATS), e.g. to check that the worst case command
+latency stays well under the 8 s watchdog timeout.
+
+A few stages can take much longer than the protection period (PROT_TICKS,
+about 10 ms): an oversampled ADC snapshot (64 sweeps take about 150 ms) or a
+blocking IMU command (up to IMU_INT_TIMEOUT_MS per wait for HINT). They call
+run_loop_poll() between their steps, which runs the checks that can't wait
+for the next iteration (`loop_poll_fn`, set by init_protection()). So the time
+between two checks is bounded by the longest step instead of the longest
+stage. A function pointer keeps those stages from depending on protection.c.
+*/
+
+#include "loop_stats.h"
+
+loop_stage_stats_t loop_stats[LOOP_STAGE_COUNT];
+// Run by run_loop_poll(), or NULL
+void (*loop_poll_fn)(void) = NULL;
+
+
+void reset_loop_stats(void) {
+    for (uint8_t i = 0; i < LOOP_STAGE_COUNT; i++) {
+        loop_stage_stats_t* stats = &loop_stats[i];
+        stats->count = 0;
+        stats->sum = 0;
+        stats->min = 0xFFFF;
+        stats->max = 0;
+        for (uint8_t j = 0; j < LOOP_HIST_BINS; j++) {
+            stats->hist[j] = 0;
+        }
+    }
+}
+
+/*
+Reads uptime_s and the timer ticks into the current second consistently.
+Returns - the number of ticks per second
+*/
+uint16_t read_uptime_ticks(uint32_t* seconds, uint16_t* ticks) {
+    uint16_t period = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *seconds = uptime_s;
+        *ticks = TCNT1;
+        period = OCR1A + 1;
+        // The counter has wrapped but the interrupt that increments uptime_s
+        // hasn't run yet
+        if ((TIFR1 & _BV(OCF1A)) && *ticks < period / 2) {
+            (*seconds)++;
+        }
+    }
+    return period;
+}
+
+/*
+Returns the time in timer ticks (wraps around after about 6 days, but
+differences are still correct).
+*/
+uint32_t read_loop_time(void) {
+    uint32_t seconds = 0;
+    uint16_t ticks = 0;
+    uint16_t period = read_uptime_ticks(&seconds, &ticks);
+    return seconds * period + ticks;
+}
+
+/*
+Records the time since `start` (from read_loop_time()) for a stage.
+Returns - the current time, to use as the start of the next stage
+*/
+uint32_t record_loop_stage(uint8_t stage, uint32_t start) {
+    uint32_t now = read_loop_time();
+    uint32_t duration = now - start;
+    loop_stage_stats_t* stats = &loop_stats[stage];
+
+    // Keep the mean (approximately) instead of overflowing
+    if (stats->sum > UINT32_MAX - duration) {
+        stats->sum >>= 1;
+        stats->count >>= 1;
+    }
+    stats->sum += duration;
+    stats->count++;
+
+    uint16_t sat = (duration > 0xFFFF) ? 0xFFFF : duration;
+    if (sat < stats->min) {
+        stats->min = sat;
+    }
+    if (sat > stats->max) {
+        stats->max = sat;
+    }
+
+    // Number of significant bits
+    uint8_t bin = 0;
+    while (duration > 0 && bin < LOOP_HIST_BINS - 1) {
+        duration >>= 1;
+        bin++;
+    }
+    if (stats->hist[bin] < 0xFFFF) {
+        stats->hist[bin]++;
+    }
+
+    return now;
+}
+
+/*
+Gets one of the LOOP_STAT_* items for a stage.
+Returns - 1 for success, 0 if the stage or item is not valid
+*/
+uint8_t get_loop_stat(uint8_t stage, uint8_t item, uint32_t* value) {
+    if (stage >= LOOP_STAGE_COUNT) {
+        return 0;
+    }
+    loop_stage_stats_t* stats = &loop_stats[stage];
+
+    if (item == LOOP_STAT_COUNT) {
+        *value = stats->count;
+    } else if (item == LOOP_STAT_MIN) {
+        // Nothing recorded yet
+        *value = (stats->count == 0) ? 0 : stats->min;
+    } else if (item == LOOP_STAT_MAX) {
+        *value = stats->max;
+    } else if (item == LOOP_STAT_MEAN) {
+        *value = (stats->count == 0) ? 0 : stats->sum / stats->count;
+    } else if (item == LOOP_STAT_TICKS_PER_S) {
+        *value = (uint32_t) OCR1A + 1;
+    } else if (item >= LOOP_STAT_HIST && item < LOOP_STAT_HIST + LOOP_HIST_BINS) {
+        *value = stats->hist[item - LOOP_STAT_HIST];
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Runs the time-critical checks, for stages that can take long
+void run_loop_poll(void) {
+    if (loop_poll_fn != NULL) {
+        loop_poll_fn();
+    }
+}
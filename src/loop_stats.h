@@ -0,0 +1,62 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <uptime/uptime.h>
+
+// Main loop stages
+#define LOOP_STAGE_HB           0
+#define LOOP_STAGE_MEAS         1
+#define LOOP_STAGE_HEATERS      2
+#define LOOP_STAGE_CAN_TX       3
+#define LOOP_STAGE_CAN_RX       4
+#define LOOP_STAGE_IMU          5
+#define LOOP_STAGE_CONFIG       6
+// Includes the time spent asleep (see idle.c)
+#define LOOP_STAGE_IDLE         7
+// One whole iteration of the main loop
+#define LOOP_STAGE_ITERATION    8
+// Overcurrent and undervoltage checks (see protection.c) - after the other
+// stages so their IDs don't change, although it runs second
+#define LOOP_STAGE_PROT         9
+#define LOOP_STAGE_COUNT        10
+
+// Number of histogram bins - bin 0 counts durations of 0 ticks, bin n counts
+// [2^(n-1), 2^n) ticks, and the last bin counts everything longer
+#define LOOP_HIST_BINS 16
+
+// Items that can be read with get_loop_stat()
+#define LOOP_STAT_COUNT         0x00
+#define LOOP_STAT_MIN           0x01
+#define LOOP_STAT_MAX           0x02
+#define LOOP_STAT_MEAN          0x03
+// Timer ticks per second (same for all stages)
+#define LOOP_STAT_TICKS_PER_S   0x04
+// Histogram bin n is item LOOP_STAT_HIST + n
+#define LOOP_STAT_HIST          0x10
+
+typedef struct {
+    // Number of durations recorded (and summed in `sum`)
+    uint32_t count;
+    uint32_t sum;
+    // In timer ticks, saturated at 0xFFFF (over 8 s)
+    uint16_t min;
+    uint16_t max;
+    // Saturated at 0xFFFF
+    uint16_t hist[LOOP_HIST_BINS];
+} loop_stage_stats_t;
+
+extern loop_stage_stats_t loop_stats[LOOP_STAGE_COUNT];
+extern void (*loop_poll_fn)(void);
+
+void reset_loop_stats(void);
+uint16_t read_uptime_ticks(uint32_t* seconds, uint16_t* ticks);
+uint32_t read_loop_time(void);
+uint32_t record_loop_stage(uint8_t stage, uint32_t start);
+uint8_t get_loop_stat(uint8_t stage, uint8_t item, uint32_t* value);
+void run_loop_poll(void);
+
+#endif
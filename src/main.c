@@ -1,30 +1,60 @@
-// Standard libraries
-#include "general.h"
-
-int main(void) {
-    WDT_OFF();
-    WDT_ENABLE_SYS_RESET(WDTO_8S);
-
-    init_eps();
-    init_hb(HB_EPS);
-
-    print("\n\n");
-    print("EPS main init\n");
-
-    // Run once at beginning
-    control_heater_mode();
-
-    // Main loop (infinite)
-    while (1) {
-        // Reset watchdog timer
-        WDT_ENABLE_SYS_RESET(WDTO_8S);
-        // Possibly send/receive heartbeat
-        run_hb();
-        // Heater control
-        run_heaters();
-        // Send a TX CAN message
-        send_next_tx_msg();
-        // Process an RX CAN message
-        process_next_rx_msg();
-    }
-}
+// Standard libraries
+#include "general.h"
+
+int main(void) {
+    WDT_OFF();
+    WDT_ENABLE_SYS_RESET(WDTO_8S);
+
+    init_eps();
+    init_hb(HB_EPS);
+
+    print("\n\n");
+    print("EPS main init\n");
+
+    // Run once at beginning
+    control_heater_mode();
+
+    // Main loop (infinite)
+    // Start of the current main loop iteration and stage
+    uint32_t iteration_start = read_loop_time();
+    uint32_t stage_start = iteration_start;
+
+    while (1) {
+        // Reset watchdog timer
+        WDT_ENABLE_SYS_RESET(WDTO_8S);
+        // Possibly send/receive heartbeat
+        run_hb();
+        stage_start = record_loop_stage(LOOP_STAGE_HB, stage_start);
+        // Overcurrent and undervoltage checks
+        run_protection();
+        stage_start = record_loop_stage(LOOP_STAGE_PROT, stage_start);
+        // Refresh ADC snapshot
+        run_measurements();
+        // Integrate the pack current
+        run_battery();
+        // Rail energy and current statistics
+        run_rail_stats();
+        stage_start = record_loop_stage(LOOP_STAGE_MEAS, stage_start);
+        // Heater control
+        run_heaters();
+        stage_start = record_loop_stage(LOOP_STAGE_HEATERS, stage_start);
+        // Send a TX CAN message
+        send_next_tx_msg();
+        stage_start = record_loop_stage(LOOP_STAGE_CAN_TX, stage_start);
+        // Process an RX CAN message
+        process_next_rx_msg();
+        stage_start = record_loop_stage(LOOP_STAGE_CAN_RX, stage_start);
+        // Collect streamed IMU reports
+        run_imu();
+        stage_start = record_loop_stage(LOOP_STAGE_IMU, stage_start);
+        // Start committing changed configuration to EEPROM
+        run_config();
+        stage_start = record_loop_stage(LOOP_STAGE_CONFIG, stage_start);
+        // Sleep until the next interrupt if there is nothing to do
+        run_idle();
+        stage_start = record_loop_stage(LOOP_STAGE_IDLE, stage_start);
+
+        record_loop_stage(LOOP_STAGE_ITERATION, iteration_start);
+        iteration_start = stage_start;
+    }
+}
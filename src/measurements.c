@@ -0,0 +1,197 @@
+/*
+Background sampling of all ADC channels into a timestamped snapshot.
+
+Housekeeping requests are answered from the snapshot instead of each doing a
+blocking ADC conversion over SPI, so a CAN_EPS_HK request takes the same short
+time no matter which field is requested. The snapshot is refreshed from the
+main loop every meas_period_s seconds.
+
+All 16 channels are converted in one auto-1 sweep, which only needs one SPI
+frame per channel (plus the program frames) instead of the three a
+single-channel fetch takes to get through the ADC's pipeline. The sweep is
+written into the snapshot that isn't published, and the published pointer is
+switched once it is complete, so a reader always sees the channels, timestamp
+and duration of one sweep.
+
+Each channel can be oversampled and decimated (a boxcar average) to reduce
+noise for the HK data and the heater decisions: with an oversampling shift of
+n, the snapshot holds the mean of 4^n consecutive sweeps. The sum is kept in
+a 32-bit integer accumulator and `ext` keeps MEAS_EXT_FRAC_BITS fractional
+bits of the mean, so the n extra bits of resolution only cost additions and
+shifts. The sweeps run back to back as often as the channel with the highest
+ratio needs (64 sweeps take about 150 ms), so a low ratio only for the noisy
+channels keeps the main loop responsive. The protection checks still run
+between sweeps (see run_loop_poll()). The shifts are configured over CAN
+(CAN_EPS_CTRL_SET_ADC_OVERSAMPLE) and stored in the config journal.
+*/
+
+#include "measurements.h"
+
+adc_snapshot_t adc_snapshots[2] = {
+    {
+        .uptime_s = 0,
+        .ticks = 0,
+        .sweep_ticks = 0,
+        .count = 0
+    },
+    {
+        .uptime_s = 0,
+        .ticks = 0,
+        .sweep_ticks = 0,
+        .count = 0
+    }
+};
+adc_snapshot_t* volatile adc_snapshot = &adc_snapshots[0];
+
+uint32_t meas_period_s = MEAS_PERIOD_S;
+
+// log4 of the oversampling ratio of each channel
+uint8_t meas_oversample_shift[ADC_CHANNELS] = { 0 };
+
+
+// Unpacks 2-bit shifts for 8 channels from a config value
+static void restore_oversample_shifts(uint8_t config_id, uint8_t first) {
+    uint16_t packed = 0;
+    if (!get_config(config_id, &packed)) {
+        packed = 0;
+    }
+    for (uint8_t i = 0; i < 8; i++) {
+        meas_oversample_shift[first + i] = (packed >> (i * 2)) & 0x03;
+    }
+}
+
+// Packs the 2-bit shifts for 8 channels into a config value
+static void save_oversample_shifts(uint8_t config_id, uint8_t first) {
+    uint16_t packed = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        packed |= (uint16_t) meas_oversample_shift[first + i] << (i * 2);
+    }
+    set_config(config_id, packed);
+}
+
+void init_measurements(void) {
+    // The config journal is restored by init_heaters()
+    restore_oversample_shifts(CONFIG_ADC_OVERSAMPLE_LO, 0);
+    restore_oversample_shifts(CONFIG_ADC_OVERSAMPLE_HI, 8);
+    sample_adc_snapshot();
+}
+
+/*
+Sets the number of sweeps averaged for `channel` (0xFF for every channel).
+ratio - 1, 4, 16 or 64
+Returns - 1 if successful, 0 if the channel or ratio is invalid
+*/
+uint8_t set_meas_oversample_ratio(uint8_t channel, uint8_t ratio) {
+    if (channel >= ADC_CHANNELS && channel != 0xFF) {
+        return 0;
+    }
+    uint8_t shift = 0;
+    while (shift < MEAS_OVERSAMPLE_MAX_SHIFT && (1 << (shift * 2)) != ratio) {
+        shift++;
+    }
+    if ((1 << (shift * 2)) != ratio) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        if (channel == 0xFF || channel == i) {
+            meas_oversample_shift[i] = shift;
+        }
+    }
+    // Save to EEPROM (committed in the background)
+    save_oversample_shifts(CONFIG_ADC_OVERSAMPLE_LO, 0);
+    save_oversample_shifts(CONFIG_ADC_OVERSAMPLE_HI, 8);
+    return 1;
+}
+
+// Returns the number of sweeps averaged for `channel`, or 0 if it is invalid
+uint8_t get_meas_oversample_ratio(uint8_t channel) {
+    if (channel >= ADC_CHANNELS) {
+        return 0;
+    }
+    return 1 << (meas_oversample_shift[channel] * 2);
+}
+
+// Sweeps all ADC channels (as many times as their oversampling needs) into
+// the snapshot
+void sample_adc_snapshot(void) {
+    adc_snapshot_t* cur = adc_snapshot;
+    adc_snapshot_t* next = (cur == &adc_snapshots[0]) ?
+        &adc_snapshots[1] : &adc_snapshots[0];
+
+    uint8_t max_shift = 0;
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        if (meas_oversample_shift[i] > max_shift) {
+            max_shift = meas_oversample_shift[i];
+        }
+    }
+    uint8_t sweeps = 1 << (max_shift * 2);
+
+    claim_spi_bus(&spi_lib_common_dev);
+    uint32_t start_s = 0;
+    uint16_t start_ticks = 0;
+    uint32_t end_s = 0;
+    uint16_t end_ticks = 0;
+    uint32_t acc[ADC_CHANNELS] = { 0 };
+    read_uptime_ticks(&start_s, &start_ticks);
+    for (uint8_t sweep = 0; sweep < sweeps; sweep++) {
+        fetch_all_adc_channels(&adc);
+        // Channels with a lower ratio use the first sweeps
+        for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+            if (sweep < (1 << (meas_oversample_shift[i] * 2))) {
+                acc[i] += read_adc_channel(&adc, i);
+            }
+        }
+        // The checks use the ADC too, so claim it back for the next sweep
+        // (the main loop runs them after the last one)
+        if (sweep + 1 < sweeps) {
+            run_loop_poll();
+            claim_spi_bus(&spi_lib_common_dev);
+        }
+    }
+    uint16_t period = read_uptime_ticks(&end_s, &end_ticks);
+
+    // Decimate - dividing the sum of 4^n samples by 4^n is a shift by 2n
+    for (uint8_t i = 0; i < ADC_CHANNELS; i++) {
+        uint8_t shift = meas_oversample_shift[i] * 2;
+        if (shift > MEAS_EXT_FRAC_BITS) {
+            next->ext[i] = (uint16_t) (acc[i] >> (shift - MEAS_EXT_FRAC_BITS));
+        } else {
+            next->ext[i] = (uint16_t) (acc[i] << (MEAS_EXT_FRAC_BITS - shift));
+        }
+        next->raw[i] = (uint16_t) ((acc[i] + ((1UL << shift) >> 1)) >> shift);
+    }
+
+    // Timestamp the middle of the sweeps
+    uint32_t sweep_ticks = (end_s - start_s) * period + end_ticks - start_ticks;
+    uint32_t mid_s = start_s;
+    uint32_t mid_ticks = start_ticks + sweep_ticks / 2;
+    mid_s += mid_ticks / period;
+    mid_ticks %= period;
+
+    next->uptime_s = mid_s;
+    next->ticks = (uint16_t) mid_ticks;
+    next->sweep_ticks = (sweep_ticks > 0xFFFF) ? 0xFFFF : (uint16_t) sweep_ticks;
+    next->count = cur->count + 1;
+
+    // Publish it
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        adc_snapshot = next;
+    }
+}
+
+// Returns true if the snapshot is older than the sampling period
+bool is_meas_due(void) {
+    adc_snapshot_t* cur = adc_snapshot;
+    return cur->count == 0 || (uptime_s - cur->uptime_s) >= meas_period_s;
+}
+
+// Main loop task - refreshes the snapshot if it is older than the sampling
+// period
+void run_measurements(void) {
+    if (!is_meas_due()) {
+        return;
+    }
+
+    sample_adc_snapshot();
+}
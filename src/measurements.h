@@ -0,0 +1,55 @@
+#ifndef MEASUREMENTS_H
+#define MEASUREMENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <adc/adc.h>
+#include <util/atomic.h>
+#include <uptime/uptime.h>
+
+#include "config.h"
+#include "devices.h"
+#include "loop_stats.h"
+
+// How often to refresh the ADC snapshot
+#define MEAS_PERIOD_S 1
+
+// Each channel can be averaged over 4^n sweeps (1, 4, 16 or 64 samples), which
+// adds n bits of resolution for white noise
+#define MEAS_OVERSAMPLE_MAX_SHIFT   3
+// Fractional bits of the oversampled data in the snapshot
+#define MEAS_EXT_FRAC_BITS          4
+
+typedef struct {
+    // Raw 12-bit data for every ADC channel (the rounded mean of its
+    // oversampled sweeps)
+    uint16_t raw[ADC_CHANNELS];
+    // The same data with MEAS_EXT_FRAC_BITS fractional bits (only the top 12
+    // plus the channel's oversampling shift are significant)
+    uint16_t ext[ADC_CHANNELS];
+    // Middle of the sweeps the channels were sampled in, as the value of
+    // uptime_s and the Timer 1 ticks (128 us) into that second
+    uint32_t uptime_s;
+    uint16_t ticks;
+    // How long the sweeps took, in Timer 1 ticks
+    uint16_t sweep_ticks;
+    // Number of times the snapshot has been refreshed
+    uint32_t count;
+} adc_snapshot_t;
+
+// Latest complete snapshot (one of adc_snapshots, the other one is filled by
+// the next sweep)
+extern adc_snapshot_t* volatile adc_snapshot;
+extern adc_snapshot_t adc_snapshots[2];
+extern uint32_t meas_period_s;
+extern uint8_t meas_oversample_shift[ADC_CHANNELS];
+
+void init_measurements(void);
+uint8_t set_meas_oversample_ratio(uint8_t channel, uint8_t ratio);
+uint8_t get_meas_oversample_ratio(uint8_t channel);
+void sample_adc_snapshot(void);
+bool is_meas_due(void);
+void run_measurements(void);
+
+#endif
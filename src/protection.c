@@ -0,0 +1,274 @@
+/*
+Fast overcurrent and undervoltage protection.
+
+Every PROT_TICKS (about 10 ms), the Timer 1 compare B interrupt sets a flag
+that wakes the main loop, and run_protection() reads the pack voltage and the
+3V3, 5V and payload rail currents and compares them with raw ADC thresholds.
+The main loop stages that can run for longer than that (oversampled ADC
+snapshots, blocking IMU commands) also run the checks between their steps
+(poll_protection(), see run_loop_poll() in loop_stats.c). The checks can't run
+in the interrupt itself, since the SPI bus may be in the middle of an IMU
+transfer.
+Working on raw values keeps the check to compares, with no floating point. The
+4 channels are converted in one auto-1 sweep of just those channels (6 SPI
+frames instead of 12 for single-channel fetches), which matters at this rate
+with the SPI clock at F_CPU/64.
+
+When a check has been past its threshold for PROT_TRIP_SAMPLES samples in a
+row (about 30 ms), it trips: its loads are switched off through the PEX (an
+overcurrent switches off that rail, an undervoltage on the pack sheds the 5V
+and payload rails), an EVT_PROT_TRIP entry is logged and a CAN_EPS_PROT_TRIP
+frame is queued for OBC by the next run_protection() (not in the middle of
+another stage, which may be building a frame of its own). The loads stay off (latched) even if the reading
+recovers, until OBC clears them (CAN_EPS_CTRL_CLEAR_PROT). If the fault is
+still there, the check trips again.
+
+The thresholds are set with CAN_EPS_CTRL_SET_PROT_THRESH and kept in the
+config journal. An overcurrent threshold of 0x0FFF or an undervoltage
+threshold of 0 can't be crossed, which disables the check.
+
+The same tick also sets the battery and rail statistics sample flags every
+BATT_SAMPLE_DIV ticks (see battery.c and rail_stats.c).
+*/
+
+#include "protection.h"
+
+typedef struct {
+    uint8_t channel;
+    // True if the check trips below the threshold, false if above
+    bool under;
+    uint8_t loads;
+    uint16_t def_threshold;
+} prot_check_t;
+
+const prot_check_t prot_checks[PROT_CHECK_COUNT] PROGMEM = {
+    [PROT_PACK_UV] = { ADC_VMON_PACK, true, PROT_LOAD_5V | PROT_LOAD_PAY,
+        PROT_DEF_PACK_UV },
+    [PROT_3V3_OC] = { ADC_IMON_3V3, false, PROT_LOAD_3V3, PROT_DEF_RAIL_OC },
+    [PROT_5V_OC] = { ADC_IMON_5V, false, PROT_LOAD_5V, PROT_DEF_RAIL_OC },
+    [PROT_PAY_OC] = { ADC_IMON_PAY_LIM, false, PROT_LOAD_PAY, PROT_DEF_PAY_OC },
+};
+
+// PEX pin of each load (by bit in PROT_LOAD_*)
+const uint8_t prot_load_pins[] PROGMEM = {
+    PEX_LOAD_3V3_EN, PEX_LOAD_5V_EN, PEX_LOAD_PAY_EN
+};
+
+// Set by the tick interrupt when the checks should run
+volatile bool prot_check_flag = false;
+uint16_t prot_thresholds[PROT_CHECK_COUNT];
+// Checks that have tripped (bit n is check n) and loads that are switched
+// off, since the last clear
+uint8_t prot_tripped = 0;
+uint8_t prot_loads_off = 0;
+// Number of trips since startup
+uint16_t prot_trip_count = 0;
+
+// Consecutive samples past the threshold for each check
+static uint8_t prot_counts[PROT_CHECK_COUNT];
+// ADC channels of the checks (bit n is channel n)
+static uint16_t prot_channels = 0;
+// Ticks until the next battery and rail sample
+static volatile uint8_t prot_sample_div = 0;
+// Trips not reported over CAN yet (bit n is check n), with the loads they
+// switched off and the value that tripped them
+static uint8_t prot_unreported = 0;
+static uint8_t prot_trip_loads[PROT_CHECK_COUNT];
+static uint16_t prot_trip_raw[PROT_CHECK_COUNT];
+
+
+static void schedule_prot_tick(void) {
+    uint16_t next = OCR1B + PROT_TICKS;
+    if (next > OCR1A) {
+        next -= OCR1A + 1;
+    }
+    OCR1B = next;
+}
+
+// Switches the loads in `mask` on or off
+static void set_prot_loads(uint8_t mask, uint8_t state) {
+    claim_spi_bus(&spi_lib_common_dev);
+    for (uint8_t i = 0; i < sizeof(prot_load_pins); i++) {
+        if (mask & _BV(i)) {
+            set_pex_pin(&pex, PEX_LOAD_PORT, pgm_read_byte(&prot_load_pins[i]),
+                state);
+        }
+    }
+}
+
+/*
+Call after init_pex(), restore_config() (in init_heaters()), init_battery(),
+init_rail_stats() and init_uptime() - switches every load on and starts the
+tick.
+*/
+void init_protection(void) {
+    for (uint8_t i = 0; i < PROT_CHECK_COUNT; i++) {
+        uint16_t threshold = 0;
+        if (!get_config(CONFIG_PROT_THRESH + i, &threshold)) {
+            threshold = pgm_read_word(&prot_checks[i].def_threshold);
+        }
+        prot_thresholds[i] = threshold;
+        prot_counts[i] = 0;
+        prot_channels |= _BV(pgm_read_byte(&prot_checks[i].channel));
+    }
+    prot_check_flag = false;
+    prot_tripped = 0;
+    prot_loads_off = 0;
+    prot_trip_count = 0;
+    prot_unreported = 0;
+    prot_sample_div = BATT_SAMPLE_DIV;
+    loop_poll_fn = poll_protection;
+
+    claim_spi_bus(&spi_lib_common_dev);
+    for (uint8_t i = 0; i < sizeof(prot_load_pins); i++) {
+        set_pex_pin_dir(&pex, PEX_LOAD_PORT, pgm_read_byte(&prot_load_pins[i]),
+            OUTPUT);
+    }
+    set_prot_loads(PROT_LOAD_ALL, 1);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        OCR1B = TCNT1;
+        schedule_prot_tick();
+        TIMSK1 |= _BV(OCIE1B);
+    }
+}
+
+/*
+Sets the raw ADC threshold of a check and saves it in the config journal.
+Returns - 1 if the check and threshold are valid, otherwise 0
+*/
+uint8_t set_prot_threshold(uint8_t check, uint16_t raw) {
+    if (check >= PROT_CHECK_COUNT || raw > 0x0FFF) {
+        return 0;
+    }
+    prot_thresholds[check] = raw;
+    prot_counts[check] = 0;
+    set_config(CONFIG_PROT_THRESH + check, raw);
+    return 1;
+}
+
+// Switches the loads that were switched off back on and rearms every check
+void clear_protection(void) {
+    if (prot_loads_off != 0) {
+        set_prot_loads(prot_loads_off, 1);
+    }
+    prot_loads_off = 0;
+    prot_tripped = 0;
+    for (uint8_t i = 0; i < PROT_CHECK_COUNT; i++) {
+        prot_counts[i] = 0;
+    }
+}
+
+// Switches off the loads of a check that tripped, logs it, and leaves it to
+// be reported
+static void trip_protection(uint8_t check, uint16_t raw) {
+    uint8_t loads = pgm_read_byte(&prot_checks[check].loads) &
+        (uint8_t) ~prot_loads_off;
+    if (loads != 0) {
+        set_prot_loads(loads, 0);
+    }
+    prot_loads_off |= loads;
+    prot_tripped |= _BV(check);
+    prot_trip_count++;
+
+    uint16_t threshold = prot_thresholds[check];
+    uint8_t args[EVT_PROT_TRIP_LEN] = { check, loads,
+        (raw >> 8) & 0xFF, raw & 0xFF, (threshold >> 8) & 0xFF,
+        threshold & 0xFF };
+    log_event(EVT_PROT_TRIP, args);
+
+    prot_unreported |= _BV(check);
+    prot_trip_loads[check] = loads;
+    prot_trip_raw[check] = raw;
+}
+
+// Queues a CAN_EPS_PROT_TRIP frame for every trip that hasn't been reported
+static void report_prot_trips(void) {
+    for (uint8_t i = 0; i < PROT_CHECK_COUNT && prot_unreported != 0; i++) {
+        if (!(prot_unreported & _BV(i))) {
+            continue;
+        }
+        prot_unreported &= (uint8_t) ~_BV(i);
+
+        // Dropped and counted in `can_tx_ring.overflows` if the ring is full
+        // (the trip is still in the log and CAN_EPS_CTRL_GET_PROT_STATUS)
+        uint16_t raw = prot_trip_raw[i];
+        uint16_t threshold = prot_thresholds[i];
+        uint8_t* tx_msg = can_ring_reserve(&can_tx_ring);
+        if (tx_msg != NULL) {
+            tx_msg[0] = CAN_EPS_PROT_TRIP;
+            tx_msg[1] = i;
+            tx_msg[2] = prot_trip_loads[i];
+            tx_msg[3] = prot_loads_off;
+            tx_msg[4] = (raw >> 8) & 0xFF;
+            tx_msg[5] = raw & 0xFF;
+            tx_msg[6] = (threshold >> 8) & 0xFF;
+            tx_msg[7] = threshold & 0xFF;
+            can_ring_commit(&can_tx_ring);
+        }
+    }
+}
+
+// Samples every check's channel and trips the checks that have been past
+// their threshold for long enough
+void check_protection(void) {
+    claim_spi_bus(&spi_lib_common_dev);
+    // The snapshot is kept separately (see measurements.c), so the sweep can
+    // use the ADC's channel data
+    uint16_t auto_channels = adc.auto_channels;
+    adc.auto_channels = prot_channels;
+    fetch_all_adc_channels(&adc);
+    adc.auto_channels = auto_channels;
+
+    for (uint8_t i = 0; i < PROT_CHECK_COUNT; i++) {
+        uint8_t channel = pgm_read_byte(&prot_checks[i].channel);
+        uint16_t raw = read_adc_channel(&adc, channel);
+        bool past = pgm_read_byte(&prot_checks[i].under) ?
+            (raw < prot_thresholds[i]) : (raw > prot_thresholds[i]);
+
+        if (!past) {
+            prot_counts[i] = 0;
+        } else if (prot_counts[i] < PROT_TRIP_SAMPLES) {
+            prot_counts[i]++;
+            // Latched - only reported once until it is cleared
+            if (prot_counts[i] == PROT_TRIP_SAMPLES &&
+                    !(prot_tripped & _BV(i))) {
+                trip_protection(i, raw);
+            }
+        }
+    }
+}
+
+// Returns true if the tick interrupt has fired since the last check
+bool is_prot_check_due(void) {
+    return prot_check_flag;
+}
+
+/*
+Runs the checks when they are due, without reporting trips over CAN. For the
+stages that take long (see run_loop_poll()).
+*/
+void poll_protection(void) {
+    if (prot_check_flag) {
+        prot_check_flag = false;
+        check_protection();
+    }
+}
+
+// Main loop task - runs the checks when they are due, and reports the trips
+void run_protection(void) {
+    poll_protection();
+    report_prot_trips();
+}
+
+ISR(TIMER1_COMPB_vect) {
+    schedule_prot_tick();
+    prot_check_flag = true;
+
+    prot_sample_div--;
+    if (prot_sample_div == 0) {
+        prot_sample_div = BATT_SAMPLE_DIV;
+        batt_sample_flag = true;
+        rail_sample_flag = true;
+    }
+}
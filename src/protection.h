@@ -0,0 +1,65 @@
+#ifndef PROTECTION_H
+#define PROTECTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <adc/adc.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <conversions/conversions.h>
+#include <pex/pex.h>
+#include <util/atomic.h>
+
+#include "battery.h"
+#include "can_commands.h"
+#include "config.h"
+#include "devices.h"
+#include "event_log.h"
+#include "loop_stats.h"
+#include "rail_stats.h"
+
+// Protection check period (Timer 1 ticks, about 10 ms)
+#define PROT_TICKS          78
+// Consecutive samples past a threshold before a check trips, so a single
+// noisy sample doesn't switch a load off
+#define PROT_TRIP_SAMPLES   3
+
+// Checks
+#define PROT_PACK_UV        0
+#define PROT_3V3_OC         1
+#define PROT_5V_OC          2
+#define PROT_PAY_OC         3
+#define PROT_CHECK_COUNT    4
+
+// Loads that can be switched off (bits in the load masks)
+#define PROT_LOAD_3V3       0x01
+#define PROT_LOAD_5V        0x02
+#define PROT_LOAD_PAY       0x04
+#define PROT_LOAD_ALL       0x07
+
+// Default thresholds (raw ADC values) - pack below 3.0 V per cell (the empty
+// end of batt_ocv_curve), 3V3 or 5V rail above 3 A, payload above 2 A
+#define PROT_DEF_PACK_UV    ((uint16_t) (3000.0 * BATT_CELLS_SERIES / \
+    BATT_VOL_FULL_SCALE_MV * 0x0FFF + 0.5))
+#define PROT_DEF_RAIL_OC    ((uint16_t) (3000.0 / RAIL_CUR_FULL_SCALE_MA * \
+    0x0FFF + 0.5))
+#define PROT_DEF_PAY_OC     ((uint16_t) (2000.0 / RAIL_EFUSE_FULL_SCALE_MA * \
+    0x0FFF + 0.5))
+
+extern volatile bool prot_check_flag;
+extern uint16_t prot_thresholds[PROT_CHECK_COUNT];
+extern uint8_t prot_tripped;
+extern uint8_t prot_loads_off;
+extern uint16_t prot_trip_count;
+
+void init_protection(void);
+uint8_t set_prot_threshold(uint8_t check, uint16_t raw);
+void clear_protection(void);
+bool is_prot_check_due(void);
+void check_protection(void);
+void poll_protection(void);
+void run_protection(void);
+
+#endif
@@ -0,0 +1,201 @@
+/*
+Energy and current statistics of the 3V3, 5V and payload rails.
+
+The rail currents are sampled together with the battery current, every
+BATT_SAMPLE_DIV protection ticks (about 100 ms, see protection.c), so the
+statistics don't depend on when OBC asks. Each sample adds voltage x current x
+the measured time since the previous sample to the rail's energy, in fixed
+point (mJ, with the fraction of a mJ carried over), and updates the minimum,
+maximum and sum of the current. The voltages change slowly, so they are taken
+from the ADC snapshot. The payload efuse has no voltage monitor - it is fed
+from the pack, so the pack voltage is used.
+
+The energy, mean, minimum and maximum current of each rail are HK fields
+(CAN_EPS_HK_3V3_ENERGY etc.), so one HK batch per orbit replaces polling the
+currents. With reset on read (CAN_EPS_CTRL_SET_RAIL_RESET_ON_READ), reading a
+field restarts that statistic, so each read covers the time since the
+previous one. Otherwise they accumulate until CAN_EPS_CTRL_RESET_RAIL_STATS.
+*/
+
+#include "rail_stats.h"
+
+typedef struct {
+    uint8_t cur_channel;
+    uint8_t vol_channel;
+    uint16_t cur_full_scale_ma;
+} rail_info_t;
+
+const rail_info_t rail_info[RAIL_COUNT] PROGMEM = {
+    [RAIL_3V3] = { ADC_IMON_3V3,        ADC_VMON_3V3,   RAIL_CUR_FULL_SCALE_MA },
+    [RAIL_5V]  = { ADC_IMON_5V,         ADC_VMON_5V,    RAIL_CUR_FULL_SCALE_MA },
+    [RAIL_PAY] = { ADC_IMON_PAY_LIM,    ADC_VMON_PACK,  RAIL_EFUSE_FULL_SCALE_MA },
+};
+
+// Set by the protection tick interrupt when the rails should be sampled
+volatile bool rail_sample_flag = false;
+// True if reading a statistic restarts it
+bool rail_reset_on_read = false;
+rail_acc_t rail_accs[RAIL_COUNT];
+
+// Last current sample of each rail (raw)
+static uint16_t rail_last_cur[RAIL_COUNT];
+// Loop timer value of the last sample
+static uint32_t rail_last_time = 0;
+
+
+static void reset_rail_cur_min(rail_acc_t* acc) {
+    acc->cur_min = 0xFFFF;
+}
+
+static void reset_rail_cur_max(rail_acc_t* acc) {
+    acc->cur_max = 0;
+}
+
+static void reset_rail_cur_mean(rail_acc_t* acc) {
+    acc->cur_sum = 0;
+    acc->samples = 0;
+}
+
+static void reset_rail_energy(rail_acc_t* acc) {
+    acc->energy_mj = 0;
+    acc->energy_uj = 0;
+    acc->energy_rem = 0;
+}
+
+void reset_rail_stats(void) {
+    for (uint8_t i = 0; i < RAIL_COUNT; i++) {
+        rail_acc_t* acc = &rail_accs[i];
+        reset_rail_energy(acc);
+        reset_rail_cur_mean(acc);
+        reset_rail_cur_min(acc);
+        reset_rail_cur_max(acc);
+    }
+}
+
+// Call after init_measurements() and init_uptime()
+void init_rail_stats(void) {
+    rail_sample_flag = false;
+    rail_reset_on_read = false;
+    reset_rail_stats();
+    for (uint8_t i = 0; i < RAIL_COUNT; i++) {
+        rail_last_cur[i] = 0;
+    }
+    rail_last_time = read_loop_time();
+}
+
+static int32_t rail_cur_raw_to_ma(uint8_t rail, uint32_t raw) {
+    uint16_t full_scale = pgm_read_word(&rail_info[rail].cur_full_scale_ma);
+    return (int32_t) ((raw * full_scale + 0x0FFF / 2) / 0x0FFF);
+}
+
+// Samples the rail currents and accumulates them since the last sample
+void sample_rails(void) {
+    claim_spi_bus(&spi_lib_common_dev);
+    uint32_t seconds = 0;
+    uint16_t ticks = 0;
+    uint16_t period = read_uptime_ticks(&seconds, &ticks);
+    uint32_t now = seconds * period + ticks;
+    uint32_t dt = now - rail_last_time;
+    // Same limit as the battery current
+    if (dt > 0xFFFF) {
+        dt = 0xFFFF;
+    }
+    rail_last_time = now;
+
+    for (uint8_t i = 0; i < RAIL_COUNT; i++) {
+        rail_acc_t* acc = &rail_accs[i];
+        uint8_t cur_channel = pgm_read_byte(&rail_info[i].cur_channel);
+        uint8_t vol_channel = pgm_read_byte(&rail_info[i].vol_channel);
+        uint16_t raw = fetch_and_read_adc_channel(&adc, cur_channel);
+
+        uint16_t full_scale = pgm_read_word(&rail_info[i].cur_full_scale_ma);
+        uint32_t vol_mv = (uint32_t) adc_snapshot->raw[vol_channel] *
+            RAIL_VOL_FULL_SCALE_MV / 0x0FFF;
+        // Trapezoid - twice the mean current, times the voltage and the time
+        // Each step fits in 32 bits (sum < 2^13, full scale < 2^16, voltage
+        // <= 10 V, dt <= 0xFFFF ticks)
+        uint32_t sum = (uint32_t) rail_last_cur[i] + raw;
+        rail_last_cur[i] = raw;
+        // Twice the mean current (uA)
+        uint32_t cur2 = sum * full_scale;
+        uint32_t cur2_ua = (cur2 / 0x0FFF) * 1000 +
+            (cur2 % 0x0FFF) * 1000 / 0x0FFF;
+        // Twice the mean power (uW)
+        uint32_t pow2_uw = (cur2_ua / 1000) * vol_mv +
+            (cur2_ua % 1000) * vol_mv / 1000;
+        // Energy over dt ticks (uJ), with the fraction of a uJ carried over
+        uint32_t unit = 2UL * period;
+        uint32_t rem = (pow2_uw % unit) * dt + acc->energy_rem;
+        uint32_t uj = (pow2_uw / unit) * dt + rem / unit + acc->energy_uj;
+        acc->energy_rem = (uint16_t) (rem % unit);
+        acc->energy_uj = (uint16_t) (uj % 1000);
+        acc->energy_mj += uj / 1000;
+
+        acc->cur_sum += raw;
+        acc->samples++;
+        if (raw < acc->cur_min) {
+            acc->cur_min = raw;
+        }
+        if (raw > acc->cur_max) {
+            acc->cur_max = raw;
+        }
+    }
+}
+
+// Returns true if the sample interrupt has fired since the last sample
+bool is_rail_sample_due(void) {
+    return rail_sample_flag;
+}
+
+// Main loop task - samples the rails when it is due
+void run_rail_stats(void) {
+    if (rail_sample_flag) {
+        rail_sample_flag = false;
+        sample_rails();
+    }
+}
+
+/*
+Gets one statistic of a rail (see RAIL_STAT_*), and restarts it with reset on
+read. The current statistics are 0 if there are no samples.
+Returns - 1 if the rail and item are valid, otherwise 0
+*/
+uint8_t get_rail_stat(uint8_t rail, uint8_t item, uint32_t* value) {
+    if (rail >= RAIL_COUNT) {
+        return 0;
+    }
+    rail_acc_t* acc = &rail_accs[rail];
+
+    switch (item) {
+        case RAIL_STAT_ENERGY:
+            *value = acc->energy_mj;
+            if (rail_reset_on_read) {
+                reset_rail_energy(acc);
+            }
+            break;
+        case RAIL_STAT_CUR_MEAN:
+            *value = (acc->samples == 0) ? 0 :
+                rail_cur_raw_to_ma(rail, (acc->cur_sum + acc->samples / 2) /
+                acc->samples);
+            if (rail_reset_on_read) {
+                reset_rail_cur_mean(acc);
+            }
+            break;
+        case RAIL_STAT_CUR_MIN:
+            *value = (acc->cur_min == 0xFFFF) ? 0 :
+                rail_cur_raw_to_ma(rail, acc->cur_min);
+            if (rail_reset_on_read) {
+                reset_rail_cur_min(acc);
+            }
+            break;
+        case RAIL_STAT_CUR_MAX:
+            *value = rail_cur_raw_to_ma(rail, acc->cur_max);
+            if (rail_reset_on_read) {
+                reset_rail_cur_max(acc);
+            }
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,65 @@
+#ifndef RAIL_STATS_H
+#define RAIL_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <adc/adc.h>
+#include <avr/pgmspace.h>
+#include <conversions/conversions.h>
+
+#include "devices.h"
+#include "loop_stats.h"
+#include "measurements.h"
+
+// Rails with energy accounting
+#define RAIL_3V3    0
+#define RAIL_5V     1
+#define RAIL_PAY    2
+#define RAIL_COUNT  3
+
+// Statistics reported for each rail (each one since it was last read with
+// reset on read, otherwise since the last reset)
+#define RAIL_STAT_ENERGY    0   // mJ
+#define RAIL_STAT_CUR_MEAN  1   // mA
+#define RAIL_STAT_CUR_MIN   2   // mA
+#define RAIL_STAT_CUR_MAX   3   // mA
+#define RAIL_STAT_COUNT     4
+
+// Current (mA) at full scale of the INA214 (3V3, 5V) and efuse IMON (PAY)
+// current channels, and rail voltage (mV) at full scale of the voltage
+// monitor channels
+#define RAIL_CUR_FULL_SCALE_MA      ((int32_t) (ADC_VREF * 1000.0 / \
+    (ADC_CUR_SENSE_AMP_GAIN * ADC_DEF_CUR_SENSE_RES) + 0.5))
+#define RAIL_EFUSE_FULL_SCALE_MA    ((int32_t) (ADC_VREF * 1000.0 / \
+    (ADC_EFUSE_CUR_SENSE_RES * ADC_EFUSE_IMON_CUR_GAIN) + 0.5))
+#define RAIL_VOL_FULL_SCALE_MV      ((int32_t) (ADC_VREF * 1000.0 * \
+    (ADC_VOL_SENSE_LOW_RES + ADC_VOL_SENSE_HIGH_RES) / \
+    ADC_VOL_SENSE_LOW_RES + 0.5))
+
+// Accumulated since the statistics were reset (raw ADC values for the
+// current)
+typedef struct {
+    uint32_t energy_mj;
+    // Energy that doesn't make a whole mJ yet (uJ), and that doesn't make a
+    // whole uJ yet, in units of 1 / (2 * ticks per second) uJ
+    uint16_t energy_uj;
+    uint16_t energy_rem;
+    uint32_t cur_sum;
+    uint32_t samples;
+    uint16_t cur_min;
+    uint16_t cur_max;
+} rail_acc_t;
+
+extern volatile bool rail_sample_flag;
+extern bool rail_reset_on_read;
+extern rail_acc_t rail_accs[RAIL_COUNT];
+
+void init_rail_stats(void);
+void reset_rail_stats(void);
+bool is_rail_sample_due(void);
+void sample_rails(void);
+void run_rail_stats(void);
+uint8_t get_rail_stat(uint8_t rail, uint8_t item, uint32_t* value);
+
+#endif
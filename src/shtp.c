@@ -0,0 +1,139 @@
+/*
+Incremental parser for the cargo of SHTP packets from the BNO080.
+
+The cargo of an input packet is a sequence of SH-2 reports - a timebase
+reference (0xFB), then one or more sensor reports, possibly many of the same
+sensor when they are batched (#1 p.79). Reports don't carry a length, so the
+length of each report ID comes from the SH-2 reference manual (#1 p.57-75).
+
+The IMU driver feeds every cargo byte to feed_shtp_byte() from SPI_STC_vect
+as it is received (see spi_xfer.c), so there is no packet buffer - only the
+report being received is kept, and each report is passed to the handler for
+its ID as soon as its last byte arrives. Packets of any length (the 284-byte
+advertisement, a batch of reports) are consumed without dropping any reports.
+After an unknown report ID the position of the next report is unknown, so the
+rest of the packet is skipped.
+
+Datasheets: see imu.c
+*/
+
+#include "shtp.h"
+
+typedef struct {
+    uint8_t id;
+    uint8_t len;
+} shtp_report_len_t;
+
+// Lengths of the reports that can appear in input packets (#1 p.57-75)
+const shtp_report_len_t shtp_report_lens[] PROGMEM = {
+    { 0xFB, 5 },    // Base timestamp reference
+    { 0xFA, 5 },    // Timestamp rebase
+    { 0x01, 10 },   // Accelerometer
+    { 0x02, 10 },   // Gyroscope calibrated
+    { 0x03, 10 },   // Magnetic field calibrated
+    { 0x04, 10 },   // Linear acceleration
+    { 0x05, 14 },   // Rotation vector
+    { 0x06, 10 },   // Gravity
+    { 0x07, 16 },   // Gyroscope uncalibrated
+    { 0x08, 12 },   // Game rotation vector
+    { 0x09, 14 },   // Geomagnetic rotation vector
+    { 0x0A, 8 },    // Pressure
+    { 0x0B, 8 },    // Ambient light
+    { 0x0C, 6 },    // Humidity
+    { 0x0D, 6 },    // Proximity
+    { 0x0E, 6 },    // Temperature
+    { 0x0F, 16 },   // Magnetic field uncalibrated
+    { 0x10, 5 },    // Tap detector
+    { 0x11, 12 },   // Step counter
+    { 0x12, 6 },    // Significant motion
+    { 0x13, 6 },    // Stability classifier
+    { 0x14, 16 },   // Raw accelerometer
+    { 0x15, 16 },   // Raw gyroscope
+    { 0x16, 16 },   // Raw magnetometer
+    { 0x18, 8 },    // Step detector
+    { 0x19, 6 },    // Shake detector
+    { 0x1A, 6 },    // Flip detector
+    { 0x1B, 6 },    // Pickup detector
+    { 0x1C, 6 },    // Stability detector
+    { 0x1E, 16 },   // Personal activity classifier
+    { 0x1F, 6 },    // Sleep detector
+    { 0x20, 6 },    // Tilt detector
+    { 0x21, 6 },    // Pocket detector
+    { 0x22, 6 },    // Circle detector
+    { 0x23, 6 },    // Heart rate monitor
+    { 0x28, 14 },   // ARVR-stabilized rotation vector
+    { 0x29, 12 },   // ARVR-stabilized game rotation vector
+    { 0x2A, 14 },   // Gyro-integrated rotation vector
+};
+
+/*
+Returns the length of a report (including its report ID), or 0 if the report
+ID is unknown.
+*/
+uint8_t get_shtp_report_len(uint8_t id) {
+    for (uint8_t i = 0; i < sizeof(shtp_report_lens) / sizeof(shtp_report_lens[0]); i++) {
+        if (pgm_read_byte(&shtp_report_lens[i].id) == id) {
+            return pgm_read_byte(&shtp_report_lens[i].len);
+        }
+    }
+    return 0;
+}
+
+static shtp_report_fn_t get_shtp_handler(shtp_parser_t* parser, uint8_t id) {
+    for (uint8_t i = 0; i < parser->handler_count; i++) {
+        if (pgm_read_byte(&parser->handlers[i].id) == id) {
+            return (shtp_report_fn_t) pgm_read_ptr(&parser->handlers[i].fn);
+        }
+    }
+    return NULL;
+}
+
+/*
+Starts parsing a packet, call with the cargo length (without the header)
+before feeding its first byte.
+*/
+void start_shtp_packet(shtp_parser_t* parser, uint16_t cargo_len) {
+    parser->left = cargo_len;
+    parser->len = 0;
+    parser->pos = 0;
+    parser->fn = NULL;
+}
+
+/*
+Adds the next cargo byte, and calls the handler when it completes a report.
+Bytes after the end of the packet are ignored.
+*/
+void feed_shtp_byte(shtp_parser_t* parser, uint8_t byte) {
+    if (parser->left == 0) {
+        return;
+    }
+    parser->left--;
+
+    // Report ID
+    if (parser->len == 0) {
+        uint8_t len = get_shtp_report_len(byte);
+        // Unknown or cut short - can't find where the next report starts
+        if (len == 0 || len - 1 > parser->left) {
+            parser->skipped += parser->left + 1;
+            parser->left = 0;
+            return;
+        }
+        parser->len = len;
+        parser->pos = 0;
+        parser->fn = get_shtp_handler(parser, byte);
+    }
+
+    // Only reports with a handler are kept
+    if (parser->fn != NULL) {
+        parser->report[parser->pos] = byte;
+    }
+    parser->pos++;
+
+    if (parser->pos == parser->len) {
+        if (parser->fn != NULL) {
+            parser->fn(parser->report, parser->len);
+            parser->reports++;
+        }
+        parser->len = 0;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SHTP_H
+#define SHTP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+// Longest report the parser keeps (the raw and uncalibrated sensor reports)
+#define SHTP_REPORT_MAX_LEN 16
+
+// Called from the parser with each complete report it has a handler for
+// report - starts with the report ID, `len` bytes
+typedef void(*shtp_report_fn_t)(const uint8_t* report, uint8_t len);
+
+// Handler for a report ID
+typedef struct {
+    uint8_t id;
+    shtp_report_fn_t fn;
+} shtp_handler_t;
+
+typedef struct {
+    // Handlers (in program memory), reports without one are skipped
+    const shtp_handler_t* handlers;
+    uint8_t handler_count;
+
+    // Cargo bytes left in the packet
+    uint16_t left;
+    // Report being received, its length (0 before its report ID), and the
+    // number of bytes received
+    uint8_t report[SHTP_REPORT_MAX_LEN];
+    uint8_t len;
+    uint8_t pos;
+    // Handler for the report being received (NULL to skip it)
+    shtp_report_fn_t fn;
+
+    // Reports passed to a handler
+    uint32_t reports;
+    // Cargo bytes skipped after an unknown report ID
+    uint32_t skipped;
+} shtp_parser_t;
+
+uint8_t get_shtp_report_len(uint8_t id);
+void start_shtp_packet(shtp_parser_t* parser, uint16_t cargo_len);
+void feed_shtp_byte(shtp_parser_t* parser, uint8_t byte);
+
+#endif
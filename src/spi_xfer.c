@@ -0,0 +1,251 @@
+/*
+SPI bus manager and interrupt-driven transfers.
+
+The ADC, DAC, PEX and IMU share one SPI bus with different modes and clocks.
+Each device is described once by an spi_dev_t. The mode and clock currently
+programmed in SPCR/SPSR are cached, so switching to a device only writes the
+registers that differ - back to back transfers with the same device (e.g.
+every IMU packet) don't touch them at all.
+
+queue_spi_xfer() adds a transfer to a queue and starts it if the bus is free.
+Each time a byte has been exchanged, SPI_STC_vect stores the received byte
+(and/or passes it to the transfer's `rx_byte` callback) and sends the next
+one. After the last byte it calls the transfer's `done`
+callback, which may continue on the same device with chain_spi_xfer() (CS
+stays asserted, e.g. to read the data after a packet header). Otherwise CS is
+released and the next queued transfer starts straight away, so transfers with
+different devices run back to back. The CPU is free between bytes (e.g. for
+the main loop to handle CAN messages while an IMU packet is read).
+
+Blocking transfers with send_spi() (including lib-common's ADC, DAC and PEX
+drivers, which assume mode 0 at the default clock) must not use the bus while
+the queue is running, so they call claim_spi_bus() first.
+
+Each byte costs an interrupt (about 60 cycles), so at the fastest SPI clocks
+a transfer takes longer than with send_spi(), but the CPU is only busy for
+the interrupts instead of the whole transfer (see host/bench/eps_bench.c).
+*/
+
+#include "spi_xfer.h"
+
+// lib-common's drivers leave the bus in the mode init_spi() sets up
+spi_dev_t spi_lib_common_dev = {
+    .cs = NULL,
+    .cpol = 0,
+    .cpha = 0,
+    .clk_freq = SPI_DEF_CLK_FREQ
+};
+
+// Set while a transfer is in progress or queued
+volatile bool spi_xfer_busy = false;
+// Number of mode/clock register writes avoided because the configuration
+// was already programmed
+uint32_t spi_cfg_skipped = 0;
+
+// Mode and clock currently programmed
+static uint8_t spi_cur_cpol = 0;
+static uint8_t spi_cur_cpha = 0;
+static spi_clk_freq_t spi_cur_clk_freq = SPI_DEF_CLK_FREQ;
+
+// Transfer in progress and the index of the byte being exchanged
+static spi_xfer_t* spi_xfer_cur = NULL;
+static volatile uint16_t spi_xfer_index = 0;
+// Set by chain_spi_xfer() from a `done` callback
+static spi_xfer_t* spi_xfer_chained = NULL;
+
+// Transfers waiting for the bus (circular)
+static spi_xfer_t* spi_xfer_queue[SPI_XFER_QUEUE_SIZE];
+static uint8_t spi_xfer_queue_head = 0;
+static uint8_t spi_xfer_queue_count = 0;
+
+
+static void start_queued_spi_xfer(void);
+
+/*
+Stops any transfer in progress and empties the queue (call after init_spi()).
+*/
+void init_spi_xfer(void) {
+    SPCR &= (uint8_t) ~_BV(SPIE);
+    spi_xfer_cur = NULL;
+    spi_xfer_index = 0;
+    spi_xfer_chained = NULL;
+    spi_xfer_queue_head = 0;
+    spi_xfer_queue_count = 0;
+    spi_xfer_busy = false;
+    spi_cfg_skipped = 0;
+
+    // What init_spi() programs
+    spi_cur_cpol = spi_lib_common_dev.cpol;
+    spi_cur_cpha = spi_lib_common_dev.cpha;
+    spi_cur_clk_freq = spi_lib_common_dev.clk_freq;
+}
+
+// Programs the device's mode and clock, skipping what is already set
+static void configure_spi_dev(spi_dev_t* dev) {
+    if (dev->cpol != spi_cur_cpol || dev->cpha != spi_cur_cpha) {
+        set_spi_cpol_cpha(dev->cpol, dev->cpha);
+        spi_cur_cpol = dev->cpol;
+        spi_cur_cpha = dev->cpha;
+    } else {
+        spi_cfg_skipped++;
+    }
+
+    if (dev->clk_freq != spi_cur_clk_freq) {
+        set_spi_clk_freq(dev->clk_freq);
+        spi_cur_clk_freq = dev->clk_freq;
+    } else {
+        spi_cfg_skipped++;
+    }
+}
+
+void select_spi_dev(spi_dev_t* dev) {
+    if (dev->cs != NULL) {
+        set_cs_low(dev->cs->pin, dev->cs->port);
+    }
+}
+
+void deselect_spi_dev(spi_dev_t* dev) {
+    if (dev->cs != NULL) {
+        set_cs_high(dev->cs->pin, dev->cs->port);
+    }
+}
+
+/*
+Waits until every queued transfer is done, then sets up the bus for blocking
+transfers with `dev` (its chip select is not asserted).
+*/
+void claim_spi_bus(spi_dev_t* dev) {
+    wait_spi_xfer();
+    configure_spi_dev(dev);
+}
+
+static uint8_t next_spi_xfer_byte(spi_xfer_t* xfer, uint16_t index) {
+    return (xfer->tx != NULL) ? xfer->tx[index] : xfer->fill;
+}
+
+static void end_spi_xfer(spi_xfer_t* xfer);
+
+// Sends the first byte of `xfer` (its device is already selected), or ends it
+// straight away if it is empty
+static void begin_spi_xfer(spi_xfer_t* xfer) {
+    spi_xfer_cur = xfer;
+    spi_xfer_index = 0;
+    if (xfer->len == 0) {
+        end_spi_xfer(xfer);
+        return;
+    }
+    // Writing the data register starts the exchange
+    SPDR = next_spi_xfer_byte(xfer, 0);
+}
+
+// Calls the `done` callback, then continues with the chained transfer or
+// releases the device and starts the next queued one
+static void end_spi_xfer(spi_xfer_t* xfer) {
+    spi_xfer_chained = NULL;
+    if (xfer->done != NULL) {
+        xfer->done();
+    }
+    if (spi_xfer_chained != NULL) {
+        spi_xfer_t* next = spi_xfer_chained;
+        spi_xfer_chained = NULL;
+        begin_spi_xfer(next);
+        return;
+    }
+
+    deselect_spi_dev(xfer->dev);
+    start_queued_spi_xfer();
+}
+
+// Starts the oldest queued transfer, or frees the bus if there is none
+static void start_queued_spi_xfer(void) {
+    if (spi_xfer_queue_count == 0) {
+        SPCR &= (uint8_t) ~_BV(SPIE);
+        spi_xfer_cur = NULL;
+        spi_xfer_busy = false;
+        return;
+    }
+
+    spi_xfer_t* xfer = spi_xfer_queue[spi_xfer_queue_head];
+    spi_xfer_queue_head = (spi_xfer_queue_head + 1) % SPI_XFER_QUEUE_SIZE;
+    spi_xfer_queue_count--;
+
+    configure_spi_dev(xfer->dev);
+    select_spi_dev(xfer->dev);
+    begin_spi_xfer(xfer);
+}
+
+/*
+Queues exchanging `xfer->len` bytes with `xfer->dev`, and starts it if the bus
+is free (an empty transfer is done immediately).
+Returns - 1 if the transfer was queued, 0 if the queue is full
+*/
+uint8_t queue_spi_xfer(spi_xfer_t* xfer) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (spi_xfer_queue_count >= SPI_XFER_QUEUE_SIZE) {
+            return 0;
+        }
+        uint8_t tail = (spi_xfer_queue_head + spi_xfer_queue_count) %
+            SPI_XFER_QUEUE_SIZE;
+        spi_xfer_queue[tail] = xfer;
+        spi_xfer_queue_count++;
+
+        if (!spi_xfer_busy) {
+            spi_xfer_busy = true;
+            SPCR |= _BV(SPIE);
+            start_queued_spi_xfer();
+        }
+    }
+    return 1;
+}
+
+/*
+Only call from a `done` callback - continues with `xfer` on the same device
+once the callback returns, without releasing chip select or letting a queued
+transfer run in between.
+*/
+void chain_spi_xfer(spi_xfer_t* xfer) {
+    spi_xfer_chained = xfer;
+}
+
+/*
+Waits (in idle sleep, woken by the SPI interrupt) until the transfer in
+progress and all queued transfers are done. Interrupts must be enabled.
+*/
+void wait_spi_xfer(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (1) {
+        // Interrupts are disabled between the check and going to sleep, so the
+        // last interrupt can't be missed
+        cli();
+        if (!spi_xfer_busy) {
+            sei();
+            return;
+        }
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+}
+
+ISR(SPI_STC_vect) {
+    spi_xfer_t* xfer = spi_xfer_cur;
+    uint16_t index = spi_xfer_index;
+
+    uint8_t byte = SPDR;
+    if (xfer->rx != NULL && index < xfer->rx_max) {
+        xfer->rx[index] = byte;
+    }
+    if (xfer->rx_byte != NULL) {
+        xfer->rx_byte(byte);
+    }
+
+    index++;
+    if (index < xfer->len) {
+        spi_xfer_index = index;
+        SPDR = next_spi_xfer_byte(xfer, index);
+        return;
+    }
+
+    end_spi_xfer(xfer);
+}
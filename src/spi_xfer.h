@@ -0,0 +1,65 @@
+#ifndef SPI_XFER_H
+#define SPI_XFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <spi/spi.h>
+#include <util/atomic.h>
+#include <utilities/utilities.h>
+
+// Number of transfers that can wait for the bus
+#define SPI_XFER_QUEUE_SIZE 4
+
+// A device on the shared SPI bus, registered once with its mode, clock and
+// chip select
+typedef struct {
+    // NULL if the device's driver asserts its own chip select
+    pin_info_t* cs;
+    uint8_t cpol;
+    uint8_t cpha;
+    spi_clk_freq_t clk_freq;
+} spi_dev_t;
+
+// Called from SPI_STC_vect when the last byte of a transfer has been received
+// (chip select is still asserted, it may continue with chain_spi_xfer())
+typedef void(*spi_xfer_fn_t)(void);
+
+// Called from SPI_STC_vect with each received byte, as it arrives
+typedef void(*spi_rx_fn_t)(uint8_t byte);
+
+typedef struct {
+    spi_dev_t* dev;
+    // Bytes to send, or NULL to send `fill` for every byte
+    const uint8_t* tx;
+    uint8_t fill;
+    // Where to store the received bytes, or NULL to discard them - only the
+    // first `rx_max` bytes are stored
+    uint8_t* rx;
+    uint16_t rx_max;
+    // Called with every received byte (e.g. to parse it without storing the
+    // whole transfer), or NULL
+    spi_rx_fn_t rx_byte;
+    // Number of bytes to exchange
+    uint16_t len;
+    spi_xfer_fn_t done;
+} spi_xfer_t;
+
+extern spi_dev_t spi_lib_common_dev;
+
+extern volatile bool spi_xfer_busy;
+extern uint32_t spi_cfg_skipped;
+
+void init_spi_xfer(void);
+void claim_spi_bus(spi_dev_t* dev);
+void select_spi_dev(spi_dev_t* dev);
+void deselect_spi_dev(spi_dev_t* dev);
+uint8_t queue_spi_xfer(spi_xfer_t* xfer);
+void chain_spi_xfer(spi_xfer_t* xfer);
+void wait_spi_xfer(void);
+
+#endif
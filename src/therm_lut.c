@@ -0,0 +1,176 @@
+/*
+Fixed-point thermistor and heater setpoint conversions with lookup tables.
+
+lib-common's adc_raw_to_therm_temp(), dac_raw_data_to_heater_setpoint() and
+heater_setpoint_to_dac_raw_data() evaluate the beta model with log()/exp() in
+floating point, which takes milliseconds on the AVR and pulls libm into the
+image. These functions give the same conversions in 1/100 C (centi-degrees)
+with integer arithmetic only, in microseconds.
+
+The thermistor is the top of a divider from THERM_V_REF, so only raw values up
+to half of the ADC/DAC full scale are meaningful. The ADC and DAC tables have
+the temperature every 2^THERM_LUT_SHIFT raw values from 0 to 2048. The
+setpoint table has the raw DAC data (with fractional bits) every 2.56 C, so
+the inverse conversion doesn't need a search or a division. Values between
+entries are interpolated linearly. The entries are computed by the compiler
+from the beta model (GCC evaluates __builtin_log() of constants at build
+time), so changing a thermistor parameter in conversions.h regenerates them
+and nothing is computed at run time. The tables live in flash (PROGMEM).
+
+The error from the exact formulas is under 0.05 C between 0 C and 100 C and
+under 0.15 C between -40 C and 125 C (see host/tests/therm_lut_test.c).
+*/
+
+#include "therm_lut.h"
+
+#define THERM_LUT_STEP (1 << THERM_LUT_SHIFT)
+#define THERM_KELVIN_OFFSET 273.15
+
+// Beta model temperature (C) of the thermistor for divider voltage `vol`
+#define THERM_VOL_TO_TEMP(vol) \
+    (1.0 / (1.0 / (THERM_T_REF + THERM_KELVIN_OFFSET) + \
+    __builtin_log(THERM_BIAS_RES * (THERM_V_REF - (vol)) / (vol) / \
+    THERM_R_REF) / THERM_BETA) - THERM_KELVIN_OFFSET)
+
+// Rounds a temperature to 1/100 C, saturating
+#define THERM_TEMP_TO_CENTI_C(temp) \
+    ((100.0 * (temp) >= THERM_LUT_MAX_CENTI_C) ? THERM_LUT_MAX_CENTI_C : \
+    (100.0 * (temp) <= THERM_LUT_MIN_CENTI_C) ? THERM_LUT_MIN_CENTI_C : \
+    (int16_t) (100.0 * (temp) + ((temp) >= 0 ? 0.5 : -0.5)))
+
+// Raw value of entry `i`, kept strictly between 0 V and THERM_V_REF where the
+// formula is defined (entry 0 and the last entry saturate)
+#define THERM_LUT_RAW(i) \
+    (((i) == 0) ? 1 : ((i) == THERM_LUT_LEN - 1) ? 2047 : (i) * THERM_LUT_STEP)
+
+#define THERM_ADC_ENTRY(i) THERM_TEMP_TO_CENTI_C(THERM_VOL_TO_TEMP( \
+    THERM_LUT_RAW(i) / 4095.0 * ADC_VREF))
+#define THERM_DAC_ENTRY(i) THERM_TEMP_TO_CENTI_C(THERM_VOL_TO_TEMP( \
+    THERM_LUT_RAW(i) / (double) (1 << DAC_NUM_BITS) * DAC_VREF * DAC_VREF_GAIN))
+
+// Raw DAC data (with THERM_SP_LUT_FRAC_BITS fractional bits) for the setpoint
+// of entry `i`
+#define THERM_SP_TEMP(i) \
+    ((THERM_SP_LUT_MIN_CENTI_C + (i) * (1L << THERM_SP_LUT_SHIFT)) / 100.0)
+#define THERM_TEMP_TO_RES(temp) \
+    (THERM_R_REF * __builtin_exp(THERM_BETA * (1.0 / ((temp) + \
+    THERM_KELVIN_OFFSET) - 1.0 / (THERM_T_REF + THERM_KELVIN_OFFSET))))
+#define THERM_SP_ENTRY(i) \
+    ((uint16_t) (THERM_V_REF * THERM_BIAS_RES / \
+    (THERM_TEMP_TO_RES(THERM_SP_TEMP(i)) + THERM_BIAS_RES) / \
+    (DAC_VREF * DAC_VREF_GAIN) * (1 << DAC_NUM_BITS) * \
+    (1 << THERM_SP_LUT_FRAC_BITS) + 0.5))
+
+#define THERM_LUT_ROW(entry, i) \
+    entry(i), entry(i + 1), entry(i + 2), entry(i + 3), \
+    entry(i + 4), entry(i + 5), entry(i + 6), entry(i + 7)
+
+// Thermistor temperature (1/100 C) for raw ADC data
+const int16_t therm_adc_lut[THERM_LUT_LEN] PROGMEM = {
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 0),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 8),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 16),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 24),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 32),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 40),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 48),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 56),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 64),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 72),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 80),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 88),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 96),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 104),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 112),
+    THERM_LUT_ROW(THERM_ADC_ENTRY, 120),
+    THERM_ADC_ENTRY(128)
+};
+
+// Heater setpoint temperature (1/100 C) for raw DAC data
+const int16_t therm_dac_lut[THERM_LUT_LEN] PROGMEM = {
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 0),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 8),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 16),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 24),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 32),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 40),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 48),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 56),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 64),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 72),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 80),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 88),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 96),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 104),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 112),
+    THERM_LUT_ROW(THERM_DAC_ENTRY, 120),
+    THERM_DAC_ENTRY(128)
+};
+
+// Raw heater setpoint (DAC data, THERM_SP_LUT_FRAC_BITS fractional bits) for
+// temperatures from THERM_SP_LUT_MIN_CENTI_C
+const uint16_t therm_sp_lut[THERM_SP_LUT_LEN] PROGMEM = {
+    THERM_LUT_ROW(THERM_SP_ENTRY, 0),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 8),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 16),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 24),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 32),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 40),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 48),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 56),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 64),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 72),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 80),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 88),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 96),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 104),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 112),
+    THERM_LUT_ROW(THERM_SP_ENTRY, 120),
+    THERM_SP_ENTRY(128)
+};
+
+
+// Interpolates `lut` at `raw_data`
+static int16_t interp_therm_lut(const int16_t* lut, uint16_t raw_data) {
+    if (raw_data >= (THERM_LUT_LEN - 1) * THERM_LUT_STEP) {
+        return (int16_t) pgm_read_word(&lut[THERM_LUT_LEN - 1]);
+    }
+
+    uint8_t i = raw_data >> THERM_LUT_SHIFT;
+    uint8_t frac = raw_data & (THERM_LUT_STEP - 1);
+    int16_t a = (int16_t) pgm_read_word(&lut[i]);
+    int16_t b = (int16_t) pgm_read_word(&lut[i + 1]);
+    // Rounded to the nearest 1/100 C
+    return a + (int16_t) (((int32_t) (b - a) * frac + THERM_LUT_STEP / 2) >>
+        THERM_LUT_SHIFT);
+}
+
+// Converts raw ADC data from a thermistor channel to 1/100 C
+int16_t adc_raw_to_therm_centi_c(uint16_t raw_data) {
+    return interp_therm_lut(therm_adc_lut, raw_data);
+}
+
+// Converts a raw heater setpoint (DAC data) to 1/100 C
+int16_t dac_raw_to_heater_setpoint_centi_c(uint16_t raw_data) {
+    return interp_therm_lut(therm_dac_lut, raw_data);
+}
+
+// Converts a heater setpoint in 1/100 C to the nearest raw DAC data
+uint16_t heater_setpoint_centi_c_to_dac_raw(int16_t centi_c) {
+    int32_t offset = (int32_t) centi_c - THERM_SP_LUT_MIN_CENTI_C;
+    uint16_t value = 0;
+    if (offset <= 0) {
+        value = pgm_read_word(&therm_sp_lut[0]);
+    } else if (offset >= (int32_t) (THERM_SP_LUT_LEN - 1) << THERM_SP_LUT_SHIFT) {
+        value = pgm_read_word(&therm_sp_lut[THERM_SP_LUT_LEN - 1]);
+    } else {
+        uint8_t i = offset >> THERM_SP_LUT_SHIFT;
+        uint8_t frac = offset & ((1 << THERM_SP_LUT_SHIFT) - 1);
+        uint16_t a = pgm_read_word(&therm_sp_lut[i]);
+        uint16_t b = pgm_read_word(&therm_sp_lut[i + 1]);
+        // The raw value increases with the temperature
+        value = a + (uint16_t) (((uint32_t) (b - a) * frac +
+            (1 << (THERM_SP_LUT_SHIFT - 1))) >> THERM_SP_LUT_SHIFT);
+    }
+    return (value + (1 << (THERM_SP_LUT_FRAC_BITS - 1))) >> THERM_SP_LUT_FRAC_BITS;
+}
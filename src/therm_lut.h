@@ -0,0 +1,34 @@
+#ifndef THERM_LUT_H
+#define THERM_LUT_H
+
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+#include <conversions/conversions.h>
+
+// Raw values between table entries (2^THERM_LUT_SHIFT)
+#define THERM_LUT_SHIFT         4
+// Entries for raw 0 to 2048 (the thermistor divider never exceeds
+// THERM_V_REF, i.e. half of the ADC and DAC full scale)
+#define THERM_LUT_LEN           129
+// Temperatures saturate at these values (in 1/100 C)
+#define THERM_LUT_MIN_CENTI_C   (-9000)
+#define THERM_LUT_MAX_CENTI_C   30000
+
+// Setpoint table - one entry every 2^THERM_SP_LUT_SHIFT 1/100 C (2.56 C) from
+// THERM_SP_LUT_MIN_CENTI_C (-81.92 C to 245.76 C)
+#define THERM_SP_LUT_SHIFT          8
+#define THERM_SP_LUT_LEN            129
+#define THERM_SP_LUT_MIN_CENTI_C    (-8192)
+// Fractional bits of the raw DAC data in the setpoint table
+#define THERM_SP_LUT_FRAC_BITS      4
+
+extern const int16_t therm_adc_lut[THERM_LUT_LEN];
+extern const int16_t therm_dac_lut[THERM_LUT_LEN];
+extern const uint16_t therm_sp_lut[THERM_SP_LUT_LEN];
+
+int16_t adc_raw_to_therm_centi_c(uint16_t raw_data);
+int16_t dac_raw_to_heater_setpoint_centi_c(uint16_t raw_data);
+uint16_t heater_setpoint_centi_c_to_dac_raw(int16_t centi_c);
+
+#endif